@@ -124,6 +124,25 @@ const std::vector<Handler<CommandLineValues>>& CommandLineArgs() {
                    L"Path to the pipe in which the daemon is listening")
           .Set(&CommandLineValues::client),
 
+      Handler<CommandLineValues>({L"client_protocol"},
+                                 L"Protocol used when connecting to a daemon")
+          .Require(L"protocol",
+                   L"The protocol for screen updates and input. Valid values "
+                   L"are `binary` and `vm`.")
+          .Set<CommandLineValues::ClientProtocol>(
+              &CommandLineValues::client_protocol,
+              [](std::wstring input, std::wstring* error)
+                  -> std::optional<CommandLineValues::ClientProtocol> {
+                if (input == L"binary")
+                  return CommandLineValues::ClientProtocol::kBinary;
+                if (input == L"vm")
+                  return CommandLineValues::ClientProtocol::kVmCode;
+                *error =
+                    L"Invalid value (valid values are `binary` and `vm`): " +
+                    input;
+                return std::nullopt;
+              }),
+
       Handler<CommandLineValues>({L"mute"}, L"Disable audio output")
           .Set(&CommandLineValues::mute, true)
           .Accept(L"bool", L""),
@@ -28,6 +28,17 @@ struct CommandLineValues : public command_line_arguments::StandardArguments {
   // If non-empty, path of the server to connect to.
   wstring client = L"";
 
+  // Protocol through which a client receives screen updates from the server
+  // (and sends its input).
+  enum class ClientProtocol {
+    // Compact binary frames (see src/screen_protocol.h).
+    kBinary,
+    // VM code, which the receiving end must compile. Slower, but also
+    // understood by older versions.
+    kVmCode
+  };
+  ClientProtocol client_protocol = ClientProtocol::kBinary;
+
   bool mute = false;
   bool background = false;
 
@@ -51,6 +51,7 @@ extern "C" {
 #include "src/transformation/noop.h"
 #include "src/transformation/repetitions.h"
 #include "src/transformation/stack.h"
+#include "src/trigram_index.h"
 #include "src/viewers.h"
 #include "src/vm/public/callbacks.h"
 #include "src/vm/public/constant_expression.h"
@@ -89,6 +90,11 @@ using futures::IterationControlCommand;
 namespace {
 static const wchar_t* kOldCursors = L"old-cursors";
 
+// Seconds to wait after a change before recording it in the journal (so that
+// bursts of changes are recorded together). A crash may lose the changes done
+// in this period.
+constexpr double kJournalUpdateDelay = 0.2;
+
 using std::unordered_set;
 
 template <typename EdgeStruct, typename FieldValue>
@@ -266,7 +272,7 @@ using std::to_wstring;
            VMType::Function({VMType::String(), VMType::String()})},
           [](vector<unique_ptr<Value>> args) {
             CHECK_EQ(args.size(), size_t(2));
-            CHECK_EQ(args[0]->type, VMType::ObjectType(L"Buffer"));
+            CHECK_EQ(args[0]->type(), VMType::ObjectType(L"Buffer"));
             auto buffer =
                 VMTypeMapper<std::shared_ptr<editor::OpenBuffer>>::get(
                     args[0].get());
@@ -282,7 +288,7 @@ using std::to_wstring;
            VMType::Function({VMType::Bool(), VMType::String()})},
           [](vector<unique_ptr<Value>> args) {
             CHECK_EQ(args.size(), size_t(2));
-            CHECK_EQ(args[0]->type, VMType::ObjectType(L"Buffer"));
+            CHECK_EQ(args[0]->type(), VMType::ObjectType(L"Buffer"));
             auto buffer =
                 VMTypeMapper<std::shared_ptr<editor::OpenBuffer>>::get(
                     args[0].get());
@@ -334,9 +340,9 @@ using std::to_wstring;
            VMType::String(), VMType::Function({VMType::Void()})},
           [editor_state](vector<unique_ptr<Value>> args) {
             CHECK_EQ(args.size(), 4u);
-            CHECK_EQ(args[0]->type, VMType::ObjectType(L"Buffer"));
-            CHECK_EQ(args[1]->type, VMType::VM_STRING);
-            CHECK_EQ(args[2]->type, VMType::VM_STRING);
+            CHECK_EQ(args[0]->type(), VMType::ObjectType(L"Buffer"));
+            CHECK_EQ(args[1]->type(), VMType::VM_STRING);
+            CHECK_EQ(args[2]->type(), VMType::VM_STRING);
             auto buffer =
                 VMTypeMapper<std::shared_ptr<editor::OpenBuffer>>::get(
                     args[0].get());
@@ -450,21 +456,20 @@ OpenBuffer::OpenBuffer(ConstructorAccessTag, Options options)
           });
         }
         SetDiskState(DiskState::kStale);
-        if (Read(buffer_variables::persist_state)) {
-          switch (backup_state_) {
-            case DiskState::kCurrent: {
-              backup_state_ = DiskState::kStale;
-              auto flush_backup_time = Now();
-              flush_backup_time.tv_sec += 30;
-              work_queue_.ScheduleAt(flush_backup_time,
-                                     [shared_this = shared_from_this()] {
-                                       shared_this->UpdateBackup();
-                                     });
-            } break;
-
-            case DiskState::kStale:
-              break;  // Nothing.
-          }
+        if (Read(buffer_variables::persist_state) &&
+            !journal_update_pending_) {
+          journal_update_pending_ = true;
+          work_queue_.ScheduleAt(AddSeconds(Now(), kJournalUpdateDelay),
+                                 [shared_this = shared_from_this()] {
+                                   shared_this->UpdateJournal();
+                                 });
+        }
+        if (!search_index_update_pending_) {
+          search_index_update_pending_ = true;
+          work_queue_.Schedule([this] {
+            search_index_update_pending_ = false;
+            MaybeStartUpdatingSearchIndex();
+          });
         }
         time(&last_action_);
         cursors_tracker_.AdjustCursors(transformation);
@@ -484,7 +489,10 @@ OpenBuffer::OpenBuffer(ConstructorAccessTag, Options options)
       status_(options_.editor->GetConsole(), options_.editor->audio_player()),
       syntax_data_(L"SyntaxData", &work_queue_),
       async_read_evaluator_(L"ReadEvaluator", &work_queue_),
-      file_system_driver_(&work_queue_) {}
+      file_system_driver_(&work_queue_),
+      search_index_evaluator_(
+          L"SearchIndex", &work_queue_,
+          BackgroundCallbackRunner::Options::QueueBehavior::kFlush) {}
 
 OpenBuffer::~OpenBuffer() {
   LOG(INFO) << "Start destructor.";
@@ -557,6 +565,8 @@ void OpenBuffer::Close() {
   if (dirty() && Read(buffer_variables::save_on_close)) {
     log_->Append(L"Saving buffer: " + Read(buffer_variables::name));
     Save();
+  } else {
+    DiscardJournal();
   }
   for (auto& observer : close_observers_) {
     observer();
@@ -644,12 +654,16 @@ futures::Value<PossibleError> OpenBuffer::PersistState() const {
   }
   contents.push_back(L"");
 
-  return OnError(SaveContentsToFile(path.ToString(), contents, work_queue()),
-                 [this](Error error) {
-                   status()->SetWarningText(L"Unable to persist state: " +
-                                            error.description);
-                   return error;
-                 });
+  return OnError(
+      SaveContentsToFile(
+          path.ToString(), contents,
+          SaveDurabilityFromString(Read(buffer_variables::save_durability)),
+          work_queue()),
+      [this](Error error) {
+        status()->SetWarningText(L"Unable to persist state: " +
+                                 error.description);
+        return error;
+      });
 }
 
 void OpenBuffer::ClearContents(
@@ -779,6 +793,7 @@ void OpenBuffer::UpdateTreeParser() {
   } else {
     tree_parser_ = NewNullTreeParser();
   }
+  complete_parse_tree_installed_ = false;
 }
 
 std::shared_ptr<const ParseTree> OpenBuffer::parse_tree() const {
@@ -828,33 +843,93 @@ void OpenBuffer::Initialize() {
 void OpenBuffer::MaybeStartUpdatingSyntaxTrees() {
   if (TreeParser::IsNull(tree_parser_.get())) return;
 
+  // Parses for previous contents should give up: their results would be
+  // discarded.
+  syntax_data_abort_notification_->Notify();
+  syntax_data_abort_notification_ = std::make_shared<Notification>();
+
   struct Output {
     std::shared_ptr<const ParseTree> parse_tree;
     std::shared_ptr<const ParseTree> simplified_parse_tree;
   };
 
+  auto contents = std::shared_ptr<BufferContents>(contents_.copy());
+  std::optional<LineColumnDelta> view_size = viewers_.view_size();
+  if (!complete_parse_tree_installed_ && view_size.has_value()) {
+    // Until the first parse of the entire buffer completes, highlight the
+    // visible lines (parsed as if they started at the top level).
+    LineNumber begin = std::min(Read(buffer_variables::view_start).line,
+                                contents->EndLine());
+    Range visible_range(
+        LineColumn(begin),
+        LineColumn(std::min(begin + view_size->line, contents->EndLine())));
+    syntax_data_
+        .Run(std::function<Output(void)>(
+            [contents, parser = tree_parser_, visible_range,
+             abort_notification = syntax_data_abort_notification_] {
+              static Tracker tracker(
+                  L"OpenBuffer::MaybeStartUpdatingSyntaxTrees::visible");
+              auto tracker_call = tracker.Call();
+              Output output;
+              if (abort_notification->HasBeenNotified()) return output;
+              output.parse_tree = std::make_shared<ParseTree>(
+                  parser->FindChildren(*contents, visible_range));
+              output.simplified_parse_tree = std::make_shared<ParseTree>(
+                  SimplifyTree(*output.parse_tree));
+              return output;
+            }))
+        .SetConsumer([this](Output output) {
+          if (output.parse_tree == nullptr || complete_parse_tree_installed_) {
+            return;
+          }
+          LOG(INFO) << "Installing parse trees for visible lines.";
+          parse_tree_ = std::move(output.parse_tree);
+          simplified_parse_tree_ = std::move(output.simplified_parse_tree);
+        });
+  }
+
   syntax_data_
       .Run(std::function<Output(void)>(
-          [contents = std::shared_ptr<BufferContents>(contents_.copy()),
-           parser = tree_parser_] {
+          [contents, parser = tree_parser_,
+           abort_notification = syntax_data_abort_notification_] {
             static Tracker tracker(
                 L"OpenBuffer::MaybeStartUpdatingSyntaxTrees::produce");
             auto tracker_call = tracker.Call();
             VLOG(3) << "Executing parse tree update.";
             Output output;
-            output.parse_tree = std::make_shared<ParseTree>(
-                parser->FindChildren(*contents, contents->range()));
+            std::optional<ParseTree> tree =
+                parser->FindChildrenUnlessAborted(*contents,
+                                                  *abort_notification);
+            if (!tree.has_value()) return output;
+            output.parse_tree = std::make_shared<ParseTree>(std::move(*tree));
             output.simplified_parse_tree =
                 std::make_shared<ParseTree>(SimplifyTree(*output.parse_tree));
             return output;
           }))
       .SetConsumer([this](Output output) {
+        if (output.parse_tree == nullptr) return;  // Aborted.
         LOG(INFO) << "Installing new parse trees.";
         parse_tree_ = std::move(output.parse_tree);
         simplified_parse_tree_ = std::move(output.simplified_parse_tree);
+        complete_parse_tree_installed_ = true;
       });
 }
 
+void OpenBuffer::MaybeStartUpdatingSearchIndex() {
+  int threshold = Read(buffer_variables::search_index_threshold);
+  if (threshold < 0 || contents_.size() < LineNumberDelta(threshold)) {
+    search_index_ = nullptr;
+    return;
+  }
+  if (search_index_ == nullptr) {
+    LOG(INFO) << "Creating search index.";
+    search_index_ = std::make_shared<TrigramIndex>();
+  }
+  search_index_evaluator_.RunIgnoringResults(
+      [contents = std::shared_ptr<BufferContents>(contents_.copy()),
+       index = search_index_] { index->Update(*contents); });
+}
+
 void OpenBuffer::StartNewLine(std::shared_ptr<Line> line) {
   static Tracker tracker(L"OpenBuffer::StartNewLine");
   auto tracker_call = tracker.Call();
@@ -863,25 +938,45 @@ void OpenBuffer::StartNewLine(std::shared_ptr<Line> line) {
   DVLOG(5) << "Line is completed: " << contents_.back()->ToString();
 
   if (Read(buffer_variables::contains_line_marks)) {
-    static Tracker tracker(L"OpenBuffer::StartNewLine::ScanForMarks");
-    auto tracker_call = tracker.Call();
-    auto options = ResolvePathOptions::New(editor());
-    options.path = contents_.back()->ToString();
-    if (auto results = ResolvePath(std::move(options)); results.has_value()) {
-      LineMarks::Mark mark;
-      mark.source = Read(buffer_variables::name);
-      mark.source_line = contents_.EndLine();
-      mark.target_buffer = results->path;
-      if (results->position.has_value()) {
-        mark.target = *results->position;
-      }
-      LOG(INFO) << "Found a mark: " << mark;
-      editor()->line_marks()->AddMark(mark);
-    }
+    ScanForMarks(contents_.EndLine(), *contents_.back());
   }
   contents_.push_back(std::move(line));
 }
 
+void OpenBuffer::AppendLines(std::vector<std::shared_ptr<const Line>> lines) {
+  static Tracker tracker(L"OpenBuffer::AppendLines");
+  auto tracker_call = tracker.Call();
+  if (lines.empty()) return;
+
+  if (Read(buffer_variables::contains_line_marks)) {
+    // All lines except the last one (after the append) are completed.
+    LineNumber line_number = contents_.EndLine();
+    ScanForMarks(line_number, *contents_.back());
+    for (size_t i = 0; i + 1 < lines.size(); i++) {
+      ScanForMarks(++line_number, *lines[i]);
+    }
+  }
+  contents_.append_back(std::move(lines));
+}
+
+void OpenBuffer::ScanForMarks(LineNumber line_number, const Line& line) {
+  static Tracker tracker(L"OpenBuffer::ScanForMarks");
+  auto tracker_call = tracker.Call();
+  auto options = ResolvePathOptions::New(editor());
+  options.path = line.ToString();
+  if (auto results = ResolvePath(std::move(options)); results.has_value()) {
+    LineMarks::Mark mark;
+    mark.source = Read(buffer_variables::name);
+    mark.source_line = line_number;
+    mark.target_buffer = results->path;
+    if (results->position.has_value()) {
+      mark.target = *results->position;
+    }
+    LOG(INFO) << "Found a mark: " << mark;
+    editor()->line_marks()->AddMark(mark);
+  }
+}
+
 void OpenBuffer::Reload() {
   if (child_pid_ != -1) {
     LOG(INFO) << "Sending SIGTERM.";
@@ -941,6 +1036,15 @@ void OpenBuffer::Reload() {
         return futures::Past(Success());
       },
       [shared_this = shared_from_this(), this](EmptyValue) {
+        if (Read(buffer_variables::persist_state)) {
+          AddEndOfFileObserver(
+              [weak_this = std::weak_ptr<OpenBuffer>(shared_this)] {
+                auto buffer = weak_this.lock();
+                if (buffer == nullptr) return;
+                buffer->UpdateJournalFileVersion().SetConsumer(
+                    [buffer](EmptyValue) { buffer->RecoverFromJournal(); });
+              });
+        }
         switch (reload_state_) {
           case ReloadState::kDone:
             LOG(FATAL) << "Invalid reload state! Can't be kDone.";
@@ -968,8 +1072,13 @@ futures::Value<PossibleError> OpenBuffer::Save() {
     status_.SetWarningText(L"Buffer can't be saved.");
     return futures::Past(PossibleError(Error(L"Buffer can't be saved.")));
   }
-  return options_.handle_save(
-      {.buffer = this, .save_type = Options::SaveType::kMainFile});
+  return futures::Transform(
+      options_.handle_save({.buffer = this}),
+      [shared_this = shared_from_this()](EmptyValue) {
+        shared_this->DiscardJournal();
+        return futures::Transform(shared_this->UpdateJournalFileVersion(),
+                                  [](EmptyValue) { return Success(); });
+      });
 }
 
 ValueOrError<Path> OpenBuffer::GetEdgeStateDirectory() const {
@@ -1020,14 +1129,107 @@ ValueOrError<Path> OpenBuffer::GetEdgeStateDirectory() const {
 
 Log* OpenBuffer::log() const { return log_.get(); }
 
-void OpenBuffer::UpdateBackup() {
-  CHECK(backup_state_ == DiskState::kStale);
-  log_->Append(L"UpdateBackup starts.");
-  if (options_.handle_save != nullptr) {
-    options_.handle_save(
-        {.buffer = this, .save_type = Options::SaveType::kBackup});
+namespace {
+ValueOrError<Path> JournalPath(const OpenBuffer& buffer) {
+  ASSIGN_OR_RETURN(auto state_directory, buffer.GetEdgeStateDirectory());
+  return Success(Path::Join(state_directory,
+                            PathComponent::FromString(L"journal").value()));
+}
+}  // namespace
+
+void OpenBuffer::UpdateJournal() {
+  journal_update_pending_ = false;
+  if (disk_state_ == DiskState::kCurrent) {
+    DiscardJournal();
+    return;
+  }
+  if (!Read(buffer_variables::persist_state) ||
+      Read(buffer_variables::path).empty()) {
+    return;
+  }
+  if (journal_ != nullptr) {
+    journal_->Update(contents_);
+    return;
+  }
+  auto path = JournalPath(*this);
+  if (path.IsError()) {
+    LOG(INFO) << "Unable to start journal: " << path.error().description;
+    return;
+  }
+  log_->Append(L"Starting journal: " + path.value().ToString());
+  journal_ = std::make_unique<EditJournal>(path.value().ToString(),
+                                           journal_file_version_, contents_);
+}
+
+void OpenBuffer::DiscardJournal() {
+  if (journal_ == nullptr) return;
+  log_->Append(L"Discarding journal.");
+  journal_->Discard();
+  journal_ = nullptr;
+}
+
+futures::Value<EmptyValue> OpenBuffer::UpdateJournalFileVersion() {
+  futures::Future<EmptyValue> output;
+  file_system_driver()
+      ->Stat(Read(buffer_variables::path))
+      .SetConsumer([shared_this = shared_from_this(),
+                    consumer = std::move(output.consumer)](
+                       ValueOrError<struct stat> stat_buffer) {
+        shared_this->journal_file_version_ =
+            stat_buffer.IsError()
+                ? std::nullopt
+                : std::optional<EditJournal::FileVersion>(
+                      EditJournal::FileVersion::FromStat(stat_buffer.value()));
+        consumer(EmptyValue());
+      });
+  return std::move(output.value);
+}
+
+void OpenBuffer::RecoverFromJournal() {
+  if (journal_ != nullptr || Read(buffer_variables::path).empty()) return;
+  auto path = JournalPath(*this);
+  if (path.IsError()) return;
+  file_system_driver()
+      ->Stat(path.value().ToString())
+      .SetConsumer([shared_this = shared_from_this(), path = path.value()](
+                       ValueOrError<struct stat> stat_buffer) {
+        if (stat_buffer.IsError()) return;  // There's no journal.
+        futures::OnError(
+            futures::Transform(
+                shared_this->async_read_evaluator_.Run(
+                    [path] { return EditJournal::Recover(path.ToString()); }),
+                [shared_this, path](EditJournal::Recovered recovered) {
+                  shared_this->ApplyRecoveredJournal(path,
+                                                     std::move(recovered));
+                  return Success();
+                }),
+            [shared_this](Error error) {
+              shared_this->status_.SetWarningText(
+                  L"Unable to recover changes: " + error.description);
+              return error;
+            });
+      });
+}
+
+void OpenBuffer::ApplyRecoveredJournal(const Path& path,
+                                       EditJournal::Recovered recovered) {
+  if (journal_ != nullptr) return;
+  if (!(recovered.file_version == journal_file_version_)) {
+    status_.SetWarningText(
+        L"File changed since the journal was written; not recovering unsaved "
+        L"changes from: " +
+        path.ToString());
+    return;
   }
-  backup_state_ = DiskState::kCurrent;
+  ClearContents(BufferContents::CursorsBehavior::kAdjust);
+  contents_.insert(LineNumber(0), *recovered.contents, std::nullopt);
+  contents_.EraseLines(contents_.EndLine(), LineNumber(0) + contents_.size(),
+                       BufferContents::CursorsBehavior::kAdjust);
+  // Replaces the file we just read.
+  journal_ = std::make_unique<EditJournal>(path.ToString(),
+                                           journal_file_version_, contents_);
+  status_.SetInformationText(L"Recovered unsaved changes from: " +
+                             path.ToString());
 }
 
 void OpenBuffer::AppendLazyString(std::shared_ptr<LazyString> input) {
@@ -1143,19 +1345,23 @@ std::optional<futures::Value<std::unique_ptr<Value>>> OpenBuffer::EvaluateFile(
     const wstring& path) {
   wstring error_description;
   std::shared_ptr<Expression> expression =
-      CompileFile(ToByteString(path), environment_, &error_description);
+      editor()->compiled_files()->CompileFile(ToByteString(path), environment_,
+                                              &error_description);
   if (expression == nullptr) {
     status_.SetWarningText(path + L": error: " + error_description);
     return std::nullopt;
   }
   LOG(INFO) << Read(buffer_variables::path) << " ("
             << Read(buffer_variables::name) << "): Evaluating file: " << path;
-  return Evaluate(
-      expression.get(), environment_,
-      [path, work_queue = work_queue()](std::function<void()> resume) {
-        LOG(INFO) << "Evaluation of file yields: " << path;
-        work_queue->Schedule(std::move(resume));
-      });
+  return futures::Transform(
+      Evaluate(
+          expression.get(), environment_,
+          [path, work_queue = work_queue()](std::function<void()> resume) {
+            LOG(INFO) << "Evaluation of file yields: " << path;
+            work_queue->Schedule(std::move(resume));
+          }),
+      // The expression must live until the evaluation is done.
+      [expression](std::unique_ptr<Value> value) { return value; });
 }
 
 WorkQueue* OpenBuffer::work_queue() const { return &work_queue_; }
@@ -1666,13 +1872,13 @@ futures::Value<std::wstring> OpenBuffer::TransformKeyboardText(
 }
 
 bool OpenBuffer::AddKeyboardTextTransformer(unique_ptr<Value> transformer) {
-  if (transformer == nullptr || transformer->type.type != VMType::FUNCTION ||
-      transformer->type.type_arguments.size() != 2 ||
-      transformer->type.type_arguments[0].type != VMType::VM_STRING ||
-      transformer->type.type_arguments[1].type != VMType::VM_STRING) {
+  if (transformer == nullptr || transformer->type().type != VMType::FUNCTION ||
+      transformer->type().type_arguments.size() != 2 ||
+      transformer->type().type_arguments[0].type != VMType::VM_STRING ||
+      transformer->type().type_arguments[1].type != VMType::VM_STRING) {
     status_.SetWarningText(
         L": Unexpected type for keyboard text transformer: " +
-        transformer->type.ToString());
+        transformer->type().ToString());
     return false;
   }
   keyboard_text_transformers_.push_back(std::move(transformer));
@@ -1894,6 +2100,9 @@ const int& OpenBuffer::Read(const EdgeVariable<int>* variable) const {
 
 void OpenBuffer::Set(const EdgeVariable<int>* variable, int value) {
   int_variables_.Set(variable, value);
+  if (variable == buffer_variables::search_index_threshold) {
+    MaybeStartUpdatingSearchIndex();
+  }
 }
 
 const double& OpenBuffer::Read(const EdgeVariable<double>* variable) const {
@@ -2150,6 +2359,7 @@ bool OpenBuffer::IsPastPosition(LineColumn position) const {
 void OpenBuffer::ReadData(std::unique_ptr<FileDescriptorReader>* source) {
   CHECK(source != nullptr);
   CHECK(*source != nullptr);
+  editor()->IncrementDisplayVersion();
   (*source)->ReadData().SetConsumer(
       [this, source](FileDescriptorReader::ReadResult value) {
         if (value != FileDescriptorReader::ReadResult::kDone) return;
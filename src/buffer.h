@@ -14,6 +14,7 @@
 #include "src/buffer_terminal.h"
 #include "src/cursors.h"
 #include "src/dirname.h"
+#include "src/edit_journal.h"
 #include "src/file_descriptor_reader.h"
 #include "src/futures/futures.h"
 #include "src/lazy_string.h"
@@ -22,6 +23,7 @@
 #include "src/line_marks.h"
 #include "src/log.h"
 #include "src/map_mode.h"
+#include "src/notification.h"
 #include "src/parse_tree.h"
 #include "src/status.h"
 #include "src/substring.h"
@@ -52,6 +54,7 @@ using namespace afc::vm;
 
 class ParseTree;
 class TreeParser;
+class TrigramIndex;
 
 class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
   struct ConstructorAccessTag {};
@@ -97,12 +100,10 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
     // entering the buffer from other buffers).
     std::function<void(OpenBuffer*)> handle_visit = nullptr;
 
-    enum class SaveType { kMainFile, kBackup };
     // Optional function that saves the buffer. If not provided, attempts to
     // save the buffer will fail.
     struct HandleSaveOptions {
       OpenBuffer* buffer;
-      SaveType save_type = SaveType::kMainFile;
     };
     std::function<futures::Value<PossibleError>(HandleSaveOptions)>
         handle_save = nullptr;
@@ -213,6 +214,9 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
   // Adds a new line. If there's a previous line, notifies various things about
   // it.
   void StartNewLine(std::shared_ptr<Line> line);
+  // Equivalent to calling `StartNewLine` for each line, but splices all the
+  // lines in a single operation (notifying listeners only once).
+  void AppendLines(std::vector<std::shared_ptr<const Line>> lines);
 
   void DeleteRange(const Range& range);
 
@@ -395,8 +399,6 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
 
   Log* log() const;
 
-  void UpdateBackup();
-
   /////////////////////////////////////////////////////////////////////////////
   // Cursors
 
@@ -450,6 +452,16 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
 
   std::unique_ptr<BufferTerminal> NewTerminal();  // Public for testing.
 
+  //////////////////////////////////////////////////////////////////////////////
+  // Search index
+
+  // Returns an index of the contents that can be used to speed up searches
+  // (see `buffer_variables::search_index_threshold`), or nullptr. The index may
+  // lag behind the contents.
+  std::shared_ptr<const TrigramIndex> search_index() const {
+    return search_index_;
+  }
+
  private:
   // Code that would normally be in the constructor, but which may require the
   // use of `shared_from_this`. This function will be called by `New` after the
@@ -457,6 +469,27 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
   void Initialize();
   void MaybeStartUpdatingSyntaxTrees();
 
+  // Creates (or deletes) `search_index_` according to
+  // `buffer_variables::search_index_threshold` and, if it exists, starts
+  // updating it in the background.
+  void MaybeStartUpdatingSearchIndex();
+
+  // Records the changes to `contents_` in `journal_` (creating it if needed).
+  void UpdateJournal();
+  // Deletes the journal (e.g., once the contents have been saved).
+  void DiscardJournal();
+  // Sets `journal_file_version_` from the file at `buffer_variables::path`.
+  futures::Value<EmptyValue> UpdateJournalFileVersion();
+  // If a journal from a previous session exists and its changes apply to
+  // `journal_file_version_`, replaces the contents with those recovered from
+  // it.
+  void RecoverFromJournal();
+  void ApplyRecoveredJournal(const Path& path,
+                             EditJournal::Recovered recovered);
+
+  // If `line` (at position `line_number`) refers to a path, adds a mark.
+  void ScanForMarks(LineNumber line_number, const Line& line);
+
   static void EvaluateMap(OpenBuffer* buffer, LineNumber line,
                           Value::Callback map_callback,
                           transformation::Stack* transformation,
@@ -520,7 +553,6 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
   BufferContents contents_;
 
   DiskState disk_state_ = DiskState::kCurrent;
-  DiskState backup_state_ = DiskState::kCurrent;
   bool reading_from_parser_ = false;
 
   EdgeStructInstance<bool> bool_variables_;
@@ -599,6 +631,14 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
   std::shared_ptr<TreeParser> tree_parser_ = NewNullTreeParser();
 
   mutable AsyncEvaluator syntax_data_;
+  // Notified when the contents change, to abort parses of the old contents.
+  // Never nullptr.
+  std::shared_ptr<Notification> syntax_data_abort_notification_ =
+      std::make_shared<Notification>();
+  // Has `parse_tree_` been set from a parse of the entire buffer (since
+  // `tree_parser_` was last set)? Until then, parse trees for only the visible
+  // lines are installed.
+  bool complete_parse_tree_installed_ = false;
 
   // Never nullptr.
   std::shared_ptr<const ParseTree> parse_tree_ =
@@ -621,6 +661,22 @@ class OpenBuffer : public std::enable_shared_from_this<OpenBuffer> {
 
   AsyncEvaluator async_read_evaluator_;
   FileSystemDriver file_system_driver_;
+
+  // Whether we've scheduled (in `work_queue_`) a call to
+  // `MaybeStartUpdatingSearchIndex`.
+  bool search_index_update_pending_ = false;
+  std::shared_ptr<TrigramIndex> search_index_;
+  AsyncEvaluator search_index_evaluator_;
+
+  // Only used if `buffer_variables::persist_state` is set. Created on the first
+  // change after the contents were loaded or saved.
+  std::unique_ptr<EditJournal> journal_;
+  // Whether we've scheduled (in `work_queue_`) a call to `UpdateJournal`.
+  bool journal_update_pending_ = false;
+  // The version of the file at `buffer_variables::path` when the contents were
+  // last loaded or saved (std::nullopt if it didn't exist). The journal's
+  // changes apply to it.
+  std::optional<EditJournal::FileVersion> journal_file_version_;
 };
 
 }  // namespace editor
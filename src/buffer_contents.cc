@@ -59,20 +59,20 @@ void BufferContents::insert(LineNumber position_line,
                             const BufferContents& source,
                             const std::optional<LineModifierSet>& modifiers) {
   CHECK_LE(position_line, EndLine());
-  auto prefix = Lines::Prefix(lines_, position_line.line);
-  auto suffix = Lines::Suffix(lines_, position_line.line);
-  Lines::Every(source.lines_, [&](std::shared_ptr<const Line> line) {
-    VLOG(6) << "Insert line: " << line->EndColumn() << " modifiers: "
-            << (modifiers.has_value() ? modifiers->size() : -1);
-    if (modifiers.has_value()) {
+  auto lines = source.lines_;
+  if (modifiers.has_value()) {
+    std::vector<std::shared_ptr<const Line>> replacements;
+    replacements.reserve(source.size().line_delta);
+    for (const auto& line : source) {
       auto replacement = std::make_shared<Line>(*line);
       replacement->SetAllModifiers(modifiers.value());
-      line = replacement;
+      replacements.push_back(std::move(replacement));
     }
-    prefix = Lines::PushBack(prefix, line);
-    return true;
-  });
-  lines_ = Lines::Append(prefix, suffix);
+    lines = Lines::FromRange(replacements.begin(), replacements.end());
+  }
+  lines_ = Lines::Append(
+      Lines::Append(Lines::Prefix(lines_, position_line.line), lines),
+      Lines::Suffix(lines_, position_line.line));
   update_listener_(CursorsTracker::Transformation()
                        .WithBegin(LineColumn(position_line))
                        .LineDelta(source.size()));
@@ -81,9 +81,10 @@ void BufferContents::insert(LineNumber position_line,
 bool BufferContents::EveryLine(
     const std::function<bool(LineNumber, const Line&)>& callback) const {
   LineNumber line_number;
-  return Lines::Every(lines_, [&](const std::shared_ptr<const Line>& line) {
-    return callback(line_number++, *line);
-  });
+  for (const auto& line : *this) {
+    if (!callback(line_number++, *line)) return false;
+  }
+  return true;
 }
 
 void BufferContents::ForEach(
@@ -169,7 +170,7 @@ void BufferContents::DeleteToLineEnd(LineColumn position) {
 
 void BufferContents::SetCharacter(
     LineColumn position, int c,
-    std::unordered_set<LineModifier, hash<int>> modifiers) {
+    LineModifierSet modifiers) {
   VLOG(5) << "Set character: " << c << " at " << position
           << " with modifiers: " << modifiers.size();
   TransformLine(position.line, [&](Line::Options* options) {
@@ -254,6 +255,13 @@ void BufferContents::push_back(shared_ptr<const Line> line) {
   update_listener_({});
 }
 
+void BufferContents::append_back(std::vector<shared_ptr<const Line>> lines) {
+  static Tracker tracker(L"BufferContents::append_back");
+  auto tracker_call = tracker.Call();
+  lines_ = Lines::Append(lines_, Lines::FromRange(lines.begin(), lines.end()));
+  update_listener_({});
+}
+
 std::vector<fuzz::Handler> BufferContents::FuzzHandlers() {
   using namespace fuzz;
   std::vector<Handler> output;
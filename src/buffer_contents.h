@@ -56,6 +56,32 @@ class BufferContents : public fuzz::FuzzTestable {
     return at(LineNumber(0));
   }
 
+  // Iteration over the lines. The iterators keep the lines alive: they remain
+  // valid even if the contents are modified (but won't reflect the changes).
+  // Moving an iterator to an adjacent line runs in constant amortized time.
+  using const_iterator = Lines::Iterator;
+  const_iterator begin() const { return Lines::Begin(lines_); }
+  const_iterator end() const { return Lines::End(lines_); }
+
+  // Returns an iterator pointing to `position`, which may be one past the last
+  // line (for an iterator equal to `end()`).
+  const_iterator IteratorAt(LineNumber position) const {
+    CHECK_LE(position, LineNumber(0) + size());
+    return const_iterator(lines_, position.line);
+  }
+
+  // Returns the number of initial lines that are shared (the same instances)
+  // with `other`. Fast when one was obtained by editing the other.
+  LineNumberDelta CommonPrefix(const BufferContents& other) const {
+    return LineNumberDelta(Lines::CommonPrefixSize(lines_, other.lines_));
+  }
+
+  // Returns the number of final lines that are shared with `other`. Fast when
+  // one was obtained by editing the other.
+  LineNumberDelta CommonSuffix(const BufferContents& other) const {
+    return LineNumberDelta(Lines::CommonSuffixSize(lines_, other.lines_));
+  }
+
   // Iterates: runs the callback on every line in the buffer, passing as the
   // first argument the line count (starts counting at 0). Stops the iteration
   // if the callback returns false. Returns true iff the callback always
@@ -85,18 +111,14 @@ class BufferContents : public fuzz::FuzzTestable {
 
   template <class C>
   void sort(LineNumber first, LineNumber last, C compare) {
-    // TODO: Only append to `lines` the actual range [first, last), and then
-    // just Append to prefix/suffix.
-    std::vector<std::shared_ptr<const Line>> lines;
-    Lines::Every(lines_, [&lines](std::shared_ptr<const Line> line) {
-      lines.push_back(line);
-      return true;
-    });
-    std::sort(lines.begin() + first.line, lines.begin() + last.line, compare);
-    lines_ = nullptr;
-    for (auto& line : lines) {
-      lines_ = Lines::PushBack(std::move(lines_), std::move(line));
-    }
+    CHECK_LE(first, last);
+    std::vector<std::shared_ptr<const Line>> lines(IteratorAt(first),
+                                                   IteratorAt(last));
+    std::sort(lines.begin(), lines.end(), compare);
+    lines_ = Lines::Append(
+        Lines::Append(Lines::Prefix(lines_, first.line),
+                      Lines::FromRange(lines.begin(), lines.end())),
+        Lines::Suffix(lines_, last.line));
     update_listener_(CursorsTracker::Transformation());
   }
 
@@ -120,7 +142,7 @@ class BufferContents : public fuzz::FuzzTestable {
   // case the character will just get appended (extending the line by exactly
   // one character).
   void SetCharacter(LineColumn position, int c,
-                    std::unordered_set<LineModifier, hash<int>> modifiers);
+                    LineModifierSet modifiers);
 
   void InsertCharacter(LineColumn position);
   void AppendToLine(LineNumber line, Line line_to_append);
@@ -140,6 +162,9 @@ class BufferContents : public fuzz::FuzzTestable {
 
   void push_back(wstring str);
   void push_back(shared_ptr<const Line> line);
+  // Equivalent to calling `push_back` for each line, but much faster (and only
+  // notifies the update listener once).
+  void append_back(std::vector<shared_ptr<const Line>> lines);
 
   std::vector<fuzz::Handler> FuzzHandlers() override;
 
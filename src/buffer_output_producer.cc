@@ -42,7 +42,6 @@ OutputProducer::Generator ParseTreeHighlighter(
       std::nullopt, [=]() {
         OutputProducer::LineWithCursor output = generator.generate();
         Line::Options line_options(std::move(*output.line));
-        LineModifierSet modifiers = {LineModifier::BLUE};
         line_options.modifiers.erase(line_options.modifiers.lower_bound(begin),
                                      line_options.modifiers.lower_bound(end));
         line_options.modifiers[begin] = {LineModifier::BLUE};
@@ -62,7 +61,7 @@ OutputProducer::Generator ParseTreeHighlighter(
 // next, and this restriction won't apply.
 void GetSyntaxModifiersForLine(
     Range range, const ParseTree* tree, LineModifierSet syntax_modifiers,
-    std::map<ColumnNumber, LineModifierSet>* output) {
+    LineModifierMap* output) {
   CHECK(tree);
   VLOG(5) << "Getting syntax for " << range << " from " << tree->range();
   if (range.Intersection(tree->range()).IsEmpty()) return;
@@ -100,13 +99,13 @@ OutputProducer::Generator ParseTreeHighlighterTokens(
     OutputProducer::LineWithCursor input = generator.generate();
     Line::Options options(std::move(*input.line));
 
-    std::map<ColumnNumber, LineModifierSet> syntax_modifiers;
+    LineModifierMap syntax_modifiers;
     GetSyntaxModifiersForLine(range, root, {}, &syntax_modifiers);
     LOG(INFO) << "Syntax tokens for " << range << ": "
               << syntax_modifiers.size();
 
     // Merge them.
-    std::map<ColumnNumber, LineModifierSet> merged_modifiers;
+    LineModifierMap merged_modifiers;
     auto parent_it = options.modifiers.begin();
     auto syntax_it = syntax_modifiers.begin();
     LineModifierSet current_parent_modifiers;
@@ -333,7 +333,9 @@ EdgeVariable<bool>* const persist_state =
         .Name(L"persist_state")
         .Description(
             L"Should we aim to persist information for this buffer (in "
-            L"$EDGE_PATH/state/)?")
+            L"$EDGE_PATH/state/)? This includes a journal of the unsaved "
+            L"changes, from which they are recovered when the file is opened "
+            L"again (e.g., after a crash).")
         .Build();
 
 EdgeStruct<wstring>* StringStruct() {
@@ -538,6 +540,20 @@ EdgeVariable<wstring>* const shell_command_help_filter =
             L"[^|;]*$")
         .Build();
 
+EdgeVariable<wstring>* const save_durability =
+    StringStruct()
+        ->Add()
+        .Name(L"save_durability")
+        .Description(
+            L"Controls how the contents of the buffer are flushed to disk when "
+            L"it is saved (which is done by writing a temporary file and "
+            L"renaming it). Valid values are: \"none\" (leave it to the "
+            L"kernel), \"data\" (sync the data of the temporary file before "
+            L"renaming it), and \"directory\" (like \"data\", but also sync "
+            L"the directory after renaming the file).")
+        .DefaultValue(L"none")
+        .Build();
+
 EdgeStruct<int>* IntStruct() {
   static EdgeStruct<int>* output = new EdgeStruct<int>();
   return output;
@@ -602,6 +618,36 @@ EdgeVariable<int>* const progress =
         .DefaultValue(0)
         .Build();
 
+EdgeVariable<int>* const mmap_threshold =
+    IntStruct()
+        ->Add()
+        .Name(L"mmap_threshold")
+        .Description(
+            L"If non-negative, regular files of at least this many bytes are "
+            L"loaded by mapping them into memory, rather than by reading "
+            L"them. Lines are then decoded lazily, when they are first used, "
+            L"so the memory used is roughly the size of the file. If the file "
+            L"is modified in place (rather than replaced) while the buffer is "
+            L"open, the contents shown may change; if it is truncated, the "
+            L"missing lines read as '\\0' characters.")
+        .DefaultValue(1 << 20)
+        .Build();
+
+EdgeVariable<int>* const search_index_threshold =
+    IntStruct()
+        ->Add()
+        .Name(L"search_index_threshold")
+        .Description(
+            L"Buffers with at least this many lines maintain (in a background "
+            L"thread) an index of the sequences of three characters in their "
+            L"lines. Searches for regular expressions that contain literal "
+            L"strings (of at least three characters) use it to skip most lines, "
+            L"which makes searching for rare strings in very large buffers (such "
+            L"as logs) much faster. The index uses memory roughly proportional "
+            L"to the size of the buffer. A negative value disables this.")
+        .DefaultValue(-1)
+        .Build();
+
 EdgeStruct<double>* DoubleStruct() {
   static EdgeStruct<double>* output = new EdgeStruct<double>();
   return output;
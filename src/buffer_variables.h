@@ -59,6 +59,7 @@ extern EdgeVariable<wstring>* const typos;
 extern EdgeVariable<wstring>* const directory_noise;
 extern EdgeVariable<wstring>* const contents_type;
 extern EdgeVariable<wstring>* const shell_command_help_filter;
+extern EdgeVariable<wstring>* const save_durability;
 
 EdgeStruct<int>* IntStruct();
 extern EdgeVariable<int>* const line_width;
@@ -66,6 +67,8 @@ extern EdgeVariable<int>* const buffer_list_context_lines;
 extern EdgeVariable<int>* const margin_lines;
 extern EdgeVariable<int>* const margin_columns;
 extern EdgeVariable<int>* const progress;
+extern EdgeVariable<int>* const mmap_threshold;
+extern EdgeVariable<int>* const search_index_threshold;
 
 EdgeStruct<double>* DoubleStruct();
 extern EdgeVariable<double>* const margin_lines_ratio;
@@ -73,6 +73,7 @@ std::optional<std::unordered_set<OpenBuffer*>> OptimizeFilter(
 }
 
 struct BuffersListOptions {
+  const EditorState* editor_state;
   const std::map<wstring, std::shared_ptr<OpenBuffer>>* buffers;
   std::shared_ptr<OpenBuffer> active_buffer;
   std::set<OpenBuffer*> active_buffers;
@@ -83,6 +84,16 @@ struct BuffersListOptions {
 
 enum class FilterResult { kExcluded, kIncluded };
 
+// Returns true if less than `seconds` have passed since `time`. If so, tells
+// the editor when that will change, so that it redraws the screen then.
+bool IsRecent(const BuffersListOptions& options, struct timespec time,
+              double seconds) {
+  struct timespec expiration = AddSeconds(time, seconds);
+  if (!(Now() < expiration)) return false;
+  options.editor_state->AddDisplayExpiration(expiration);
+  return true;
+}
+
 LineModifierSet GetNumberModifiers(const BuffersListOptions& options,
                                    OpenBuffer* buffer,
                                    FilterResult filter_result) {
@@ -90,8 +101,8 @@ LineModifierSet GetNumberModifiers(const BuffersListOptions& options,
   if (buffer->status()->GetType() == Status::Type::kWarning) {
     output.insert(LineModifier::RED);
     const double kSecondsWarningHighlight = 5;
-    if (GetElapsedSecondsSince(buffer->status()->last_change_time()) <
-        kSecondsWarningHighlight) {
+    if (IsRecent(options, buffer->status()->last_change_time(),
+                 kSecondsWarningHighlight)) {
       output.insert(LineModifier::REVERSE);
     }
   } else if (filter_result == FilterResult::kExcluded) {
@@ -108,7 +119,7 @@ LineModifierSet GetNumberModifiers(const BuffersListOptions& options,
     } else {
       output.insert(LineModifier::RED);
     }
-    if (GetElapsedSecondsSince(buffer->time_last_exit()) < 5.0) {
+    if (IsRecent(options, buffer->time_last_exit(), 5.0)) {
       output.insert({LineModifier::REVERSE});
     }
   } else {
@@ -555,6 +566,7 @@ std::unique_ptr<OutputProducer> BuffersList::CreateOutputProducer(
       active_buffers.insert(b.get());
     }
     rows.push_back({std::make_unique<BuffersListProducer>(BuffersListOptions{
+                        .editor_state = editor_state_,
                         .buffers = &buffers_,
                         .active_buffer = widget_->GetActiveLeaf()->Lock(),
                         .active_buffers = std::move(active_buffers),
@@ -1,5 +1,7 @@
 #include "src/const_tree.h"
 
+#include <malloc.h>
+
 #include "src/tests/benchmarks.h"
 #include "src/tests/tests.h"
 #include "src/time.h"
@@ -177,6 +179,133 @@ bool registration_erase =
       return SecondsBetween(start, end) / indices.size();
     });
 
+// Benchmarks on trees shaped like the lines in a large buffer: shared pointers
+// (to a single value, so that only the tree itself is measured). The trees are
+// built once (with `PushBack`, like loading a file); the `elements` argument is
+// the number of operations to run.
+using LineTree = ConstTree<std::shared_ptr<const int>>;
+
+const LineTree::Ptr& GetLineTree(size_t size) {
+  static std::unordered_map<size_t, LineTree::Ptr> trees;
+  auto& output = trees[size];
+  if (output == nullptr) {
+    auto line = std::make_shared<const int>(kNumberToInsert);
+    for (size_t i = 0; i < size; i++) {
+      output = LineTree::PushBack(output, line);
+    }
+  }
+  return output;
+}
+
+void RegisterLineTreeBenchmarks(std::wstring name, size_t size) {
+  const std::wstring prefix = L"ConstTree::" + name + L"Lines::";
+  tests::RegisterBenchmark(prefix + L"Insert", [size](int elements) {
+    const auto& tree = GetLineTree(size);
+    auto indices = RandomIndices(elements, size);
+    auto line = std::make_shared<const int>(0);
+    auto start = Now();
+    for (auto& index : indices) {
+      CHECK_EQ(LineTree::Size(LineTree::Insert(tree, index, line)), size + 1);
+    }
+    auto end = Now();
+    return SecondsBetween(start, end) / elements;
+  });
+  tests::RegisterBenchmark(prefix + L"Erase", [size](int elements) {
+    const auto& tree = GetLineTree(size);
+    auto indices = RandomIndices(elements, size);
+    auto start = Now();
+    for (auto& index : indices) {
+      CHECK_EQ(LineTree::Size(LineTree::Erase(tree, index)), size - 1);
+    }
+    auto end = Now();
+    return SecondsBetween(start, end) / elements;
+  });
+  tests::RegisterBenchmark(prefix + L"Get", [size](int elements) {
+    const auto& tree = GetLineTree(size);
+    auto indices = RandomIndices(elements, size);
+    auto start = Now();
+    for (auto& index : indices) {
+      CHECK_EQ(*tree->Get(index), kNumberToInsert);
+    }
+    auto end = Now();
+    return SecondsBetween(start, end) / elements;
+  });
+  // Returns the time per element of a full iteration.
+  tests::RegisterBenchmark(prefix + L"Every", [size](int elements) {
+    const auto& tree = GetLineTree(size);
+    auto start = Now();
+    for (int i = 0; i < elements; i++) {
+      size_t count = 0;
+      LineTree::Every(tree, [&count](const std::shared_ptr<const int>& line) {
+        count += *line;
+        return true;
+      });
+      CHECK_EQ(count, size * kNumberToInsert);
+    }
+    auto end = Now();
+    return SecondsBetween(start, end) / elements / size;
+  });
+  // Like `Every`, but through an `Iterator`.
+  tests::RegisterBenchmark(prefix + L"Iterator", [size](int elements) {
+    const auto& tree = GetLineTree(size);
+    auto start = Now();
+    for (int i = 0; i < elements; i++) {
+      size_t count = 0;
+      for (auto it = LineTree::Begin(tree), end = LineTree::End(tree);
+           it != end; ++it) {
+        count += **it;
+      }
+      CHECK_EQ(count, size * kNumberToInsert);
+    }
+    auto end = Now();
+    return SecondsBetween(start, end) / elements / size;
+  });
+}
+
+// Returns the time per element.
+bool registration_from_range =
+    tests::RegisterBenchmark(L"ConstTree::FromRange", [](int elements) {
+      std::vector<int> v(elements, kNumberToInsert);
+      auto start = Now();
+      auto tree = IntTree::FromRange(v.begin(), v.end());
+      auto end = Now();
+      CHECK_EQ(IntTree::Size(tree), static_cast<size_t>(elements));
+      return SecondsBetween(start, end) / elements;
+    });
+
+// Returns the time per element (to compare with `ConstTree::FromRange`).
+bool registration_push_back_all =
+    tests::RegisterBenchmark(L"ConstTree::PushBackAll", [](int elements) {
+      auto start = Now();
+      IntTree::Ptr tree;
+      for (int i = 0; i < elements; i++) {
+        tree = IntTree::PushBack(tree, kNumberToInsert);
+      }
+      auto end = Now();
+      CHECK_EQ(IntTree::Size(tree), static_cast<size_t>(elements));
+      return SecondsBetween(start, end) / elements;
+    });
+
+bool registration_line_tree = [] {
+  RegisterLineTreeBenchmarks(L"1M", 1e6);
+  RegisterLineTreeBenchmarks(L"10M", 1e7);
+  return true;
+}();
+
+// Returns the number of bytes allocated per element (rather than a time).
+bool registration_memory =
+    tests::RegisterBenchmark(L"ConstTree::MemoryPerElement", [](int elements) {
+      auto line = std::make_shared<const int>(kNumberToInsert);
+      auto start = mallinfo2().uordblks;
+      LineTree::Ptr tree;
+      for (int i = 0; i < elements; i++) {
+        tree = LineTree::PushBack(tree, line);
+      }
+      auto end = mallinfo2().uordblks;
+      CHECK_EQ(LineTree::Size(tree), static_cast<size_t>(elements));
+      return static_cast<double>(end - start) / elements;
+    });
+
 bool IsEqual(const std::vector<int>& v, const IntTree::Ptr& tree) {
   if (v.size() != IntTree::Size(tree)) return false;
   for (size_t i = 0; i < v.size(); ++i) {
@@ -220,6 +349,138 @@ class ConstTreeTests : public tests::TestGroup<ConstTreeTests> {
                      tree_copy, random() % (IntTree::Size(tree_copy)));
                  CHECK(IsEqual(v, tree));
                }
+             }},
+            {.name = L"PushBackOnSharedTail",
+             .callback =
+                 [] {
+                   // Pushing back to a tree shouldn't affect other trees that
+                   // share its tail.
+                   IntTree::Ptr tree;
+                   for (int i = 0; i < 10; i++) tree = IntTree::PushBack(tree, i);
+                   auto a = IntTree::PushBack(tree, 100);
+                   auto b = IntTree::PushBack(tree, 200);
+                   auto prefix = IntTree::PushBack(IntTree::Prefix(a, 5), 300);
+                   CHECK_EQ(IntTree::Size(tree), 10ul);
+                   CHECK_EQ(a->Get(10), 100);
+                   CHECK_EQ(b->Get(10), 200);
+                   CHECK_EQ(IntTree::Size(prefix), 6ul);
+                   CHECK_EQ(prefix->Get(5), 300);
+                   CHECK_EQ(a->Get(5), 5);
+                 }},
+            {.name = L"FromRange",
+             .callback =
+                 [] {
+                   for (int size = 0; size < 1000; size += 1 + size / 10) {
+                     std::vector<int> v;
+                     for (int i = 0; i < size; i++) v.push_back(random());
+                     auto tree = IntTree::FromRange(v.begin(), v.end());
+                     CHECK(IsEqual(v, tree));
+                     tree = IntTree::PushBack(tree, 5);
+                     v.push_back(5);
+                     tree = IntTree::Append(tree, tree);
+                     auto copy = v;
+                     v.insert(v.end(), copy.begin(), copy.end());
+                     CHECK(IsEqual(v, tree));
+                   }
+                 }},
+            {.name = L"Iterator",
+             .callback =
+                 [] {
+                   IntTree::Ptr tree;
+                   std::vector<int> v;
+                   while (IntTree::Size(tree) < 2000) {
+                     size_t position = random() % (IntTree::Size(tree) + 1);
+                     int number = random();
+                     tree = IntTree::Insert(tree, position, number);
+                     v.insert(v.begin() + position, number);
+                   }
+                   CHECK(std::equal(IntTree::Begin(tree), IntTree::End(tree),
+                                    v.begin(), v.end()));
+                   auto it = IntTree::End(tree);
+                   for (size_t i = v.size(); i > 0; i--) {
+                     --it;
+                     CHECK_EQ(it.position(), i - 1);
+                     CHECK_EQ(*it, v[i - 1]);
+                   }
+                   CHECK(it == IntTree::Begin(tree));
+                   for (int i = 0; i < 100; i++) {
+                     size_t position = random() % v.size();
+                     it = IntTree::Iterator(tree, position);
+                     CHECK_EQ(*it, v[position]);
+                     if (position > 0) CHECK_EQ(*std::prev(it), v[position - 1]);
+                     if (position + 1 < v.size())
+                       CHECK_EQ(*std::next(it), v[position + 1]);
+                   }
+                   CHECK(IntTree::Begin(nullptr) == IntTree::End(nullptr));
+                 }},
+            {.name = L"UpperBoundAndEvery", .callback = [] {
+               IntTree::Ptr tree;
+               std::vector<int> v;
+               for (int i = 0; i < 1000; i++) {
+                 tree = IntTree::PushBack(tree, 2 * i);
+                 v.push_back(2 * i);
+               }
+               // Break the tree into many leaves.
+               for (int i = 0; i < 100; i++) {
+                 size_t position = random() % IntTree::Size(tree);
+                 tree = IntTree::Insert(tree, position, tree->Get(position));
+                 v.insert(v.begin() + position, v[position]);
+               }
+               CHECK(IsEqual(v, tree));
+               for (int key = -1; key < 2001; key++) {
+                 CHECK_EQ(IntTree::UpperBound(tree, key, std::less<int>()),
+                          static_cast<size_t>(
+                              std::upper_bound(v.begin(), v.end(), key) -
+                              v.begin()));
+               }
+               size_t position = 0;
+               CHECK(IntTree::Every(tree, [&](int value) {
+                 return value == v[position++];
+               }));
+               CHECK_EQ(position, v.size());
+               position = 0;
+               CHECK(!IntTree::Every(tree, [&](int) { return ++position < 500; }));
+               CHECK_EQ(position, 500ul);
+             }},
+            {.name = L"CommonPrefixSize", .callback = [] {
+               IntTree::Ptr tree;
+               for (int i = 0; i < 1000; i++) {
+                 tree = IntTree::PushBack(tree, i);
+               }
+               CHECK_EQ(IntTree::CommonPrefixSize(tree, nullptr), 0ul);
+               CHECK_EQ(IntTree::CommonPrefixSize(tree, tree), 1000ul);
+               auto longer = IntTree::PushBack(tree, 1000);
+               CHECK_EQ(IntTree::CommonPrefixSize(tree, longer), 1000ul);
+               CHECK_EQ(IntTree::CommonPrefixSize(longer, tree), 1000ul);
+               // Shares the tail chunk with `tree`, but not its contents.
+               auto replaced = IntTree::PushBack(IntTree::Prefix(tree, 999), -1);
+               CHECK_EQ(IntTree::CommonPrefixSize(tree, replaced), 999ul);
+               auto edited = IntTree::Insert(tree, 300, -1);
+               CHECK_EQ(IntTree::CommonPrefixSize(tree, edited), 300ul);
+               auto copy = IntTree::FromRange(IntTree::Begin(tree),
+                                              IntTree::End(tree));
+               CHECK_EQ(IntTree::CommonPrefixSize(tree, copy), 1000ul);
+             }},
+            {.name = L"CommonSuffixSize", .callback = [] {
+               IntTree::Ptr tree;
+               for (int i = 0; i < 1000; i++) {
+                 tree = IntTree::PushBack(tree, i);
+               }
+               CHECK_EQ(IntTree::CommonSuffixSize(tree, nullptr), 0ul);
+               CHECK_EQ(IntTree::CommonSuffixSize(tree, tree), 1000ul);
+               auto longer = IntTree::PushBack(tree, 1000);
+               CHECK_EQ(IntTree::CommonSuffixSize(tree, longer), 0ul);
+               auto edited = IntTree::Insert(tree, 300, -1);
+               CHECK_EQ(IntTree::CommonSuffixSize(tree, edited), 700ul);
+               CHECK_EQ(IntTree::CommonSuffixSize(edited, tree), 700ul);
+               auto erased = IntTree::Erase(tree, 0);
+               CHECK_EQ(IntTree::CommonSuffixSize(tree, erased), 999ul);
+               auto copy = IntTree::FromRange(IntTree::Begin(tree),
+                                              IntTree::End(tree));
+               CHECK_EQ(IntTree::CommonSuffixSize(tree, copy), 1000ul);
+               auto prefixed = IntTree::Append(IntTree::Leaf(-1), tree);
+               CHECK_EQ(IntTree::CommonSuffixSize(prefixed, tree), 1000ul);
+               CHECK_EQ(IntTree::CommonPrefixSize(prefixed, tree), 0ul);
              }}};
   }
 };
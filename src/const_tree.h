@@ -3,12 +3,24 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
 
 namespace afc::editor {
 
-// An immutable tree supporting fast `Prefix` (get initial sequence), `Suffix`,
-// and `Append` operations.
+// An immutable sequence supporting fast `Prefix` (get initial sequence),
+// `Suffix`, and `Append` operations.
+//
+// The elements are stored in fixed-size arrays ("chunks") held by the leaves of
+// a balanced binary tree, so that the per-element overhead is small and
+// iteration mostly walks contiguous memory. The last chunk (the "tail") is kept
+// outside of the tree: this allows `PushBack` to run in constant amortized
+// time.
 template <typename T>
 class ConstTree {
  private:
@@ -18,83 +30,331 @@ class ConstTree {
     friend ConstTree<T>;
   };
 
+  static constexpr size_t kChunkSize = 64;
+
+  // Fixed-capacity storage for elements. Elements are only ever appended to a
+  // chunk (never modified or removed), so a chunk can be shared by many trees,
+  // each of which uses some prefix of it. `TryAppend` lets the tree whose
+  // prefix covers all the elements in the chunk extend it in place (without
+  // affecting other trees sharing the chunk).
+  class Chunk {
+   public:
+    Chunk() = default;
+    Chunk(const Chunk&) = delete;
+
+    ~Chunk() {
+      size_t used = used_.load();
+      for (size_t i = 0; i < used; i++) {
+        reinterpret_cast<T*>(&storage_[i])->~T();
+      }
+    }
+
+    const T& Get(size_t index) const {
+      return *reinterpret_cast<const T*>(&storage_[index]);
+    }
+
+    // Appends `element` iff the chunk has room and contains exactly
+    // `expected_size` elements (in which case it returns true). This is
+    // thread-safe.
+    bool TryAppend(size_t expected_size, T& element) {
+      if (expected_size == kChunkSize ||
+          !used_.compare_exchange_strong(expected_size, expected_size + 1)) {
+        return false;
+      }
+      new (&storage_[expected_size]) T(std::move(element));
+      return true;
+    }
+
+   private:
+    std::atomic<size_t> used_ = 0;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type
+        storage_[kChunkSize];
+  };
+
+  // The first `size` elements in `chunk`.
+  struct Span {
+    std::shared_ptr<Chunk> chunk;
+    size_t size = 0;
+
+    const T* begin() const { return &chunk->Get(0); }
+    const T* end() const { return begin() + size; }
+  };
+
+  // Returns a new chunk holding copies of the elements in [begin, end).
+  static Span NewLeaf(const T* begin, const T* end) {
+    CHECK_LE(end - begin, static_cast<ptrdiff_t>(kChunkSize));
+    Span output{std::make_shared<Chunk>(), 0};
+    for (const T* it = begin; it != end; ++it) {
+      T copy = *it;
+      CHECK(output.chunk->TryAppend(output.size++, copy));
+    }
+    return output;
+  }
+
+  // A node in the (AVL-balanced) tree of leaves.
+  class Node {
+   public:
+    using Ptr = std::shared_ptr<const Node>;
+
+    Node(Span leaf) : depth_(1), size_(leaf.size), leaf_(std::move(leaf)) {
+      CHECK_GT(size_, 0ul);
+    }
+
+    Node(Ptr left, Ptr right)
+        : depth_(1 + std::max(left->depth_, right->depth_)),
+          size_(left->size_ + right->size_),
+          left_(std::move(left)),
+          right_(std::move(right)) {
+      CHECK_LE(std::max(left_->depth_, right_->depth_),
+               std::min(left_->depth_, right_->depth_) + 1);
+    }
+
+    static size_t Size(const Ptr& node) {
+      return node == nullptr ? 0 : node->size_;
+    }
+
+    static size_t Depth(const Ptr& node) {
+      return node == nullptr ? 0 : node->depth_;
+    }
+
+    static Ptr New(Span leaf) {
+      return leaf.size == 0 ? nullptr : std::make_shared<Node>(std::move(leaf));
+    }
+
+    // Returns a perfectly balanced tree with the leaves in [begin, end).
+    static Ptr FromLeaves(const std::vector<Span>& leaves, size_t begin,
+                          size_t end) {
+      if (begin == end) return nullptr;
+      if (begin + 1 == end) return New(leaves[begin]);
+      size_t middle = begin + (end - begin) / 2;
+      return NewInternal(FromLeaves(leaves, begin, middle),
+                         FromLeaves(leaves, middle, end));
+    }
+
+    const T& Get(size_t index) const {
+      const Node* node = this;
+      while (!node->IsLeaf()) {
+        if (index < node->left_->size_) {
+          node = node->left_.get();
+        } else {
+          index -= node->left_->size_;
+          node = node->right_.get();
+        }
+      }
+      return node->leaf_.chunk->Get(index);
+    }
+
+    static Ptr Append(const Ptr& a, const Ptr& b) {
+      if (a == nullptr) return b;
+      if (b == nullptr) return a;
+      // Merge the leaves that become adjacent if they fit in a single chunk.
+      // This keeps leaves from becoming fragmented as elements get inserted
+      // (with Prefix, PushBack and Append).
+      const Span& a_last = a->LastLeaf();
+      const Span& b_first = b->FirstLeaf();
+      if (a_last.size + b_first.size <= kChunkSize) {
+        Span merged = NewLeaf(a_last.begin(), a_last.end());
+        for (const T& element : b_first) {
+          T copy = element;
+          CHECK(merged.chunk->TryAppend(merged.size++, copy));
+        }
+        return Join(Join(a->RemoveLastLeaf(), New(std::move(merged))),
+                    b->RemoveFirstLeaf());
+      }
+      return Join(a, b);
+    }
+
+    static Ptr Prefix(const Ptr& node, size_t length) {
+      if (length == Size(node)) return node;
+      CHECK(node != nullptr);
+      CHECK_LT(length, node->size_);
+      if (node->IsLeaf()) {
+        return New(NewLeaf(node->leaf_.begin(), node->leaf_.begin() + length));
+      }
+      if (length <= node->left_->size_) {
+        return Prefix(node->left_, length);
+      }
+      return Join(node->left_, Prefix(node->right_, length - node->left_->size_));
+    }
+
+    static Ptr Suffix(const Ptr& node, size_t start) {
+      if (start >= Size(node)) return nullptr;
+      if (start == 0) return node;
+      if (node->IsLeaf()) {
+        return New(NewLeaf(node->leaf_.begin() + start, node->leaf_.end()));
+      }
+      if (start >= node->left_->size_) {
+        return Suffix(node->right_, start - node->left_->size_);
+      }
+      return Join(Suffix(node->left_, start), node->right_);
+    }
+
+    template <typename LessThan>
+    static size_t UpperBound(const Ptr& node, const T& key,
+                             LessThan less_than) {
+      if (node == nullptr) return 0;
+      if (node->IsLeaf()) {
+        return std::upper_bound(node->leaf_.begin(), node->leaf_.end(), key,
+                                less_than) -
+               node->leaf_.begin();
+      }
+      if (less_than(key, *node->right_->FirstLeaf().begin())) {
+        return UpperBound(node->left_, key, less_than);
+      }
+      return node->left_->size_ + UpperBound(node->right_, key, less_than);
+    }
+
+    template <typename Predicate>
+    static bool Every(const Ptr& node, Predicate& predicate) {
+      if (node == nullptr) return true;
+      if (node->IsLeaf()) {
+        for (const T& element : node->leaf_) {
+          if (!predicate(element)) return false;
+        }
+        return true;
+      }
+      return Every(node->left_, predicate) && Every(node->right_, predicate);
+    }
+
+    bool IsLeaf() const { return left_ == nullptr; }
+    size_t size() const { return size_; }
+    const Span& leaf() const { return leaf_; }
+    const Node* left() const { return left_.get(); }
+    const Node* right() const { return right_.get(); }
+
+   private:
+    const Span& FirstLeaf() const {
+      return IsLeaf() ? leaf_ : left_->FirstLeaf();
+    }
+
+    const Span& LastLeaf() const {
+      return IsLeaf() ? leaf_ : right_->LastLeaf();
+    }
+
+    Ptr RemoveFirstLeaf() const {
+      return IsLeaf() ? nullptr : Join(left_->RemoveFirstLeaf(), right_);
+    }
+
+    Ptr RemoveLastLeaf() const {
+      return IsLeaf() ? nullptr : Join(left_, right_->RemoveLastLeaf());
+    }
+
+    // Concatenates two trees (without merging leaves), descending along the
+    // spine of the deeper one and rebalancing on the way back up.
+    static Ptr Join(const Ptr& a, const Ptr& b) {
+      if (a == nullptr) return b;
+      if (b == nullptr) return a;
+      if (a->depth_ > b->depth_ + 1) {
+        return Rebalance(a->left_, Join(a->right_, b));
+      } else if (b->depth_ > a->depth_ + 1) {
+        return Rebalance(Join(a, b->left_), b->right_);
+      }
+      return std::make_shared<Node>(a, b);
+    }
+
+    // Creates a node for `left` and `right`, which may differ in depth by at
+    // most two.
+    static Ptr Rebalance(const Ptr& left, const Ptr& right) {
+      if (right->depth_ > left->depth_ + 1) {
+        if (Depth(right->left_) > Depth(right->right_)) {
+          return NewInternal(NewInternal(left, right->left_->left_),
+                             NewInternal(right->left_->right_, right->right_));
+        }
+        return NewInternal(NewInternal(left, right->left_), right->right_);
+      } else if (left->depth_ > right->depth_ + 1) {
+        if (Depth(left->right_) > Depth(left->left_)) {
+          return NewInternal(NewInternal(left->left_, left->right_->left_),
+                             NewInternal(left->right_->right_, right));
+        }
+        return NewInternal(left->left_, NewInternal(left->right_, right));
+      }
+      return NewInternal(left, right);
+    }
+
+    static Ptr NewInternal(Ptr left, Ptr right) {
+      return std::make_shared<Node>(std::move(left), std::move(right));
+    }
+
+    const size_t depth_;
+    const size_t size_;
+
+    // Only set in leaves.
+    const Span leaf_;
+
+    // Only set in internal nodes (in which case both are set).
+    const Ptr left_;
+    const Ptr right_;
+  };
+
  public:
   using Ptr = std::shared_ptr<ConstTree<T>>;
 
   // Only `New` should be calling this.
-  ConstTree(ConstructorAccessTag, T element, Ptr left, Ptr right)
-      : depth_(1 + std::max(Depth(left), Depth(right))),
-        size_(1 + Size(left) + Size(right)),
-        element_(std::move(element)),
-        left_(std::move(left)),
-        right_(std::move(right)) {
-    CHECK_LE(std::max(Depth(left), Depth(right)),
-             std::min(Depth(left), Depth(right)) + 1);
-  }
+  ConstTree(ConstructorAccessTag, typename Node::Ptr body, Span tail)
+      : size_(Node::Size(body) + tail.size),
+        body_(std::move(body)),
+        tail_(std::move(tail)) {}
 
-  static Ptr Leaf(T element) {
-    return New(std::move(element), nullptr, nullptr);
-  }
+  static Ptr Leaf(T element) { return PushBack(nullptr, std::move(element)); }
 
   static Ptr Append(const Ptr& a, const Ptr& b) {
     if (a == nullptr) return b;
     if (b == nullptr) return a;
-    return New(a->Last(), a->MinusLast(), b);
+    if (b->body_ == nullptr) {
+      // Optimization: keep the tail of `b`, so that elements can be pushed
+      // back efficiently.
+      return New(a->AsNode(), b->tail_);
+    }
+    return New(Node::Append(a->AsNode(), b->body_), b->tail_);
+  }
+
+  // Returns a (balanced) tree with copies of the elements in [begin, end).
+  // Runs in linear time.
+  template <typename InputIterator>
+  static Ptr FromRange(InputIterator begin, InputIterator end) {
+    std::vector<Span> leaves;
+    for (; begin != end; ++begin) {
+      if (leaves.empty() || leaves.back().size == kChunkSize) {
+        leaves.push_back({std::make_shared<Chunk>(), 0});
+      }
+      T copy = *begin;
+      CHECK(leaves.back().chunk->TryAppend(leaves.back().size++, copy));
+    }
+    if (leaves.empty()) return nullptr;
+    Span tail = std::move(leaves.back());
+    leaves.pop_back();
+    return New(Node::FromLeaves(leaves, 0, leaves.size()), std::move(tail));
   }
 
   static Ptr PushBack(const Ptr& a, T element) {
-    return New(std::move(element), a, nullptr);
+    if (a != nullptr && a->tail_.chunk != nullptr &&
+        a->tail_.chunk->TryAppend(a->tail_.size, element)) {
+      return New(a->body_, {a->tail_.chunk, a->tail_.size + 1});
+    }
+    Span tail{std::make_shared<Chunk>(), 0};
+    CHECK(tail.chunk->TryAppend(tail.size++, element));
+    return New(a == nullptr ? nullptr : a->AsNode(), std::move(tail));
   }
 
   static Ptr Insert(const Ptr& tree, size_t index, T element) {
     CHECK_LE(index, Size(tree));
-    if (tree == nullptr) return Leaf(std::move(element));
-    auto size_left = Size(tree->left_);
-    if (index <= size_left)
-      return New(tree->element_, Insert(tree->left_, index, std::move(element)),
-                 tree->right_);
-    else
-      return New(
-          tree->element_, tree->left_,
-          Insert(tree->right_, index - size_left - 1, std::move(element)));
+    return Append(PushBack(Prefix(tree, index), std::move(element)),
+                  Suffix(tree, index));
   }
 
   static Ptr Erase(const Ptr& tree, size_t index) {
-    CHECK_LE(index, Size(tree));
-    auto size_left = Size(tree->left_);
-    if (index < size_left) {
-      return New(tree->element_, Erase(tree->left_, index), tree->right_);
-    } else if (index > size_left) {
-      return New(tree->element_, tree->left_,
-                 Erase(tree->right_, index - size_left - 1));
-    } else if (tree->left_ == nullptr) {
-      return tree->right_;
-    } else {
-      return New(tree->left_->element_,
-                 Erase(tree->left_, Size(tree->left_->left_)), tree->right_);
-    }
+    CHECK_LT(index, Size(tree));
+    return Append(Prefix(tree, index), Suffix(tree, index + 1));
   }
 
   static size_t Size(const Ptr& tree) {
     return tree == nullptr ? 0 : tree->size_;
   }
 
-  static size_t Depth(const Ptr& tree) {
-    return tree == nullptr ? 0 : tree->depth_;
-  }
-
-  const T& Get(size_t i) {
+  const T& Get(size_t i) const {
     CHECK_LT(i, size_);
-    auto size_left = Size(left_);
-    if (i < size_left) {
-      CHECK(left_ != nullptr);
-      return left_->Get(i);
-    } else if (i == size_left) {
-      return element_;
-    } else {
-      CHECK(right_ != nullptr);
-      return right_->Get(i - size_left - 1);
-    }
+    size_t body_size = Node::Size(body_);
+    return i < body_size ? body_->Get(i) : tail_.chunk->Get(i - body_size);
   }
 
   // Returns a tree containing the first len elements. Prefix("abcde", 2) ==
@@ -103,11 +363,13 @@ class ConstTree {
     if (len == Size(a)) return a;
     CHECK(a != nullptr);
     CHECK_LT(len, a->size_);
-    auto size_left = Size(a->left_);
-    if (len <= size_left) {
-      return Prefix(a->left_, len);
+    size_t body_size = Node::Size(a->body_);
+    if (len <= body_size) {
+      return New(Node::Prefix(a->body_, len), {});
     }
-    return New(a->element_, a->left_, Prefix(a->right_, len - size_left - 1));
+    // The tail chunk can be shared (the new tree simply ignores the last
+    // elements).
+    return New(a->body_, {a->tail_.chunk, len - body_size});
   }
 
   // Returns a tree skipping the first len elements (i.e., from element `len` to
@@ -115,12 +377,13 @@ class ConstTree {
   static Ptr Suffix(const Ptr& a, size_t len) {
     if (len >= Size(a)) return nullptr;
     CHECK(a != nullptr);
-    CHECK_LT(len, a->size_);
-    auto size_left = Size(a->left_);
-    if (len >= size_left + 1) {
-      return Suffix(a->right_, len - size_left - 1);
+    if (len == 0) return a;
+    size_t body_size = Node::Size(a->body_);
+    if (len >= body_size) {
+      return New(nullptr, NewLeaf(a->tail_.begin() + len - body_size,
+                                  a->tail_.end()));
     }
-    return New(a->element_, Suffix(a->left_, len), a->right_);
+    return New(Node::Suffix(a->body_, len), a->tail_);
   }
 
   // Similar to std::upper_bound(begin(), end(), val, compare). Returns the
@@ -128,71 +391,232 @@ class ConstTree {
   // be sorted (according to the less_than value given).
   template <typename LessThan>
   static size_t UpperBound(const Ptr& tree, const T& key, LessThan less_than) {
-    if (tree == nullptr) {
-      return 0;
-    } else if (less_than(key, tree->element_)) {
-      return UpperBound(tree->left_, key, less_than);
-    } else {
-      return Size(tree->left_) + 1 + UpperBound(tree->right_, key, less_than);
+    if (tree == nullptr) return 0;
+    if (tree->tail_.size > 0 &&
+        !less_than(key, *tree->tail_.begin())) {
+      return Node::Size(tree->body_) +
+             (std::upper_bound(tree->tail_.begin(), tree->tail_.end(), key,
+                               less_than) -
+              tree->tail_.begin());
     }
+    return Node::UpperBound(tree->body_, key, less_than);
   }
 
   template <typename Predicate>
   static bool Every(const Ptr& tree, Predicate predicate) {
-    return tree == nullptr ||
-           (Every(tree->left_, predicate) && predicate(tree->element_) &&
-            Every(tree->right_, predicate));
+    if (tree == nullptr) return true;
+    if (!Node::Every(tree->body_, predicate)) return false;
+    for (const T& element : tree->tail_) {
+      if (!predicate(element)) return false;
+    }
+    return true;
   }
 
- private:
-  T Last() { return right_ == nullptr ? element_ : right_->Last(); }
-
-  Ptr MinusLast() {
-    return right_ == nullptr ? left_
-                             : New(element_, left_, right_->MinusLast());
+  // Returns the number of initial elements that `a` and `b` have in common
+  // (according to `==`). Elements that `a` and `b` share (that are stored in
+  // the same chunk) are skipped a chunk at a time, so this is fast when one
+  // tree was derived from the other (e.g., by inserting or erasing elements).
+  static size_t CommonPrefixSize(const Ptr& a, const Ptr& b) {
+    size_t limit = std::min(Size(a), Size(b));
+    if (limit == 0 || a == b) return limit;
+    size_t start = 0;
+    if (a->body_ == b->body_) {
+      // Elements in a chunk never change once they've been appended.
+      if (a->tail_.chunk == b->tail_.chunk) return limit;
+      start = Node::Size(a->body_);
+    }
+    Iterator it_a(a, start);
+    Iterator it_b(b, start);
+    while (it_a.position() < limit) {
+      if (&*it_a == &*it_b) {
+        size_t shared = std::min({it_a.LeafEnd(), it_b.LeafEnd(), limit}) -
+                        it_a.position();
+        it_a.Skip(shared);
+        it_b.Skip(shared);
+      } else if (*it_a == *it_b) {
+        ++it_a;
+        ++it_b;
+      } else {
+        break;
+      }
+    }
+    return it_a.position();
   }
 
-  Ptr RotateRight() {
-    CHECK(left_ != nullptr);
-    return NewFinal(left_->element_, left_->left_,
-                    NewFinal(element_, left_->right_, right_));
+  // Returns the number of final elements that `a` and `b` have in common.
+  // Like `CommonPrefixSize`, skips shared elements a chunk at a time.
+  static size_t CommonSuffixSize(const Ptr& a, const Ptr& b) {
+    size_t limit = std::min(Size(a), Size(b));
+    if (limit == 0 || a == b) return limit;
+    Iterator it_a = End(a);
+    Iterator it_b = End(b);
+    size_t output = 0;
+    while (output < limit) {
+      --it_a;
+      --it_b;
+      if (&*it_a == &*it_b) {
+        size_t shared = std::min({it_a.position() - it_a.leaf_start_,
+                                  it_b.position() - it_b.leaf_start_,
+                                  limit - output - 1});
+        it_a.position_ -= shared;
+        it_b.position_ -= shared;
+        output += shared + 1;
+      } else if (*it_a == *it_b) {
+        output++;
+      } else {
+        break;
+      }
+    }
+    return output;
   }
 
-  Ptr RotateLeft() {
-    CHECK(right_ != nullptr);
-    return NewFinal(right_->element_, NewFinal(element_, left_, right_->left_),
-                    right_->right_);
-  }
+  // Bidirectional iterator over the elements in a tree. It keeps a reference to
+  // the tree, so it remains valid even if the tree is replaced (e.g., by
+  // `BufferContents`).
+  //
+  // Moving to an adjacent element runs in constant amortized time: the iterator
+  // holds the path from the root to the current leaf, and only climbs as far as
+  // needed when it walks out of the leaf.
+  class Iterator {
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    Iterator() = default;
+
+    Iterator(Ptr tree, size_t position)
+        : tree_(std::move(tree)), position_(position) {
+      CHECK_LE(position_, Size(tree_));
+      Seek();
+    }
+
+    reference operator*() const {
+      CHECK_LT(position_ - leaf_start_, leaf_size_);
+      return leaf_begin_[position_ - leaf_start_];
+    }
+    pointer operator->() const { return &**this; }
+
+    Iterator& operator++() {
+      if (++position_ - leaf_start_ >= leaf_size_) Seek();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator output = *this;
+      ++*this;
+      return output;
+    }
+
+    Iterator& operator--() {
+      CHECK_GT(position_, 0ul);
+      if (position_-- == leaf_start_) Seek();
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator output = *this;
+      --*this;
+      return output;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return tree_ == other.tree_ && position_ == other.position_;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+    // The index of the current element.
+    size_t position() const { return position_; }
 
-  static Ptr New(T element, Ptr left, Ptr right) {
-    VLOG(5) << "New with depths: " << Depth(left) << ", " << Depth(right);
-    if (Depth(right) > Depth(left) + 1) {
-      if (Depth(right->left_) > Depth(right->right_)) {
-        right = right->RotateRight();
+   private:
+    friend ConstTree;
+
+    // The index one past the last element in the current leaf.
+    size_t LeafEnd() const { return leaf_start_ + leaf_size_; }
+
+    // Advances `n` elements.
+    void Skip(size_t n) {
+      position_ += n;
+      if (position_ >= LeafEnd()) Seek();
+    }
+
+    // Updates `leaf_begin_`, `leaf_size_`, `leaf_start_` and `path_` to point to the leaf that
+    // contains `position_`.
+    void Seek() {
+      size_t size = Size(tree_);
+      if (position_ == size) {
+        leaf_begin_ = nullptr;
+        leaf_size_ = 0;
+        leaf_start_ = size;
+        return;
+      }
+      size_t body_size = Node::Size(tree_->body_);
+      if (position_ >= body_size) {
+        SetLeaf(tree_->tail_, body_size);
+        return;
       }
-      return NewFinal(right->element_, New(element, left, right->left_),
-                      right->right_);
-    } else if (Depth(left) > Depth(right) + 1) {
-      if (Depth(left->right_) > Depth(left->left_)) {
-        left = left->RotateLeft();
+      while (!path_.empty() &&
+             (position_ < path_.back().start ||
+              position_ >= path_.back().start + path_.back().node->size())) {
+        path_.pop_back();
       }
-      return NewFinal(left->element_, left->left_,
-                      New(element, left->right_, right));
+      if (path_.empty()) path_.push_back({tree_->body_.get(), 0});
+      while (!path_.back().node->IsLeaf()) {
+        const Node* node = path_.back().node;
+        size_t start = path_.back().start;
+        if (position_ < start + node->left()->size()) {
+          path_.push_back({node->left(), start});
+        } else {
+          path_.push_back({node->right(), start + node->left()->size()});
+        }
+      }
+      SetLeaf(path_.back().node->leaf(), path_.back().start);
+    }
+
+    void SetLeaf(const Span& leaf, size_t start) {
+      leaf_begin_ = leaf.begin();
+      leaf_size_ = leaf.size;
+      leaf_start_ = start;
     }
-    return NewFinal(element, left, right);
+
+    struct PathEntry {
+      const Node* node;
+      // The index (in the entire tree) of the first element in `node`.
+      size_t start;
+    };
+
+    Ptr tree_;
+    size_t position_ = 0;
+    std::vector<PathEntry> path_;
+    // The elements in the current leaf (which `tree_` keeps alive).
+    const T* leaf_begin_ = nullptr;
+    size_t leaf_size_ = 0;
+    size_t leaf_start_ = 0;
+  };
+
+  static Iterator Begin(Ptr tree) { return Iterator(std::move(tree), 0); }
+  static Iterator End(Ptr tree) {
+    size_t size = Size(tree);
+    return Iterator(std::move(tree), size);
+  }
+
+ private:
+  static Ptr New(typename Node::Ptr body, Span tail) {
+    if (body == nullptr && tail.size == 0) return nullptr;
+    return std::make_shared<ConstTree<T>>(ConstructorAccessTag{},
+                                          std::move(body), std::move(tail));
   }
 
-  static Ptr NewFinal(T element, Ptr left, Ptr right) {
-    return std::make_shared<ConstTree<T>>(ConstructorAccessTag{}, element, left,
-                                          right);
+  // Returns all the elements in a single tree (merging the tail into the body).
+  typename Node::Ptr AsNode() const {
+    return Node::Append(body_, Node::New(tail_));
   }
 
-  const size_t depth_;
   const size_t size_;
-  const T element_;
 
-  const std::shared_ptr<ConstTree<T>> left_;
-  const std::shared_ptr<ConstTree<T>> right_;
+  // Holds all elements except the last `tail_.size`.
+  const typename Node::Ptr body_;
+  const Span tail_;
 };
 
 }  // namespace afc::editor
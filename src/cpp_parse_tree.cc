@@ -2,9 +2,21 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
+
 #include "src/buffer.h"
+#include "src/const_tree.h"
+#include "src/hash.h"
+#include "src/notification.h"
 #include "src/parse_tools.h"
 #include "src/seek.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
+#include "src/tracker.h"
 
 namespace afc {
 namespace editor {
@@ -31,6 +43,81 @@ static const wstring digit_chars = L"1234567890";
 static const LineModifierSet BAD_PARSE_MODIFIERS =
     LineModifierSet({LineModifier::BG_RED, LineModifier::BOLD});
 
+// When parsing with an abort notification, how often to check it.
+constexpr size_t kLinesBetweenAbortChecks = 1024;
+
+// Bounded cache of the results of parsing a line, keyed by the hash of the line
+// and the states at its start.
+//
+// Entries are kept in two generations. Lookups that find an entry in the old
+// generation move it to the current one. Once the current generation is full,
+// it becomes the old one, discarding all entries that weren't used since the
+// previous time this happened.
+class ParseResultsCache {
+ public:
+  // Returns the results for a line, running `parse` to produce them if they
+  // aren't in the cache. The reference is valid until the next call.
+  template <typename Parse>
+  const ParseResults& Get(size_t line_hash, const std::vector<size_t>& states,
+                          Parse parse) {
+    size_t key = line_hash;
+    for (size_t state : states) key = hash_combine(key, state);
+    if (auto it = current_.find(key);
+        it != current_.end() && it->second.Matches(line_hash, states)) {
+      hits_++;
+      return it->second.results;
+    }
+    if (current_.size() >= kGenerationSize) {
+      previous_ = std::move(current_);
+      current_.clear();
+    }
+    if (auto it = previous_.find(key);
+        it != previous_.end() && it->second.Matches(line_hash, states)) {
+      hits_++;
+      Entry& entry = current_[key];
+      entry = std::move(it->second);
+      previous_.erase(it);
+      return entry.results;
+    }
+    misses_++;
+    Entry& entry = current_[key];
+    entry = Entry{line_hash, states, parse()};
+    return entry.results;
+  }
+
+  static constexpr size_t kGenerationSize = 1 << 15;
+
+  size_t size() const { return current_.size() + previous_.size(); }
+
+  // Adds the number of lookups since the last call to the trackers.
+  void FlushCounters() {
+    static Tracker hits_tracker(L"CppTreeParser::ParseResultsCache::Hit");
+    static Tracker misses_tracker(L"CppTreeParser::ParseResultsCache::Miss");
+    hits_tracker.AddExecutions(hits_);
+    misses_tracker.AddExecutions(misses_);
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+ private:
+  struct Entry {
+    bool Matches(size_t other_line_hash,
+                 const std::vector<size_t>& other_states) const {
+      return line_hash == other_line_hash && states == other_states;
+    }
+
+    size_t line_hash = 0;
+    // The states at the start of the line.
+    std::vector<size_t> states;
+    ParseResults results;
+  };
+
+  std::unordered_map<size_t, Entry> current_;
+  std::unordered_map<size_t, Entry> previous_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
 class CppTreeParser : public TreeParser {
  public:
   CppTreeParser(std::unordered_set<wstring> keywords,
@@ -42,46 +129,33 @@ class CppTreeParser : public TreeParser {
         typos_(std::move(typos)) {}
 
   ParseTree FindChildren(const BufferContents& buffer, Range range) override {
-    // TODO: Does this actually clean up expired references? Probably not?
-    cache_.erase(std::weak_ptr<LazyString>());
+    if (range == buffer.range()) {
+      ParseTree output = FindChildrenIncrementally(buffer, nullptr).value();
+      cache_.FlushCounters();
+      return output;
+    }
 
-    std::vector<size_t> states_stack = {DEFAULT_AT_START_OF_LINE};
+    States states = InitialStates();
     std::vector<ParseTree> trees = {ParseTree(range)};
+    auto line_iterator = buffer.IteratorAt(range.begin.line);
     range.ForEachLine([&](LineNumber i) {
-      auto insert_results = cache_[buffer.at(i)->contents()].insert(
-          {states_stack, ParseResults()});
-      if (insert_results.second) {
-        ParseData data(buffer, std::move(states_stack),
-                       min(LineColumn(i + LineNumberDelta(1)), range.end));
-        data.set_position(max(LineColumn(i), range.begin));
-        ParseLine(&data);
-        insert_results.first->second = *data.parse_results();
-      }
-      for (auto& action : insert_results.first->second.actions) {
-        action.Execute(&trees, i);
-      }
-      states_stack = insert_results.first->second.states_stack;
+      states = ExecuteLine(buffer, range, i, **line_iterator, states, &trees);
+      ++line_iterator;
     });
-
-    auto final_position =
-        LineColumn(buffer.EndLine(), buffer.back()->EndColumn());
-    if (final_position >= range.end) {
-      DVLOG(5) << "Draining final states: " << states_stack.size();
-      ParseData data(buffer, std::move(states_stack),
-                     std::min(LineColumn(LineNumber(0) + buffer.size() +
-                                         LineNumberDelta(1)),
-                              range.end));
-      while (data.parse_results()->states_stack.size() > 1) {
-        data.PopBack();
-      }
-      for (auto& action : data.parse_results()->actions) {
-        action.Execute(&trees, final_position.line);
-      }
-    }
+    Drain(buffer, range, *states, &trees);
+    cache_.FlushCounters();
     CHECK(!trees.empty());
     return trees[0];
   }
 
+  std::optional<ParseTree> FindChildrenUnlessAborted(
+      const BufferContents& buffer,
+      const Notification& abort_notification) override {
+    auto output = FindChildrenIncrementally(buffer, &abort_notification);
+    cache_.FlushCounters();
+    return output;
+  }
+
   void ParseLine(ParseData* result) {
     bool done = false;
     while (!done) {
@@ -140,6 +214,293 @@ class CppTreeParser : public TreeParser {
   }
 
  private:
+  // The stack of states at the start of a line. Consecutive lines that start
+  // with the same states share the instance.
+  using States = std::shared_ptr<const std::vector<size_t>>;
+  using StatesTree = ConstTree<States>;
+
+  // The results of a parse of an entire buffer.
+  struct LastParse {
+    std::shared_ptr<const BufferContents> contents;
+    // If the parse was aborted, the trees that were open are closed at the
+    // start of the line at which it stopped.
+    ParseTree tree;
+    // The states at the start of each line in `contents`. If the parse was
+    // aborted, only up to the line at which it stopped.
+    StatesTree::Ptr states;
+  };
+
+  static States InitialStates() {
+    static const States* const output = new States(
+        std::make_shared<std::vector<size_t>>(1, DEFAULT_AT_START_OF_LINE));
+    return *output;
+  }
+
+  // Only reparses the lines that changed since the last parse, resuming from
+  // the states at the start of the first line that changed. Once the parse
+  // reaches an unchanged line starting with the same states as in the last
+  // parse, the remaining trees are taken from the last parse.
+  //
+  // If `abort_notification` is notified, stops (returning std::nullopt) and
+  // keeps the work done in `aborted_parse_`; the next call can resume from it.
+  std::optional<ParseTree> FindChildrenIncrementally(
+      const BufferContents& buffer, const Notification* abort_notification) {
+    static Tracker tracker(L"CppTreeParser::FindChildrenIncrementally");
+    auto tracker_call = tracker.Call();
+
+    const Range range = buffer.range();
+    const size_t size = buffer.size().line_delta;
+    size_t start = 0;
+    // Lines at or after `resync_start` are unchanged since the last parse; in
+    // the last parse, they were `delta` lines earlier.
+    size_t resync_start = size;
+    ptrdiff_t delta = 0;
+    const LastParse* resume_parse = nullptr;
+    if (last_parse_.has_value()) {
+      const BufferContents& last_contents = *last_parse_->contents;
+      const size_t last_size = last_contents.size().line_delta;
+      const size_t prefix = buffer.CommonPrefix(last_contents).line_delta;
+      if (prefix == size && prefix == last_size) return last_parse_->tree;
+      const size_t suffix =
+          std::min(static_cast<size_t>(
+                       buffer.CommonSuffix(last_contents).line_delta),
+                   std::min(size, last_size) - prefix);
+      start = ResumeLine(buffer, *last_parse_);
+      resync_start = size - suffix;
+      delta = static_cast<ptrdiff_t>(size) - last_size;
+      resume_parse = &*last_parse_;
+    }
+    if (aborted_parse_.has_value() &&
+        (resume_parse == nullptr ||
+         ResumeLine(buffer, *aborted_parse_) > start)) {
+      start = ResumeLine(buffer, *aborted_parse_);
+      resume_parse = &*aborted_parse_;
+    }
+
+    States states = InitialStates();
+    std::vector<ParseTree> trees = {ParseTree(range)};
+    StatesTree::Ptr states_prefix;
+    if (resume_parse != nullptr) {
+      DVLOG(5) << "Resuming at line " << start;
+      states = resume_parse->states->Get(start);
+      states_prefix = StatesTree::Prefix(resume_parse->states, start);
+      trees = OpenTreesAt(resume_parse->tree, LineNumber(start), range);
+      CHECK_EQ(trees.size(), states->size());
+    }
+
+    std::vector<States> new_states;
+    auto line_iterator = buffer.IteratorAt(LineNumber(start));
+    for (size_t line = start; line + 1 < size; ++line, ++line_iterator) {
+      if (line >= resync_start) {
+        size_t last_line = line - delta;
+        if (*last_parse_->states->Get(last_line) == *states) {
+          DVLOG(5) << "Resynchronized at line " << line << " (from " << start
+                   << ")";
+          ParseTree tree =
+              SpliceTrees(std::move(trees), last_parse_->tree,
+                          LineNumber(last_line), LineNumberDelta(delta));
+          last_parse_ = LastParse{
+              .contents = buffer.copy(),
+              .tree = tree,
+              .states = StatesTree::Append(
+                  StatesTree::Append(states_prefix,
+                                     StatesTree::FromRange(new_states.begin(),
+                                                           new_states.end())),
+                  StatesTree::Suffix(last_parse_->states, last_line))};
+          aborted_parse_ = std::nullopt;
+          return tree;
+        }
+      }
+      if (abort_notification != nullptr && line > start &&
+          (line - start) % kLinesBetweenAbortChecks == 0 &&
+          abort_notification->HasBeenNotified()) {
+        DVLOG(5) << "Aborted at line " << line << " (from " << start << ")";
+        new_states.push_back(states);
+        aborted_parse_ = LastParse{
+            .contents = buffer.copy(),
+            .tree = CloseTrees(std::move(trees), LineNumber(line)),
+            .states = StatesTree::Append(
+                states_prefix, StatesTree::FromRange(new_states.begin(),
+                                                     new_states.end()))};
+        return std::nullopt;
+      }
+      new_states.push_back(states);
+      states = ExecuteLine(buffer, range, LineNumber(line), **line_iterator,
+                           states, &trees);
+    }
+    new_states.push_back(states);  // The last line.
+    Drain(buffer, range, *states, &trees);
+    CHECK(!trees.empty());
+    last_parse_ = LastParse{
+        .contents = buffer.copy(),
+        .tree = trees[0],
+        .states = StatesTree::Append(
+            states_prefix,
+            StatesTree::FromRange(new_states.begin(), new_states.end()))};
+    aborted_parse_ = std::nullopt;
+    return trees[0];
+  }
+
+  // Returns the first line of `buffer` that a parse can resume from, based on
+  // `parse`.
+  static size_t ResumeLine(const BufferContents& buffer,
+                           const LastParse& parse) {
+    // The last line is never parsed (only drained), so we may need to start
+    // before it.
+    return std::min({static_cast<size_t>(
+                         buffer.CommonPrefix(*parse.contents).line_delta),
+                     StatesTree::Size(parse.states) - 1,
+                     static_cast<size_t>(buffer.size().line_delta) - 1});
+  }
+
+  // Closes all the trees in `trees` (a stack of open trees) at the start of
+  // `line`. Returns the root.
+  static ParseTree CloseTrees(std::vector<ParseTree> trees, LineNumber line) {
+    while (trees.size() > 1) {
+      ParseTree child = std::move(trees.back());
+      trees.pop_back();
+      child.set_range(Range(child.range().begin, LineColumn(line)));
+      trees.back().PushChild(std::move(child));
+    }
+    return std::move(trees[0]);
+  }
+
+  // Parses a line (or retrieves the results from `cache_`) and executes the
+  // resulting actions. Returns the states at the start of the next line.
+  States ExecuteLine(const BufferContents& buffer, Range range, LineNumber i,
+                     const Line& line, const States& states,
+                     std::vector<ParseTree>* trees) {
+    const ParseResults& results =
+        cache_.Get(line.GetHash(), *states, [&] {
+          ParseData data(buffer, *states,
+                         min(LineColumn(i + LineNumberDelta(1)), range.end));
+          data.set_position(max(LineColumn(i), range.begin));
+          ParseLine(&data);
+          return *data.parse_results();
+        });
+    for (auto& action : results.actions) {
+      action.Execute(trees, i);
+    }
+    const auto& output = results.states_stack;
+    return output == *states ? states
+                             : std::make_shared<std::vector<size_t>>(output);
+  }
+
+  // Pops all the trees that remain open at the end of the buffer.
+  void Drain(const BufferContents& buffer, Range range,
+             std::vector<size_t> states_stack, std::vector<ParseTree>* trees) {
+    auto final_position =
+        LineColumn(buffer.EndLine(), buffer.back()->EndColumn());
+    if (final_position < range.end) return;
+    DVLOG(5) << "Draining final states: " << states_stack.size();
+    ParseData data(buffer, std::move(states_stack),
+                   std::min(LineColumn(LineNumber(0) + buffer.size() +
+                                       LineNumberDelta(1)),
+                            range.end));
+    while (data.parse_results()->states_stack.size() > 1) {
+      data.PopBack();
+    }
+    for (auto& action : data.parse_results()->actions) {
+      action.Execute(trees, final_position.line);
+    }
+  }
+
+  // Returns the first child of `tree` that wasn't closed before `line`.
+  static std::vector<ParseTree>::const_iterator FirstChildNotClosedBefore(
+      const ParseTree& tree, LineNumber line) {
+    return std::partition_point(tree.children().begin(), tree.children().end(),
+                                [line](const ParseTree& child) {
+                                  return child.range().end.line < line;
+                                });
+  }
+
+  // Returns the child of `tree` that was open at the start of `line`, if any.
+  static const ParseTree* OpenChildAt(const ParseTree& tree, LineNumber line) {
+    auto it = FirstChildNotClosedBefore(tree, line);
+    return it == tree.children().end() || it->range().begin.line >= line
+               ? nullptr
+               : &*it;
+  }
+
+  // Returns the stack of trees that a parse of `root` had open at the start of
+  // `line`, with only the children that were closed before it. The bottom of
+  // the stack is a new root with `range`.
+  static std::vector<ParseTree> OpenTreesAt(const ParseTree& root,
+                                            LineNumber line, Range range) {
+    std::vector<ParseTree> output = {ParseTree(range)};
+    for (const ParseTree* tree = &root; tree != nullptr;
+         tree = OpenChildAt(*tree, line)) {
+      if (tree != &root) {
+        output.push_back(ParseTree(Range(tree->range().begin, LineColumn())));
+        output.back().set_modifiers(tree->modifiers());
+      }
+      auto end = FirstChildNotClosedBefore(*tree, line);
+      for (auto it = tree->children().begin(); it != end; ++it) {
+        output.back().PushChild(*it);
+      }
+      if (tree != &root && !output.back().children().empty()) {
+        // The first child of an open tree is the bracket that opened it, which
+        // only gets highlighted once the tree is closed.
+        output.back().MutableChildren(0)->set_modifiers(BAD_PARSE_MODIFIERS);
+      }
+    }
+    return output;
+  }
+
+  // Completes the stack of open trees `trees` (at the start of a line) with the
+  // children that the trees open at the start of `last_line` in `last_root`
+  // received after it, moving them by `delta` lines.
+  static ParseTree SpliceTrees(std::vector<ParseTree> trees,
+                               const ParseTree& last_root, LineNumber last_line,
+                               LineNumberDelta delta) {
+    std::vector<const ParseTree*> last_trees;
+    for (const ParseTree* tree = &last_root; tree != nullptr;
+         tree = OpenChildAt(*tree, last_line)) {
+      last_trees.push_back(tree);
+    }
+    CHECK_EQ(last_trees.size(), trees.size());
+
+    for (size_t i = trees.size(); i-- > 0;) {
+      ParseTree& tree = trees[i];
+      const ParseTree& last_tree = *last_trees[i];
+      if (i + 1 < trees.size()) tree.PushChild(std::move(trees[i + 1]));
+      const auto& children = last_tree.children();
+      for (auto it = std::partition_point(
+               children.begin(), children.end(),
+               [last_line](const ParseTree& child) {
+                 return child.range().begin.line < last_line;
+               });
+           it != children.end(); ++it) {
+        tree.PushChild(MoveTree(*it, delta));
+      }
+      if (i == 0) break;  // The root keeps its range.
+      Range range = tree.range();
+      range.end = last_tree.range().end;
+      range.end.line += delta;
+      tree.set_range(range);
+      if (!tree.children().empty() && !children.empty() &&
+          children[0].range().begin.line < last_line) {
+        // The last parse may have highlighted it when it closed `last_tree`.
+        tree.MutableChildren(0)->set_modifiers(children[0].modifiers());
+      }
+    }
+    return std::move(trees[0]);
+  }
+
+  // Returns a copy of `tree` moved by `delta` lines.
+  static ParseTree MoveTree(const ParseTree& tree, LineNumberDelta delta) {
+    if (delta == LineNumberDelta()) return tree;
+    Range range = tree.range();
+    range.begin.line += delta;
+    range.end.line += delta;
+    ParseTree output(range);
+    output.set_modifiers(tree.modifiers());
+    for (const auto& child : tree.children()) {
+      output.PushChild(MoveTree(child, delta));
+    }
+    return output;
+  }
+
   void AfterSlash(State state_default, State state_default_at_start_of_line,
                   ParseData* result) {
     auto seek = result->seek();
@@ -364,11 +725,14 @@ class CppTreeParser : public TreeParser {
   const std::unordered_set<wstring> keywords_;
   const std::unordered_set<wstring> typos_;
 
+  // The last parse that ran to completion (against which parses can
+  // resynchronize).
+  std::optional<LastParse> last_parse_;
+  // Set if a parse was aborted after `last_parse_`.
+  std::optional<LastParse> aborted_parse_;
+
   // Allows us to avoid reparsing previously parsed lines.
-  std::map<std::weak_ptr<LazyString>,
-           std::map<std::vector<size_t>, ParseResults>,
-           std::owner_less<std::weak_ptr<LazyString>>>
-      cache_;
+  ParseResultsCache cache_;
 };
 
 }  // namespace
@@ -378,5 +742,231 @@ std::unique_ptr<TreeParser> NewCppTreeParser(
   return std::make_unique<CppTreeParser>(std::move(keywords), std::move(typos));
 }
 
+namespace {
+std::unique_ptr<TreeParser> NewTestParser() {
+  return NewCppTreeParser({L"namespace", L"int", L"return"}, {L"teh"});
+}
+
+// Returns a line of code at a nesting level that depends on `i`.
+std::wstring TestLine(int i) {
+  switch (i % 8) {
+    case 0:
+      return L"namespace foo {";
+    case 1:
+      return L"int Function(int a, int b) {  // Comment.";
+    case 2:
+      return L"  return a + b * 27 + 'x';  /* Other comment. */";
+    case 3:
+      return L"}";
+    case 4:
+      return L"#include \"file.h\"";
+    case 5:
+      return L"/* Comment spanning";
+    case 6:
+      return L"   multiple lines. */";
+    default:
+      return L"}  // namespace foo";
+  }
+}
+
+BufferContents TestContents(int lines) {
+  BufferContents contents;
+  for (int i = 0; i < lines; i++) contents.push_back(TestLine(i));
+  return contents;
+}
+
+void CheckMatchesFullParse(const ParseTree& tree,
+                           const BufferContents& contents) {
+  ParseTree expected =
+      NewTestParser()->FindChildren(contents, contents.range());
+  std::ostringstream tree_string;
+  tree_string << tree;
+  std::ostringstream expected_string;
+  expected_string << expected;
+  CHECK_EQ(tree_string.str(), expected_string.str());
+  CHECK_EQ(tree.hash(), expected.hash());
+}
+
+bool cpp_tree_parser_tests_registration = tests::Register(
+    L"CppTreeParser",
+    {{.name = L"IncrementalMatchesFullParse", .callback = [] {
+        static const std::wstring kCharacters = L"{}()/*\"'#ab1 ";
+        auto parser = NewTestParser();
+        BufferContents contents = TestContents(200);
+        for (int i = 0; i < 300; i++) {
+          size_t size = contents.size().line_delta;
+          LineNumber line(random() % size);
+          switch (random() % 4) {
+            case 0:
+              contents.insert_line(line,
+                                   std::make_shared<Line>(TestLine(random())));
+              break;
+            case 1:
+              if (size > 1) {
+                contents.EraseLines(
+                    line, std::min(line + LineNumberDelta(random() % 4 + 1),
+                                   LineNumber(0) + contents.size()),
+                    BufferContents::CursorsBehavior::kUnmodified);
+              }
+              break;
+            default: {
+              std::wstring text = contents.at(line)->ToString();
+              text.insert(random() % (text.size() + 1), 1,
+                          kCharacters[random() % kCharacters.size()]);
+              contents.set_line(line, std::make_shared<Line>(text));
+            }
+          }
+          CheckMatchesFullParse(
+              parser->FindChildren(contents, contents.range()), contents);
+        }
+      }}});
+
+bool cpp_tree_parser_abort_tests_registration = tests::Register(
+    L"CppTreeParserAbort",
+    {{.name = L"ResumesAfterAbort",
+      .callback =
+          [] {
+            auto parser = NewTestParser();
+            Notification aborted;
+            aborted.Notify();
+            BufferContents contents = TestContents(5000);
+            CHECK(!parser->FindChildrenUnlessAborted(contents, aborted)
+                       .has_value());
+            // After the line at which the parse stopped.
+            contents.insert_line(LineNumber(3000),
+                                 std::make_shared<Line>(L"/* foo"));
+            CHECK(!parser->FindChildrenUnlessAborted(contents, aborted)
+                       .has_value());
+            // Before the line at which the parse stopped.
+            contents.set_line(LineNumber(10), std::make_shared<Line>(L"{"));
+            auto tree =
+                parser->FindChildrenUnlessAborted(contents, Notification());
+            CHECK(tree.has_value());
+            CheckMatchesFullParse(tree.value(), contents);
+            contents.EraseLines(LineNumber(10), LineNumber(11),
+                                BufferContents::CursorsBehavior::kUnmodified);
+            CheckMatchesFullParse(
+                parser->FindChildren(contents, contents.range()), contents);
+          }},
+     {.name = L"ResynchronizesAfterAbort", .callback = [] {
+        auto parser = NewTestParser();
+        Notification aborted;
+        aborted.Notify();
+        BufferContents contents = TestContents(5000);
+        parser->FindChildren(contents, contents.range());
+        std::wstring original_line = contents.at(LineNumber(4))->ToString();
+        // Removing a closing bracket nests the rest of the buffer one level
+        // deeper.
+        contents.set_line(LineNumber(4), std::make_shared<Line>(L""));
+        CHECK(!parser->FindChildrenUnlessAborted(contents, aborted)
+                   .has_value());
+        contents.set_line(LineNumber(4), std::make_shared<Line>(original_line));
+        CheckMatchesFullParse(
+            parser->FindChildrenUnlessAborted(contents, Notification()).value(),
+            contents);
+      }}});
+
+size_t CacheHits() {
+  for (const auto& data : Tracker::GetData()) {
+    if (data.name == L"CppTreeParser::ParseResultsCache::Hit") {
+      return data.executions;
+    }
+  }
+  return 0;
+}
+
+bool parse_results_cache_tests_registration = tests::Register(
+    L"ParseResultsCache",
+    {{.name = L"Bounded",
+      .callback =
+          [] {
+            ParseResultsCache cache;
+            size_t parses = 0;
+            for (size_t i = 0; i < 5 * ParseResultsCache::kGenerationSize;
+                 i++) {
+              cache.Get(i, {0}, [&] {
+                parses++;
+                return ParseResults();
+              });
+              CHECK_LE(cache.size(), 2 * ParseResultsCache::kGenerationSize);
+            }
+            CHECK_EQ(parses, 5 * ParseResultsCache::kGenerationSize);
+          }},
+     {.name = L"KeepsRecentEntries",
+      .callback =
+          [] {
+            ParseResultsCache cache;
+            size_t parses = 0;
+            auto parse = [&] {
+              parses++;
+              return ParseResults();
+            };
+            for (size_t i = 0; i < 4 * ParseResultsCache::kGenerationSize;
+                 i++) {
+              cache.Get(i, {0}, parse);
+              cache.Get(0, {0}, parse);
+            }
+            CHECK_EQ(parses, 4 * ParseResultsCache::kGenerationSize);
+          }},
+     {.name = L"KeyIncludesStates",
+      .callback =
+          [] {
+            ParseResultsCache cache;
+            size_t parses = 0;
+            auto parse = [&] {
+              parses++;
+              return ParseResults();
+            };
+            cache.Get(0, {0}, parse);
+            cache.Get(0, {0, 1}, parse);
+            cache.Get(1, {0}, parse);
+            cache.Get(0, {0, 1}, parse);
+            CHECK_EQ(parses, 3ul);
+          }},
+     {.name = L"HitsForEqualLines", .callback = [] {
+        auto parser = NewTestParser();
+        BufferContents contents = TestContents(100);
+        parser->FindChildren(contents, contents.range());
+        // Different `Line` instances with the same contents.
+        BufferContents copy = TestContents(100);
+        size_t hits = CacheHits();
+        ParseTree tree = parser->FindChildren(copy, copy.range());
+        // All lines but the last one (which is never parsed).
+        CHECK_EQ(CacheHits(), hits + copy.size().line_delta - 1);
+        CheckMatchesFullParse(tree, copy);
+      }}});
+
+bool cpp_tree_parser_benchmark_registration = tests::RegisterBenchmark(
+    L"CppTreeParser::EditLine", [](int elements) {
+      auto parser = NewTestParser();
+      BufferContents contents = TestContents(elements);
+      parser->FindChildren(contents, contents.range());
+      static const int kRuns = 100;
+      auto start = Now();
+      for (int i = 0; i < kRuns; i++) {
+        LineNumber line(random() % elements);
+        contents.set_line(line, std::make_shared<Line>(
+                                    contents.at(line)->ToString() + L"x"));
+        parser->FindChildren(contents, contents.range());
+      }
+      auto end = Now();
+      return SecondsBetween(start, end) / kRuns;
+    });
+
+bool cpp_tree_parser_equal_lines_benchmark_registration =
+    tests::RegisterBenchmark(
+        L"CppTreeParser::ParseEqualLines", [](int elements) {
+          auto parser = NewTestParser();
+          BufferContents contents = TestContents(elements);
+          parser->FindChildren(contents, contents.range());
+          // All lookups will hit the cache.
+          BufferContents copy = TestContents(elements);
+          auto start = Now();
+          parser->FindChildren(copy, copy.range());
+          auto end = Now();
+          return SecondsBetween(start, end) / elements;
+        });
+}  // namespace
+
 }  // namespace editor
 }  // namespace afc
@@ -0,0 +1,406 @@
+#include "src/edit_journal.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <sstream>
+
+#include "src/async_processor.h"
+#include "src/tests/tests.h"
+#include "src/utf8_file_writer.h"
+#include "src/wstring.h"
+
+namespace afc::editor {
+namespace {
+// Records are only compacted once they add up to at least this many bytes, to
+// avoid rewriting small journals too often.
+constexpr size_t kMinimumCompactionSize = 1 << 20;
+
+AsyncEvaluator* JournalEvaluator() {
+  static AsyncEvaluator* output = new AsyncEvaluator(L"EditJournal", nullptr);
+  return output;
+}
+
+// Returns contents with exactly the lines given.
+std::unique_ptr<BufferContents> ContentsFromLines(
+    std::vector<std::shared_ptr<const Line>> lines) {
+  auto output = std::make_unique<BufferContents>();
+  if (lines.empty()) return output;
+  output->set_line(LineNumber(0), std::move(lines.front()));
+  lines.erase(lines.begin());
+  output->append_back(std::move(lines));
+  return output;
+}
+
+void WriteLines(Utf8FileWriter* writer, BufferContents::const_iterator begin,
+                BufferContents::const_iterator end) {
+  for (; begin != end; ++begin) {
+    writer->Write(*(*begin)->contents());
+    writer->Write(L'\n');
+  }
+}
+
+// Returns false if the file ends before `count` complete lines can be read.
+bool ReadLines(std::ifstream& file, size_t count,
+               std::vector<std::shared_ptr<const Line>>* output) {
+  output->reserve(count);
+  std::string line;
+  for (size_t i = 0; i < count; i++) {
+    if (!std::getline(file, line) || file.eof()) return false;
+    output->push_back(std::make_shared<Line>(FromByteString(line)));
+  }
+  return true;
+}
+
+std::wstring FileVersionToString(
+    const std::optional<EditJournal::FileVersion>& version) {
+  if (!version.has_value()) return L"none";
+  return std::to_wstring(version->size) + L" " +
+         std::to_wstring(version->modification_seconds) + L" " +
+         std::to_wstring(version->modification_nanoseconds);
+}
+
+// Returns false if `input` doesn't start with a valid version.
+bool ReadFileVersion(std::istream& input,
+                     std::optional<EditJournal::FileVersion>* output) {
+  std::string token;
+  input >> token;
+  if (input.fail()) return false;
+  if (token == "none") {
+    *output = std::nullopt;
+    return true;
+  }
+  std::istringstream token_stream(token);
+  EditJournal::FileVersion version;
+  token_stream >> version.size;
+  input >> version.modification_seconds >> version.modification_nanoseconds;
+  if (token_stream.fail() || input.fail()) return false;
+  *output = version;
+  return true;
+}
+}  // namespace
+
+/* static */ EditJournal::FileVersion EditJournal::FileVersion::FromStat(
+    const struct stat& stat_buffer) {
+  return FileVersion{.size = stat_buffer.st_size,
+                     .modification_seconds = stat_buffer.st_mtim.tv_sec,
+                     .modification_nanoseconds = stat_buffer.st_mtim.tv_nsec};
+}
+
+bool EditJournal::FileVersion::operator==(const FileVersion& other) const {
+  return size == other.size &&
+         modification_seconds == other.modification_seconds &&
+         modification_nanoseconds == other.modification_nanoseconds;
+}
+
+// Only accessed from the background thread.
+struct EditJournal::Data {
+  Data(std::wstring input_path, std::optional<FileVersion> input_file_version)
+      : path(std::move(input_path)),
+        file_version(std::move(input_file_version)) {}
+  ~Data() { Close(); }
+
+  // Writes a snapshot of `contents` to a temporary file and renames it to
+  // `path`. Subsequent records will be appended to it.
+  void WriteSnapshot(const BufferContents& contents) {
+    const std::wstring tmp_path = path + L".tmp";
+    int new_fd = open(ToByteString(tmp_path).c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (new_fd == -1) return Stop(L"open", errno);
+    auto new_writer = std::make_unique<Utf8FileWriter>(new_fd);
+    new_writer->Write(L"snapshot " +
+                      std::to_wstring(contents.size().line_delta) + L" " +
+                      FileVersionToString(file_version) + L"\n");
+    WriteLines(new_writer.get(), contents.begin(), contents.end());
+    int error = new_writer->Flush();
+    if (error == 0 && rename(ToByteString(tmp_path).c_str(),
+                             ToByteString(path).c_str()) == -1) {
+      error = errno;
+    }
+    if (error != 0) {
+      close(new_fd);
+      unlink(ToByteString(tmp_path).c_str());
+      return Stop(L"snapshot", error);
+    }
+    Close();
+    fd = new_fd;
+    writer = std::move(new_writer);
+    snapshot_size = writer->size();
+  }
+
+  // Appends a record replacing the lines in `previous` that aren't in
+  // `contents`.
+  void Append(const BufferContents& previous, const BufferContents& contents) {
+    if (fd == -1) return;
+    const size_t previous_size = previous.size().line_delta;
+    const size_t size = contents.size().line_delta;
+    const size_t prefix = contents.CommonPrefix(previous).line_delta;
+    if (prefix == previous_size && prefix == size) return;
+    const size_t suffix = std::min(
+        static_cast<size_t>(contents.CommonSuffix(previous).line_delta),
+        std::min(previous_size, size) - prefix);
+
+    writer->Write(L"replace " + std::to_wstring(prefix) + L" " +
+                  std::to_wstring(previous_size - prefix - suffix) + L" " +
+                  std::to_wstring(size - prefix - suffix) + L"\n");
+    WriteLines(writer.get(), contents.IteratorAt(LineNumber(prefix)),
+               contents.IteratorAt(LineNumber(size - suffix)));
+    if (int error = writer->Flush(); error != 0) return Stop(L"write", error);
+    if (writer->size() - snapshot_size >
+        std::max(snapshot_size, kMinimumCompactionSize)) {
+      WriteSnapshot(contents);
+    }
+  }
+
+  void Discard() {
+    Close();
+    unlink(ToByteString(path).c_str());
+  }
+
+  void Stop(std::wstring operation, int error) {
+    LOG(INFO) << "Edit journal: " << path << ": " << operation
+              << " failed: " << strerror(error);
+    Close();
+  }
+
+  void Close() {
+    if (fd == -1) return;
+    close(fd);
+    fd = -1;
+    writer = nullptr;
+  }
+
+  const std::wstring path;
+  const std::optional<FileVersion> file_version;
+  int fd = -1;
+  std::unique_ptr<Utf8FileWriter> writer;
+  // The number of bytes in the last snapshot (which `writer` started with).
+  size_t snapshot_size = 0;
+};
+
+EditJournal::EditJournal(std::wstring path,
+                         std::optional<FileVersion> file_version,
+                         const BufferContents& contents)
+    : data_(std::make_shared<Data>(std::move(path), std::move(file_version))),
+      contents_(contents.copy()) {
+  JournalEvaluator()->RunIgnoringResults(
+      [data = data_, contents = contents_] { data->WriteSnapshot(*contents); });
+}
+
+void EditJournal::Update(const BufferContents& contents) {
+  std::shared_ptr<const BufferContents> previous = std::move(contents_);
+  contents_ = contents.copy();
+  JournalEvaluator()->RunIgnoringResults(
+      [data = data_, previous, contents = contents_] {
+        data->Append(*previous, *contents);
+      });
+}
+
+void EditJournal::Discard() {
+  JournalEvaluator()->RunIgnoringResults([data = data_] { data->Discard(); });
+}
+
+/* static */ ValueOrError<EditJournal::Recovered> EditJournal::Recover(
+    std::wstring path) {
+  std::ifstream file(ToByteString(path), std::ios::binary);
+  if (!file.is_open()) {
+    return Error(L"Unable to open journal: " + path + L": " +
+                 FromByteString(strerror(errno)));
+  }
+  std::unique_ptr<BufferContents> output;
+  std::optional<FileVersion> file_version;
+  std::string header;
+  while (std::getline(file, header) && !file.eof()) {
+    std::istringstream header_stream(header);
+    std::string type;
+    size_t first = 0;
+    size_t removed = 0;
+    size_t inserted = 0;
+    header_stream >> type;
+    bool valid_file_version = true;
+    if (type == "snapshot") {
+      header_stream >> inserted;
+      valid_file_version = ReadFileVersion(header_stream, &file_version);
+    } else if (type == "replace") {
+      header_stream >> first >> removed >> inserted;
+    }
+    if (header_stream.fail() || !valid_file_version ||
+        (type == "replace" && output == nullptr) ||
+        (type != "snapshot" && type != "replace")) {
+      return Error(L"Invalid journal record: " + FromByteString(header));
+    }
+
+    std::vector<std::shared_ptr<const Line>> lines;
+    if (!ReadLines(file, inserted, &lines)) break;  // Incomplete record.
+    if (type == "snapshot") {
+      output = ContentsFromLines(std::move(lines));
+      continue;
+    }
+
+    size_t size = output->size().line_delta;
+    if (first + removed > size) {
+      return Error(L"Journal record out of range: " + FromByteString(header));
+    }
+    if (first < size && !lines.empty()) {
+      output->insert(LineNumber(first), *ContentsFromLines(std::move(lines)),
+                     std::nullopt);
+    } else {
+      output->append_back(std::move(lines));
+    }
+    output->EraseLines(LineNumber(first + inserted),
+                       LineNumber(first + inserted + removed),
+                       BufferContents::CursorsBehavior::kUnmodified);
+  }
+  if (output == nullptr) return Error(L"Journal without snapshot: " + path);
+  return Success(
+      Recovered{.file_version = file_version,
+                .contents = std::shared_ptr<const BufferContents>(
+                    std::move(output))});
+}
+
+namespace {
+// Blocks until the journal has executed all pending operations.
+void WaitForJournal() {
+  auto done = std::make_shared<std::promise<void>>();
+  auto future = done->get_future();
+  JournalEvaluator()->RunIgnoringResults([done] { done->set_value(); });
+  future.wait();
+}
+
+// Runs `callback` with the path to a journal in a temporary directory.
+void WithJournalPath(std::function<void(std::wstring)> callback) {
+  char directory[] = "/tmp/edge-tests-journal-XXXXXX";
+  CHECK(mkdtemp(directory) != nullptr);
+  std::string path = std::string(directory) + "/journal";
+  callback(FromByteString(path));
+  unlink(path.c_str());
+  rmdir(directory);
+}
+
+void CheckRecovers(const std::wstring& path, const BufferContents& contents,
+                   std::optional<EditJournal::FileVersion> file_version =
+                       std::nullopt) {
+  auto recovered = EditJournal::Recover(path);
+  CHECK(!recovered.IsError()) << recovered.error().description;
+  CHECK(recovered.value().contents->ToString() == contents.ToString())
+      << recovered.value().contents->ToString();
+  CHECK(recovered.value().file_version == file_version);
+}
+
+const EditJournal::FileVersion kTestFileVersion = {
+    .size = 1234,
+    .modification_seconds = 1600000000,
+    .modification_nanoseconds = 56789};
+
+bool edit_journal_tests_registration = tests::Register(
+    L"EditJournal",
+    {{.name = L"Snapshot",
+      .callback =
+          [] {
+            WithJournalPath([](std::wstring path) {
+              BufferContents contents;
+              contents.push_back(L"alejandro");
+              contents.push_back(L"ñandú");
+              EditJournal journal(path, std::nullopt, contents);
+              WaitForJournal();
+              CheckRecovers(path, contents);
+            });
+          }},
+     {.name = L"Records",
+      .callback =
+          [] {
+            WithJournalPath([](std::wstring path) {
+              BufferContents contents;
+              for (int i = 0; i < 10; i++) {
+                contents.push_back(L"line " + std::to_wstring(i));
+              }
+              EditJournal journal(path, std::nullopt, contents);
+              contents.insert_line(LineNumber(3),
+                                   std::make_shared<Line>(L"inserted"));
+              journal.Update(contents);
+              contents.EraseLines(LineNumber(0), LineNumber(2),
+                                  BufferContents::CursorsBehavior::kAdjust);
+              journal.Update(contents);
+              contents.SplitLine(LineColumn(LineNumber(5), ColumnNumber(2)));
+              contents.push_back(L"last");
+              journal.Update(contents);
+              journal.Update(contents);  // Nothing changed.
+              contents.EraseLines(LineNumber(0),
+                                  LineNumber(0) + contents.size(),
+                                  BufferContents::CursorsBehavior::kAdjust);
+              journal.Update(contents);
+              contents.AppendToLine(LineNumber(0), Line(L"new"));
+              journal.Update(contents);
+              WaitForJournal();
+              CheckRecovers(path, contents);
+            });
+          }},
+     {.name = L"Compaction",
+      .callback =
+          [] {
+            WithJournalPath([](std::wstring path) {
+              BufferContents contents;
+              contents.push_back(L"short");
+              EditJournal journal(path, kTestFileVersion, contents);
+              size_t records_size = 0;
+              for (int i = 0; i < 3000; i++) {
+                std::wstring line(1000, L'a' + i % 26);
+                contents.set_line(LineNumber(1), std::make_shared<Line>(line));
+                journal.Update(contents);
+                records_size += line.size();
+              }
+              WaitForJournal();
+              struct stat stat_buffer;
+              CHECK_EQ(stat(ToByteString(path).c_str(), &stat_buffer), 0);
+              CHECK_LT(static_cast<size_t>(stat_buffer.st_size), records_size);
+              CheckRecovers(path, contents, kTestFileVersion);
+            });
+          }},
+     {.name = L"FileVersion",
+      .callback =
+          [] {
+            WithJournalPath([](std::wstring path) {
+              BufferContents contents;
+              contents.push_back(L"foo");
+              EditJournal journal(path, kTestFileVersion, contents);
+              WaitForJournal();
+              CheckRecovers(path, contents, kTestFileVersion);
+              struct stat stat_buffer;
+              CHECK_EQ(stat(ToByteString(path).c_str(), &stat_buffer), 0);
+              EditJournal::FileVersion version =
+                  EditJournal::FileVersion::FromStat(stat_buffer);
+              CHECK_EQ(version.size, stat_buffer.st_size);
+              CHECK(!(version == kTestFileVersion));
+              CHECK(version == EditJournal::FileVersion::FromStat(stat_buffer));
+            });
+          }},
+     {.name = L"IncompleteRecord",
+      .callback =
+          [] {
+            WithJournalPath([](std::wstring path) {
+              BufferContents contents;
+              contents.push_back(L"foo");
+              EditJournal journal(path, std::nullopt, contents);
+              WaitForJournal();
+              std::ofstream(ToByteString(path), std::ios::app)
+                  << "replace 0 1 2\nbar\nqu";
+              CheckRecovers(path, contents);
+            });
+          }},
+     {.name = L"Discard", .callback = [] {
+        WithJournalPath([](std::wstring path) {
+          BufferContents contents;
+          EditJournal journal(path, std::nullopt, contents);
+          journal.Discard();
+          WaitForJournal();
+          CHECK(EditJournal::Recover(path).IsError());
+        });
+      }}});
+}  // namespace
+}  // namespace afc::editor
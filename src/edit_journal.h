@@ -0,0 +1,69 @@
+#ifndef __AFC_EDITOR_EDIT_JOURNAL_H__
+#define __AFC_EDITOR_EDIT_JOURNAL_H__
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "src/buffer_contents.h"
+#include "src/value_or_error.h"
+
+namespace afc::editor {
+
+// Append-only journal of the changes to the contents of a buffer, from which
+// they can be recovered (e.g., after a crash).
+//
+// The journal starts with a snapshot of the contents. Each call to `Update`
+// appends a record replacing the range of lines that changed since the previous
+// call (found by comparing the `Line` instances, which unchanged lines keep).
+// Once the records outgrow the snapshot, they are compacted into a new one.
+//
+// Every snapshot records the version of the file (on disk) that the changes
+// apply to, so that they aren't recovered over a different version.
+//
+// All file operations happen in a background thread.
+class EditJournal {
+ public:
+  struct FileVersion {
+    static FileVersion FromStat(const struct stat& stat_buffer);
+
+    bool operator==(const FileVersion& other) const;
+
+    int64_t size = 0;
+    int64_t modification_seconds = 0;
+    int64_t modification_nanoseconds = 0;
+  };
+
+  // Starts a journal at `path` (atomically replacing any previous file) with a
+  // snapshot of `contents`, which are changes to `file_version` (std::nullopt
+  // if the file didn't exist).
+  EditJournal(std::wstring path, std::optional<FileVersion> file_version,
+              const BufferContents& contents);
+
+  void Update(const BufferContents& contents);
+
+  // Stops journaling and deletes the file.
+  void Discard();
+
+  struct Recovered {
+    std::optional<FileVersion> file_version;
+    std::shared_ptr<const BufferContents> contents;
+  };
+
+  // Reads the journal at `path` and returns the contents it describes. If the
+  // journal ends with an incomplete record, ignores it. Blocks on I/O.
+  static ValueOrError<Recovered> Recover(std::wstring path);
+
+ private:
+  struct Data;
+
+  const std::shared_ptr<Data> data_;
+  std::shared_ptr<const BufferContents> contents_;
+};
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_EDIT_JOURNAL_H__
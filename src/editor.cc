@@ -68,13 +68,12 @@ using std::wstring;
 template <typename MethodReturnType>
 void RegisterBufferMethod(ObjectType* editor_type, const wstring& name,
                           MethodReturnType (OpenBuffer::*method)(void)) {
-  auto callback = std::make_unique<Value>(VMType::FUNCTION);
   // Returns nothing.
-  callback->type.type_arguments = {VMType(VMType::VM_VOID),
-                                   VMType::ObjectType(editor_type)};
+  auto callback = std::make_unique<Value>(VMType::Function(
+      {VMType(VMType::VM_VOID), VMType::ObjectType(editor_type)}));
   callback->callback = [method](vector<unique_ptr<Value>> args, Trampoline*) {
     CHECK_EQ(args.size(), size_t(1));
-    CHECK_EQ(args[0]->type, VMType::ObjectType(L"Editor"));
+    CHECK_EQ(args[0]->type(), VMType::ObjectType(L"Editor"));
 
     auto editor = static_cast<EditorState*>(args[0]->user_value.get());
     CHECK(editor != nullptr);
@@ -103,7 +102,13 @@ void EditorState::NotifyInternalEvent() {
 }
 
 // Executes pending work from all buffers.
-void EditorState::ExecutePendingWork() { work_queue_.Execute(); }
+void EditorState::ExecutePendingWork() {
+  if (auto next = work_queue_.NextExecution();
+      next.has_value() && next.value() < Now()) {
+    IncrementDisplayVersion();
+  }
+  work_queue_.Execute();
+}
 
 std::optional<struct timespec> EditorState::WorkQueueNextExecution() const {
   std::optional<struct timespec> output;
@@ -167,8 +172,12 @@ std::shared_ptr<Environment> EditorState::BuildEditorEnvironment() {
   auto editor_type = std::make_unique<ObjectType>(L"Editor");
 
   // Methods for Editor.
-  RegisterVariableFields(editor_variables::BoolStruct(), editor_type.get(),
-                         &EditorState::Read, &EditorState::Set);
+  RegisterVariableFields<EdgeStruct<bool>, bool>(
+      editor_variables::BoolStruct(), editor_type.get(), &EditorState::Read,
+      &EditorState::Set);
+  RegisterVariableFields<EdgeStruct<int>, int>(
+      editor_variables::IntStruct(), editor_type.get(), &EditorState::Read,
+      &EditorState::Set);
   editor_type->AddField(
       L"AddVerticalSplit",
       vm::NewCallback([](EditorState* editor) { editor->AddVerticalSplit(); }));
@@ -386,8 +395,8 @@ std::shared_ptr<Environment> EditorState::BuildEditorEnvironment() {
                           VMType::Function({VMType::Void()})},
                          [this](vector<unique_ptr<Value>> args) {
                            CHECK_EQ(args.size(), 3u);
-                           CHECK_EQ(args[0]->type, VMType::VM_STRING);
-                           CHECK_EQ(args[1]->type, VMType::VM_STRING);
+                           CHECK_EQ(args[0]->type(), VMType::VM_STRING);
+                           CHECK_EQ(args[1]->type(), VMType::VM_STRING);
                            default_commands_->Add(args[0]->str, args[1]->str,
                                                   std::move(args[2]),
                                                   environment_);
@@ -437,6 +446,7 @@ std::pair<int, int> BuildPipe() {
 
 EditorState::EditorState(CommandLineValues args, AudioPlayer* audio_player)
     : bool_variables_(editor_variables::BoolStruct()->NewInstance()),
+      int_variables_(editor_variables::IntStruct()->NewInstance()),
       home_directory_(args.home_directory),
       edge_path_(args.config_paths),
       environment_(BuildEditorEnvironment()),
@@ -451,8 +461,8 @@ EditorState::EditorState(CommandLineValues args, AudioPlayer* audio_player)
   futures::ForEach(paths.begin(), paths.end(), [this](std::wstring dir) {
     auto path = PathJoin(dir, L"hooks/start.cc");
     wstring error_description;
-    std::shared_ptr<Expression> expression =
-        CompileFile(ToByteString(path), environment_, &error_description);
+    std::shared_ptr<Expression> expression = compiled_files_.CompileFile(
+        ToByteString(path), environment_, &error_description);
     if (expression == nullptr) {
       LOG(INFO) << "Compilation error for " << path << ": "
                 << error_description;
@@ -467,7 +477,9 @@ EditorState::EditorState(CommandLineValues args, AudioPlayer* audio_player)
               LOG(INFO) << "Evaluation of file yields: " << path;
               work_queue->Schedule(std::move(resume));
             }),
-        futures::Past(futures::IterationControlCommand::kContinue));
+        [expression](std::unique_ptr<Value>) {
+          return futures::IterationControlCommand::kContinue;
+        });
   });
 }
 
@@ -496,6 +508,14 @@ void EditorState::toggle_bool_variable(const EdgeVariable<bool>* variable) {
                     : !Read(variable));
 }
 
+const int& EditorState::Read(const EdgeVariable<int>* variable) const {
+  return int_variables_.Get(variable);
+}
+
+void EditorState::Set(const EdgeVariable<int>* variable, int value) {
+  int_variables_.Set(variable, value);
+}
+
 void EditorState::CheckPosition() {
   auto buffer = buffer_tree_.GetActiveLeaf()->Lock();
   if (buffer != nullptr) {
@@ -808,6 +828,8 @@ void EditorState::Terminate(TerminationType termination_type, int exit_value) {
 }
 
 void EditorState::ProcessInput(int c) {
+  IncrementDisplayVersion();
+  input_processed_ = true;
   EditorMode* handler = keyboard_redirect().get();
   if (handler != nullptr) {
     // Pass.
@@ -882,6 +904,26 @@ EditorState::ScreenState EditorState::FlushScreenState() {
   return output;
 }
 
+void EditorState::AddDisplayExpiration(struct timespec time) const {
+  std::unique_lock<std::mutex> lock(display_expiration_mutex_);
+  if (!display_expiration_.has_value() || time < display_expiration_.value()) {
+    display_expiration_ = time;
+  }
+}
+
+bool EditorState::FlushInputProcessed() {
+  bool output = input_processed_;
+  input_processed_ = false;
+  return output;
+}
+
+std::optional<struct timespec> EditorState::TakeDisplayExpiration() {
+  std::unique_lock<std::mutex> lock(display_expiration_mutex_);
+  std::optional<struct timespec> output = display_expiration_;
+  display_expiration_ = std::nullopt;
+  return output;
+}
+
 // We will store the positions in a special buffer.  They will be sorted from
 // old (top) to new (bottom), one per line.  Each line will be of the form:
 //
@@ -1011,6 +1053,7 @@ void EditorState::ProcessSignals() {
   if (pending_signals_.empty()) {
     return;
   }
+  IncrementDisplayVersion();
   vector<int> signals;
   signals.swap(pending_signals_);
   for (int signal : signals) {
@@ -1,6 +1,7 @@
 #ifndef __AFC_EDITOR_EDITOR_H__
 #define __AFC_EDITOR_EDITOR_H__
 
+#include <atomic>
 #include <ctime>
 #include <list>
 #include <map>
@@ -55,6 +56,9 @@ class EditorState {
   void Set(const EdgeVariable<bool>* variable, bool value);
   void toggle_bool_variable(const EdgeVariable<bool>* variable);
 
+  const int& Read(const EdgeVariable<int>* variable) const;
+  void Set(const EdgeVariable<int>* variable, int value);
+
   void CheckPosition();
 
   void CloseBuffer(OpenBuffer* buffer);
@@ -182,6 +186,23 @@ class EditorState {
     screen_state_.needs_hard_redraw = value;
   }
 
+  // Incremented whenever something happens that may change what the screen
+  // shows: input is processed, pending work is executed, a buffer reads data,
+  // etc. `Terminal` skips updating screens when this hasn't changed.
+  size_t display_version() const { return display_version_; }
+  void IncrementDisplayVersion() { display_version_++; }
+
+  // Returns true if `ProcessInput` has run (with local input or input from a
+  // remote client) since the last call.
+  bool FlushInputProcessed();
+
+  // Output producers call this when what they generate will change at `time`
+  // even if nothing happens (e.g., a highlight expires). May be called from
+  // any thread.
+  void AddDisplayExpiration(struct timespec time) const;
+  // Returns (and forgets) the earliest time given to `AddDisplayExpiration`.
+  std::optional<struct timespec> TakeDisplayExpiration();
+
   void PushCurrentPosition();
   void PushPosition(LineColumn position);
   std::shared_ptr<OpenBuffer> GetConsole();
@@ -196,6 +217,8 @@ class EditorState {
   const vector<wstring>& edge_path() const { return edge_path_; }
 
   std::shared_ptr<Environment> environment() { return environment_; }
+  // Used to avoid compiling the same files (e.g., hooks) repeatedly.
+  CompiledFilesCache* compiled_files() { return &compiled_files_; }
 
   wstring expand_path(const wstring& path) const;
 
@@ -230,6 +253,7 @@ class EditorState {
   std::shared_ptr<Environment> BuildEditorEnvironment();
 
   EdgeStructInstance<bool> bool_variables_;
+  EdgeStructInstance<int> int_variables_;
 
   map<wstring, shared_ptr<OpenBuffer>> buffers_;
   std::optional<int> exit_value_;
@@ -238,6 +262,7 @@ class EditorState {
   vector<wstring> edge_path_;
 
   const std::shared_ptr<Environment> environment_;
+  CompiledFilesCache compiled_files_;
 
   wstring last_search_query_;
 
@@ -247,6 +272,10 @@ class EditorState {
 
   std::mutex mutex_;
   ScreenState screen_state_;
+  std::atomic<size_t> display_version_ = 0;
+  bool input_processed_ = false;
+  mutable std::mutex display_expiration_mutex_;
+  mutable std::optional<struct timespec> display_expiration_;
 
   // Initially we don't consume SIGINT: we let it crash the process (in case
   // the user has accidentally ran Edge). However, as soon as the user starts
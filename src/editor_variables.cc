@@ -15,4 +15,45 @@ EdgeVariable<bool>* const multiple_buffers =
         .Description(L"Should all visible buffers be considered as active?")
         .Build();
 
+EdgeVariable<bool>* const parallel_line_generation =
+    BoolStruct()
+        ->Add()
+        .Name(L"parallel_line_generation")
+        .Description(
+            L"Should the lines shown in the screen be generated in parallel "
+            L"(in background threads)? This only affects lines that can be "
+            L"generated independently (such as the contents of buffers).")
+        .DefaultValue(true)
+        .Build();
+
+EdgeStruct<int>* IntStruct() {
+  static EdgeStruct<int>* output = new EdgeStruct<int>();
+  return output;
+}
+
+EdgeVariable<int>* const frames_per_second =
+    IntStruct()
+        ->Add()
+        .Name(L"frames_per_second")
+        .Description(
+            L"Maximum number of times per second that the screen is updated. "
+            L"When buffers receive output quickly, updates are coalesced; the "
+            L"rate is also reduced if updating the screen takes a significant "
+            L"fraction of the time. Updates that follow keyboard input aren't "
+            L"delayed. A non-positive value disables the limit.")
+        .DefaultValue(30)
+        .Build();
+
+EdgeVariable<int>* const line_cache_screens =
+    IntStruct()
+        ->Add()
+        .Name(L"line_cache_screens")
+        .Description(
+            L"Size of the cache of lines ready to be drawn on the screen, as a "
+            L"multiple of the number of lines in the screen. Larger values make "
+            L"scrolling back to recently shown lines cheaper, at the cost of "
+            L"memory.")
+        .DefaultValue(20)
+        .Build();
+
 }  // namespace afc::editor::editor_variables
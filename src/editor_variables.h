@@ -8,6 +8,11 @@ namespace afc::editor::editor_variables {
 
 EdgeStruct<bool>* BoolStruct();
 extern EdgeVariable<bool>* const multiple_buffers;
+extern EdgeVariable<bool>* const parallel_line_generation;
+
+EdgeStruct<int>* IntStruct();
+extern EdgeVariable<int>* const frames_per_second;
+extern EdgeVariable<int>* const line_cache_screens;
 
 }  // namespace afc::editor::editor_variables
 
@@ -1,6 +1,10 @@
 #include "src/file_descriptor_reader.h"
 
+#include <langinfo.h>
+
 #include <cctype>
+#include <cstring>
+#include <deque>
 #include <ostream>
 
 #include "src/buffer.h"
@@ -8,11 +12,94 @@
 #include "src/char_buffer.h"
 #include "src/editor.h"
 #include "src/lazy_string.h"
+#include "src/screen_vm.h"
 #include "src/time.h"
 #include "src/tracker.h"
+#include "src/utf8_decoder.h"
 #include "src/wstring.h"
 
 namespace afc::editor {
+namespace {
+// Decodes `input` according to the current locale. For UTF-8 (by far the most
+// common case), uses `DecodeUtf8`; otherwise, falls back to `mbsnrtowcs` (and,
+// if the input isn't valid, to treating each byte as a character).
+DecodedUtf8 DecodeLocaleInput(const char* input, size_t length) {
+  if (strcmp(nl_langinfo(CODESET), "UTF-8") == 0) {
+    return DecodeUtf8(input, length);
+  }
+  DecodedUtf8 output;
+  const char* input_tmp = input;
+  int output_characters = mbsnrtowcs(nullptr, &input_tmp, length, 0, nullptr);
+  if (output_characters == -1) {
+    output.contents.assign(input, input + length);
+    output.bytes_consumed = length;
+  } else {
+    output.contents.resize(output_characters);
+    input_tmp = input;
+    mbsnrtowcs(output.contents.data(), &input_tmp, length,
+               output.contents.size(), nullptr);
+    output.bytes_consumed = input_tmp == nullptr ? length : input_tmp - input;
+  }
+  for (size_t i = 0; i < output.contents.size(); i++) {
+    if (output.contents[i] == L'\n') output.newlines.push_back(i);
+  }
+  return output;
+}
+}  // namespace
+
+// VM code and frames of the binary screen protocol are applied in the order in
+// which they were received: each waits until the evaluation of all the code
+// received before it completes.
+struct FileDescriptorReader::VmInput
+    : public std::enable_shared_from_this<VmInput> {
+  struct Item {
+    enum class Type { kCode, kFrame };
+    Type type;
+    std::string data;
+  };
+
+  explicit VmInput(OpenBuffer* input_buffer) : buffer(input_buffer) {}
+
+  // Applies the items queued, until one needs to wait for an evaluation.
+  void Process() {
+    while (!evaluating && !items.empty()) {
+      Item item = std::move(items.front());
+      items.pop_front();
+      switch (item.type) {
+        case Item::Type::kFrame:
+          if (auto result =
+                  decoder.Apply(item.data, ScreenFrameCallbacks(buffer));
+              result.IsError()) {
+            LOG(INFO) << "Invalid frame: " << result.error().description;
+          }
+          break;
+        case Item::Type::kCode: {
+          std::wstring code = FromByteString(item.data);
+          LOG(INFO) << buffer->Read(buffer_variables::name)
+                    << ": Evaluating VM code: " << code;
+          auto value = buffer->EvaluateString(code);
+          if (!value.has_value() || value->Get().has_value()) break;
+          evaluating = true;
+          value->SetConsumer([weak_this = weak_from_this()](
+                                 std::unique_ptr<vm::Value>) {
+            if (auto shared_this = weak_this.lock(); shared_this != nullptr) {
+              shared_this->evaluating = false;
+              shared_this->Process();
+            }
+          });
+          break;
+        }
+      }
+    }
+  }
+
+  OpenBuffer* const buffer;
+  std::deque<Item> items;
+  // Is the evaluation of code (popped from `items`) still running?
+  bool evaluating = false;
+  // Remembers the lines that the server has sent.
+  screen_protocol::Decoder decoder;
+};
 
 FileDescriptorReader::FileDescriptorReader(Options options)
     : options_(std::make_shared<Options>(std::move(options))) {
@@ -65,40 +152,47 @@ FileDescriptorReader::ReadData() {
   }
   low_buffer_length_ += characters_read;
 
+  size_t text_length = low_buffer_length_;
+  size_t queued_text_length = 0;
+  if (options_->buffer->Read(buffer_variables::vm_exec)) {
+    text_length = QueueScreenFrames(&queued_text_length);
+    if (text_length == 0) {
+      vm_input_->Process();
+      if (low_buffer_length_ == 0) low_buffer_ = nullptr;
+      clock_gettime(0, &last_input_received_);
+      options_->buffer->RegisterProgress();
+      return futures::Past(ReadResult::kContinue);
+    }
+  }
+
   static Tracker chars_tracker(
       L"FileDescriptorReader::ReadData::UnicodeConversion");
   auto chars_tracker_call = chars_tracker.Call();
 
-  const char* low_buffer_tmp = low_buffer_.get();
-  int output_characters =
-      mbsnrtowcs(nullptr, &low_buffer_tmp, low_buffer_length_, 0, nullptr);
-  std::vector<wchar_t> buffer(output_characters == -1 ? low_buffer_length_
-                                                      : output_characters);
-
-  low_buffer_tmp = low_buffer_.get();
-  if (output_characters == -1) {
-    low_buffer_tmp = nullptr;
-    for (size_t i = 0; i < low_buffer_length_; i++) {
-      buffer[i] = static_cast<wchar_t>(*(low_buffer_.get() + i));
-    }
-  } else {
-    mbsnrtowcs(&buffer[0], &low_buffer_tmp, low_buffer_length_, buffer.size(),
-               nullptr);
-  }
+  DecodedUtf8 decoded = DecodeLocaleInput(low_buffer_.get(), text_length);
 
   chars_tracker_call = nullptr;
 
-  shared_ptr<LazyString> buffer_wrapper(NewLazyString(std::move(buffer)));
+  shared_ptr<LazyString> buffer_wrapper(
+      NewLazyString(std::move(decoded.contents)));
   VLOG(5) << "Input: [" << buffer_wrapper->ToString() << "]";
 
-  size_t processed = low_buffer_tmp == nullptr
-                         ? low_buffer_length_
-                         : low_buffer_tmp - low_buffer_.get();
+  // The text before a frame was already queued (even if it ended with an
+  // incomplete character).
+  size_t processed = std::max(decoded.bytes_consumed, queued_text_length);
   VLOG(5) << options_->buffer->Read(buffer_variables::name)
           << ": Characters consumed: " << processed
           << ", produced: " << buffer_wrapper->size();
   CHECK_LE(processed, low_buffer_length_);
-  memmove(low_buffer_.get(), low_buffer_tmp, low_buffer_length_ - processed);
+  if (options_->buffer->Read(buffer_variables::vm_exec) &&
+      processed > queued_text_length) {
+    vm_input_->items.push_back(
+        {.type = VmInput::Item::Type::kCode,
+         .data = std::string(low_buffer_.get() + queued_text_length,
+                             processed - queued_text_length)});
+  }
+  memmove(low_buffer_.get(), low_buffer_.get() + processed,
+          low_buffer_length_ - processed);
   low_buffer_length_ -= processed;
   if (low_buffer_length_ == 0) {
     LOG(INFO) << "Consumed all input.";
@@ -106,16 +200,15 @@ FileDescriptorReader::ReadData() {
   }
 
   if (options_->buffer->Read(buffer_variables::vm_exec)) {
-    LOG(INFO) << options_->buffer->Read(buffer_variables::name)
-              << ": Evaluating VM code: " << buffer_wrapper->ToString();
-    options_->buffer->EvaluateString(buffer_wrapper->ToString());
+    vm_input_->Process();
   }
 
   clock_gettime(0, &last_input_received_);
   options_->buffer->RegisterProgress();
   if (options_->terminal == nullptr) {
     state_ = State::kParsing;
-    return futures::Transform(ParseAndInsertLines(buffer_wrapper),
+    return futures::Transform(ParseAndInsertLines(buffer_wrapper,
+                                                  std::move(decoded.newlines)),
                               [this](bool) {
                                 state_ = State::kIdle;
                                 return ReadResult::kContinue;
@@ -127,26 +220,72 @@ FileDescriptorReader::ReadData() {
   return futures::Past(ReadResult::kContinue);
 }
 
+size_t FileDescriptorReader::QueueScreenFrames(size_t* queued_text_length) {
+  if (vm_input_ == nullptr) {
+    vm_input_ = std::make_shared<VmInput>(options_->buffer);
+  }
+  char* start = low_buffer_.get();
+  if (memchr(start, screen_protocol::kFrameMarker, low_buffer_length_) ==
+      nullptr) {
+    return low_buffer_length_;
+  }
+
+  static Tracker tracker(L"FileDescriptorReader::QueueScreenFrames");
+  auto tracker_call = tracker.Call();
+  std::string text;
+  std::string_view input(start, low_buffer_length_);
+  while (!input.empty()) {
+    size_t marker = input.find(screen_protocol::kFrameMarker);
+    text += input.substr(0, marker);
+    if (marker == std::string_view::npos) {
+      input = {};
+      break;
+    }
+    std::string_view frame_start = input.substr(marker);
+    auto payload = screen_protocol::ReadFrame(&frame_start);
+    if (!payload.has_value()) {
+      input.remove_prefix(marker);
+      break;  // Incomplete; we'll get the rest later.
+    }
+    if (text.size() > *queued_text_length) {
+      vm_input_->items.push_back(
+          {.type = VmInput::Item::Type::kCode,
+           .data = text.substr(*queued_text_length)});
+      *queued_text_length = text.size();
+    }
+    vm_input_->items.push_back({.type = VmInput::Item::Type::kFrame,
+                                .data = std::string(payload.value())});
+    input = frame_start;
+  }
+
+  // Retain the input that follows an incomplete frame.
+  size_t text_length = text.size();
+  text += input;
+  memcpy(start, text.data(), text.size());
+  low_buffer_length_ = text.size();
+  return text_length;
+}
+
 std::vector<std::shared_ptr<Line>> CreateLineInstances(
-    std::shared_ptr<LazyString> contents, const LineModifierSet& modifiers) {
+    std::shared_ptr<LazyString> contents, const std::vector<size_t>& newlines,
+    const LineModifierSet& modifiers) {
   static Tracker tracker(L"FileDescriptorReader::CreateLineInstances");
   auto tracker_call = tracker.Call();
 
   std::vector<std::shared_ptr<Line>> lines_to_insert;
+  lines_to_insert.reserve(newlines.size() + 1);
   ColumnNumber line_start;
-  for (ColumnNumber i; i.ToDelta() < ColumnNumberDelta(contents->size()); i++) {
-    if (contents->get(i) == '\n') {
-      VLOG(8) << "Adding line from " << line_start << " to " << i;
-
-      Line::Options line_options;
-      line_options.contents =
-          Substring(contents, line_start, ColumnNumber(i) - line_start);
-      line_options.modifiers[ColumnNumber(0)] = modifiers;
-      lines_to_insert.emplace_back(
-          std::make_shared<Line>(std::move(line_options)));
-
-      line_start = ColumnNumber(i) + ColumnNumberDelta(1);
-    }
+  for (size_t newline : newlines) {
+    ColumnNumber i(newline);
+    VLOG(8) << "Adding line from " << line_start << " to " << i;
+
+    Line::Options line_options;
+    line_options.contents = Substring(contents, line_start, i - line_start);
+    line_options.modifiers[ColumnNumber(0)] = modifiers;
+    lines_to_insert.emplace_back(
+        std::make_shared<Line>(std::move(line_options)));
+
+    line_start = i + ColumnNumberDelta(1);
   }
 
   VLOG(8) << "Adding last line from " << line_start << " to "
@@ -168,26 +307,23 @@ void InsertLines(const FileDescriptorReader::Options& options,
 
   auto follower = options.buffer->GetEndPositionFollower();
 
-  for (auto it = lines_to_insert.begin(); it != lines_to_insert.end(); ++it) {
-    if (it == lines_to_insert.begin()) {
-      options.buffer->AppendToLastLine(std::move(**it));
-    } else {
-      options.buffer->StartNewLine(std::move(*it));
-    }
-  }
+  CHECK(!lines_to_insert.empty());
+  options.buffer->AppendToLastLine(std::move(*lines_to_insert.front()));
+  options.buffer->AppendLines(std::vector<std::shared_ptr<const Line>>(
+      lines_to_insert.begin() + 1, lines_to_insert.end()));
 }
 
 futures::Value<bool> FileDescriptorReader::ParseAndInsertLines(
-    std::shared_ptr<LazyString> contents) {
+    std::shared_ptr<LazyString> contents, std::vector<size_t> newlines) {
   return futures::Transform(
       options_->read_evaluator->Run(
           // TODO: Find a way to remove the `std::function`, letting the read
           // evaluator somehow detect the return type. Not sure why it doesn't
           // work.
           std::function<std::vector<std::shared_ptr<Line>>()>(
-              [modifiers = options_->modifiers,
-               contents = std::move(contents)]() mutable {
-                return CreateLineInstances(std::move(contents),
+              [modifiers = options_->modifiers, contents = std::move(contents),
+               newlines = std::move(newlines)]() mutable {
+                return CreateLineInstances(std::move(contents), newlines,
                                            std::move(modifiers));
               })),
       [options = options_, lines_read_rate = lines_read_rate_](
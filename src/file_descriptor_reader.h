@@ -14,6 +14,7 @@
 #include "src/lazy_string.h"
 #include "src/line_column.h"
 #include "src/line_modifier.h"
+#include "src/screen_protocol.h"
 
 namespace afc {
 namespace editor {
@@ -64,8 +65,17 @@ class FileDescriptorReader {
   futures::Value<ReadResult> ReadData();
 
  private:
-  futures::Value<bool> ParseAndInsertLines(
-      std::shared_ptr<LazyString> contents);
+  // Only used for buffers that execute the input they receive (`vm_exec`).
+  // Removes from `low_buffer_` all the complete frames of the binary screen
+  // protocol, queueing them in `vm_input_` after the text (VM code) that
+  // precedes each. Returns the number of bytes of text at the start of
+  // `low_buffer_`, which may be followed by an incomplete frame. Sets
+  // `queued_text_length` to the number of those bytes that were queued.
+  size_t QueueScreenFrames(size_t* queued_text_length);
+
+  // `newlines` contains the positions in `contents` of all '\n' characters.
+  futures::Value<bool> ParseAndInsertLines(std::shared_ptr<LazyString> contents,
+                                           std::vector<size_t> newlines);
 
   const std::shared_ptr<const Options> options_;
 
@@ -78,6 +88,10 @@ class FileDescriptorReader {
   std::unique_ptr<char[]> low_buffer_;
   size_t low_buffer_length_ = 0;
 
+  // Input for `vm_exec` buffers, applied in the order in which it was read.
+  struct VmInput;
+  std::shared_ptr<VmInput> vm_input_;
+
   mutable struct timespec last_input_received_ = {0, 0};
 
   const std::shared_ptr<DecayingCounter> lines_read_rate_ =
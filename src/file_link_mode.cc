@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <fstream>
 #include <memory>
 #include <regex>
 #include <stdexcept>
@@ -28,9 +29,14 @@ extern "C" {
 #include "src/file_system_driver.h"
 #include "src/lazy_string_append.h"
 #include "src/line_prompt_mode.h"
+#include "src/mapped_file.h"
 #include "src/run_command_handler.h"
 #include "src/search_handler.h"
 #include "src/server.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
+#include "src/utf8_file_writer.h"
 #include "src/vm/public/callbacks.h"
 #include "src/vm/public/value.h"
 #include "src/wstring.h"
@@ -190,6 +196,38 @@ futures::Value<PossibleError> GenerateContents(
         }
         *stat_buffer = stat_results.value();
 
+        if (S_ISREG(stat_buffer->st_mode) &&
+            target->Read(buffer_variables::mmap_threshold) >= 0 &&
+            stat_buffer->st_size >=
+                target->Read(buffer_variables::mmap_threshold)) {
+          return futures::Transform(
+              file_system_driver->Open(path, O_RDONLY, 0),
+              [background_directory_reader](int fd) {
+                return background_directory_reader->Run(
+                    [fd]() -> ValueOrError<
+                               std::vector<std::shared_ptr<const Line>>> {
+                      auto contents = ReadMappedFileLines(fd);
+                      if (contents.IsError()) return contents.error();
+                      std::vector<std::shared_ptr<const Line>> lines;
+                      lines.reserve(contents.value().size());
+                      for (auto& line : contents.value()) {
+                        lines.push_back(std::make_shared<Line>(
+                            Line::Options(std::move(line))));
+                      }
+                      return Success(std::move(lines));
+                    });
+              },
+              [target](std::vector<std::shared_ptr<const Line>> lines) {
+                auto disk_state_freezer = target->FreezeDiskState();
+                auto follower = target->GetEndPositionFollower();
+                CHECK(!lines.empty());
+                target->AppendToLastLine(lines.front()->contents());
+                lines.erase(lines.begin());
+                target->AppendLines(std::move(lines));
+                return Success();
+              });
+        }
+
         if (!S_ISDIR(stat_buffer->st_mode)) {
           return futures::Transform(
               file_system_driver->Open(path, O_RDONLY | O_NONBLOCK, 0),
@@ -270,57 +308,40 @@ futures::Value<PossibleError> Save(
   }
   auto path = path_or_error.value();
   if (S_ISDIR(stat_buffer->st_mode)) {
-    return options.save_type == OpenBuffer::Options::SaveType::kBackup
-               ? futures::Past(Success())
-               : futures::Past(PossibleError(
-                     Error(L"Buffer can't be saved: Buffer is a directory.")));
-  }
-
-  switch (options.save_type) {
-    case OpenBuffer::Options::SaveType::kMainFile:
-      break;
-    case OpenBuffer::Options::SaveType::kBackup:
-      auto state_directory = buffer->GetEdgeStateDirectory();
-      if (state_directory.IsError()) {
-        return futures::Past(PossibleError(Error::Augment(
-            L"Unable to backup buffer: ", state_directory.error())));
-      }
-      path = Path::Join(state_directory.value(),
-                        PathComponent::FromString(L"backup").value());
+    return futures::Past(PossibleError(
+        Error(L"Buffer can't be saved: Buffer is a directory.")));
   }
 
   return futures::Transform(
-      SaveContentsToFile(path.ToString(), *buffer->contents(),
-                         buffer->work_queue()),
+      SaveContentsToFile(
+          path.ToString(), *buffer->contents(),
+          SaveDurabilityFromString(
+              buffer->Read(buffer_variables::save_durability)),
+          buffer->work_queue()),
       [buffer](EmptyValue) { return buffer->PersistState(); },
-      [editor_state, stat_buffer, options, buffer, path](EmptyValue) {
-        switch (options.save_type) {
-          case OpenBuffer::Options::SaveType::kMainFile:
-            buffer->status()->SetInformationText(L"🖫 Saved: " +
-                                                 path.ToString());
-            // TODO(easy): Move this to the caller, for symmetry with
-            // kBackup case.
-            buffer->SetDiskState(OpenBuffer::DiskState::kCurrent);
-            for (const auto& dir : editor_state->edge_path()) {
-              buffer->EvaluateFile(dir + L"/hooks/buffer-save.cc");
-            }
-            if (buffer->Read(
-                    buffer_variables::trigger_reload_on_buffer_write)) {
-              for (auto& it : *editor_state->buffers()) {
-                CHECK(it.second != nullptr);
-                if (it.second->Read(buffer_variables::reload_on_buffer_write)) {
-                  LOG(INFO) << "Write of " << path << " triggers reload: "
-                            << it.second->Read(buffer_variables::name);
-                  it.second->Reload();
-                }
-              }
+      [editor_state, stat_buffer, buffer, path](EmptyValue) {
+        buffer->status()->SetInformationText(L"🖫 Saved: " + path.ToString());
+        // TODO(easy): Move this to the caller.
+        buffer->SetDiskState(OpenBuffer::DiskState::kCurrent);
+        for (const auto& dir : editor_state->edge_path()) {
+          buffer->EvaluateFile(dir + L"/hooks/buffer-save.cc");
+        }
+        if (buffer->Read(buffer_variables::trigger_reload_on_buffer_write)) {
+          for (auto& it : *editor_state->buffers()) {
+            CHECK(it.second != nullptr);
+            if (it.second->Read(buffer_variables::reload_on_buffer_write)) {
+              LOG(INFO) << "Write of " << path << " triggers reload: "
+                        << it.second->Read(buffer_variables::name);
+              it.second->Reload();
             }
-            stat(ToByteString(path.ToString()).c_str(), stat_buffer);
-            break;
-          case OpenBuffer::Options::SaveType::kBackup:
-            break;
+          }
         }
-        return futures::Past(Success());
+        return futures::IgnoreErrors(futures::Transform(
+            buffer->file_system_driver()->Stat(path.ToString()),
+            [stat_buffer](struct stat stat_results) {
+              *stat_buffer = stat_results;
+              return Success();
+            }));
       });
 }
 
@@ -340,28 +361,116 @@ static bool CanStatPath(const wstring& path) {
 
 using std::unique_ptr;
 
+namespace {
+PossibleError WriteContents(const wstring& path, int fd,
+                            const BufferContents& contents) {
+  Utf8FileWriter writer(fd);
+  contents.EveryLine([&writer](LineNumber position, const Line& line) {
+    if (position > LineNumber(0)) writer.Write(L'\n');
+    writer.Write(*line.contents());
+    return writer.error() == 0;
+  });
+  if (int error = writer.Flush(); error != 0) {
+    return Error(path + L": write failed: " + std::to_wstring(fd) + L": " +
+                 FromByteString(strerror(error)));
+  }
+  return Success();
+}
+
+bool contents_tests_registration = tests::Register(
+    L"WriteContents",
+    {{.name = L"Encoding",
+      .callback =
+          [] {
+            char path[] = "/tmp/edge-tests-XXXXXX";
+            int fd = mkstemp(path);
+            CHECK_NE(fd, -1);
+            BufferContents contents;
+            contents.push_back(L"abc");
+            contents.push_back(L"");
+            contents.push_back(L"ñandú ≠ 𝄞");
+            contents.push_back(std::wstring(1, static_cast<wchar_t>(0xD800)));
+            CHECK(!WriteContents(FromByteString(path), fd, contents).IsError());
+            close(fd);
+            std::ifstream file(path, std::ios::binary);
+            std::string output((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+            unlink(path);
+            // BufferContents starts with an empty line.
+            CHECK_EQ(output,
+                     "\nabc\n\n\xC3\xB1\x61nd\xC3\xBA \xE2\x89\xA0 "
+                     "\xF0\x9D\x84\x9E\n\xEF\xBF\xBD");
+          }},
+     {.name = L"LargerThanBuffer", .callback = [] {
+        char path[] = "/tmp/edge-tests-XXXXXX";
+        int fd = mkstemp(path);
+        CHECK_NE(fd, -1);
+        BufferContents contents;
+        for (int i = 0; i < 100000; i++) {
+          contents.push_back(std::wstring(20, L'λ'));
+        }
+        CHECK(!WriteContents(FromByteString(path), fd, contents).IsError());
+        close(fd);
+        struct stat stat_buffer;
+        CHECK_EQ(stat(path, &stat_buffer), 0);
+        unlink(path);
+        CHECK_EQ(stat_buffer.st_size, 100000 * (20 * 2 + 1));
+      }}});
+
+bool save_benchmark_registration =
+    tests::RegisterBenchmark(L"SaveContentsToFile", [](int elements) {
+      char path[] = "/tmp/edge-benchmark-XXXXXX";
+      int fd = mkstemp(path);
+      CHECK_NE(fd, -1);
+      BufferContents contents;
+      for (int i = 0; i < elements; i++) {
+        contents.push_back(L"    output->push_back(" + std::to_wstring(i) +
+                           L"); // Some text to write to the file: ñandú.");
+      }
+      auto start = Now();
+      CHECK(!WriteContents(FromByteString(path), fd, contents).IsError());
+      double output = SecondsBetween(start, Now()) / elements;
+      close(fd);
+      unlink(path);
+      return output;
+    });
+
+futures::Value<PossibleError> SyncDirectoryIfNeeded(
+    const wstring& path, SaveDurability durability,
+    std::shared_ptr<FileSystemDriver> file_system_driver) {
+  if (durability != SaveDurability::kDirectory) {
+    return futures::Past(Success());
+  }
+  wstring directory = Dirname(path);
+  return file_system_driver->SyncDirectory(directory.empty() ? L"."
+                                                             : directory);
+}
+}  // namespace
+
+SaveDurability SaveDurabilityFromString(const wstring& value) {
+  if (value == L"data") return SaveDurability::kFileData;
+  if (value == L"directory") return SaveDurability::kDirectory;
+  if (value != L"none") {
+    LOG(INFO) << "Unknown value for save_durability: " << value;
+  }
+  return SaveDurability::kNone;
+}
+
 // Always returns an actual value.
 futures::Value<PossibleError> SaveContentsToOpenFile(
     WorkQueue* work_queue, const wstring& path, int fd,
-    const BufferContents& contents) {
+    const BufferContents& contents, SaveDurability durability) {
   auto contents_writer =
       std::make_shared<AsyncEvaluator>(L"SaveContentsToOpenFile", work_queue);
   return futures::Transform(
-      contents_writer->Run([contents, path, fd]() {
-        // TODO: It'd be significant more efficient to do fewer (bigger)
-        // writes.
-        std::optional<PossibleError> error;
-        contents.EveryLine([&](LineNumber position, const Line& line) {
-          string str = (position == LineNumber(0) ? "" : "\n") +
-                       ToByteString(line.ToString());
-          if (write(fd, str.c_str(), str.size()) == -1) {
-            error = Error(path + L": write failed: " + std::to_wstring(fd) +
-                          L": " + FromByteString(strerror(errno)));
-            return false;
-          }
-          return true;
-        });
-        return error.value_or(Success());
+      contents_writer->Run([contents, path, fd, durability]() -> PossibleError {
+        auto output = WriteContents(path, fd, contents);
+        if (!output.IsError() && durability != SaveDurability::kNone &&
+            fdatasync(fd) == -1) {
+          return Error(path + L": fdatasync failed: " +
+                       FromByteString(strerror(errno)));
+        }
+        return output;
       }),
       // Ensure that `contents_writer` survives the future.
       //
@@ -372,6 +481,7 @@ futures::Value<PossibleError> SaveContentsToOpenFile(
 
 futures::Value<PossibleError> SaveContentsToFile(const wstring& path,
                                                  const BufferContents& contents,
+                                                 SaveDurability durability,
                                                  WorkQueue* work_queue) {
   auto file_system_driver = std::make_shared<FileSystemDriver>(work_queue);
   const wstring tmp_path = path + L".tmp";
@@ -392,10 +502,12 @@ futures::Value<PossibleError> SaveContentsToFile(const wstring& path,
         return file_system_driver->Open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC,
                                         stat_value.st_mode);
       },
-      [path, contents, work_queue, tmp_path, file_system_driver](int fd) {
+      [path, contents, durability, work_queue, tmp_path,
+       file_system_driver](int fd) {
         CHECK_NE(fd, -1);
         return futures::Transform(
-            OnError(SaveContentsToOpenFile(work_queue, tmp_path, fd, contents),
+            OnError(SaveContentsToOpenFile(work_queue, tmp_path, fd, contents,
+                                           durability),
                     [file_system_driver, fd](Error error) {
                       file_system_driver->Close(fd);
                       return error;
@@ -405,6 +517,10 @@ futures::Value<PossibleError> SaveContentsToFile(const wstring& path,
             },
             [path, file_system_driver, tmp_path](EmptyValue) {
               return file_system_driver->Rename(tmp_path, path);
+            },
+            [path, durability, file_system_driver](EmptyValue) {
+              return SyncDirectoryIfNeeded(path, durability,
+                                           file_system_driver);
             });
       });
 }
@@ -17,9 +17,25 @@ namespace editor {
 using std::string;
 using std::unique_ptr;
 
+// How much effort `SaveContentsToFile` should make to ensure that the contents
+// survive a crash once the returned future has been notified.
+enum class SaveDurability {
+  // Don't sync anything; leave it to the kernel.
+  kNone,
+  // Sync the data of the temporary file before renaming it.
+  kFileData,
+  // Like kFileData, but also sync the directory after the rename.
+  kDirectory
+};
+
+// Parses the value of buffer_variables::save_durability. Unknown values are
+// treated as kNone.
+SaveDurability SaveDurabilityFromString(const wstring& value);
+
 // Saves the contents of the buffer to the path given.
 futures::Value<PossibleError> SaveContentsToFile(const wstring& path,
                                                  const BufferContents& contents,
+                                                 SaveDurability durability,
                                                  WorkQueue* work_queue);
 
 struct OpenFileOptions {
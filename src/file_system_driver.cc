@@ -53,4 +53,19 @@ futures::Value<PossibleError> FileSystemDriver::Rename(std::wstring oldpath,
   });
 }
 
+futures::Value<PossibleError> FileSystemDriver::SyncDirectory(
+    std::wstring path) {
+  return evaluator_.Run([path = std::move(path)]() -> PossibleError {
+    int fd = open(ToByteString(path).c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+      return Error(L"SyncDirectory: Open failed: `" + path + L"`: " +
+                   FromByteString(strerror(errno)));
+    }
+    PossibleError output =
+        SyscallReturnValue(L"SyncDirectory: " + path, fsync(fd));
+    close(fd);
+    return output;
+  });
+}
+
 }  // namespace afc::editor
@@ -37,6 +37,9 @@ class FileSystemDriver {
   futures::Value<ValueOrError<struct stat>> Stat(std::wstring path);
   futures::Value<PossibleError> Rename(std::wstring oldpath,
                                        std::wstring newpath);
+  // Flushes the directory entries of `path` (e.g., after a `Rename` of a file
+  // inside it) to the underlying device.
+  futures::Value<PossibleError> SyncDirectory(std::wstring path);
 
  private:
   AsyncEvaluator evaluator_;
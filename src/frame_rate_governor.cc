@@ -0,0 +1,148 @@
+#include "src/frame_rate_governor.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "src/tests/tests.h"
+#include "src/time.h"
+
+namespace afc::editor {
+namespace {
+// Even if updating the screen is very slow, we update it at least this often,
+// so that it still looks live.
+constexpr double kMaxSecondsBetweenDisplays = 1.0;
+
+// Weight of the last update in `average_display_seconds_`.
+constexpr double kDisplaySecondsDecay = 0.2;
+
+// Updates this close to `NextDisplay` aren't deferred. Otherwise, rounding
+// errors could cause us to wake up at `NextDisplay` only to defer the update
+// again (by a tiny amount).
+constexpr double kToleranceSeconds = 0.001;
+}  // namespace
+
+FrameRateGovernor::FrameRateGovernor(
+    std::function<Tracker::Data()> display_tracker_data)
+    : display_tracker_data_(std::move(display_tracker_data)),
+      tracker_seconds_(display_tracker_data_().seconds) {}
+
+bool FrameRateGovernor::ShouldDisplay(struct timespec now, bool urgent) {
+  if (urgent || !last_display_.has_value() ||
+      SecondsBetween(last_display_.value(), now) >=
+          MinSecondsBetweenDisplays() - kToleranceSeconds) {
+    last_display_ = now;
+    deferred_display_ = false;
+    return true;
+  }
+  VLOG(6) << "Deferring screen update.";
+  deferred_display_ = true;
+  return false;
+}
+
+void FrameRateGovernor::RegisterDisplay() {
+  double tracker_seconds = display_tracker_data_().seconds;
+  double seconds = tracker_seconds - tracker_seconds_;
+  tracker_seconds_ = tracker_seconds;
+  average_display_seconds_ = kDisplaySecondsDecay * seconds +
+                             (1 - kDisplaySecondsDecay) *
+                                 average_display_seconds_;
+}
+
+std::optional<struct timespec> FrameRateGovernor::NextDisplay() const {
+  if (!deferred_display_) return std::nullopt;
+  CHECK(last_display_.has_value());
+  return AddSeconds(last_display_.value(), MinSecondsBetweenDisplays());
+}
+
+double FrameRateGovernor::MinSecondsBetweenDisplays() const {
+  double output = average_display_seconds_ / kMaxDisplayLoad;
+  if (max_frames_per_second_ > 0) {
+    output = std::max(output, 1.0 / max_frames_per_second_);
+  }
+  return std::min(output, kMaxSecondsBetweenDisplays);
+}
+
+namespace {
+// Returns a governor that measures updates through `display_seconds`.
+FrameRateGovernor NewTestGovernor(const double* display_seconds) {
+  return FrameRateGovernor([display_seconds] {
+    return Tracker::Data{.name = L"Display", .seconds = *display_seconds};
+  });
+}
+
+class FrameRateGovernorTests : public tests::TestGroup<FrameRateGovernorTests> {
+ public:
+  FrameRateGovernorTests() : TestGroup<FrameRateGovernorTests>() {}
+  std::wstring Name() const override { return L"FrameRateGovernorTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {
+        {.name = L"CoalescesUpdates",
+         .callback =
+             [] {
+               double display_seconds = 0;
+               FrameRateGovernor governor = NewTestGovernor(&display_seconds);
+               governor.set_max_frames_per_second(10);
+               struct timespec start = Now();
+               CHECK(governor.ShouldDisplay(start, false));
+               CHECK(!governor.NextDisplay().has_value());
+               CHECK(!governor.ShouldDisplay(AddSeconds(start, 0.05), false));
+               CHECK(governor.NextDisplay().has_value());
+               CHECK_NEAR(SecondsBetween(start, governor.NextDisplay().value()),
+                          0.1, 1e-6);
+               CHECK(!governor.ShouldDisplay(AddSeconds(start, 0.09), false));
+               CHECK(governor.ShouldDisplay(AddSeconds(start, 0.1), false));
+               CHECK(!governor.NextDisplay().has_value());
+             }},
+        {.name = L"UrgentUpdates",
+         .callback =
+             [] {
+               double display_seconds = 0;
+               FrameRateGovernor governor = NewTestGovernor(&display_seconds);
+               governor.set_max_frames_per_second(10);
+               struct timespec start = Now();
+               CHECK(governor.ShouldDisplay(start, false));
+               CHECK(governor.ShouldDisplay(AddSeconds(start, 0.01), true));
+               CHECK(!governor.ShouldDisplay(AddSeconds(start, 0.1), false));
+             }},
+        {.name = L"Unlimited",
+         .callback =
+             [] {
+               double display_seconds = 0;
+               FrameRateGovernor governor = NewTestGovernor(&display_seconds);
+               governor.set_max_frames_per_second(0);
+               struct timespec start = Now();
+               for (int i = 0; i < 10; i++) {
+                 CHECK(governor.ShouldDisplay(start, false));
+               }
+             }},
+        {.name = L"SlowUpdates", .callback = [] {
+           double display_seconds = 0;
+           FrameRateGovernor governor = NewTestGovernor(&display_seconds);
+           governor.set_max_frames_per_second(100);
+           struct timespec time = Now();
+           for (int i = 0; i < 100; i++) {
+             time = AddSeconds(time, 1.0);
+             CHECK(governor.ShouldDisplay(time, false));
+             display_seconds += 0.1;
+             governor.RegisterDisplay();
+           }
+           CHECK(!governor.ShouldDisplay(AddSeconds(time, 0.3), false));
+           CHECK(governor.ShouldDisplay(AddSeconds(time, 0.41), false));
+           // Extremely slow updates still happen every second.
+           for (int i = 0; i < 100; i++) {
+             time = AddSeconds(time, 10.0);
+             CHECK(governor.ShouldDisplay(time, false));
+             display_seconds += 5;
+             governor.RegisterDisplay();
+           }
+           CHECK(governor.ShouldDisplay(AddSeconds(time, 1.0), false));
+         }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<FrameRateGovernorTests>::registration_ =
+    tests::Add<editor::FrameRateGovernorTests>();
+}  // namespace
+}  // namespace afc::editor
@@ -0,0 +1,66 @@
+#ifndef __AFC_EDITOR_FRAME_RATE_GOVERNOR_H__
+#define __AFC_EDITOR_FRAME_RATE_GOVERNOR_H__
+
+#include <ctime>
+#include <functional>
+#include <optional>
+
+#include "src/tracker.h"
+
+namespace afc::editor {
+
+// Decides when the screen should be updated. Limits how often that happens, so
+// that the main loop doesn't spend most of its time updating the screen (e.g.,
+// when a buffer is receiving lots of output, which would make the loop wake up
+// very frequently), which only the terminal would benefit from.
+//
+// The minimum time between updates is given by the maximum frames per second
+// and by the time that updates take: we increase it if updating the screen
+// would otherwise take more than `kMaxDisplayLoad` of the time. The time that
+// updates take is read from the `Tracker` that measures them.
+class FrameRateGovernor {
+ public:
+  static constexpr double kMaxDisplayLoad = 0.25;
+
+  // `display_tracker_data` returns the current data of the tracker that
+  // measures screen updates.
+  explicit FrameRateGovernor(
+      std::function<Tracker::Data()> display_tracker_data);
+
+  // A non-positive value disables the limit.
+  void set_max_frames_per_second(int value) {
+    max_frames_per_second_ = value;
+  }
+
+  // Returns true if the screen should be updated at `now`. Otherwise, the
+  // update is deferred until `NextDisplay`. `urgent` signals that the user is
+  // waiting for the update (e.g., to see the effects of keys pressed), so it
+  // shouldn't be deferred.
+  bool ShouldDisplay(struct timespec now, bool urgent);
+
+  // Must be called after updating the screen (following a call to
+  // `ShouldDisplay` that returned true).
+  void RegisterDisplay();
+
+  // If an update was deferred, returns the time at which it should happen.
+  std::optional<struct timespec> NextDisplay() const;
+
+ private:
+  double MinSecondsBetweenDisplays() const;
+
+  const std::function<Tracker::Data()> display_tracker_data_;
+  int max_frames_per_second_ = 30;
+
+  // When we last updated the screen.
+  std::optional<struct timespec> last_display_;
+  // The seconds in `display_tracker_data_` when we last updated the screen.
+  double tracker_seconds_;
+  // An exponential moving average of the time that updates take (according to
+  // `display_tracker_data_`).
+  double average_display_seconds_ = 0;
+  bool deferred_display_ = false;
+};
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_FRAME_RATE_GOVERNOR_H__
@@ -1,17 +1,221 @@
 #include "src/lazy_string_append.h"
 
 #include <glog/logging.h>
+#include <malloc.h>
 
+#include "src/char_buffer.h"
 #include "src/const_tree.h"
 #include "src/lazy_string_functional.h"
 #include "src/line_column.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
 
 namespace afc {
 namespace editor {
 namespace {
+// An immutable rope: a height-balanced binary tree whose leaves hold
+// contiguous arrays of characters (up to `kMaxLeafSize`). Internal nodes only
+// hold the counts needed to find a position.
+//
+// Compared to a ConstTree<wchar_t>, leaves are larger and hold the characters
+// inline (rather than in separately allocated chunks), which uses less memory
+// per character.
+class Rope {
+ private:
+  struct ConstructorAccessTag {
+   private:
+    ConstructorAccessTag() = default;
+    friend Rope;
+  };
+
+ public:
+  using Ptr = std::shared_ptr<const Rope>;
+
+  static constexpr size_t kMaxLeafSize = 256;
+
+  // Only `NewLeaf` and `NewNode` should be calling these.
+  Rope(ConstructorAccessTag, std::vector<wchar_t> chars)
+      : depth_(1), size_(chars.size()), chars_(std::move(chars)) {
+    CHECK_LE(chars_.size(), kMaxLeafSize);
+  }
+
+  Rope(ConstructorAccessTag, Ptr left, Ptr right)
+      : depth_(1 + std::max(left->depth_, right->depth_)),
+        size_(left->size_ + right->size_),
+        left_(std::move(left)),
+        right_(std::move(right)) {
+    CHECK_LE(std::max(left_->depth_, right_->depth_),
+             std::min(left_->depth_, right_->depth_) + 1);
+  }
+
+  static Ptr FromLazyString(const LazyString& input) {
+    std::vector<Ptr> leaves;
+    std::vector<wchar_t> chars;
+    ForEachColumn(input, [&](ColumnNumber, wchar_t c) {
+      chars.push_back(c);
+      if (chars.size() == kMaxLeafSize) {
+        leaves.push_back(NewLeaf(std::move(chars)));
+        chars = {};
+      }
+    });
+    if (!chars.empty()) leaves.push_back(NewLeaf(std::move(chars)));
+    return leaves.empty() ? nullptr : Balanced(leaves, 0, leaves.size());
+  }
+
+  static Ptr Append(const Ptr& a, const Ptr& b) {
+    if (a == nullptr) return b;
+    if (b == nullptr) return a;
+    // The common case of extending a string by a few characters only needs to
+    // copy a single leaf (and the path to it).
+    if (b->IsLeaf() && a->LastLeaf().size_ + b->size_ <= kMaxLeafSize) {
+      return a->ReplaceLastLeaf(Merge(a->LastLeaf(), *b));
+    }
+    if (a->IsLeaf() && a->size_ + b->FirstLeaf().size_ <= kMaxLeafSize) {
+      return b->ReplaceFirstLeaf(Merge(*a, b->FirstLeaf()));
+    }
+    return Join(a, b);
+  }
+
+  static size_t Size(const Ptr& rope) {
+    return rope == nullptr ? 0 : rope->size_;
+  }
+
+  static size_t Depth(const Ptr& rope) {
+    return rope == nullptr ? 0 : rope->depth_;
+  }
+
+  wchar_t Get(size_t position) const {
+    CHECK_LT(position, size_);
+    const Rope* node = this;
+    while (!node->IsLeaf()) {
+      if (position < node->left_->size_) {
+        node = node->left_.get();
+      } else {
+        position -= node->left_->size_;
+        node = node->right_.get();
+      }
+    }
+    return node->chars_[position];
+  }
+
+ private:
+  bool IsLeaf() const { return left_ == nullptr; }
+
+  const Rope& FirstLeaf() const {
+    return IsLeaf() ? *this : left_->FirstLeaf();
+  }
+
+  const Rope& LastLeaf() const { return IsLeaf() ? *this : right_->LastLeaf(); }
+
+  Ptr ReplaceFirstLeaf(Ptr leaf) const {
+    return IsLeaf() ? leaf
+                    : NewNode(left_->ReplaceFirstLeaf(std::move(leaf)), right_);
+  }
+
+  Ptr ReplaceLastLeaf(Ptr leaf) const {
+    return IsLeaf() ? leaf
+                    : NewNode(left_, right_->ReplaceLastLeaf(std::move(leaf)));
+  }
+
+  static Ptr Merge(const Rope& a, const Rope& b) {
+    CHECK(a.IsLeaf());
+    CHECK(b.IsLeaf());
+    std::vector<wchar_t> chars;
+    chars.reserve(a.size_ + b.size_);
+    chars.insert(chars.end(), a.chars_.begin(), a.chars_.end());
+    chars.insert(chars.end(), b.chars_.begin(), b.chars_.end());
+    return NewLeaf(std::move(chars));
+  }
+
+  static Ptr Balanced(const std::vector<Ptr>& leaves, size_t begin,
+                      size_t end) {
+    CHECK_LT(begin, end);
+    if (end - begin == 1) return leaves[begin];
+    size_t middle = begin + (end - begin) / 2;
+    return NewNode(Balanced(leaves, begin, middle),
+                   Balanced(leaves, middle, end));
+  }
+
+  // Concatenates two trees, descending along the spine of the deeper one until
+  // the depths are close enough and rotating on the way back up.
+  static Ptr Join(const Ptr& a, const Ptr& b) {
+    if (a->depth_ > b->depth_ + 1) {
+      return Rebalance(a->left_, Join(a->right_, b));
+    } else if (b->depth_ > a->depth_ + 1) {
+      return Rebalance(Join(a, b->left_), b->right_);
+    }
+    return NewNode(a, b);
+  }
+
+  // Creates a node for `left` and `right`, which may differ in depth by at most
+  // two.
+  static Ptr Rebalance(const Ptr& left, const Ptr& right) {
+    if (right->depth_ > left->depth_ + 1) {
+      if (Depth(right->left_) > Depth(right->right_)) {
+        return NewNode(NewNode(left, right->left_->left_),
+                       NewNode(right->left_->right_, right->right_));
+      }
+      return NewNode(NewNode(left, right->left_), right->right_);
+    } else if (left->depth_ > right->depth_ + 1) {
+      if (Depth(left->right_) > Depth(left->left_)) {
+        return NewNode(NewNode(left->left_, left->right_->left_),
+                       NewNode(left->right_->right_, right));
+      }
+      return NewNode(left->left_, NewNode(left->right_, right));
+    }
+    return NewNode(left, right);
+  }
+
+  static Ptr NewLeaf(std::vector<wchar_t> chars) {
+    return std::make_shared<Rope>(ConstructorAccessTag{}, std::move(chars));
+  }
+
+  static Ptr NewNode(Ptr left, Ptr right) {
+    return std::make_shared<Rope>(ConstructorAccessTag{}, std::move(left),
+                                  std::move(right));
+  }
+
+  const size_t depth_;
+  const size_t size_;
+
+  // Only set in leaves.
+  const std::vector<wchar_t> chars_;
+
+  // Only set in internal nodes (in which case both are set).
+  const Ptr left_;
+  const Ptr right_;
+};
+
 class StringAppendImpl : public LazyString {
  public:
-  StringAppendImpl(ConstTree<wchar_t>::Ptr tree) : tree_(std::move(tree)) {}
+  StringAppendImpl(Rope::Ptr rope) : rope_(std::move(rope)) {}
+
+  wchar_t get(ColumnNumber pos) const { return rope_->Get(pos.column); }
+
+  ColumnNumberDelta size() const {
+    return ColumnNumberDelta(Rope::Size(rope_));
+  }
+
+  const Rope::Ptr& rope() const { return rope_; }
+
+ private:
+  const Rope::Ptr rope_;
+};
+
+Rope::Ptr RopeFrom(std::shared_ptr<LazyString> a) {
+  auto a_cast = dynamic_cast<StringAppendImpl*>(a.get());
+  if (a_cast != nullptr) {
+    return a_cast->rope();
+  }
+  return Rope::FromLazyString(*a);
+}
+
+// The representation that StringAppend used before Rope, kept for comparison
+// in the benchmarks below.
+class CharTreeString : public LazyString {
+ public:
+  CharTreeString(ConstTree<wchar_t>::Ptr tree) : tree_(std::move(tree)) {}
 
   wchar_t get(ColumnNumber pos) const { return tree_->Get(pos.column); }
 
@@ -19,23 +223,127 @@ class StringAppendImpl : public LazyString {
     return ColumnNumberDelta(ConstTree<wchar_t>::Size(tree_));
   }
 
-  const ConstTree<wchar_t>::Ptr& tree() const { return tree_; }
+  static std::shared_ptr<LazyString> Append(std::shared_ptr<LazyString> a,
+                                            std::shared_ptr<LazyString> b) {
+    return std::make_shared<CharTreeString>(
+        ConstTree<wchar_t>::Append(TreeFrom(a), TreeFrom(b)));
+  }
 
  private:
+  static ConstTree<wchar_t>::Ptr TreeFrom(std::shared_ptr<LazyString> a) {
+    auto a_cast = dynamic_cast<CharTreeString*>(a.get());
+    if (a_cast != nullptr) {
+      return a_cast->tree_;
+    }
+    ConstTree<wchar_t>::Ptr output;
+    ForEachColumn(*a, [&output](ColumnNumber, wchar_t c) {
+      output = ConstTree<wchar_t>::PushBack(output, c);
+    });
+    return output;
+  }
+
   const ConstTree<wchar_t>::Ptr tree_;
 };
 
-ConstTree<wchar_t>::Ptr TreeFrom(std::shared_ptr<LazyString> a) {
-  auto a_cast = dynamic_cast<StringAppendImpl*>(a.get());
-  if (a_cast != nullptr) {
-    return a_cast->tree();
+using AppendFunction = std::function<std::shared_ptr<LazyString>(
+    std::shared_ptr<LazyString>, std::shared_ptr<LazyString>)>;
+
+// Builds a string of `size` characters by appending one character at a time,
+// which is what happens when a line is typed in insert mode.
+std::shared_ptr<LazyString> BuildString(const AppendFunction& append,
+                                        size_t size) {
+  std::shared_ptr<LazyString> output = EmptyString();
+  for (size_t i = 0; i < size; i++) {
+    output = append(output, NewLazyString(std::wstring(1, L'a' + i % 26)));
   }
-  ConstTree<wchar_t>::Ptr output;
-  ForEachColumn(*a, [&output](ColumnNumber, wchar_t c) {
-    output = ConstTree<wchar_t>::PushBack(output, c);
-  });
   return output;
 }
+
+double BenchmarkAppendCharacter(const AppendFunction& append, int elements) {
+  auto input = BuildString(append, elements);
+  static const int kRuns = 1e4;
+  std::shared_ptr<LazyString> suffix = NewLazyString(L"x");
+  auto start = Now();
+  for (int i = 0; i < kRuns; i++) {
+    CHECK_EQ(append(input, suffix)->size(), ColumnNumberDelta(elements + 1));
+  }
+  auto end = Now();
+  return SecondsBetween(start, end) / kRuns;
+}
+
+double BenchmarkGet(const AppendFunction& append, int elements) {
+  auto input = BuildString(append, elements);
+  static const int kRuns = 1e5;
+  std::vector<ColumnNumber> positions;
+  for (int i = 0; i < kRuns; i++) {
+    positions.push_back(ColumnNumber(random() % elements));
+  }
+  auto start = Now();
+  for (auto& position : positions) {
+    CHECK_GE(input->get(position), L'a');
+  }
+  auto end = Now();
+  return SecondsBetween(start, end) / kRuns;
+}
+
+double BenchmarkForEachColumn(const AppendFunction& append, int elements) {
+  auto input = BuildString(append, elements);
+  size_t count = 0;
+  auto start = Now();
+  ForEachColumn(*input, [&count](ColumnNumber, wchar_t c) {
+    if (c == L'a') count++;
+  });
+  auto end = Now();
+  CHECK_EQ(count, (elements + 25) / 26ul);
+  return SecondsBetween(start, end) / elements;
+}
+
+// Returns the number of bytes allocated per character (rather than a time).
+double BenchmarkMemory(const AppendFunction& append, int elements) {
+  auto start = mallinfo2().uordblks;
+  auto input = BuildString(append, elements);
+  auto end = mallinfo2().uordblks;
+  CHECK_EQ(input->size(), ColumnNumberDelta(elements));
+  return static_cast<double>(end - start) / elements;
+}
+
+const AppendFunction kRopeAppend = [](std::shared_ptr<LazyString> a,
+                                      std::shared_ptr<LazyString> b) {
+  return StringAppend(std::move(a), std::move(b));
+};
+
+const AppendFunction kCharTreeAppend = CharTreeString::Append;
+
+bool registration_append_character = tests::RegisterBenchmark(
+    L"StringAppend::AppendCharacter",
+    [](int elements) { return BenchmarkAppendCharacter(kRopeAppend, elements); });
+bool registration_char_tree_append_character =
+    tests::RegisterBenchmark(L"CharTreeString::AppendCharacter", [](int elements) {
+      return BenchmarkAppendCharacter(kCharTreeAppend, elements);
+    });
+
+bool registration_get = tests::RegisterBenchmark(
+    L"StringAppend::Get",
+    [](int elements) { return BenchmarkGet(kRopeAppend, elements); });
+bool registration_char_tree_get = tests::RegisterBenchmark(
+    L"CharTreeString::Get",
+    [](int elements) { return BenchmarkGet(kCharTreeAppend, elements); });
+
+bool registration_for_each_column =
+    tests::RegisterBenchmark(L"StringAppend::ForEachColumn", [](int elements) {
+      return BenchmarkForEachColumn(kRopeAppend, elements);
+    });
+bool registration_char_tree_for_each_column = tests::RegisterBenchmark(
+    L"CharTreeString::ForEachColumn", [](int elements) {
+      return BenchmarkForEachColumn(kCharTreeAppend, elements);
+    });
+
+bool registration_memory = tests::RegisterBenchmark(
+    L"StringAppend::MemoryPerCharacter",
+    [](int elements) { return BenchmarkMemory(kRopeAppend, elements); });
+bool registration_char_tree_memory = tests::RegisterBenchmark(
+    L"CharTreeString::MemoryPerCharacter",
+    [](int elements) { return BenchmarkMemory(kCharTreeAppend, elements); });
 }  // namespace
 
 std::shared_ptr<LazyString> StringAppend(std::shared_ptr<LazyString> a,
@@ -51,7 +359,7 @@ std::shared_ptr<LazyString> StringAppend(std::shared_ptr<LazyString> a,
   }
 
   return std::make_shared<StringAppendImpl>(
-      ConstTree<wchar_t>::Append(TreeFrom(a), TreeFrom(b)));
+      Rope::Append(RopeFrom(std::move(a)), RopeFrom(std::move(b))));
 }
 
 std::shared_ptr<LazyString> StringAppend(std::shared_ptr<LazyString> a,
@@ -78,5 +386,55 @@ std::shared_ptr<LazyString> Concatenate(
   return output;
 }
 
+namespace {
+class StringAppendTests : public tests::TestGroup<StringAppendTests> {
+ public:
+  StringAppendTests() : TestGroup<StringAppendTests>() {}
+  std::wstring Name() const override { return L"StringAppendTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"AppendCharacters",
+             .callback =
+                 [] {
+                   auto output = EmptyString();
+                   std::wstring expected;
+                   for (int i = 0; i < 2000; i++) {
+                     wchar_t c = L'a' + i % 26;
+                     output = StringAppend(output,
+                                           NewLazyString(std::wstring(1, c)));
+                     expected.push_back(c);
+                   }
+                   CHECK(output->ToString() == expected);
+                 }},
+            {.name = L"RandomWalk", .callback = [] {
+               // Appends strings of random lengths on either side and checks
+               // the contents (and, implicitly, the balance invariants).
+               auto output = EmptyString();
+               std::wstring expected;
+               for (int i = 0; i < 500; i++) {
+                 std::wstring piece(random() % (2 * Rope::kMaxLeafSize),
+                                    L'a' + i % 26);
+                 if (random() % 2 == 0) {
+                   output = StringAppend(output, NewLazyString(piece));
+                   expected = expected + piece;
+                 } else {
+                   output = StringAppend(NewLazyString(piece), output);
+                   expected = piece + expected;
+                 }
+                 if (random() % 10 == 0 && expected.size() < 1e4) {
+                   output = StringAppend(output, output);
+                   expected = expected + expected;
+                 }
+                 CHECK_EQ(output->size(), ColumnNumberDelta(expected.size()));
+               }
+               CHECK(output->ToString() == expected);
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<StringAppendTests>::registration_ =
+    tests::Add<editor::StringAppendTests>();
+}  // namespace
+
 }  // namespace editor
 }  // namespace afc
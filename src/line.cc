@@ -12,6 +12,8 @@
 #include "src/lazy_string_append.h"
 #include "src/lazy_string_functional.h"
 #include "src/substring.h"
+#include "src/tests/benchmarks.h"
+#include "src/time.h"
 #include "src/tracker.h"
 #include "src/wstring.h"
 
@@ -71,7 +73,7 @@ void Line::Options::InsertCharacterAtPosition(ColumnNumber column) {
           NewLazyString(L" ")),
       afc::editor::Substring(contents, column));
 
-  std::map<ColumnNumber, LineModifierSet> new_modifiers;
+  LineModifierMap new_modifiers;
   for (auto& m : modifiers) {
     new_modifiers[m.first + (m.first < column ? ColumnNumberDelta(0)
                                               : ColumnNumberDelta(1))] =
@@ -155,7 +157,7 @@ Line::Options& Line::Options::DeleteCharacters(ColumnNumber column,
       afc::editor::Substring(contents, ColumnNumber(0), column.ToDelta()),
       afc::editor::Substring(contents, column + delta));
 
-  std::map<ColumnNumber, LineModifierSet> new_modifiers;
+  LineModifierMap new_modifiers;
   // TODO: We could optimize this to only set it once (rather than for every
   // modifier before the deleted range).
   std::optional<LineModifierSet> last_modifiers_before_gap;
@@ -394,5 +396,34 @@ wint_t Line::GetWithLock(ColumnNumber column) const {
   return options_.contents->get(column);
 }
 
+namespace {
+// Returns the time to produce the output of a line with `tokens` highlighted
+// tokens.
+bool registration_output_benchmark =
+    tests::RegisterBenchmark(L"Line::Output", [](int tokens) {
+      static const std::vector<LineModifierSet> kModifiers = {
+          {LineModifier::CYAN},
+          {LineModifier::BOLD, LineModifier::YELLOW},
+          {},
+          {LineModifier::DIM}};
+      Line::Options options;
+      for (int i = 0; i < tokens; i++) {
+        options.AppendString(L"tok" + std::to_wstring(i % 10) + L" ",
+                             kModifiers[i % kModifiers.size()]);
+      }
+      Line line(std::move(options));
+      auto start = Now();
+      line.Output(
+          {.initial_column = ColumnNumber(0),
+           .width = ColumnNumberDelta(5 * tokens),
+           .active_cursor_column = ColumnNumber(2),
+           .inactive_cursor_columns = {},
+           .modifiers_main_cursor = {LineModifier::REVERSE},
+           .modifiers_inactive_cursors = {LineModifier::REVERSE,
+                                          LineModifier::CYAN}});
+      return SecondsBetween(start, Now());
+    });
+}  // namespace
+
 }  // namespace editor
 }  // namespace afc
@@ -74,7 +74,7 @@ class Line {
     // previous value, assume LineModifierSet(). There's no need to include
     // RESET: it is assumed implicitly. In other words, modifiers don't carry
     // over past an entry.
-    std::map<ColumnNumber, LineModifierSet> modifiers;
+    LineModifierMap modifiers;
 
     LineModifierSet end_of_line_modifiers;
 
@@ -105,11 +105,11 @@ class Line {
   wstring ToString() const { return contents()->ToString(); }
 
   void SetAllModifiers(const LineModifierSet& modifiers);
-  const std::map<ColumnNumber, LineModifierSet>& modifiers() const {
+  const LineModifierMap& modifiers() const {
     std::unique_lock<std::mutex> lock(mutex_);
     return options_.modifiers;
   }
-  std::map<ColumnNumber, LineModifierSet>& modifiers() {
+  LineModifierMap& modifiers() {
     std::unique_lock<std::mutex> lock(mutex_);
     return options_.modifiers;
   }
@@ -674,7 +674,7 @@ namespace vm {
 /* static */
 editor::LineColumn VMTypeMapper<editor::LineColumn>::get(Value* value) {
   CHECK(value != nullptr);
-  CHECK_EQ(value->type, VMTypeMapper<editor::LineColumn>::vmtype);
+  CHECK_EQ(value->type(), VMTypeMapper<editor::LineColumn>::vmtype);
   CHECK(value->user_value != nullptr);
   return *static_cast<editor::LineColumn*>(value->user_value.get());
 }
@@ -694,7 +694,7 @@ const VMType VMTypeMapper<editor::LineColumn>::vmtype =
 /* static */
 editor::Range VMTypeMapper<editor::Range>::get(Value* value) {
   CHECK(value != nullptr);
-  CHECK_EQ(value->type, VMTypeMapper<editor::Range>::vmtype);
+  CHECK_EQ(value->type(), VMTypeMapper<editor::Range>::vmtype);
   CHECK(value->user_value != nullptr);
   return *static_cast<editor::Range*>(value->user_value.get());
 }
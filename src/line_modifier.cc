@@ -1,5 +1,7 @@
 #include "src/line_modifier.h"
 
+#include "src/tests/tests.h"
+
 namespace afc {
 namespace editor {
 
@@ -56,5 +58,55 @@ LineModifier ModifierFromString(std::string modifier) {
   return RESET;  // Ugh.
 }
 
+namespace {
+class LineModifierTests : public tests::TestGroup<LineModifierTests> {
+ public:
+  LineModifierTests() : TestGroup<LineModifierTests>() {}
+  std::wstring Name() const override { return L"LineModifierTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"SetOperations",
+             .callback =
+                 [] {
+                   LineModifierSet modifiers = {BG_RED, BOLD};
+                   CHECK_EQ(modifiers.size(), 2ul);
+                   CHECK(modifiers.insert(RED).second);
+                   CHECK(!modifiers.insert(RED).second);
+                   CHECK_EQ(modifiers.count(BOLD), 1ul);
+                   CHECK(modifiers.find(ITALIC) == modifiers.end());
+                   CHECK(*modifiers.find(RED) == RED);
+                   std::vector<LineModifier> values(modifiers.begin(),
+                                                    modifiers.end());
+                   CHECK(values == std::vector<LineModifier>({BOLD, RED, BG_RED}));
+                   modifiers.erase(modifiers.find(RED));
+                   CHECK_EQ(modifiers.erase(BOLD), 1ul);
+                   CHECK_EQ(modifiers.erase(BOLD), 0ul);
+                   CHECK(modifiers == LineModifierSet({BG_RED}));
+                   modifiers.clear();
+                   CHECK(modifiers.empty());
+                 }},
+            {.name = L"MapOperations", .callback = [] {
+               LineModifierMap map;
+               map[ColumnNumber(5)] = {BOLD};
+               map[ColumnNumber(1)] = {RED};
+               map.insert({ColumnNumber(3), {}});
+               CHECK(!map.insert({ColumnNumber(3), {DIM}}).second);
+               CHECK_EQ(map.size(), 3ul);
+               CHECK(map.begin()->first == ColumnNumber(1));
+               CHECK(map.rbegin()->second == LineModifierSet({BOLD}));
+               CHECK(map.lower_bound(ColumnNumber(2))->first == ColumnNumber(3));
+               CHECK(map.upper_bound(ColumnNumber(3))->first == ColumnNumber(5));
+               CHECK(map.find(ColumnNumber(4)) == map.end());
+               map.erase(map.lower_bound(ColumnNumber(2)),
+                         map.lower_bound(ColumnNumber(6)));
+               CHECK(map == LineModifierMap({{ColumnNumber(1), {RED}}}));
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<LineModifierTests>::registration_ =
+    tests::Add<editor::LineModifierTests>();
+}  // namespace
+
 }  // namespace editor
 }  // namespace afc
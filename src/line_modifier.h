@@ -1,8 +1,18 @@
 #ifndef __AFC_EDITOR_LINE_MODIFIER_H__
 #define __AFC_EDITOR_LINE_MODIFIER_H__
 
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <vector>
+
 #include "src/hash.h"
 #include "src/lazy_string.h"
+#include "src/line_column.h"
 #include "src/vm/public/environment.h"
 #include "unordered_set"
 
@@ -26,7 +36,209 @@ enum LineModifier {
   BG_RED,
 };
 
-using LineModifierSet = std::unordered_set<LineModifier, std::hash<int>>;
+// A set of modifiers, represented as a bitmask. Supports the subset of the
+// interface of `std::set` that we need. Iterates in the order of the values of
+// the modifiers.
+class LineModifierSet {
+ public:
+  using value_type = LineModifier;
+
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = LineModifier;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const LineModifier*;
+    using reference = LineModifier;
+
+    const_iterator(uint32_t bits) : bits_(bits) {}
+
+    LineModifier operator*() const {
+      DCHECK_NE(bits_, 0u);
+      return static_cast<LineModifier>(__builtin_ctz(bits_));
+    }
+    const_iterator& operator++() {
+      bits_ &= bits_ - 1;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator output = *this;
+      ++*this;
+      return output;
+    }
+    bool operator==(const const_iterator& other) const {
+      return bits_ == other.bits_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    // The modifiers that we haven't visited yet.
+    uint32_t bits_;
+  };
+  using iterator = const_iterator;
+
+  LineModifierSet() = default;
+  LineModifierSet(std::initializer_list<LineModifier> modifiers) {
+    insert(modifiers.begin(), modifiers.end());
+  }
+  template <typename Iterator>
+  LineModifierSet(Iterator begin, Iterator end) {
+    insert(begin, end);
+  }
+
+  const_iterator begin() const { return const_iterator(bits_); }
+  const_iterator end() const { return const_iterator(0); }
+
+  bool empty() const { return bits_ == 0; }
+  size_t size() const { return __builtin_popcount(bits_); }
+  void clear() { bits_ = 0; }
+
+  size_t count(LineModifier modifier) const {
+    return (bits_ & Bit(modifier)) == 0 ? 0 : 1;
+  }
+  const_iterator find(LineModifier modifier) const {
+    // The iterator only visits `modifier` and the modifiers after it.
+    return count(modifier) == 0 ? end()
+                                : const_iterator(bits_ & ~(Bit(modifier) - 1));
+  }
+
+  std::pair<const_iterator, bool> insert(LineModifier modifier) {
+    bool inserted = count(modifier) == 0;
+    bits_ |= Bit(modifier);
+    return {find(modifier), inserted};
+  }
+  template <typename Iterator>
+  void insert(Iterator begin, Iterator end) {
+    for (; begin != end; ++begin) insert(*begin);
+  }
+  void insert(const LineModifierSet& other) { bits_ |= other.bits_; }
+
+  size_t erase(LineModifier modifier) {
+    size_t output = count(modifier);
+    bits_ &= ~Bit(modifier);
+    return output;
+  }
+  void erase(const_iterator position) { erase(*position); }
+
+  uint32_t bits() const { return bits_; }
+
+  bool operator==(const LineModifierSet& other) const {
+    return bits_ == other.bits_;
+  }
+  bool operator!=(const LineModifierSet& other) const {
+    return bits_ != other.bits_;
+  }
+
+ private:
+  static uint32_t Bit(LineModifier modifier) {
+    DCHECK_LT(static_cast<int>(modifier), 32);
+    return uint32_t(1) << modifier;
+  }
+
+  uint32_t bits_ = 0;
+};
+
+// Maps columns to the modifiers that apply from them until the next entry.
+// Supports the subset of the interface of `std::map` that we need.
+//
+// The entries are kept in a sorted vector: lines have few entries, which are
+// almost always added in order, so this is much cheaper (to build, copy and
+// traverse) than a tree.
+class LineModifierMap {
+ public:
+  using value_type = std::pair<ColumnNumber, LineModifierSet>;
+  using iterator = std::vector<value_type>::iterator;
+  using const_iterator = std::vector<value_type>::const_iterator;
+  using const_reverse_iterator = std::vector<value_type>::const_reverse_iterator;
+
+  LineModifierMap() = default;
+  LineModifierMap(std::initializer_list<value_type> entries) {
+    insert(entries.begin(), entries.end());
+  }
+
+  iterator begin() { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+  const_reverse_iterator rbegin() const { return entries_.rbegin(); }
+  const_reverse_iterator rend() const { return entries_.rend(); }
+
+  bool empty() const { return entries_.empty(); }
+  size_t size() const { return entries_.size(); }
+  void clear() { entries_.clear(); }
+  void reserve(size_t size) { entries_.reserve(size); }
+
+  iterator lower_bound(ColumnNumber column) {
+    return std::lower_bound(entries_.begin(), entries_.end(), column,
+                            CompareColumn);
+  }
+  const_iterator lower_bound(ColumnNumber column) const {
+    return std::lower_bound(entries_.begin(), entries_.end(), column,
+                            CompareColumn);
+  }
+  iterator upper_bound(ColumnNumber column) {
+    auto it = lower_bound(column);
+    return it != end() && it->first == column ? std::next(it) : it;
+  }
+  const_iterator upper_bound(ColumnNumber column) const {
+    auto it = lower_bound(column);
+    return it != end() && it->first == column ? std::next(it) : it;
+  }
+  iterator find(ColumnNumber column) {
+    auto it = lower_bound(column);
+    return it != end() && it->first == column ? it : end();
+  }
+  const_iterator find(ColumnNumber column) const {
+    auto it = lower_bound(column);
+    return it != end() && it->first == column ? it : end();
+  }
+
+  LineModifierSet& operator[](ColumnNumber column) {
+    return insert({column, LineModifierSet()}).first->second;
+  }
+
+  // Like `std::map::insert`: doesn't replace existing entries.
+  std::pair<iterator, bool> insert(value_type entry) {
+    if (entries_.empty() || entries_.back().first < entry.first) {
+      entries_.push_back(std::move(entry));
+      return {std::prev(entries_.end()), true};
+    }
+    auto it = lower_bound(entry.first);
+    if (it != end() && it->first == entry.first) return {it, false};
+    return {entries_.insert(it, std::move(entry)), true};
+  }
+  template <typename Iterator>
+  void insert(Iterator begin, Iterator end) {
+    for (; begin != end; ++begin) insert(*begin);
+  }
+
+  iterator erase(const_iterator position) { return entries_.erase(position); }
+  iterator erase(const_iterator begin, const_iterator end) {
+    return entries_.erase(begin, end);
+  }
+  size_t erase(ColumnNumber column) {
+    auto it = find(column);
+    if (it == end()) return 0;
+    entries_.erase(it);
+    return 1;
+  }
+
+  bool operator==(const LineModifierMap& other) const {
+    return entries_ == other.entries_;
+  }
+  bool operator!=(const LineModifierMap& other) const {
+    return entries_ != other.entries_;
+  }
+
+ private:
+  static bool CompareColumn(const value_type& entry, ColumnNumber column) {
+    return entry.first < column;
+  }
+
+  std::vector<value_type> entries_;
+};
 
 std::string ModifierToString(LineModifier modifier);
 LineModifier ModifierFromString(std::string modifier);
@@ -38,11 +250,7 @@ namespace std {
 template <>
 struct hash<afc::editor::LineModifierSet> {
   std::size_t operator()(const afc::editor::LineModifierSet& modifiers) const {
-    size_t output = 0;
-    for (auto& m : modifiers) {
-      output = hash_combine(output, m);
-    }
-    return output;
+    return std::hash<uint32_t>{}(modifiers.bits());
   }
 };
 }  // namespace std
@@ -18,6 +18,20 @@ class LRUCache {
  public:
   LRUCache(size_t max_size) : max_size_(max_size) {}
 
+  // Expires the least recently used entries if the cache has more than
+  // `max_size` entries.
+  void SetMaxSize(size_t max_size) {
+    ValidateInvariants();
+    CHECK_GT(max_size, 0ul);
+    max_size_ = max_size;
+    while (access_order_.size() > max_size_) {
+      size_t erase_result = map_.erase(access_order_.back().key);
+      CHECK_EQ(erase_result, 1ul);
+      access_order_.pop_back();
+    }
+    ValidateInvariants();
+  }
+
   void Clear() {
     ValidateInvariants();
     LOG(INFO) << "Clearing LRU Cache (size: " << access_order_.size();
@@ -26,6 +40,8 @@ class LRUCache {
     ValidateInvariants();
   }
 
+  bool Contains(const Key& key) const { return map_.count(key) > 0; }
+
   // If the key is currently in the map, just returns its value.
   //
   // Otherwise, runs the Creator callback, a function that receives zero
@@ -66,7 +82,7 @@ class LRUCache {
     CHECK_EQ(access_order_.size(), map_.size());
   }
 
-  const size_t max_size_;
+  size_t max_size_;
 
   // Most recent at the front.
   struct AccessEntry {
@@ -23,10 +23,12 @@ extern "C" {
 #include "src/editor.h"
 #include "src/file_descriptor_reader.h"
 #include "src/file_link_mode.h"
+#include "src/frame_rate_governor.h"
 #include "src/lazy_string.h"
 #include "src/run_command_handler.h"
 #include "src/screen.h"
 #include "src/screen_curses.h"
+#include "src/screen_protocol.h"
 #include "src/screen_vm.h"
 #include "src/server.h"
 #include "src/terminal.h"
@@ -117,7 +119,10 @@ wstring CommandsToRun(CommandLineValues args) {
   }
   if (!args.client.empty()) {
     commands_to_run +=
-        L"Screen screen = RemoteScreen(\"" +
+        std::wstring(args.client_protocol ==
+                             CommandLineValues::ClientProtocol::kBinary
+                         ? L"Screen screen = RemoteBinaryScreen(\""
+                         : L"Screen screen = RemoteScreen(\"") +
         CppEscapeString(FromByteString(getenv(kEdgeParentAddress))) + L"\");\n";
   } else if (!buffers_to_watch.empty() &&
              args.nested_edge_behavior ==
@@ -167,6 +172,18 @@ void SendCommandsToParent(int fd, const string commands_to_run) {
   }
 }
 
+void SendFrameToParent(int fd, const string& frame) {
+  CHECK_NE(fd, -1);
+  for (size_t pos = 0; pos < frame.size();) {
+    int bytes_written = write(fd, frame.c_str() + pos, frame.size() - pos);
+    if (bytes_written == -1) {
+      std::cerr << "write: " << strerror(errno);
+      exit(1);
+    }
+    pos += bytes_written;
+  }
+}
+
 wstring StartServer(const CommandLineValues& args, bool connected_to_parent) {
   LOG(INFO) << "Starting server.";
 
@@ -329,6 +346,14 @@ int main(int argc, const char** argv) {
   // changes to the server).
   std::optional<LineColumnDelta> last_screen_size;
 
+  FrameRateGovernor frame_rate_governor(
+      [] { return Terminal::DisplayTracker().data(); });
+  // Whether we've received input since we last updated the screen. We don't
+  // defer updating it in that case: the user is waiting for it. Input that we
+  // process (including input from remote clients) is reported by
+  // `EditorState::FlushInputProcessed`.
+  bool input_received = false;
+
   BeepFrequencies(audio_player.get(), {783.99, 723.25, 783.99});
   editor_state()->status()->SetInformationText(GetGreetingMessage());
 
@@ -339,45 +364,60 @@ int main(int argc, const char** argv) {
     VLOG(5) << "Executing pending work.";
     editor_state()->ExecutePendingWork();
 
-    VLOG(5) << "Updating screens.";
-    auto screen_state = editor_state()->FlushScreenState();
-    if (screen_curses != nullptr) {
-      if (args.client.empty()) {
-        terminal.Display(editor_state(), screen_curses.get(), screen_state);
-      } else {
-        screen_curses->Refresh();  // Don't want this to be buffered!
-        auto screen_size =
-            LineColumnDelta{screen_curses->lines(), screen_curses->columns()};
-        if (last_screen_size.has_value() &&
-            screen_size != last_screen_size.value()) {
-          LOG(INFO) << "Sending screen size update to server.";
-          SendCommandsToParent(
-              remote_server_fd,
-              "screen.set_size(" +
-                  std::to_string(screen_size.column.column_delta) + "," +
-                  std::to_string(screen_size.line.line_delta) + ");" +
-                  "set_screen_needs_hard_redraw(true);\n");
-          last_screen_size = screen_size;
+    frame_rate_governor.set_max_frames_per_second(
+        editor_state()->Read(editor_variables::frames_per_second));
+    input_received |= editor_state()->FlushInputProcessed();
+    if (frame_rate_governor.ShouldDisplay(Now(), input_received)) {
+      input_received = false;
+      VLOG(5) << "Updating screens.";
+      auto screen_state = editor_state()->FlushScreenState();
+      if (screen_curses != nullptr) {
+        if (args.client.empty()) {
+          terminal.Display(editor_state(), screen_curses.get(), screen_state);
+        } else {
+          screen_curses->Refresh();  // Don't want this to be buffered!
+          auto screen_size =
+              LineColumnDelta{screen_curses->lines(), screen_curses->columns()};
+          if (last_screen_size.has_value() &&
+              screen_size != last_screen_size.value()) {
+            LOG(INFO) << "Sending screen size update to server.";
+            switch (args.client_protocol) {
+              case CommandLineValues::ClientProtocol::kBinary:
+                SendFrameToParent(remote_server_fd,
+                                  screen_protocol::SetSizeFrame(screen_size));
+                break;
+              case CommandLineValues::ClientProtocol::kVmCode:
+                SendCommandsToParent(
+                    remote_server_fd,
+                    "screen.set_size(" +
+                        std::to_string(screen_size.column.column_delta) + "," +
+                        std::to_string(screen_size.line.line_delta) + ");" +
+                        "set_screen_needs_hard_redraw(true);\n");
+                break;
+            }
+            last_screen_size = screen_size;
+          }
         }
       }
-    }
-    VLOG(5) << "Updating remote screens.";
-    for (auto& buffer : *editor_state()->buffers()) {
-      auto value =
-          buffer.second->environment()->Lookup(L"screen", GetScreenVmType());
-      if (value->type.type != VMType::OBJECT_TYPE ||
-          value->type.object_type != L"Screen") {
-        continue;
-      }
-      auto buffer_screen = static_cast<Screen*>(value->user_value.get());
-      if (buffer_screen == nullptr) {
-        continue;
-      }
-      if (buffer_screen == screen_curses.get()) {
-        continue;
+      VLOG(5) << "Updating remote screens.";
+      for (auto& buffer : *editor_state()->buffers()) {
+        auto value =
+            buffer.second->environment()->Lookup(L"screen", GetScreenVmType());
+        if (value->type().type != VMType::OBJECT_TYPE ||
+            value->type().object_type != L"Screen") {
+          continue;
+        }
+        auto buffer_screen = static_cast<Screen*>(value->user_value.get());
+        if (buffer_screen == nullptr) {
+          continue;
+        }
+        if (buffer_screen == screen_curses.get()) {
+          continue;
+        }
+        LOG(INFO) << "Remote screen for buffer: " << buffer.first;
+        terminal.Display(editor_state(), buffer_screen, screen_state);
       }
-      LOG(INFO) << "Remote screen for buffer: " << buffer.first;
-      terminal.Display(editor_state(), buffer_screen, screen_state);
+      frame_rate_governor.RegisterDisplay();
     }
 
     std::vector<std::shared_ptr<OpenBuffer>> buffers;
@@ -411,6 +451,14 @@ int main(int argc, const char** argv) {
 
     auto now = Now();
     auto next_execution = editor_state()->WorkQueueNextExecution();
+    for (auto next_display :
+         {frame_rate_governor.NextDisplay(), terminal.NextExpiration()}) {
+      if (next_display.has_value() &&
+          (!next_execution.has_value() ||
+           next_display.value() < next_execution.value())) {
+        next_execution = next_display;
+      }
+    }
     int timeout_ms =
         next_execution.has_value()
             ? static_cast<int>(ceil(min(
@@ -446,16 +494,33 @@ int main(int argc, const char** argv) {
               EditorState::TerminationType::kIgnoringErrors, 0);
         } else {
           CHECK(screen_curses != nullptr);
+          input_received = true;
           wint_t c;
+          std::vector<wint_t> input_to_send;
           while ((c = ReadChar(&mbstate)) != static_cast<wint_t>(-1)) {
             if (remote_server_fd == -1) {
               editor_state()->ProcessInput(c);
+            } else if (args.client_protocol ==
+                       CommandLineValues::ClientProtocol::kBinary) {
+              input_to_send.push_back(c);
             } else {
               SendCommandsToParent(
                   remote_server_fd,
                   "ProcessInput(" + std::to_string(c) + ");\n");
             }
           }
+          // We send the input in small frames: writes of up to PIPE_BUF
+          // bytes are atomic, so they won't be interleaved with writes from
+          // other clients.
+          static const size_t kMaxInputPerFrame = 512;
+          for (size_t i = 0; i < input_to_send.size(); i += kMaxInputPerFrame) {
+            SendFrameToParent(
+                remote_server_fd,
+                screen_protocol::InputFrame(std::vector<wint_t>(
+                    input_to_send.begin() + i,
+                    input_to_send.begin() +
+                        std::min(i + kMaxInputPerFrame, input_to_send.size()))));
+          }
         }
         continue;
       }
@@ -86,8 +86,8 @@ void MapModeCommands::Add(wstring name, wstring description,
                           std::unique_ptr<Value> value,
                           std::shared_ptr<vm::Environment> environment) {
   CHECK(value != nullptr);
-  CHECK_EQ(value->type.type, VMType::FUNCTION);
-  CHECK(value->type.type_arguments == std::vector<VMType>({VMType::Void()}));
+  CHECK_EQ(value->type().type, VMType::FUNCTION);
+  CHECK(value->type().type_arguments == std::vector<VMType>({VMType::Void()}));
   // TODO: Make a unique_ptr (once capture of unique_ptr is feasible).
   std::shared_ptr<vm::Expression> expression =
       NewFunctionCall(NewConstantExpression(std::move(value)), {});
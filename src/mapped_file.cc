@@ -0,0 +1,324 @@
+#include "src/mapped_file.h"
+
+#include <glog/logging.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+#include "src/line_column.h"
+#include "src/tests/tests.h"
+#include "src/tracker.h"
+#include "src/utf8_decoder.h"
+#include "src/wstring.h"
+
+namespace afc::editor {
+namespace {
+// If a file is truncated while it is mapped, reading the pages past its new end
+// raises SIGBUS. For the ranges registered here, the handler replaces those
+// pages with zero-filled ones, so the lines affected read as '\0' characters
+// (rather than crashing).
+//
+// The handler can't allocate or take locks, so the ranges are kept in a fixed
+// array of atomics.
+struct MappedRange {
+  std::atomic<uintptr_t> start = 0;
+  std::atomic<size_t> size = 0;
+};
+constexpr size_t kMaxMappedRanges = 1024;
+MappedRange mapped_ranges[kMaxMappedRanges];
+uintptr_t page_size = 0;
+struct sigaction previous_sigbus_action;
+
+void HandleSigbus(int signal, siginfo_t* info, void* context) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+  for (auto& range : mapped_ranges) {
+    uintptr_t start = range.start.load();
+    if (start == 0 || address < start ||
+        address >= start + range.size.load()) {
+      continue;
+    }
+    void* page = reinterpret_cast<void*>(address & ~(page_size - 1));
+    if (mmap(page, page_size, PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+             0) != MAP_FAILED) {
+      return;  // Retries the access.
+    }
+    break;
+  }
+  // Not ours (or we failed to fix it): let the previous handler deal with it
+  // when the access is retried.
+  sigaction(SIGBUS, &previous_sigbus_action, nullptr);
+}
+
+// Returns the index of the range, or std::nullopt if all are in use.
+std::optional<size_t> RegisterMappedRange(const char* data, size_t size) {
+  static std::once_flag install_handler_once;
+  std::call_once(install_handler_once, [] {
+    page_size = sysconf(_SC_PAGESIZE);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = &HandleSigbus;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    CHECK_EQ(sigaction(SIGBUS, &action, &previous_sigbus_action), 0);
+  });
+  for (size_t i = 0; i < kMaxMappedRanges; i++) {
+    uintptr_t expected = 0;
+    if (mapped_ranges[i].start.compare_exchange_strong(
+            expected, reinterpret_cast<uintptr_t>(data))) {
+      mapped_ranges[i].size = size;
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+// Either a mapping (registered in `mapped_ranges`) or, if no ranges were
+// available, a copy of the file in the heap.
+class MappedFile {
+ public:
+  MappedFile(const char* data, size_t size, size_t range_index)
+      : data_(data), size_(size), range_index_(range_index) {}
+  MappedFile(std::unique_ptr<char[]> copy, size_t size)
+      : copy_(std::move(copy)), data_(copy_.get()), size_(size) {}
+
+  ~MappedFile() {
+    if (!range_index_.has_value()) return;
+    mapped_ranges[*range_index_].size = 0;
+    mapped_ranges[*range_index_].start = 0;
+    if (munmap(const_cast<char*>(data_), size_) == -1) {
+      LOG(ERROR) << "munmap failed: " << strerror(errno);
+    }
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const std::unique_ptr<char[]> copy_;
+  const char* const data_;
+  const size_t size_;
+  const std::optional<size_t> range_index_;
+};
+
+ValueOrError<std::shared_ptr<const MappedFile>> CopyFile(int fd,
+                                                          size_t size) {
+  auto copy = std::make_unique<char[]>(size);
+  size_t position = 0;
+  while (position < size) {
+    ssize_t result =
+        pread(fd, copy.get() + position, size - position, position);
+    if (result == -1 && errno == EINTR) continue;
+    if (result == -1) {
+      return Error(L"pread failed: " + FromByteString(strerror(errno)));
+    }
+    if (result == 0) break;  // Truncated.
+    position += result;
+  }
+  return Success(std::make_shared<const MappedFile>(std::move(copy), position));
+}
+
+ValueOrError<std::shared_ptr<const MappedFile>> MapFile(int fd, size_t size) {
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return Error(L"mmap failed: " + FromByteString(strerror(errno)));
+  }
+  std::optional<size_t> range_index =
+      RegisterMappedRange(static_cast<char*>(data), size);
+  if (!range_index.has_value()) {
+    LOG(INFO) << "No mapped ranges available, copying the file.";
+    munmap(data, size);
+    return CopyFile(fd, size);
+  }
+  return Success(std::make_shared<const MappedFile>(static_cast<char*>(data),
+                                                    size, *range_index));
+}
+
+bool IsAscii(const char* data, size_t length) {
+  static const uint64_t kHighBits = 0x8080808080808080ull;
+  size_t position = 0;
+  for (; position + sizeof(uint64_t) <= length; position += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + position, sizeof(word));
+    if (word & kHighBits) return false;
+  }
+  for (; position < length; position++) {
+    if (data[position] & 0x80) return false;
+  }
+  return true;
+}
+
+class MappedLine : public LazyString {
+ public:
+  MappedLine(std::shared_ptr<const MappedFile> file, size_t start,
+             size_t length)
+      : file_(std::move(file)), start_(start), length_(length) {
+    CHECK_LE(start_ + length_, file_->size());
+  }
+
+  wchar_t get(ColumnNumber pos) const override {
+    const std::vector<wchar_t>* decoded = Decode();
+    if (decoded == nullptr) {
+      CHECK_LT(pos.column, length_);
+      return static_cast<unsigned char>(data()[pos.column]);
+    }
+    return decoded->at(pos.column);
+  }
+
+  ColumnNumberDelta size() const override {
+    std::call_once(size_once_,
+                   [this] { size_ = CountUtf8Characters(data(), length_); });
+    return ColumnNumberDelta(size_);
+  }
+
+ private:
+  const char* data() const { return file_->data() + start_; }
+
+  // Returns nullptr if the line only contains ASCII characters (in which case
+  // the characters can be read directly from the mapping).
+  const std::vector<wchar_t>* Decode() const {
+    std::call_once(decode_once_, [this] {
+      if (IsAscii(data(), length_)) return;
+      static Tracker tracker(L"MappedLine::Decode");
+      auto call = tracker.Call();
+      DecodedUtf8 decoded = DecodeUtf8(data(), length_);
+      // A truncated sequence at the end of the line: expose the raw bytes.
+      for (size_t i = decoded.bytes_consumed; i < length_; i++) {
+        decoded.contents.push_back(static_cast<unsigned char>(data()[i]));
+      }
+      decoded_ =
+          std::make_unique<std::vector<wchar_t>>(std::move(decoded.contents));
+    });
+    return decoded_.get();
+  }
+
+  const std::shared_ptr<const MappedFile> file_;
+  const size_t start_;
+  const size_t length_;
+
+  mutable std::once_flag decode_once_;
+  mutable std::unique_ptr<std::vector<wchar_t>> decoded_;
+
+  mutable std::once_flag size_once_;
+  mutable size_t size_ = 0;
+};
+}  // namespace
+
+ValueOrError<std::vector<std::shared_ptr<LazyString>>> ReadMappedFileLines(
+    int fd) {
+  static Tracker tracker(L"ReadMappedFileLines");
+  auto call = tracker.Call();
+
+  struct stat stat_buffer;
+  if (fstat(fd, &stat_buffer) == -1) {
+    Error error(L"fstat failed: " + FromByteString(strerror(errno)));
+    close(fd);
+    return error;
+  }
+
+  std::vector<std::shared_ptr<LazyString>> output;
+  size_t size = stat_buffer.st_size;
+  if (size == 0) {
+    close(fd);
+    output.push_back(EmptyString());
+    return Success(std::move(output));
+  }
+
+  auto file_or_error = MapFile(fd, size);
+  close(fd);
+  if (file_or_error.IsError()) return file_or_error.error();
+  std::shared_ptr<const MappedFile> file = file_or_error.value();
+  size = file->size();
+  size_t line_start = 0;
+  while (true) {
+    const void* newline =
+        memchr(file->data() + line_start, '\n', size - line_start);
+    if (newline == nullptr) break;
+    size_t line_end = static_cast<const char*>(newline) - file->data();
+    output.push_back(
+        std::make_shared<MappedLine>(file, line_start, line_end - line_start));
+    line_start = line_end + 1;
+  }
+  output.push_back(
+      std::make_shared<MappedLine>(file, line_start, size - line_start));
+  LOG(INFO) << "Mapped file with " << size << " bytes, lines: "
+            << output.size();
+  return Success(std::move(output));
+}
+
+namespace {
+std::vector<std::wstring> ReadLines(std::string contents) {
+  char path[] = "/tmp/edge-mapped-file-test-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK_NE(fd, -1);
+  CHECK_EQ(write(fd, contents.c_str(), contents.size()),
+           static_cast<ssize_t>(contents.size()));
+  unlink(path);
+  auto lines = ReadMappedFileLines(fd);
+  CHECK(!lines.IsError());
+  std::vector<std::wstring> output;
+  for (auto& line : lines.value()) output.push_back(line->ToString());
+  return output;
+}
+
+class ReadMappedFileLinesTests
+    : public tests::TestGroup<ReadMappedFileLinesTests> {
+ public:
+  ReadMappedFileLinesTests() : TestGroup<ReadMappedFileLinesTests>() {}
+  std::wstring Name() const override { return L"ReadMappedFileLinesTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"EmptyFile",
+             .callback =
+                 [] {
+                   CHECK(ReadLines("") == std::vector<std::wstring>({L""}));
+                 }},
+            {.name = L"Ascii",
+             .callback =
+                 [] {
+                   CHECK(ReadLines("alejandro\nforero\n\ncuervo") ==
+                         std::vector<std::wstring>(
+                             {L"alejandro", L"forero", L"", L"cuervo"}));
+                 }},
+            {.name = L"TrailingNewLine",
+             .callback =
+                 [] {
+                   CHECK(ReadLines("foo\n") ==
+                         std::vector<std::wstring>({L"foo", L""}));
+                 }},
+            {.name = L"Multibyte",
+             .callback =
+                 [] {
+                   CHECK(ReadLines("a\xc3\xb1o\n\xe2\x82\xac") ==
+                         std::vector<std::wstring>({L"a\u00f1o", L"\u20ac"}));
+                 }},
+            {.name = L"Truncated", .callback = [] {
+               char path[] = "/tmp/edge-mapped-file-test-XXXXXX";
+               int fd = mkstemp(path);
+               CHECK_NE(fd, -1);
+               unlink(path);
+               std::string contents = std::string(10000, 'a') + "\nbb";
+               CHECK_EQ(write(fd, contents.c_str(), contents.size()),
+                        static_cast<ssize_t>(contents.size()));
+               int truncate_fd = dup(fd);
+               auto lines = ReadMappedFileLines(fd);
+               CHECK(!lines.IsError());
+               CHECK_EQ(ftruncate(truncate_fd, 0), 0);
+               close(truncate_fd);
+               CHECK_EQ(lines.value().size(), 2ul);
+               CHECK(lines.value()[0]->ToString() ==
+                     std::wstring(10000, L'\0'));
+               CHECK(lines.value()[1]->ToString() == std::wstring(2, L'\0'));
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<ReadMappedFileLinesTests>::registration_ =
+    tests::Add<editor::ReadMappedFileLinesTests>();
+}  // namespace
+}  // namespace afc::editor
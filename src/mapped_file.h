@@ -0,0 +1,31 @@
+#ifndef __AFC_EDITOR_MAPPED_FILE_H__
+#define __AFC_EDITOR_MAPPED_FILE_H__
+
+#include <memory>
+#include <vector>
+
+#include "src/lazy_string.h"
+#include "src/value_or_error.h"
+
+namespace afc::editor {
+
+// Maps a regular file into memory and splits its contents into lines (without
+// the '\n' separators). The strings returned are views into the mapping (which
+// they keep alive); each line is decoded (from UTF-8) the first time its
+// contents are needed. Lines consisting only of ASCII characters are never
+// copied.
+//
+// Ownership of `fd` is transferred (it is closed before returning).
+//
+// The caller is expected to run this in a background thread: it touches every
+// byte once (to find the line boundaries), so it takes time linear in the size
+// of the file.
+//
+// If the file is truncated while the lines are in use, the bytes past its new
+// end read as '\0' (a SIGBUS handler maps zero pages over them).
+ValueOrError<std::vector<std::shared_ptr<LazyString>>> ReadMappedFileLines(
+    int fd);
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_MAPPED_FILE_H__
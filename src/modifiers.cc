@@ -128,8 +128,8 @@ namespace vm {
 std::shared_ptr<editor::Modifiers>
 VMTypeMapper<std::shared_ptr<editor::Modifiers>>::get(Value* value) {
   CHECK(value != nullptr);
-  CHECK(value->type.type == VMType::OBJECT_TYPE);
-  CHECK(value->type.object_type == L"Modifiers");
+  CHECK(value->type().type == VMType::OBJECT_TYPE);
+  CHECK(value->type().object_type == L"Modifiers");
   CHECK(value->user_value != nullptr);
   return std::static_pointer_cast<editor::Modifiers>(value->user_value);
 }
@@ -8,7 +8,7 @@ namespace editor {
                 std::move(modifiers));
 }
 
-void Action::Execute(std::vector<ParseTree>* trees, LineNumber line) {
+void Action::Execute(std::vector<ParseTree>* trees, LineNumber line) const {
   switch (action_type) {
     case PUSH: {
       trees->emplace_back(Range(LineColumn(line, column), LineColumn()));
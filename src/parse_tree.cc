@@ -24,13 +24,6 @@ std::ostream& operator<<(std::ostream& os, const ParseTree& t) {
 
 ParseTree::ParseTree(Range range) : range_(std::move(range)) {}
 
-ParseTree::ParseTree(const ParseTree& other)
-    : children_(other.children()),
-      children_hashes_(other.children_hashes_),
-      range_(other.range()),
-      depth_(other.depth()),
-      modifiers_(other.modifiers()) {}
-
 Range ParseTree::range() const { return range_; }
 void ParseTree::set_range(Range range) { range_ = range; }
 
@@ -46,25 +39,38 @@ void ParseTree::InsertModifier(LineModifier modifier) {
   modifiers_.insert(modifier);
 }
 
-const std::vector<ParseTree>& ParseTree::children() const { return children_; }
+const std::vector<ParseTree>& ParseTree::children() const {
+  static const std::vector<ParseTree>* const empty =
+      new std::vector<ParseTree>();
+  return children_ == nullptr ? *empty : *children_;
+}
 
 std::unique_ptr<ParseTree, std::function<void(ParseTree*)>>
 ParseTree::MutableChildren(size_t i) {
-  CHECK_LT(i, children_.size());
+  CHECK_LT(i, children().size());
   XorChildHash(i);  // Remove its old hash.
   return std::unique_ptr<ParseTree, std::function<void(ParseTree*)>>(
-      &children_[i], [this, i](ParseTree* child) {
+      &UnshareChildren()[i], [this, i](ParseTree* child) {
         depth_ = max(depth(), child->depth() + 1);
         XorChildHash(i);  // Add its new hash.
       });
 }
 
 void ParseTree::XorChildHash(size_t position) {
-  children_hashes_ ^= hash_combine(position, children_[position].hash());
+  children_hashes_ ^= hash_combine(position, children()[position].hash());
+}
+
+std::vector<ParseTree>& ParseTree::UnshareChildren() {
+  if (children_ == nullptr) {
+    children_ = std::make_shared<std::vector<ParseTree>>();
+  } else if (children_.use_count() > 1) {
+    children_ = std::make_shared<std::vector<ParseTree>>(*children_);
+  }
+  return *children_;
 }
 
 void ParseTree::Reset() {
-  children_.clear();
+  children_ = nullptr;
   children_hashes_ = 0;
   depth_ = 0;
   set_modifiers(LineModifierSet());
@@ -72,8 +78,9 @@ void ParseTree::Reset() {
 
 void ParseTree::PushChild(ParseTree child) {
   depth_ = max(depth(), child.depth() + 1);
-  children_.push_back(std::move(child));
-  XorChildHash(children_.size() - 1);
+  auto& children = UnshareChildren();
+  children.push_back(std::move(child));
+  XorChildHash(children.size() - 1);
 }
 
 size_t ParseTree::hash() const {
@@ -269,6 +276,11 @@ class LineTreeParser : public TreeParser {
   return dynamic_cast<NullTreeParser*>(parser) != nullptr;
 }
 
+std::optional<ParseTree> TreeParser::FindChildrenUnlessAborted(
+    const BufferContents& lines, const Notification&) {
+  return FindChildren(lines, lines.range());
+}
+
 std::unique_ptr<TreeParser> NewNullTreeParser() {
   return std::make_unique<NullTreeParser>();
 }
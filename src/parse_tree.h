@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_set>
 
@@ -23,7 +24,6 @@ class ParseTree {
   ParseTree() = default;
 
   ParseTree(Range range);
-  ParseTree(const ParseTree& other);
 
   Range range() const;
   void set_range(Range range);
@@ -53,7 +53,13 @@ class ParseTree {
  private:
   void XorChildHash(size_t position);
 
-  std::vector<ParseTree> children_;
+  // Ensures that `children_` isn't shared with other trees, so that it can be
+  // modified.
+  std::vector<ParseTree>& UnshareChildren();
+
+  // Shared between copies (until one of them is modified), so that copying a
+  // tree runs in constant time. May be null (if there are no children).
+  std::shared_ptr<std::vector<ParseTree>> children_;
 
   // The xor of the hashes of all children (including their positions).
   size_t children_hashes_ = 0;
@@ -88,12 +94,19 @@ const ParseTree* FollowRoute(const ParseTree& root,
 std::ostream& operator<<(std::ostream& os, const ParseTree& lc);
 
 class OpenBuffer;
+class Notification;
 
 class TreeParser {
  public:
   static bool IsNull(TreeParser*);
 
   virtual ParseTree FindChildren(const BufferContents& lines, Range range) = 0;
+
+  // Equivalent to `FindChildren(lines, lines.range())`, but parsers may give up
+  // (returning std::nullopt) once `abort_notification` is notified, keeping
+  // the work done so that the next call can continue it.
+  virtual std::optional<ParseTree> FindChildrenUnlessAborted(
+      const BufferContents& lines, const Notification& abort_notification);
 };
 
 std::unique_ptr<TreeParser> NewNullTreeParser();
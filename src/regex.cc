@@ -0,0 +1,695 @@
+#include "src/regex.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <optional>
+#include <regex>
+
+#include "src/char_buffer.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
+
+namespace afc::editor {
+namespace {
+// Bounds the size of the NFA (repetitions are expanded).
+static constexpr size_t kMaxRepetitions = 1000;
+static constexpr size_t kMaxNfaStates = 100000;
+
+// Bounds the memory used by a RegexMatcher: once the DFA reaches this size, the
+// cache is cleared.
+static constexpr size_t kMaxDfaStates = 4096;
+
+struct Node {
+  enum class Type {
+    kSequence,
+    kAlternation,
+    kRepetition,
+    kCharacter,
+    kAnyCharacter,
+    kClass,
+    kLineBegin,
+    kLineEnd
+  };
+
+  explicit Node(Type type) : type(type) {}
+
+  Type type;
+  wchar_t character = 0;
+  size_t class_index = 0;
+  std::vector<Node> children;
+
+  // Only used by kRepetition.
+  size_t min = 0;
+  std::optional<size_t> max;
+};
+}  // namespace
+
+class RegexCompiler {
+ public:
+  RegexCompiler(const std::wstring& pattern, Regex* output)
+      : pattern_(pattern), output_(output) {}
+
+  PossibleError Compile() {
+    ASSIGN_OR_RETURN(Node root, ParseAlternation());
+    if (position_ < pattern_.size()) {
+      CHECK_EQ(pattern_[position_], L')');
+      return Error(L"Unmatched ')'");
+    }
+    CollectRequiredLiterals(root);
+    int match = AddState({.type = Regex::State::Type::kMatch});
+    output_->start_ = CompileNode(root, match);
+    if (output_->states_.size() > kMaxNfaStates) {
+      return Error(L"Regular expression is too large");
+    }
+    return Success();
+  }
+
+ private:
+  bool AtEnd() const { return position_ == pattern_.size(); }
+
+  // Adds to `required_literals_` strings that every match of `node` contains.
+  // Only looks for runs of consecutive characters in sequences, so it may miss
+  // some.
+  void CollectRequiredLiterals(const Node& node) {
+    switch (node.type) {
+      case Node::Type::kCharacter:
+        output_->required_literals_.push_back(std::wstring(1, node.character));
+        return;
+      case Node::Type::kSequence: {
+        std::wstring literal;
+        for (const Node& child : node.children) {
+          if (child.type == Node::Type::kCharacter) {
+            literal.push_back(child.character);
+            continue;
+          }
+          if (!literal.empty()) {
+            output_->required_literals_.push_back(std::move(literal));
+            literal.clear();
+          }
+          CollectRequiredLiterals(child);
+        }
+        if (!literal.empty()) {
+          output_->required_literals_.push_back(std::move(literal));
+        }
+        return;
+      }
+      case Node::Type::kRepetition:
+        if (node.min > 0) CollectRequiredLiterals(node.children[0]);
+        return;
+      case Node::Type::kAlternation:
+      case Node::Type::kAnyCharacter:
+      case Node::Type::kClass:
+      case Node::Type::kLineBegin:
+      case Node::Type::kLineEnd:
+        return;
+    }
+  }
+
+  bool Consume(wchar_t c) {
+    if (AtEnd() || pattern_[position_] != c) return false;
+    position_++;
+    return true;
+  }
+
+  ValueOrError<Node> ParseAlternation() {
+    Node output(Node::Type::kAlternation);
+    do {
+      ASSIGN_OR_RETURN(Node sequence, ParseSequence());
+      output.children.push_back(std::move(sequence));
+    } while (Consume(L'|'));
+    if (output.children.size() == 1) {
+      return Success(std::move(output.children[0]));
+    }
+    return Success(std::move(output));
+  }
+
+  ValueOrError<Node> ParseSequence() {
+    Node output(Node::Type::kSequence);
+    while (!AtEnd() && pattern_[position_] != L'|' &&
+           pattern_[position_] != L')') {
+      ASSIGN_OR_RETURN(Node atom, ParseAtom());
+      while (true) {
+        Node repetition(Node::Type::kRepetition);
+        if (Consume(L'*')) {
+          repetition.min = 0;
+        } else if (Consume(L'+')) {
+          repetition.min = 1;
+        } else if (Consume(L'?')) {
+          repetition.min = 0;
+          repetition.max = 1;
+        } else if (position_ + 1 < pattern_.size() &&
+                   pattern_[position_] == L'{' &&
+                   iswdigit(pattern_[position_ + 1])) {
+          position_++;
+          repetition.min = ParseNumber();
+          if (Consume(L',')) {
+            if (!AtEnd() && iswdigit(pattern_[position_])) {
+              repetition.max = ParseNumber();
+            }
+          } else {
+            repetition.max = repetition.min;
+          }
+          if (!Consume(L'}')) return Error(L"Unmatched '{'");
+          if ((repetition.max.has_value() &&
+               repetition.max.value() < repetition.min) ||
+              repetition.min > kMaxRepetitions ||
+              repetition.max.value_or(0) > kMaxRepetitions) {
+            return Error(L"Invalid repetition bounds");
+          }
+        } else {
+          break;
+        }
+        repetition.children.push_back(std::move(atom));
+        atom = std::move(repetition);
+      }
+      output.children.push_back(std::move(atom));
+    }
+    return Success(std::move(output));
+  }
+
+  size_t ParseNumber() {
+    size_t output = 0;
+    while (!AtEnd() && iswdigit(pattern_[position_])) {
+      output = std::min(output * 10 + pattern_[position_++] - L'0',
+                        kMaxRepetitions + 1);
+    }
+    return output;
+  }
+
+  ValueOrError<Node> ParseAtom() {
+    wchar_t c = pattern_[position_++];
+    switch (c) {
+      case L'(': {
+        ASSIGN_OR_RETURN(Node output, ParseAlternation());
+        if (!Consume(L')')) return Error(L"Unmatched '('");
+        return Success(std::move(output));
+      }
+      case L'.':
+        return Success(Node(Node::Type::kAnyCharacter));
+      case L'^':
+        return Success(Node(Node::Type::kLineBegin));
+      case L'$':
+        return Success(Node(Node::Type::kLineEnd));
+      case L'[':
+        return ParseBracketExpression();
+      case L'*':
+      case L'+':
+      case L'?':
+        return Error(L"Nothing to repeat");
+      case L'\\':
+        if (AtEnd()) return Error(L"Trailing backslash");
+        c = pattern_[position_++];
+        break;
+    }
+    Node output(Node::Type::kCharacter);
+    output.character = c;
+    return Success(std::move(output));
+  }
+
+  // Parses a bracket expression, after its opening '['.
+  ValueOrError<Node> ParseBracketExpression() {
+    Regex::CharacterClass output;
+    output.negated = Consume(L'^');
+    bool first = true;
+    while (true) {
+      if (AtEnd()) return Error(L"Unmatched '['");
+      wchar_t c = pattern_[position_++];
+      if (c == L']' && !first) break;
+      first = false;
+      if (c == L'[' && Consume(L':')) {
+        size_t end = pattern_.find(L":]", position_);
+        if (end == std::wstring::npos) return Error(L"Unmatched '[:'");
+        std::wctype_t type = std::wctype(
+            ToByteString(pattern_.substr(position_, end - position_)).c_str());
+        if (type == 0) {
+          return Error(L"Invalid character class: " +
+                       pattern_.substr(position_, end - position_));
+        }
+        output.types.push_back(type);
+        position_ = end + 2;
+        continue;
+      }
+      wchar_t last = c;
+      if (position_ + 1 < pattern_.size() && pattern_[position_] == L'-' &&
+          pattern_[position_ + 1] != L']') {
+        last = pattern_[position_ + 1];
+        position_ += 2;
+        if (last < c) return Error(L"Invalid range in bracket expression");
+      }
+      output.ranges.push_back({c, last});
+    }
+    output_->classes_.push_back(std::move(output));
+    Node node(Node::Type::kClass);
+    node.class_index = output_->classes_.size() - 1;
+    return Success(std::move(node));
+  }
+
+  int AddState(Regex::State state) {
+    output_->states_.push_back(state);
+    return output_->states_.size() - 1;
+  }
+
+  // Adds the states recognizing the reverse of `node` (so the last element in
+  // a sequence is the first to be consumed), continuing to `next`. Returns the
+  // entry state.
+  int CompileNode(const Node& node, int next) {
+    // Avoid spending time on patterns that will be rejected.
+    if (output_->states_.size() > kMaxNfaStates) return next;
+    using Type = Regex::State::Type;
+    switch (node.type) {
+      case Node::Type::kSequence:
+        for (const Node& child : node.children) {
+          next = CompileNode(child, next);
+        }
+        return next;
+      case Node::Type::kAlternation: {
+        int output = CompileNode(node.children.back(), next);
+        for (size_t i = node.children.size() - 1; i > 0; i--) {
+          output = AddState({.type = Type::kSplit,
+                             .next = CompileNode(node.children[i - 1], next),
+                             .alternative = output});
+        }
+        return output;
+      }
+      case Node::Type::kRepetition: {
+        const Node& child = node.children[0];
+        int output = next;
+        if (!node.max.has_value()) {
+          output = AddState({.type = Type::kSplit, .alternative = next});
+          int body = CompileNode(child, output);
+          output_->states_[output].next = body;
+        } else {
+          for (size_t i = node.min; i < node.max.value(); i++) {
+            output = AddState({.type = Type::kSplit,
+                               .next = CompileNode(child, output),
+                               .alternative = next});
+          }
+        }
+        for (size_t i = 0; i < node.min; i++) {
+          output = CompileNode(child, output);
+        }
+        return output;
+      }
+      case Node::Type::kCharacter:
+        return AddState({.type = Type::kCharacter,
+                         .character = output_->options_.case_insensitive
+                                          ? static_cast<wchar_t>(
+                                                towlower(node.character))
+                                          : node.character,
+                         .next = next});
+      case Node::Type::kAnyCharacter:
+        return AddState({.type = Type::kAnyCharacter, .next = next});
+      case Node::Type::kClass:
+        return AddState({.type = Type::kClass,
+                         .class_index = node.class_index,
+                         .next = next});
+      case Node::Type::kLineBegin:
+        return AddState({.type = Type::kLineBegin, .next = next});
+      case Node::Type::kLineEnd:
+        return AddState({.type = Type::kLineEnd, .next = next});
+    }
+    LOG(FATAL) << "Invalid node type.";
+    return next;
+  }
+
+  const std::wstring& pattern_;
+  size_t position_ = 0;
+  Regex* const output_;
+};
+
+/* static */ ValueOrError<std::shared_ptr<const Regex>> Regex::New(
+    const std::wstring& pattern, Options options) {
+  auto output = std::make_shared<Regex>(ConstructorAccessTag(), options);
+  RegexCompiler compiler(pattern, output.get());
+  if (auto result = compiler.Compile(); result.IsError()) {
+    return result.error();
+  }
+  return Success(std::shared_ptr<const Regex>(std::move(output)));
+}
+
+bool Regex::CharacterClass::Matches(wchar_t c) const {
+  bool found =
+      std::any_of(ranges.begin(), ranges.end(),
+                  [c](auto& range) {
+                    return range.first <= c && c <= range.second;
+                  }) ||
+      std::any_of(types.begin(), types.end(),
+                  [c](std::wctype_t type) { return iswctype(c, type); });
+  return found != negated;
+}
+
+RegexMatcher::RegexMatcher(std::shared_ptr<const Regex> regex)
+    : regex_(std::move(regex)), visited_(regex_->states_.size()) {}
+
+std::vector<ColumnNumber> RegexMatcher::MatchStarts(const LazyString& input) {
+  std::vector<ColumnNumber> output;
+  size_t size = input.size().column_delta;
+  if (size == 0) return output;
+
+  // We walk the input backwards, running the NFA for the reversed pattern. The
+  // set of states at a given position contains the accepting state iff a match
+  // starts at that position.
+  if (end_state_ == -1) {
+    end_state_ =
+        Intern(Closure({regex_->start_}, /*at_begin=*/false, /*at_end=*/true));
+  }
+  int state = end_state_;
+  for (size_t column = size - 1; column > 0; column--) {
+    wchar_t c = input.get(ColumnNumber(column));
+    int next = c >= 0 && c < 128 ? dfa_states_[state].ascii_transitions[c] : -1;
+    state = next == -1 ? Transition(state, c) : next;
+    if (dfa_states_[state].accepting) {
+      output.push_back(ColumnNumber(column));
+    }
+  }
+  // The first position is the only one where `^` holds.
+  wchar_t c = input.get(ColumnNumber(0));
+  auto [it, inserted] =
+      dfa_states_[state].accepting_at_begin.insert({c, false});
+  if (inserted) {
+    it->second = Accepting(Closure(Step(dfa_states_[state].nfa_states, c),
+                                   /*at_begin=*/true, /*at_end=*/false));
+  }
+  if (it->second) output.push_back(ColumnNumber(0));
+  std::reverse(output.begin(), output.end());
+  return output;
+}
+
+bool RegexMatcher::Matches(const Regex::State& state, wchar_t c) const {
+  using Type = Regex::State::Type;
+  switch (state.type) {
+    case Type::kCharacter:
+      return (regex_->options_.case_insensitive
+                  ? static_cast<wchar_t>(towlower(c))
+                  : c) == state.character;
+    case Type::kAnyCharacter:
+      return true;
+    case Type::kClass: {
+      const auto& character_class = regex_->classes_[state.class_index];
+      return character_class.Matches(c) ||
+             (regex_->options_.case_insensitive &&
+              (character_class.Matches(towlower(c)) ||
+               character_class.Matches(towupper(c))));
+    }
+    default:
+      return false;
+  }
+}
+
+std::vector<int> RegexMatcher::Closure(std::vector<int> seeds, bool at_begin,
+                                       bool at_end) {
+  using Type = Regex::State::Type;
+  generation_++;
+  std::vector<int> output;
+  while (!seeds.empty()) {
+    int index = seeds.back();
+    seeds.pop_back();
+    if (visited_[index] == generation_) continue;
+    visited_[index] = generation_;
+    const Regex::State& state = regex_->states_[index];
+    switch (state.type) {
+      case Type::kSplit:
+        seeds.push_back(state.alternative);
+        seeds.push_back(state.next);
+        break;
+      case Type::kLineBegin:
+        if (at_begin) seeds.push_back(state.next);
+        break;
+      case Type::kLineEnd:
+        if (at_end) seeds.push_back(state.next);
+        break;
+      default:
+        output.push_back(index);
+    }
+  }
+  std::sort(output.begin(), output.end());
+  return output;
+}
+
+std::vector<int> RegexMatcher::Step(const std::vector<int>& states,
+                                    wchar_t c) const {
+  std::vector<int> output = {regex_->start_};
+  for (int index : states) {
+    const Regex::State& state = regex_->states_[index];
+    if (Matches(state, c)) output.push_back(state.next);
+  }
+  return output;
+}
+
+bool RegexMatcher::Accepting(const std::vector<int>& states) const {
+  return std::any_of(states.begin(), states.end(), [this](int index) {
+    return regex_->states_[index].type == Regex::State::Type::kMatch;
+  });
+}
+
+int RegexMatcher::Transition(int dfa_state, wchar_t c) {
+  auto get_cache = [&]() -> int& {
+    DfaState& state = dfa_states_[dfa_state];
+    return c >= 0 && c < 128 ? state.ascii_transitions[c]
+                             : state.transitions.insert({c, -1}).first->second;
+  };
+  if (int cached = get_cache(); cached != -1) return cached;
+
+  auto nfa_states =
+      Closure(Step(dfa_states_[dfa_state].nfa_states, c), false, false);
+  if (dfa_states_.size() >= kMaxDfaStates &&
+      dfa_index_.find(nfa_states) == dfa_index_.end()) {
+    VLOG(5) << "Clearing DFA cache.";
+    dfa_states_.clear();
+    dfa_index_.clear();
+    end_state_ = -1;
+    return Intern(std::move(nfa_states));
+  }
+  int output = Intern(std::move(nfa_states));
+  get_cache() = output;
+  return output;
+}
+
+int RegexMatcher::Intern(std::vector<int> nfa_states) {
+  if (auto it = dfa_index_.find(nfa_states); it != dfa_index_.end()) {
+    return it->second;
+  }
+  DfaState state;
+  state.accepting = Accepting(nfa_states);
+  state.ascii_transitions.fill(-1);
+  state.nfa_states = nfa_states;
+  dfa_states_.push_back(std::move(state));
+  int output = dfa_states_.size() - 1;
+  dfa_index_.insert({std::move(nfa_states), output});
+  return output;
+}
+
+namespace {
+std::vector<ColumnNumber> MatchStarts(std::wstring pattern, std::wstring input,
+                                      bool case_insensitive = false) {
+  auto regex = Regex::New(pattern, {.case_insensitive = case_insensitive});
+  CHECK(!regex.IsError()) << regex.error();
+  return RegexMatcher(regex.value()).MatchStarts(*NewLazyString(input));
+}
+
+std::vector<ColumnNumber> Columns(std::vector<size_t> columns) {
+  std::vector<ColumnNumber> output;
+  for (auto& column : columns) output.push_back(ColumnNumber(column));
+  return output;
+}
+
+// Returns the positions at which a match starts, running std::regex_match on
+// every substring. Only valid for patterns without anchors.
+std::vector<ColumnNumber> ReferenceMatchStarts(const std::wstring& pattern,
+                                               const std::wstring& input) {
+  std::wregex regex(pattern, std::regex_constants::extended);
+  std::vector<ColumnNumber> output;
+  for (size_t start = 0; start < input.size(); start++) {
+    for (size_t end = start; end <= input.size(); end++) {
+      if (std::regex_match(input.begin() + start, input.begin() + end,
+                           regex)) {
+        output.push_back(ColumnNumber(start));
+        break;
+      }
+    }
+  }
+  return output;
+}
+
+class RegexTests : public tests::TestGroup<RegexTests> {
+ public:
+  RegexTests() : TestGroup<RegexTests>() {}
+  std::wstring Name() const override { return L"RegexTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {
+        {.name = L"Literal",
+         .callback =
+             [] {
+               CHECK(MatchStarts(L"foo", L"afoofoo") == Columns({1, 4}));
+               CHECK(MatchStarts(L"aa", L"aaaa") == Columns({0, 1, 2}));
+               CHECK(MatchStarts(L"foo", L"").empty());
+               CHECK(MatchStarts(L"foo", L"fo").empty());
+             }},
+        {.name = L"Operators",
+         .callback =
+             [] {
+               CHECK(MatchStarts(L"a|bc", L"xabcb") == Columns({1, 2}));
+               CHECK(MatchStarts(L"(ab)+c", L"abababc abc ac") ==
+                     Columns({0, 2, 4, 8}));
+               CHECK(MatchStarts(L"ab?c", L"ac abc abbc") == Columns({0, 3}));
+               CHECK(MatchStarts(L"ab{2,3}c", L"abc abbc abbbc abbbbc") ==
+                     Columns({4, 9}));
+               CHECK(MatchStarts(L"ab{2,}c", L"abc abbbbc") == Columns({4}));
+               CHECK(MatchStarts(L"a.c", L"abc a c ac") == Columns({0, 4}));
+               CHECK(MatchStarts(L"a\\.c", L"abc a.c") == Columns({4}));
+               CHECK(MatchStarts(L"x*", L"abc") == Columns({0, 1, 2}));
+             }},
+        {.name = L"Anchors",
+         .callback =
+             [] {
+               CHECK(MatchStarts(L"^a", L"aaa") == Columns({0}));
+               CHECK(MatchStarts(L"a$", L"aaa") == Columns({2}));
+               CHECK(MatchStarts(L"^a*$", L"aaa") == Columns({0}));
+               CHECK(MatchStarts(L"^b", L"ab").empty());
+               CHECK(MatchStarts(L"a^", L"aa").empty());
+               CHECK(MatchStarts(L"^", L"abc") == Columns({0}));
+             }},
+        {.name = L"BracketExpressions",
+         .callback =
+             [] {
+               CHECK(MatchStarts(L"[0-9]+", L"a12b3") == Columns({1, 2, 4}));
+               CHECK(MatchStarts(L"[^a-z]", L"aB1c") == Columns({1, 2}));
+               CHECK(MatchStarts(L"[[:digit:]x]", L"a1xb") == Columns({1, 2}));
+               CHECK(MatchStarts(L"[]a]", L"b]a") == Columns({1, 2}));
+               CHECK(MatchStarts(L"[a-]", L"b-a") == Columns({1, 2}));
+             }},
+        {.name = L"CaseInsensitive",
+         .callback =
+             [] {
+               CHECK(MatchStarts(L"FoO", L"foo FOO fOo", true) ==
+                     Columns({0, 4, 8}));
+               CHECK(MatchStarts(L"[a-c]", L"xAbC", true) ==
+                     Columns({1, 2, 3}));
+               CHECK(MatchStarts(L"FoO", L"foo FOO").empty());
+             }},
+        {.name = L"Errors",
+         .callback =
+             [] {
+               for (std::wstring pattern :
+                    {L"(", L"a)", L"*a", L"a|+", L"[a", L"[z-a]", L"a{3,2}",
+                     L"a{2", L"\\", L"[[:foo:]]", L"(a{1000}){1000}"}) {
+                 CHECK(Regex::New(pattern, {}).IsError()) << pattern;
+               }
+             }},
+        {.name = L"RequiredLiterals",
+         .callback =
+             [] {
+               auto literals = [](std::wstring pattern) {
+                 return Regex::New(pattern, {}).value()->required_literals();
+               };
+               using Literals = std::vector<std::wstring>;
+               CHECK(literals(L"foo") == Literals({L"foo"}));
+               CHECK(literals(L"^fo[a-z]+bar(baz)?.*x{2}q(ab|cd)")
+                     == Literals({L"fo", L"bar", L"x", L"q"}));
+               CHECK(literals(L"(ab+c)+") == Literals({L"a", L"b", L"c"}));
+               CHECK(literals(L"foo|bar").empty());
+               CHECK(literals(L"a\\.b") == Literals({L"a.b"}));
+             }},
+        {.name = L"LinearTime",
+         .callback =
+             [] {
+               // Patterns that make backtracking engines take exponential
+               // time.
+               std::wstring input(10000, L'a');
+               CHECK(MatchStarts(L"(a*)*b", input).empty());
+               CHECK_EQ(MatchStarts(L"(a|aa)+$", input).size(), input.size());
+             }},
+        {.name = L"CacheOverflow",
+         .callback =
+             [] {
+               // Needs many more DFA states than the cache holds.
+               std::wstring pattern = L"a.{12}$";
+               std::wstring input;
+               for (int i = 0; i < 20000; i++) {
+                 input.push_back(random() % 2 == 0 ? L'a' : L'b');
+               }
+               auto expected = input[input.size() - 13] == L'a'
+                                   ? Columns({input.size() - 13})
+                                   : Columns({});
+               CHECK(MatchStarts(pattern, input) == expected);
+               pattern = L"a.{12}b";
+               auto results = MatchStarts(pattern, input);
+               std::vector<ColumnNumber> reference;
+               for (size_t i = 0; i + 13 < input.size(); i++) {
+                 if (input[i] == L'a' && input[i + 13] == L'b') {
+                   reference.push_back(ColumnNumber(i));
+                 }
+               }
+               CHECK(results == reference);
+             }},
+        {.name = L"RandomAgainstStdRegex", .callback = [] {
+           std::vector<std::wstring> atoms = {L"a",     L"b",    L".",
+                                              L"[ab]",  L"(a|b)", L"(ab)",
+                                              L"[^a]",  L"c"};
+           std::vector<std::wstring> suffixes = {L"", L"", L"*", L"+", L"?",
+                                                 L"{1,2}"};
+           for (int i = 0; i < 200; i++) {
+             std::wstring pattern;
+             int length = 1 + random() % 4;
+             for (int j = 0; j < length; j++) {
+               pattern += atoms[random() % atoms.size()] +
+                          suffixes[random() % suffixes.size()];
+             }
+             std::wstring input;
+             int input_length = random() % 12;
+             for (int j = 0; j < input_length; j++) {
+               input.push_back(L"abc"[random() % 3]);
+             }
+             CHECK(MatchStarts(pattern, input) ==
+                   ReferenceMatchStarts(pattern, input))
+                 << pattern << " on " << input;
+           }
+         }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<RegexTests>::registration_ =
+    tests::Add<editor::RegexTests>();
+
+std::wstring RandomLine(size_t length) {
+  static const std::wstring kCharacters =
+      L"abcdefghijklmnopqrstuvwxyz0123456789 ()[]{}.;:_-";
+  std::wstring output;
+  for (size_t i = 0; i < length; i++) {
+    output.push_back(kCharacters[random() % kCharacters.size()]);
+  }
+  return output;
+}
+
+// Returns the time per character.
+bool registration_match_starts =
+    tests::RegisterBenchmark(L"Regex::MatchStarts", [](int elements) {
+      auto input = NewLazyString(RandomLine(elements));
+      RegexMatcher matcher(Regex::New(L"[a-c]x?(foo|ba+r)", {}).value());
+      auto start = Now();
+      matcher.MatchStarts(*input);
+      auto end = Now();
+      return SecondsBetween(start, end) / elements;
+    });
+
+// Returns the time per character of the approach used before `Regex`.
+bool registration_std_regex =
+    tests::RegisterBenchmark(L"Regex::StdRegex", [](int elements) {
+      std::wstring input = RandomLine(elements);
+      std::wregex regex(L"[a-c]x?(foo|ba+r)", std::regex_constants::extended);
+      auto start = Now();
+      size_t position = 0;
+      while (position < input.size()) {
+        std::wsmatch match;
+        std::wstring suffix = input.substr(position);
+        if (!std::regex_search(suffix, match, regex)) break;
+        position += match.position() + 1;
+      }
+      auto end = Now();
+      return SecondsBetween(start, end) / elements;
+    });
+}  // namespace
+}  // namespace afc::editor
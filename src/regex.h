@@ -0,0 +1,149 @@
+#ifndef __AFC_EDITOR_REGEX_H__
+#define __AFC_EDITOR_REGEX_H__
+
+#include <array>
+#include <cwctype>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/lazy_string.h"
+#include "src/line_column.h"
+#include "src/value_or_error.h"
+
+namespace afc::editor {
+
+// A compiled regular expression, using the POSIX extended syntax: alternation
+// (`|`), groups, the `*`, `+`, `?` and `{n,m}` repetitions, `.`, bracket
+// expressions (with ranges and classes such as `[:alpha:]`), anchors and
+// backslash escapes. Back-references aren't supported.
+//
+// Instances are immutable and can be shared between threads. Use
+// `RegexMatcher` to search for matches.
+class Regex {
+ private:
+  struct ConstructorAccessTag {
+   private:
+    ConstructorAccessTag() = default;
+    friend Regex;
+  };
+
+ public:
+  struct Options {
+    bool case_insensitive = false;
+  };
+
+  static ValueOrError<std::shared_ptr<const Regex>> New(
+      const std::wstring& pattern, Options options);
+
+  // A set of characters given by a bracket expression.
+  struct CharacterClass {
+    bool Matches(wchar_t c) const;
+
+    bool negated = false;
+    std::vector<std::pair<wchar_t, wchar_t>> ranges;
+    std::vector<std::wctype_t> types;
+  };
+
+  // A state in a (Thompson) NFA.
+  struct State {
+    enum class Type {
+      kCharacter,
+      kAnyCharacter,
+      kClass,
+      kSplit,
+      kLineBegin,
+      kLineEnd,
+      kMatch
+    };
+
+    Type type;
+    wchar_t character = 0;
+    size_t class_index = 0;
+    int next = -1;
+    // Only used by kSplit.
+    int alternative = -1;
+  };
+
+  // Only `New` should call this.
+  Regex(ConstructorAccessTag, Options options) : options_(options) {}
+
+  // Strings that every match contains (ignoring case, if the regex is case
+  // insensitive). Can be used to quickly discard inputs that can't match.
+  const std::vector<std::wstring>& required_literals() const {
+    return required_literals_;
+  }
+
+ private:
+  friend class RegexMatcher;
+  friend class RegexCompiler;
+
+  const Options options_;
+
+  // Recognizes the reverse of the language given by the pattern: this allows
+  // `RegexMatcher` to find all the positions where matches start in a single
+  // (backwards) pass over the input.
+  std::vector<State> states_;
+  int start_ = -1;
+  std::vector<CharacterClass> classes_;
+
+  std::vector<std::wstring> required_literals_;
+};
+
+// Finds the matches of a regular expression in time linear on the size of the
+// input (there's no backtracking). Simulates the NFA through a DFA that is built
+// lazily (and cached across calls), so instances should be reused for many
+// inputs. Not thread-safe: use a separate instance in each thread.
+class RegexMatcher {
+ public:
+  explicit RegexMatcher(std::shared_ptr<const Regex> regex);
+
+  // Returns all the columns (in ascending order) at which a match starts.
+  std::vector<ColumnNumber> MatchStarts(const LazyString& input);
+
+ private:
+  struct DfaState {
+    std::vector<int> nfa_states;
+    bool accepting = false;
+    // Transitions already computed (or -1).
+    std::array<int, 128> ascii_transitions;
+    std::unordered_map<wchar_t, int> transitions;
+    // Whether a match starts at the beginning of the input if its first
+    // character is the key (and the rest of the input leads to this state).
+    std::unordered_map<wchar_t, bool> accepting_at_begin;
+  };
+
+  bool Matches(const Regex::State& state, wchar_t c) const;
+
+  // Returns the (sorted) consuming and accepting NFA states reachable from
+  // `seeds` without consuming input.
+  std::vector<int> Closure(std::vector<int> seeds, bool at_begin, bool at_end);
+
+  // Returns the states reached by consuming `c` from `states`, adding the start
+  // state (since a match can end at any position).
+  std::vector<int> Step(const std::vector<int>& states, wchar_t c) const;
+
+  bool Accepting(const std::vector<int>& states) const;
+
+  int Transition(int dfa_state, wchar_t c);
+
+  // Returns the index of the DFA state for `nfa_states`, creating it if needed.
+  int Intern(std::vector<int> nfa_states);
+
+  const std::shared_ptr<const Regex> regex_;
+
+  std::vector<DfaState> dfa_states_;
+  std::map<std::vector<int>, int> dfa_index_;
+  // The state at the end of the input (or -1, if not yet computed).
+  int end_state_ = -1;
+
+  // Used by `Closure`.
+  std::vector<size_t> visited_;
+  size_t generation_ = 0;
+};
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_REGEX_H__
@@ -64,7 +64,7 @@ ValueOrError<ParsedCommand> Parse(
     if (!candidate->IsFunction()) {
       continue;
     }
-    const auto& arguments = candidate->type.type_arguments;
+    const auto& arguments = candidate->type().type_arguments;
     if (accepted_return_types.find(arguments[0]) ==
         accepted_return_types.end()) {
       continue;
@@ -96,9 +96,10 @@ ValueOrError<ParsedCommand> Parse(
   } else if (!type_match_functions.empty()) {
     // TODO: Choose the most suitable one given our arguments.
     output.function = type_match_functions[0];
-    CHECK_GE(output.function->type.type_arguments.size(),
+    CHECK_GE(output.function->type().type_arguments.size(),
              1ul /* return type */);
-    size_t expected_arguments = output.function->type.type_arguments.size() - 1;
+    size_t expected_arguments =
+        output.function->type().type_arguments.size() - 1;
     if (output.tokens.size() - 1 > expected_arguments) {
       return Error(L"Too many arguments given for `" + output.tokens[0].value +
                    L"` (expected: " + std::to_wstring(expected_arguments) +
@@ -173,7 +174,7 @@ futures::Value<ColorizePromptOptions> ColorizeOptionsProvider(
             [consumer = output_future.consumer, buffer,
              output](ValueOrError<std::unique_ptr<vm::Value>> value) mutable {
               if (!value.IsError() &&
-                  value.value()->type == BufferMapper::vmtype) {
+                  value.value()->type() == BufferMapper::vmtype) {
                 output.context = BufferMapper::get(value.value().get());
               }
               consumer(output);
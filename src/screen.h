@@ -1,6 +1,11 @@
 #ifndef __AFC_EDITOR_SCREEN_H__
 #define __AFC_EDITOR_SCREEN_H__
 
+#include <atomic>
+#include <functional>
+#include <string_view>
+#include <vector>
+
 #include "src/line.h"
 #include "src/line_column.h"
 
@@ -9,8 +14,17 @@ namespace editor {
 
 class Screen {
  public:
-  Screen() = default;
-  virtual ~Screen() = default;
+  Screen() : id_(NextId()) {}
+  virtual ~Screen() {
+    for (auto& observer : destruction_observers_) observer();
+  }
+
+  // Identifies the screen. Unlike its address, never reused by other screens.
+  size_t id() const { return id_; }
+
+  void AddDestructionObserver(std::function<void()> observer) {
+    destruction_observers_.push_back(std::move(observer));
+  }
 
   // Most implementations apply their transformations directly. However, there's
   // an implementation that buffers them until Flush is called and then applies
@@ -50,12 +64,21 @@ class Screen {
 
   virtual void SetCursorVisibility(CursorVisibility cursor_visibility) = 0;
   virtual void Move(LineNumber y, ColumnNumber x) = 0;
-  virtual void WriteString(const wstring& str) = 0;
+  virtual void WriteString(std::wstring_view str) = 0;
 
   virtual void SetModifier(LineModifier modifier) = 0;
 
   virtual LineNumberDelta lines() const = 0;
   virtual ColumnNumberDelta columns() const = 0;
+
+ private:
+  static size_t NextId() {
+    static std::atomic<size_t> next_id = 0;
+    return next_id++;
+  }
+
+  const size_t id_;
+  std::vector<std::function<void()>> destruction_observers_;
 };
 
 }  // namespace editor
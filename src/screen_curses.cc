@@ -50,7 +50,9 @@ class ScreenCurses : public Screen {
   }
 
   void Move(LineNumber y, ColumnNumber x) override { move(y.line, x.column); }
-  void WriteString(const wstring& s) override { addwstr(s.c_str()); }
+  void WriteString(std::wstring_view s) override {
+    addnwstr(s.data(), s.size());
+  }
 
   void SetModifier(LineModifier modifier) override {
     switch (modifier) {
@@ -0,0 +1,602 @@
+#include "src/screen_protocol.h"
+
+#include <glog/logging.h>
+
+#include "src/screen_vm.h"
+#include "src/server.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
+#include "src/tracker.h"
+#include "src/utf8_decoder.h"
+#include "src/vm/public/environment.h"
+#include "src/vm/public/value.h"
+#include "src/vm/public/vm.h"
+
+namespace afc::editor::screen_protocol {
+namespace {
+enum class Operation : char {
+  kFlush = 1,
+  kHardRefresh,
+  kRefresh,
+  kClear,
+  // Arguments: cursor visibility (varint).
+  kSetCursorVisibility,
+  // Arguments: line, column (varints).
+  kMove,
+  // Arguments: size (varint), UTF-8 contents.
+  kWriteString,
+  // Arguments: modifier (varint).
+  kSetModifier,
+  // Draws a line that hasn't been sent before (and stores it in a slot).
+  // Arguments: line, slot, size of the operations (varints), operations.
+  kNewLine,
+  // Draws a line that has been sent before. Arguments: line, slot (varints).
+  kCachedLine,
+  // Arguments: character (varint).
+  kInput,
+  // Arguments: lines, columns (varints).
+  kSetSize,
+};
+
+void AppendOperation(Operation operation, std::string* output) {
+  output->push_back(static_cast<char>(operation));
+}
+
+void AppendVarint(size_t value, std::string* output) {
+  while (value >= 0x80) {
+    output->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  output->push_back(static_cast<char>(value));
+}
+
+void AppendUtf8(std::wstring_view str, std::string* output) {
+  for (wchar_t c : str) {
+    uint32_t code_point = c;
+    if (code_point < 0x80) {
+      output->push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      output->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      output->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+      output->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      output->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      output->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      output->push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+      output->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+      output->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      output->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  }
+}
+
+std::string MakeFrame(const std::string& payload) {
+  std::string output(1, kFrameMarker);
+  AppendVarint(payload.size(), &output);
+  output += payload;
+  return output;
+}
+
+// Returns nullopt if `input` ends before the end of the varint.
+std::optional<size_t> ReadVarint(std::string_view* input) {
+  size_t output = 0;
+  for (size_t i = 0; i < input->size() && i < 10; i++) {
+    unsigned char byte = (*input)[i];
+    output |= static_cast<size_t>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      input->remove_prefix(i + 1);
+      return output;
+    }
+  }
+  return std::nullopt;
+}
+
+ValueOrError<size_t> ReadArgument(std::string_view* input) {
+  auto output = ReadVarint(input);
+  if (!output.has_value()) return Error(L"Truncated argument.");
+  return Success(output.value());
+}
+
+ValueOrError<std::string_view> ReadBytes(std::string_view* input) {
+  ASSIGN_OR_RETURN(size_t size, ReadArgument(input));
+  if (size > input->size()) return Error(L"Truncated string.");
+  std::string_view output = input->substr(0, size);
+  input->remove_prefix(size);
+  return Success(output);
+}
+}  // namespace
+
+Encoder::Encoder() : slots_(kLineSlots) {}
+
+void Encoder::HardRefresh() {
+  FinishLine();
+  AppendOperation(Operation::kHardRefresh, &payload_);
+}
+
+void Encoder::Refresh() {
+  FinishLine();
+  AppendOperation(Operation::kRefresh, &payload_);
+}
+
+void Encoder::Clear() {
+  FinishLine();
+  AppendOperation(Operation::kClear, &payload_);
+}
+
+void Encoder::SetCursorVisibility(Screen::CursorVisibility cursor_visibility) {
+  FinishLine();
+  AppendOperation(Operation::kSetCursorVisibility, &payload_);
+  AppendVarint(cursor_visibility, &payload_);
+}
+
+void Encoder::Move(LineNumber y, ColumnNumber x) {
+  FinishLine();
+  if (x == ColumnNumber(0)) {
+    line_ = y;
+    return;
+  }
+  AppendOperation(Operation::kMove, &payload_);
+  AppendVarint(y.line, &payload_);
+  AppendVarint(x.column, &payload_);
+}
+
+void Encoder::WriteString(std::wstring_view str) {
+  std::string* output = line_.has_value() ? &line_operations_ : &payload_;
+  AppendOperation(Operation::kWriteString, output);
+  std::string bytes;
+  AppendUtf8(str, &bytes);
+  AppendVarint(bytes.size(), output);
+  *output += bytes;
+}
+
+void Encoder::SetModifier(LineModifier modifier) {
+  std::string* output = line_.has_value() ? &line_operations_ : &payload_;
+  AppendOperation(Operation::kSetModifier, output);
+  AppendVarint(modifier, output);
+}
+
+std::string Encoder::Flush() {
+  static Tracker tracker(L"screen_protocol::Encoder::Flush");
+  auto tracker_call = tracker.Call();
+  FinishLine();
+  AppendOperation(Operation::kFlush, &payload_);
+  std::string output = MakeFrame(payload_);
+  payload_.clear();
+  return output;
+}
+
+void Encoder::FinishLine() {
+  if (!line_.has_value()) return;
+  if (auto it = slots_by_operations_.find(line_operations_);
+      it != slots_by_operations_.end()) {
+    AppendOperation(Operation::kCachedLine, &payload_);
+    AppendVarint(line_->line, &payload_);
+    AppendVarint(it->second, &payload_);
+  } else {
+    size_t slot = next_slot_;
+    next_slot_ = (next_slot_ + 1) % kLineSlots;
+    slots_by_operations_.erase(slots_[slot]);
+    slots_[slot] = line_operations_;
+    slots_by_operations_.insert({slots_[slot], slot});
+
+    AppendOperation(Operation::kNewLine, &payload_);
+    AppendVarint(line_->line, &payload_);
+    AppendVarint(slot, &payload_);
+    AppendVarint(line_operations_.size(), &payload_);
+    payload_ += line_operations_;
+  }
+  line_ = std::nullopt;
+  line_operations_.clear();
+}
+
+std::string InputFrame(const std::vector<wint_t>& input) {
+  std::string payload;
+  for (wint_t c : input) {
+    AppendOperation(Operation::kInput, &payload);
+    AppendVarint(c, &payload);
+  }
+  return MakeFrame(payload);
+}
+
+std::string SetSizeFrame(LineColumnDelta size) {
+  std::string payload;
+  AppendOperation(Operation::kSetSize, &payload);
+  AppendVarint(size.line.line_delta, &payload);
+  AppendVarint(size.column.column_delta, &payload);
+  return MakeFrame(payload);
+}
+
+std::optional<std::string_view> ReadFrame(std::string_view* input) {
+  CHECK(!input->empty());
+  CHECK_EQ(input->front(), kFrameMarker);
+  std::string_view tail = input->substr(1);
+  auto size = ReadVarint(&tail);
+  if (!size.has_value() || size.value() > tail.size()) return std::nullopt;
+  std::string_view output = tail.substr(0, size.value());
+  *input = tail.substr(size.value());
+  return output;
+}
+
+Decoder::Decoder() : slots_(Encoder::kLineSlots) {}
+
+PossibleError Decoder::Apply(std::string_view payload,
+                             const Callbacks& callbacks) {
+  static Tracker tracker(L"screen_protocol::Decoder::Apply");
+  auto tracker_call = tracker.Call();
+  return ApplyOperations(payload, callbacks, false);
+}
+
+PossibleError Decoder::ApplyOperations(std::string_view payload,
+                                       const Callbacks& callbacks,
+                                       bool in_line) {
+  Screen* screen = callbacks.screen;
+  while (!payload.empty()) {
+    auto operation = static_cast<Operation>(payload.front());
+    payload.remove_prefix(1);
+    if (in_line && operation != Operation::kWriteString &&
+        operation != Operation::kSetModifier) {
+      return Error(L"Invalid operation in line.");
+    }
+    switch (operation) {
+      case Operation::kFlush:
+        if (screen != nullptr) screen->Flush();
+        break;
+      case Operation::kHardRefresh:
+        if (screen != nullptr) screen->HardRefresh();
+        break;
+      case Operation::kRefresh:
+        if (screen != nullptr) screen->Refresh();
+        break;
+      case Operation::kClear:
+        if (screen != nullptr) screen->Clear();
+        break;
+      case Operation::kSetCursorVisibility: {
+        ASSIGN_OR_RETURN(size_t visibility, ReadArgument(&payload));
+        if (screen != nullptr) {
+          screen->SetCursorVisibility(visibility == Screen::INVISIBLE
+                                          ? Screen::INVISIBLE
+                                          : Screen::NORMAL);
+        }
+        break;
+      }
+      case Operation::kMove: {
+        ASSIGN_OR_RETURN(size_t line, ReadArgument(&payload));
+        ASSIGN_OR_RETURN(size_t column, ReadArgument(&payload));
+        if (screen != nullptr) screen->Move(LineNumber(line), ColumnNumber(column));
+        break;
+      }
+      case Operation::kWriteString: {
+        ASSIGN_OR_RETURN(std::string_view bytes, ReadBytes(&payload));
+        if (screen != nullptr) {
+          DecodedUtf8 decoded = DecodeUtf8(bytes.data(), bytes.size());
+          screen->WriteString(
+              std::wstring(decoded.contents.begin(), decoded.contents.end()));
+        }
+        break;
+      }
+      case Operation::kSetModifier: {
+        ASSIGN_OR_RETURN(size_t modifier, ReadArgument(&payload));
+        if (modifier > BG_RED) return Error(L"Invalid modifier.");
+        if (screen != nullptr) {
+          screen->SetModifier(static_cast<LineModifier>(modifier));
+        }
+        break;
+      }
+      case Operation::kNewLine:
+      case Operation::kCachedLine: {
+        ASSIGN_OR_RETURN(size_t line, ReadArgument(&payload));
+        ASSIGN_OR_RETURN(size_t slot, ReadArgument(&payload));
+        if (slot >= slots_.size()) return Error(L"Invalid slot.");
+        if (operation == Operation::kNewLine) {
+          ASSIGN_OR_RETURN(std::string_view line_operations,
+                           ReadBytes(&payload));
+          slots_[slot] = std::string(line_operations);
+        }
+        if (screen != nullptr) screen->Move(LineNumber(line), ColumnNumber(0));
+        if (auto result = ApplyOperations(slots_[slot], callbacks, true);
+            result.IsError()) {
+          return result;
+        }
+        break;
+      }
+      case Operation::kInput: {
+        ASSIGN_OR_RETURN(size_t c, ReadArgument(&payload));
+        if (callbacks.process_input != nullptr) {
+          callbacks.process_input(static_cast<wint_t>(c));
+        }
+        break;
+      }
+      case Operation::kSetSize: {
+        ASSIGN_OR_RETURN(size_t lines, ReadArgument(&payload));
+        ASSIGN_OR_RETURN(size_t columns, ReadArgument(&payload));
+        if (callbacks.set_size != nullptr) {
+          callbacks.set_size(LineColumnDelta(LineNumberDelta(lines),
+                                             ColumnNumberDelta(columns)));
+        }
+        break;
+      }
+      default:
+        return Error(L"Invalid operation: " +
+                     std::to_wstring(static_cast<int>(operation)));
+    }
+  }
+  return Success();
+}
+
+namespace {
+// Records the operations it receives (as VM code, since that's convenient).
+class RecordingScreen : public Screen {
+ public:
+  void Flush() override { log += L"Flush;"; }
+  void HardRefresh() override { log += L"HardRefresh;"; }
+  void Refresh() override { log += L"Refresh;"; }
+  void Clear() override { log += L"Clear;"; }
+  void SetCursorVisibility(CursorVisibility cursor_visibility) override {
+    log += L"SetCursorVisibility(" + std::to_wstring(cursor_visibility) + L");";
+  }
+  void Move(LineNumber y, ColumnNumber x) override {
+    log += L"Move(" + std::to_wstring(y.line) + L"," +
+           std::to_wstring(x.column) + L");";
+  }
+  void WriteString(std::wstring_view str) override {
+    log += L"WriteString(" + std::wstring(str) + L");";
+  }
+  void SetModifier(LineModifier modifier) override {
+    log += L"SetModifier(" + std::to_wstring(modifier) + L");";
+  }
+  LineNumberDelta lines() const override { return LineNumberDelta(25); }
+  ColumnNumberDelta columns() const override { return ColumnNumberDelta(80); }
+
+  std::wstring log;
+};
+
+// Decodes all the frames in `input`, which must be complete.
+void DecodeAll(Decoder* decoder, std::string_view input,
+               const Decoder::Callbacks& callbacks) {
+  while (!input.empty()) {
+    auto payload = ReadFrame(&input);
+    CHECK(payload.has_value());
+    CHECK(!decoder->Apply(payload.value(), callbacks).IsError());
+  }
+}
+
+// Applies to `screen` the operations that the `Terminal` class would use to
+// draw a screen with `lines` lines of text starting at `first_line`.
+template <typename ScreenLike>
+void DrawScreen(ScreenLike* screen, size_t first_line, size_t lines) {
+  for (size_t i = 0; i < lines; i++) {
+    screen->Move(LineNumber(i), ColumnNumber(0));
+    screen->SetModifier(LineModifier::RESET);
+    screen->SetModifier(LineModifier::CYAN);
+    screen->WriteString(L"  " + std::to_wstring(first_line + i) + L"┃");
+    screen->SetModifier(LineModifier::RESET);
+    screen->WriteString(L"for (const auto& [name, value] : values_" +
+                        std::to_wstring((first_line + i) % 17) +
+                        L") { Process(name, value); }");
+    screen->SetModifier(LineModifier::RESET);
+    screen->WriteString(L"\n");
+  }
+  screen->SetCursorVisibility(Screen::NORMAL);
+  screen->Move(LineNumber(lines / 2), ColumnNumber(7));
+  screen->Refresh();
+}
+
+// Produces the VM code that `ScreenVm` would produce for the operations.
+class VmCodeScreen : public RecordingScreen {
+ public:
+  void Flush() override { code += "screen.Flush();\n"; }
+  void Refresh() override { code += "screen.Refresh();"; }
+  void SetCursorVisibility(CursorVisibility cursor_visibility) override {
+    code += "screen.SetCursorVisibility(\"" +
+            CursorVisibilityToString(cursor_visibility) + "\");";
+  }
+  void Move(LineNumber y, ColumnNumber x) override {
+    code += "screen.Move(" + std::to_string(y.line) + ", " +
+            std::to_string(x.column) + ");";
+  }
+  void WriteString(std::wstring_view str) override {
+    code += "screen.WriteString(\"";
+    AppendUtf8(CppEscapeString(std::wstring(str)), &code);
+    code += "\");";
+  }
+  void SetModifier(LineModifier modifier) override {
+    code += "screen.SetModifier(\"" + ModifierToString(modifier) + "\");";
+  }
+
+  std::string code;
+};
+
+constexpr size_t kScreenLines = 50;
+
+// Both benchmarks simulate a client that scrolls through a file (one line per
+// frame), returning the average time that the client takes to apply each
+// frame. They log the average bytes per frame.
+bool registration_binary_benchmark = tests::RegisterBenchmark(
+    L"ScreenProtocol::Binary", [](int frames) {
+      Encoder encoder;
+      std::vector<std::string> encoded;
+      size_t bytes = 0;
+      for (int i = 0; i < frames; i++) {
+        DrawScreen(&encoder, i, kScreenLines);
+        encoded.push_back(encoder.Flush());
+        bytes += encoded.back().size();
+      }
+      LOG(INFO) << "Bytes per frame: " << bytes / frames;
+
+      Decoder decoder;
+      RecordingScreen screen;
+      auto start = Now();
+      for (auto& frame : encoded) {
+        screen.log.clear();
+        DecodeAll(&decoder, frame, {.screen = &screen});
+      }
+      return SecondsBetween(start, Now()) / frames;
+    });
+
+bool registration_vm_benchmark =
+    tests::RegisterBenchmark(L"ScreenProtocol::VmCode", [](int frames) {
+      std::vector<std::string> encoded;
+      size_t bytes = 0;
+      for (int i = 0; i < frames; i++) {
+        VmCodeScreen encoder;
+        DrawScreen(&encoder, i, kScreenLines);
+        encoder.Flush();
+        encoded.push_back(std::move(encoder.code));
+        bytes += encoded.back().size();
+      }
+      LOG(INFO) << "Bytes per frame: " << bytes / frames;
+
+      auto environment =
+          std::make_shared<vm::Environment>(vm::Environment::GetDefault());
+      RegisterScreenType(environment.get());
+      auto screen = std::make_shared<RecordingScreen>();
+      environment->Define(L"screen", vm::Value::NewObject(L"Screen", screen));
+      auto start = Now();
+      for (auto& frame : encoded) {
+        screen->log.clear();
+        DecodedUtf8 decoded = DecodeUtf8(frame.data(), frame.size());
+        std::wstring error;
+        auto expression = vm::CompileString(
+            std::wstring(decoded.contents.begin(), decoded.contents.end()),
+            environment, &error);
+        CHECK(expression != nullptr) << error;
+        vm::Evaluate(expression.get(), environment, nullptr);
+      }
+      return SecondsBetween(start, Now()) / frames;
+    });
+
+class ScreenProtocolTests : public tests::TestGroup<ScreenProtocolTests> {
+ public:
+  ScreenProtocolTests() : TestGroup<ScreenProtocolTests>() {}
+  std::wstring Name() const override { return L"ScreenProtocolTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {
+        {.name = L"RoundTrip",
+         .callback =
+             [] {
+               RecordingScreen expected;
+               DrawScreen(&expected, 0, 10);
+               expected.Flush();
+
+               Encoder encoder;
+               DrawScreen(&encoder, 0, 10);
+               Decoder decoder;
+               RecordingScreen screen;
+               DecodeAll(&decoder, encoder.Flush(), {.screen = &screen});
+               CHECK(screen.log == expected.log) << screen.log;
+             }},
+        {.name = L"OtherOperations",
+         .callback =
+             [] {
+               Encoder encoder;
+               encoder.HardRefresh();
+               encoder.Clear();
+               encoder.Move(LineNumber(3), ColumnNumber(4));
+               encoder.SetModifier(LineModifier::BOLD);
+               encoder.WriteString(L"ñandú");
+               encoder.SetCursorVisibility(Screen::INVISIBLE);
+               Decoder decoder;
+               RecordingScreen screen;
+               DecodeAll(&decoder, encoder.Flush(), {.screen = &screen});
+               CHECK(screen.log ==
+                     L"HardRefresh;Clear;Move(3,4);SetModifier(1);"
+                     L"WriteString(ñandú);SetCursorVisibility(0);Flush;")
+                   << screen.log;
+             }},
+        {.name = L"CachedLines",
+         .callback =
+             [] {
+               Encoder encoder;
+               Decoder decoder;
+               DrawScreen(&encoder, 0, 20);
+               size_t first_size = encoder.Flush().size();
+               for (size_t i = 1; i < 5; i++) {
+                 RecordingScreen expected;
+                 DrawScreen(&expected, i, 20);
+                 expected.Flush();
+
+                 DrawScreen(&encoder, i, 20);
+                 std::string frame = encoder.Flush();
+                 CHECK_LT(frame.size() * 5, first_size);
+                 RecordingScreen screen;
+                 DecodeAll(&decoder, frame, {.screen = &screen});
+               }
+             }},
+        {.name = L"CachedLinesMatch",
+         .callback =
+             [] {
+               Encoder encoder;
+               Decoder decoder;
+               for (size_t i = 0; i < 5; i++) {
+                 RecordingScreen expected;
+                 DrawScreen(&expected, i, 20);
+                 expected.Flush();
+
+                 DrawScreen(&encoder, i, 20);
+                 RecordingScreen screen;
+                 DecodeAll(&decoder, encoder.Flush(), {.screen = &screen});
+                 CHECK(screen.log == expected.log) << screen.log;
+               }
+             }},
+        {.name = L"SlotsAreReused",
+         .callback =
+             [] {
+               Encoder encoder;
+               Decoder decoder;
+               for (size_t i = 0; i < 3 * Encoder::kLineSlots; i += 10) {
+                 RecordingScreen expected;
+                 DrawScreen(&expected, i % (2 * Encoder::kLineSlots), 30);
+                 expected.Flush();
+
+                 DrawScreen(&encoder, i % (2 * Encoder::kLineSlots), 30);
+                 RecordingScreen screen;
+                 DecodeAll(&decoder, encoder.Flush(), {.screen = &screen});
+                 CHECK(screen.log == expected.log) << screen.log;
+               }
+             }},
+        {.name = L"InputAndSize",
+         .callback =
+             [] {
+               std::vector<wint_t> input;
+               std::optional<LineColumnDelta> size;
+               Decoder decoder;
+               DecodeAll(&decoder,
+                         InputFrame({L'a', L'ñ', 27}) +
+                             SetSizeFrame(LineColumnDelta(LineNumberDelta(40),
+                                                          ColumnNumberDelta(120))),
+                         {.process_input = [&](wint_t c) { input.push_back(c); },
+                          .set_size = [&](LineColumnDelta value) {
+                            size = value;
+                          }});
+               CHECK(input == std::vector<wint_t>({L'a', L'ñ', 27}));
+               CHECK(size == LineColumnDelta(LineNumberDelta(40),
+                                             ColumnNumberDelta(120)));
+             }},
+        {.name = L"IncompleteFrames",
+         .callback =
+             [] {
+               std::string frame = InputFrame(std::vector<wint_t>(200, L'x'));
+               for (size_t i = 1; i < frame.size(); i++) {
+                 std::string_view input = std::string_view(frame).substr(0, i);
+                 CHECK(!ReadFrame(&input).has_value());
+                 CHECK_EQ(input.size(), i);
+               }
+               std::string_view input = frame;
+               CHECK(ReadFrame(&input).has_value());
+               CHECK(input.empty());
+             }},
+        {.name = L"InvalidOperation", .callback = [] {
+           Decoder decoder;
+           CHECK(decoder.Apply(std::string(1, 99), {}).IsError());
+           CHECK(decoder.Apply(std::string(1, 6), {}).IsError());
+         }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<ScreenProtocolTests>::registration_ =
+    tests::Add<editor::screen_protocol::ScreenProtocolTests>();
+}  // namespace
+}  // namespace afc::editor::screen_protocol
@@ -0,0 +1,103 @@
+#ifndef __AFC_EDITOR_SCREEN_PROTOCOL_H__
+#define __AFC_EDITOR_SCREEN_PROTOCOL_H__
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "src/line_column.h"
+#include "src/line_modifier.h"
+#include "src/screen.h"
+#include "src/value_or_error.h"
+
+// Binary protocol through which an Edge server updates the screens of its
+// remote clients (and through which the clients send their input back). It is
+// much cheaper (for both ends) than sending VM code (e.g.,
+// `screen.WriteString("...");`), which the receiver must compile.
+//
+// Frames can be interleaved with VM code (which is still accepted): each starts
+// with `kFrameMarker` (which never appears in VM code), followed by the size of
+// its payload (as a varint) and the payload. The payload is a sequence of
+// operations: a byte that identifies the operation, followed by its arguments.
+namespace afc::editor::screen_protocol {
+
+constexpr char kFrameMarker = '\0';
+
+// Accumulates screen operations and produces the frames that replicate them.
+//
+// Remembers the contents of the lines that it has sent (in a bounded number of
+// slots, which the decoder mirrors), so that a line that has been sent before
+// (e.g., one that has just moved to a different position because the view
+// scrolled) is sent as a reference to its slot.
+class Encoder {
+ public:
+  static constexpr size_t kLineSlots = 4096;
+
+  Encoder();
+
+  void HardRefresh();
+  void Refresh();
+  void Clear();
+  void SetCursorVisibility(Screen::CursorVisibility cursor_visibility);
+  void Move(LineNumber y, ColumnNumber x);
+  void WriteString(std::wstring_view str);
+  void SetModifier(LineModifier modifier);
+
+  // Returns a frame with all the operations given since the previous call,
+  // ending with a call to `Screen::Flush`.
+  std::string Flush();
+
+ private:
+  void FinishLine();
+
+  std::string payload_;
+
+  // Set if the operations being received draw a line (i.e., if they follow a
+  // call to `Move` to the start of `line_`). These are accumulated in
+  // `line_operations_`.
+  std::optional<LineNumber> line_;
+  std::string line_operations_;
+
+  // The operations in each slot; `slots_by_operations_` indexes them.
+  std::vector<std::string> slots_;
+  std::unordered_map<std::string_view, size_t> slots_by_operations_;
+  size_t next_slot_ = 0;
+};
+
+// Returns frames with other messages (sent by clients).
+std::string InputFrame(const std::vector<wint_t>& input);
+std::string SetSizeFrame(LineColumnDelta size);
+
+// If `input` starts with a complete frame, returns its payload. Advances
+// `input` past the frame.
+std::optional<std::string_view> ReadFrame(std::string_view* input);
+
+// Applies the frames (received in a connection) that an `Encoder` produces.
+class Decoder {
+ public:
+  struct Callbacks {
+    // Receives the screen operations. May be nullptr, in which case they are
+    // ignored.
+    Screen* screen = nullptr;
+    std::function<void(wint_t)> process_input = nullptr;
+    std::function<void(LineColumnDelta)> set_size = nullptr;
+  };
+
+  Decoder();
+
+  // Applies all the operations in `payload` (obtained through `ReadFrame`).
+  PossibleError Apply(std::string_view payload, const Callbacks& callbacks);
+
+ private:
+  PossibleError ApplyOperations(std::string_view payload,
+                                const Callbacks& callbacks, bool in_line);
+
+  std::vector<std::string> slots_;
+};
+
+}  // namespace afc::editor::screen_protocol
+
+#endif  // __AFC_EDITOR_SCREEN_PROTOCOL_H__
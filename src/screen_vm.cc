@@ -1,10 +1,16 @@
 #include "src/screen_vm.h"
 
 #include <glog/logging.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <memory>
+#include <optional>
 
+#include "src/buffer.h"
+#include "src/editor.h"
 #include "src/screen.h"
+#include "src/screen_protocol.h"
 #include "src/server.h"
 #include "src/vm/public/callbacks.h"
 #include "src/vm/public/environment.h"
@@ -35,41 +41,64 @@ using vm::VMType;
 namespace {
 class ScreenVm : public Screen {
  public:
-  ScreenVm(int fd) : fd_(fd) {}
+  enum class Protocol { kVmCode, kBinary };
+
+  ScreenVm(int fd, Protocol protocol) : fd_(fd) {
+    if (protocol == Protocol::kBinary) encoder_.emplace();
+  }
 
   ~ScreenVm() override {
     LOG(INFO) << "Sending terminate command to remote screen: fd: " << fd_;
-    buffer_ += "set_terminate(0);";
+    buffer_ += "set_terminate(0);\n";
     Write();
   }
 
   void Flush() override {
-    buffer_ += "screen.Flush();";
+    if (encoder_.has_value()) {
+      buffer_ += encoder_->Flush();
+    } else {
+      buffer_ += "screen.Flush();\n";
+    }
     Write();
   }
 
-  void HardRefresh() override { buffer_ += "screen.HardRefresh();"; }
+  void HardRefresh() override {
+    if (encoder_.has_value()) return encoder_->HardRefresh();
+    buffer_ += "screen.HardRefresh();";
+  }
 
-  void Refresh() override { buffer_ += "screen.Refresh();"; }
+  void Refresh() override {
+    if (encoder_.has_value()) return encoder_->Refresh();
+    buffer_ += "screen.Refresh();";
+  }
 
-  void Clear() override { buffer_ += "screen.Clear();"; }
+  void Clear() override {
+    if (encoder_.has_value()) return encoder_->Clear();
+    buffer_ += "screen.Clear();";
+  }
 
   void SetCursorVisibility(CursorVisibility cursor_visibility) override {
+    if (encoder_.has_value()) {
+      return encoder_->SetCursorVisibility(cursor_visibility);
+    }
     buffer_ += "screen.SetCursorVisibility(\"" +
                CursorVisibilityToString(cursor_visibility) + "\");";
   }
 
   void Move(LineNumber y, ColumnNumber x) override {
+    if (encoder_.has_value()) return encoder_->Move(y, x);
     buffer_ += "screen.Move(" + std::to_string(y.line) + ", " +
                std::to_string(x.column) + ");";
   }
 
-  void WriteString(const wstring& str) override {
-    buffer_ +=
-        "screen.WriteString(\"" + ToByteString(CppEscapeString(str)) + "\");";
+  void WriteString(std::wstring_view str) override {
+    if (encoder_.has_value()) return encoder_->WriteString(str);
+    buffer_ += "screen.WriteString(\"" +
+               ToByteString(CppEscapeString(std::wstring(str))) + "\");";
   }
 
   void SetModifier(LineModifier modifier) override {
+    if (encoder_.has_value()) return encoder_->SetModifier(modifier);
     buffer_ += "screen.SetModifier(\"" + ModifierToString(modifier) + "\");";
   }
 
@@ -83,17 +112,40 @@ class ScreenVm : public Screen {
 
  private:
   void Write() {
-    buffer_ += "\n";
-    LOG(INFO) << "Sending command: " << buffer_;
-    int result = write(fd_, buffer_.c_str(), buffer_.size());
-    if (result != static_cast<int>(buffer_.size())) {
-      LOG(INFO) << "Remote screen update failed!";
+    if (fd_ == -1) {
+      buffer_.clear();
+      return;
+    }
+    LOG(INFO) << "Sending update to remote screen: " << buffer_.size()
+              << " bytes.";
+    // A partial write would leave the receiver in the middle of a frame, so we
+    // keep writing until everything has been sent. If we can't, the receiver
+    // can no longer make sense of the stream, so we give up on it.
+    for (size_t pos = 0; pos < buffer_.size();) {
+      ssize_t result = write(fd_, buffer_.c_str() + pos, buffer_.size() - pos);
+      if (result == -1 && errno == EINTR) continue;
+      if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        struct pollfd pollfd = {.fd = fd_, .events = POLLOUT, .revents = 0};
+        poll(&pollfd, 1, -1);
+        continue;
+      }
+      if (result == -1) {
+        LOG(ERROR) << "Remote screen update failed, closing connection: "
+                   << strerror(errno);
+        close(fd_);
+        fd_ = -1;
+        break;
+      }
+      pos += result;
     }
     buffer_.clear();
   }
 
   string buffer_;
-  const int fd_;
+  // -1 once the connection has failed.
+  int fd_;
+  // Set if we use the binary protocol.
+  std::optional<screen_protocol::Encoder> encoder_;
   ColumnNumberDelta columns_ = ColumnNumberDelta(80);
   LineNumberDelta lines_ = LineNumberDelta(25);
 };
@@ -109,10 +161,26 @@ void RegisterScreenType(Environment* environment) {
           {VMType::ObjectType(screen_type.get()), VMType::String()},
           [](vector<unique_ptr<Value>> args) {
             CHECK_EQ(args.size(), 1u);
-            CHECK_EQ(args[0]->type, VMType::VM_STRING);
+            CHECK_EQ(args[0]->type(), VMType::VM_STRING);
             wstring error;
             int fd = MaybeConnectToServer(ToByteString(args[0]->str), &error);
-            return Value::NewObject(L"Screen", std::make_shared<ScreenVm>(fd));
+            return Value::NewObject(
+                L"Screen",
+                std::make_shared<ScreenVm>(fd, ScreenVm::Protocol::kVmCode));
+          }));
+
+  environment->Define(
+      L"RemoteBinaryScreen",
+      Value::NewFunction(
+          {VMType::ObjectType(screen_type.get()), VMType::String()},
+          [](vector<unique_ptr<Value>> args) {
+            CHECK_EQ(args.size(), 1u);
+            CHECK_EQ(args[0]->type(), VMType::VM_STRING);
+            wstring error;
+            int fd = MaybeConnectToServer(ToByteString(args[0]->str), &error);
+            return Value::NewObject(
+                L"Screen",
+                std::make_shared<ScreenVm>(fd, ScreenVm::Protocol::kBinary));
           }));
 
   // Methods for Screen.
@@ -184,7 +252,7 @@ void RegisterScreenType(Environment* environment) {
 }
 
 std::unique_ptr<Screen> NewScreenVm(int fd) {
-  return std::make_unique<ScreenVm>(fd);
+  return std::make_unique<ScreenVm>(fd, ScreenVm::Protocol::kVmCode);
 }
 
 const VMType& GetScreenVmType() {
@@ -192,5 +260,23 @@ const VMType& GetScreenVmType() {
   return *output;
 }
 
+screen_protocol::Decoder::Callbacks ScreenFrameCallbacks(OpenBuffer* buffer) {
+  screen_protocol::Decoder::Callbacks output;
+  auto value = buffer->environment()->Lookup(L"screen", GetScreenVmType());
+  if (value != nullptr && value->type().type == VMType::OBJECT_TYPE &&
+      value->type().object_type == L"Screen") {
+    output.screen = static_cast<Screen*>(value->user_value.get());
+  }
+  EditorState* editor = buffer->editor();
+  output.process_input = [editor](wint_t c) { editor->ProcessInput(c); };
+  output.set_size = [editor, screen = output.screen](LineColumnDelta size) {
+    if (auto screen_vm = dynamic_cast<ScreenVm*>(screen); screen_vm != nullptr) {
+      screen_vm->set_size(size.column, size.line);
+    }
+    editor->set_screen_needs_hard_redraw(true);
+  };
+  return output;
+}
+
 }  // namespace editor
 }  // namespace afc
@@ -3,6 +3,7 @@
 
 #include "screen.h"
 
+#include "src/screen_protocol.h"
 #include "src/vm/public/types.h"
 
 namespace afc {
@@ -12,6 +13,12 @@ void RegisterScreenType(vm::Environment* environment);
 std::unique_ptr<Screen> NewScreenVm(int fd);
 const vm::VMType& GetScreenVmType();
 
+class OpenBuffer;
+// Returns the callbacks that apply the frames (see src/screen_protocol.h) that
+// `buffer` receives: screen updates (from a server, applied to the screen in
+// the buffer's environment) and input (from a client).
+screen_protocol::Decoder::Callbacks ScreenFrameCallbacks(OpenBuffer* buffer);
+
 }  // namespace editor
 }  // namespace afc
 
@@ -1,7 +1,9 @@
 #include "src/search_handler.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
-#include <regex>
+#include <mutex>
 #include <set>
 
 #include "src/audio.h"
@@ -10,6 +12,12 @@
 #include "src/editor.h"
 #include "src/lazy_string_functional.h"
 #include "src/notification.h"
+#include "src/regex.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/thread_pool.h"
+#include "src/time.h"
+#include "src/trigram_index.h"
 #include "src/wstring.h"
 
 namespace afc::editor {
@@ -20,82 +28,329 @@ static constexpr int kMatchesLimit = 100;
 using std::vector;
 using std::wstring;
 
-typedef std::wregex RegexPattern;
-
-// Returns all columns where the current line matches the pattern.
-vector<ColumnNumber> GetMatches(const wstring& line,
-                                const RegexPattern& pattern) {
-  size_t start = 0;
-  vector<ColumnNumber> output;
-  while (start < line.size()) {
-    size_t match = wstring::npos;
-    wstring line_substr = line.substr(start);
-
-    std::wsmatch pattern_match;
-    std::regex_search(line_substr, pattern_match, pattern);
-    if (!pattern_match.empty()) {
-      match = pattern_match.position();
+struct SearchResults {
+  std::optional<std::wstring> error;
+  // A vector with all positions matching input sorted in ascending order.
+  std::vector<LineColumn> positions;
+};
+
+Regex::Options GetRegexOptions(const OpenBuffer& buffer) {
+  return {.case_insensitive =
+              !buffer.Read(buffer_variables::search_case_sensitive)};
+}
+
+// Appends to `output` the matches in lines [begin, end). After each line, calls
+// `interrupted(*output)`; if it returns true, returns false immediately.
+template <typename Interrupted>
+bool SearchLines(RegexMatcher* matcher, const BufferContents& contents,
+                 LineNumber begin, LineNumber end,
+                 std::vector<LineColumn>* output, Interrupted interrupted) {
+  for (auto it = contents.IteratorAt(begin); LineNumber(it.position()) < end;
+       ++it) {
+    for (const auto& column : matcher->MatchStarts(*(*it)->contents())) {
+      output->push_back(LineColumn(LineNumber(it.position()), column));
     }
-    if (match == wstring::npos) {
-      return output;
+    if (interrupted(*output)) return false;
+  }
+  return true;
+}
+
+// Large buffers are split into chunks of at most this many lines, which are
+// searched in parallel.
+static constexpr size_t kLinesPerChunk = 4096;
+
+// How often (in lines) the threads searching chunks check whether they should
+// stop.
+static constexpr size_t kLinesBetweenInterruptionChecks = 64;
+
+using LineInterval = TrigramIndex::LineInterval;
+
+// Splits `intervals` into chunks with at most `kLinesPerChunk` lines each.
+std::vector<LineInterval> SplitIntoChunks(
+    const std::vector<LineInterval>& intervals) {
+  std::vector<LineInterval> output;
+  for (const auto& interval : intervals) {
+    for (LineNumber begin = interval.begin; begin < interval.end;
+         begin += LineNumberDelta(kLinesPerChunk)) {
+      output.push_back(
+          {begin,
+           std::min(begin + LineNumberDelta(kLinesPerChunk), interval.end)});
     }
-    output.push_back(ColumnNumber(start + match));
-    start += match + 1;
   }
   return output;
 }
 
-struct SearchResults {
-  std::optional<std::wstring> error;
-  // A vector with all positions matching input sorted in ascending order.
-  std::vector<LineColumn> positions;
+// The state shared by the threads searching the chunks of a buffer.
+struct ParallelSearch {
+  ParallelSearch(std::vector<LineInterval> input_chunks)
+      : chunks(std::move(input_chunks)),
+        results(chunks.size()),
+        last_chunk_needed(chunks.size() - 1) {}
+
+  const std::vector<LineInterval> chunks;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  // The results for each chunk that has been completely searched.
+  std::vector<std::optional<std::vector<LineColumn>>> results;
+  // All chunks before this one have been completely searched.
+  size_t complete_prefix = 0;
+  // Number of matches in the chunks before `complete_prefix`.
+  size_t complete_prefix_matches = 0;
+  size_t running_workers = 0;
+
+  // The next chunk that should be claimed by a thread.
+  std::atomic<size_t> next_chunk = 0;
+  // Chunks after this one don't need to be searched: enough matches have
+  // already been found.
+  std::atomic<size_t> last_chunk_needed;
 };
 
-auto GetRegexTraits(const OpenBuffer& buffer) {
-  auto traits = std::regex_constants::extended;
-  if (!buffer.Read(buffer_variables::search_case_sensitive)) {
-    traits |= std::regex_constants::icase;
+// Claims and searches chunks until there are none left or the search should
+// stop.
+void SearchChunks(const SearchOptions& options, const BufferContents& contents,
+                  std::shared_ptr<const Regex> regex, ParallelSearch* search) {
+  RegexMatcher matcher(std::move(regex));
+  size_t chunks = search->chunks.size();
+  for (size_t chunk = search->next_chunk++;
+       chunk < chunks && chunk <= search->last_chunk_needed.load();
+       chunk = search->next_chunk++) {
+    std::vector<LineColumn> positions;
+    size_t lines = 0;
+    bool complete = SearchLines(
+        &matcher, contents, search->chunks[chunk].begin,
+        search->chunks[chunk].end, &positions,
+        [&](const std::vector<LineColumn>&) {
+          return ++lines % kLinesBetweenInterruptionChecks == 0 &&
+                 (chunk > search->last_chunk_needed.load() ||
+                  options.abort_notification->HasBeenNotified());
+        });
+    if (!complete) return;
+
+    std::unique_lock<std::mutex> lock(search->mutex);
+    search->results[chunk] = std::move(positions);
+    while (search->complete_prefix <= search->last_chunk_needed.load() &&
+           search->results[search->complete_prefix].has_value()) {
+      search->complete_prefix_matches +=
+          search->results[search->complete_prefix]->size();
+      if (options.required_positions.has_value() &&
+          search->complete_prefix_matches >=
+              options.required_positions.value()) {
+        search->last_chunk_needed = search->complete_prefix;
+      }
+      search->complete_prefix++;
+    }
+    search->condition.notify_one();
   }
-  return traits;
 }
 
-template <typename RegexTraits>
-SearchResults PerformSearch(const SearchOptions& options, RegexTraits traits,
+// If `index` isn't nullptr, it's used to skip lines that can't contain matches.
+SearchResults PerformSearch(const SearchOptions& options,
+                            Regex::Options regex_options,
                             const BufferContents& contents,
+                            std::shared_ptr<const TrigramIndex> index,
                             ProgressChannel* progress_channel) {
-  vector<LineColumn> positions;
+  static Tracker tracker(L"SearchHandler::PerformSearch");
+  auto tracker_call = tracker.Call();
 
-  std::wregex pattern;
-  try {
-    pattern = std::wregex(options.search_query, traits);
-  } catch (std::regex_error& e) {
+  auto regex = Regex::New(options.search_query, regex_options);
+  if (regex.IsError()) {
     SearchResults output;
-    output.error = L"Regex failure: " + FromByteString(e.what());
+    output.error = L"Regex failure: " + regex.error().description;
     progress_channel->Push({.values = {{L"!", output.error.value()}}});
     return output;
   }
 
-  SearchResults output;
-
-  bool searched_every_line =
-      contents.EveryLine([&](LineNumber position, const Line& line) {
-        for (const auto& column : GetMatches(line.ToString(), pattern)) {
-          output.positions.push_back(LineColumn(position, column));
-        }
+  std::optional<std::vector<LineInterval>> candidates;
+  if (index != nullptr) {
+    candidates = index->CandidateLines(contents,
+                                       regex.value()->required_literals());
+  }
+  std::vector<LineInterval> chunks = SplitIntoChunks(candidates.value_or(
+      std::vector<LineInterval>{
+          {LineNumber(0), LineNumber(0) + contents.size()}}));
 
+  SearchResults output;
+  bool searched_every_line = true;
+  ThreadPool* pool = ComputeThreadPool();
+  if (chunks.size() <= 1) {
+    RegexMatcher matcher(regex.value());
+    for (const auto& chunk : chunks) {
+      searched_every_line = SearchLines(
+          &matcher, contents, chunk.begin, chunk.end, &output.positions,
+          [&, matches = size_t(0)](
+              const std::vector<LineColumn>& positions) mutable {
+            if (positions.size() != matches) {
+              matches = positions.size();
+              progress_channel->Push(
+                  ProgressInformation{.counters = {{L"matches", matches}}});
+            }
+            return options.abort_notification->HasBeenNotified() ||
+                   (options.required_positions.has_value() &&
+                    options.required_positions.value() <= matches);
+          });
+    }
+  } else {
+    // The threads only reference `search` (and `contents`) until they
+    // decrement `running_workers`, which we wait for before returning.
+    auto search = std::make_shared<ParallelSearch>(std::move(chunks));
+    std::unique_lock<std::mutex> lock(search->mutex);
+    search->running_workers = std::min(search->chunks.size(), pool->size());
+    for (size_t i = 0; i < search->running_workers; i++) {
+      pool->RunIgnoringResults(
+          [&options, &contents, regex = regex.value(), search] {
+            SearchChunks(options, contents, regex, search.get());
+            std::unique_lock<std::mutex> lock(search->mutex);
+            search->running_workers--;
+            search->condition.notify_one();
+          });
+    }
+    size_t matches = 0;
+    while (search->running_workers > 0) {
+      search->condition.wait(lock);
+      if (search->complete_prefix_matches != matches) {
+        matches = search->complete_prefix_matches;
         progress_channel->Push(
-            ProgressInformation{.counters = {{L"matches", output.positions.size()}}});
-        return !options.abort_notification->HasBeenNotified() &&
-               (!options.required_positions.has_value() ||
-                options.required_positions.value() > output.positions.size());
-      });
-  progress_channel->Push(
-      ProgressInformation{.values = {{L"matches", std::to_wstring(output.positions.size()) +
-                                   (searched_every_line ? L"" : L"+")}}});
+            ProgressInformation{.counters = {{L"matches", matches}}});
+      }
+    }
+    for (size_t chunk = 0; chunk < search->complete_prefix; chunk++) {
+      output.positions.insert(output.positions.end(),
+                              search->results[chunk]->begin(),
+                              search->results[chunk]->end());
+    }
+    searched_every_line = search->complete_prefix == search->chunks.size();
+  }
+  progress_channel->Push(ProgressInformation{
+      .values = {{L"matches", std::to_wstring(output.positions.size()) +
+                                  (searched_every_line ? L"" : L"+")}}});
   VLOG(5) << "Perform search found matches: " << output.positions.size();
   return output;
 }
 
+std::shared_ptr<Line> RandomLine() {
+  static const std::wstring kCharacters =
+      L"abcdefghijklmnopqrstuvwxyz0123456789 ()[]{}.;:_-";
+  std::wstring line;
+  for (int j = random() % 100; j > 0; j--) {
+    line.push_back(kCharacters[random() % kCharacters.size()]);
+  }
+  return std::make_shared<Line>(std::move(line));
+}
+
+std::unique_ptr<BufferContents> RandomContents(size_t lines) {
+  std::vector<std::shared_ptr<const Line>> output_lines;
+  for (size_t i = 0; i < lines; i++) {
+    output_lines.push_back(RandomLine());
+  }
+  auto output = std::make_unique<BufferContents>();
+  output->append_back(std::move(output_lines));
+  return output;
+}
+
+SearchResults SearchForTesting(
+    const SearchOptions& options, const BufferContents& contents,
+    std::shared_ptr<const TrigramIndex> index = nullptr) {
+  WorkQueue work_queue([] {});
+  ProgressChannel progress_channel(&work_queue, [](ProgressInformation) {},
+                                   WorkQueueChannelConsumeMode::kLastAvailable);
+  return PerformSearch(options, Regex::Options(), contents, std::move(index),
+                       &progress_channel);
+}
+
+// Returns the time per search in a buffer with 1M lines of random text.
+bool registration_search_benchmark =
+    tests::RegisterBenchmark(L"PerformSearch::1MLines", [](int elements) {
+      static const BufferContents* const contents =
+          RandomContents(1e6).release();
+      SearchOptions options;
+      options.search_query = L"[a-c]x?(foo|ba+r)";
+      auto start = Now();
+      for (int i = 0; i < elements; i++) {
+        CHECK(!SearchForTesting(options, *contents).error.has_value());
+      }
+      auto end = Now();
+      return SecondsBetween(start, end) / elements;
+    });
+
+// Like `PerformSearch::1MLines`, but for a rare literal and using an index.
+bool registration_search_index_benchmark = tests::RegisterBenchmark(
+    L"PerformSearch::1MLinesWithIndex", [](int elements) {
+      static const BufferContents* const contents =
+          RandomContents(1e6).release();
+      static const std::shared_ptr<const TrigramIndex> index = [] {
+        auto output = std::make_shared<TrigramIndex>();
+        output->Update(*contents);
+        return output;
+      }();
+      SearchOptions options;
+      options.search_query = L"x[a-c]?rare_identifier";
+      auto start = Now();
+      for (int i = 0; i < elements; i++) {
+        CHECK(SearchForTesting(options, *contents, index).positions.empty());
+      }
+      auto end = Now();
+      return SecondsBetween(start, end) / elements;
+    });
+
+class SearchHandlerTests : public tests::TestGroup<SearchHandlerTests> {
+ public:
+  SearchHandlerTests() : TestGroup<SearchHandlerTests>() {}
+  std::wstring Name() const override { return L"SearchHandlerTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"ParallelMatchesSequential",
+             .callback =
+                 [] {
+                   auto contents = RandomContents(10 * kLinesPerChunk + 17);
+                   SearchOptions options;
+                   options.search_query = L"a[b-d]";
+                   RegexMatcher matcher(
+                       Regex::New(options.search_query, {}).value());
+                   std::vector<LineColumn> expected;
+                   for (auto it = contents->begin(); it != contents->end();
+                        ++it) {
+                     for (auto column :
+                          matcher.MatchStarts(*(*it)->contents())) {
+                       expected.push_back(
+                           LineColumn(LineNumber(it.position()), column));
+                     }
+                   }
+                   CHECK_GT(expected.size(), 0ul);
+                   CHECK(SearchForTesting(options, *contents).positions ==
+                         expected);
+                 }},
+            {.name = L"RequiredPositions", .callback = [] {
+               auto contents = RandomContents(10 * kLinesPerChunk);
+               SearchOptions options;
+               options.search_query = L"a";
+               auto all = SearchForTesting(options, *contents).positions;
+               options.required_positions = 100;
+               auto some = SearchForTesting(options, *contents).positions;
+               CHECK_GE(some.size(), 100ul);
+               CHECK_LT(some.size(), all.size());
+               CHECK(std::equal(some.begin(), some.end(), all.begin()));
+             }},
+            {.name = L"IndexMatchesFullSearch", .callback = [] {
+               auto contents = RandomContents(10 * kLinesPerChunk);
+               auto index = std::make_shared<TrigramIndex>();
+               index->Update(*contents);
+               contents->insert_line(LineNumber(100),
+                                     std::make_shared<Line>(L"xyzab"));
+               for (std::wstring query :
+                    {L"abc", L"x?(ab)+c", L"a[b-d]e", L"xyz", L"a.c|def"}) {
+                 SearchOptions options;
+                 options.search_query = query;
+                 auto expected = SearchForTesting(options, *contents);
+                 CHECK(SearchForTesting(options, *contents, index).positions ==
+                       expected.positions);
+               }
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<SearchHandlerTests>::registration_ =
+    tests::Add<editor::SearchHandlerTests>();
 }  // namespace
 
 AsyncSearchProcessor::AsyncSearchProcessor(WorkQueue* work_queue)
@@ -113,14 +368,16 @@ futures::Value<AsyncSearchProcessor::Output> AsyncSearchProcessor::Search(
     SearchOptions search_options, const OpenBuffer& buffer,
     std::shared_ptr<ProgressChannel> progress_channel) {
   search_options.required_positions = 100;
-  auto traits = GetRegexTraits(buffer);
+  auto regex_options = GetRegexOptions(buffer);
   return evaluator_.Run([search_options, query = search_options.search_query,
-                         traits,
+                         regex_options,
                          buffer_contents = std::shared_ptr<BufferContents>(
                              buffer.contents()->copy()),
+                         search_index = buffer.search_index(),
                          progress_channel] {
-    auto search_results = PerformSearch(
-        search_options, traits, *buffer_contents, progress_channel.get());
+    auto search_results =
+        PerformSearch(search_options, regex_options, *buffer_contents,
+                      search_index, progress_channel.get());
     VLOG(5) << "Async search completed for \"" << query
             << "\", found results: " << search_results.positions.size();
     Output output;
@@ -159,8 +416,8 @@ ValueOrError<std::vector<LineColumn>> PerformSearchWithDirection(
       editor_state->work_queue(), [](ProgressInformation) {},
       WorkQueueChannelConsumeMode::kLastAvailable);
   SearchResults results =
-      PerformSearch(options, GetRegexTraits(*buffer), *buffer->contents(),
-                    dummy_progress_channel.get());
+      PerformSearch(options, GetRegexOptions(*buffer), *buffer->contents(),
+                    buffer->search_index(), dummy_progress_channel.get());
   if (results.error.has_value()) {
     return Error(results.error.value());
   }
@@ -3,17 +3,27 @@
 #include <glog/logging.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <unordered_set>
 
 #include "src/buffer_output_producer.h"
 #include "src/buffer_variables.h"
 #include "src/dirname.h"
+#include "src/editor_variables.h"
 #include "src/frame_output_producer.h"
 #include "src/horizontal_split_output_producer.h"
 #include "src/line_marks.h"
 #include "src/parse_tree.h"
 #include "src/status_output_producer.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/thread_pool.h"
+#include "src/time.h"
+#include "src/tracker.h"
 
 namespace afc {
 namespace editor {
@@ -41,6 +51,31 @@ Terminal::Terminal() : lines_cache_(1024) {}
 
 void Terminal::Display(EditorState* editor_state, Screen* screen,
                        const EditorState::ScreenState& screen_state) {
+  ScreenVersion version{
+      .size = LineColumnDelta(screen->lines(), screen->columns()),
+      .display_version = editor_state->display_version()};
+  if (auto it = screen_versions_->find(screen->id());
+      it == screen_versions_->end()) {
+    screen->AddDestructionObserver(
+        [weak_versions = std::weak_ptr(screen_versions_), id = screen->id()] {
+          if (auto versions = weak_versions.lock(); versions != nullptr) {
+            versions->erase(id);
+          }
+        });
+  } else if (!screen_state.needs_hard_redraw &&
+             it->second.size == version.size &&
+             it->second.display_version == version.display_version &&
+             (!it->second.expiration.has_value() ||
+              Now() < it->second.expiration.value())) {
+    VLOG(5) << "Nothing has changed, skipping screen update.";
+    return;
+  }
+  auto tracker_call = DisplayTracker().Call();
+  editor_state->TakeDisplayExpiration();  // Ignore stale expirations.
+  lines_cache_.SetMaxSize(
+      std::max(1, editor_state->Read(editor_variables::line_cache_screens)) *
+      std::max(1, screen->lines().line_delta));
+
   if (screen_state.needs_hard_redraw) {
     screen->HardRefresh();
     hashes_current_lines_.clear();
@@ -71,9 +106,16 @@ void Terminal::Display(EditorState* editor_state, Screen* screen,
       std::move(rows),
       editor_state->status()->GetType() == Status::Type::kPrompt ? 1 : 0);
 
+  std::vector<OutputProducer::Generator> generators;
   for (auto line = LineNumber(); line.ToDelta() < screen->lines(); ++line) {
-    WriteLine(screen, line, producer.Next());
+    generators.push_back(producer.Next());
   }
+  auto drawers = GenerateLinesInParallel(editor_state, screen, &generators);
+  for (auto line = LineNumber(); line.ToDelta() < screen->lines(); ++line) {
+    WriteLine(screen, line, std::move(generators[line.line]), &drawers);
+  }
+  version.expiration = editor_state->TakeDisplayExpiration();
+  (*screen_versions_)[screen->id()] = version;
 
   if (editor_state->status()->GetType() == Status::Type::kPrompt ||
       (buffer != nullptr &&
@@ -89,6 +131,22 @@ void Terminal::Display(EditorState* editor_state, Screen* screen,
   screen->Flush();
 }
 
+/* static */ Tracker& Terminal::DisplayTracker() {
+  static Tracker* const output = new Tracker(L"Terminal::Display");
+  return *output;
+}
+
+std::optional<struct timespec> Terminal::NextExpiration() const {
+  std::optional<struct timespec> output;
+  for (const auto& [id, version] : *screen_versions_) {
+    if (version.expiration.has_value() &&
+        (!output.has_value() || version.expiration.value() < output.value())) {
+      output = version.expiration;
+    }
+  }
+  return output;
+}
+
 // Adjust the name of a buffer to a string suitable to be shown in the Status
 // with progress indicators surrounding it.
 //
@@ -128,14 +186,128 @@ void FlushModifiers(Screen* screen, const LineModifierSet& modifiers) {
   }
 }
 
+namespace {
+// State shared with the threads that generate lines in parallel.
+struct ParallelLineGeneration {
+  ParallelLineGeneration(std::vector<OutputProducer::Generator> input_generators,
+                         ColumnNumberDelta input_width)
+      : generators(std::move(input_generators)),
+        width(input_width),
+        output(generators.size()) {}
+
+  const std::vector<OutputProducer::Generator> generators;
+  const ColumnNumberDelta width;
+
+  // Index of the next generator to run.
+  std::atomic<size_t> next = 0;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<std::optional<Terminal::LineDrawer>> output;
+  // Number of values in `output` that have been set.
+  size_t done = 0;
+};
+
+void GenerateLines(ParallelLineGeneration* state) {
+  size_t index;
+  while ((index = state->next++) < state->generators.size()) {
+    auto drawer = Terminal::GetLineDrawer(state->generators[index].generate(),
+                                          state->width);
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->output[index] = std::move(drawer);
+    state->done++;
+    state->condition.notify_one();
+  }
+}
+
+// Runs all `generators` (in `pool` and in the current thread) and returns their
+// drawers (in the same order).
+std::vector<Terminal::LineDrawer> GenerateLineDrawers(
+    ThreadPool* pool, std::vector<OutputProducer::Generator> generators,
+    ColumnNumberDelta width) {
+  static Tracker tracker(L"Terminal::GenerateLineDrawers");
+  auto tracker_call = tracker.Call();
+  auto state = std::make_shared<ParallelLineGeneration>(std::move(generators),
+                                                        width);
+  // The pool may be busy (e.g., with a search), so we also generate lines in
+  // the current thread and only wait for the lines that have been started.
+  // The workers that start after that won't find anything left to do (and
+  // keep `state` alive).
+  for (size_t i = 1; i < std::min(pool->size(), state->generators.size());
+       i++) {
+    pool->RunIgnoringResults([state] { GenerateLines(state.get()); });
+  }
+  GenerateLines(state.get());
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->condition.wait(
+      lock, [&] { return state->done == state->generators.size(); });
+  std::vector<Terminal::LineDrawer> output;
+  for (auto& drawer : state->output) {
+    output.push_back(std::move(drawer.value()));
+  }
+  return output;
+}
+}  // namespace
+
+std::unordered_map<size_t, Terminal::LineDrawer>
+Terminal::GenerateLinesInParallel(
+    EditorState* editor_state, Screen* screen,
+    std::vector<OutputProducer::Generator>* generators) {
+  ThreadPool* pool = ComputeThreadPool();
+  if (pool->size() <= 1 ||
+      !editor_state->Read(editor_variables::parallel_line_generation)) {
+    return {};
+  }
+  std::unordered_set<size_t> hashes;
+  std::vector<size_t> lines_to_generate;
+  for (size_t line = 0; line < generators->size(); line++) {
+    const auto& inputs_hash = generators->at(line).inputs_hash;
+    if (!inputs_hash.has_value() ||
+        (line < hashes_current_lines_.size() &&
+         hashes_current_lines_[line] == inputs_hash.value()) ||
+        lines_cache_.Contains(inputs_hash.value()) ||
+        !hashes.insert(inputs_hash.value()).second) {
+      continue;
+    }
+    lines_to_generate.push_back(line);
+  }
+  std::unordered_map<size_t, LineDrawer> output;
+  // Not worth the overhead for a single line.
+  if (lines_to_generate.size() <= 1) return output;
+
+  std::vector<OutputProducer::Generator> generators_to_run;
+  std::vector<size_t> generated_hashes;
+  for (size_t line : lines_to_generate) {
+    auto& generator = generators->at(line);
+    generated_hashes.push_back(generator.inputs_hash.value());
+    generators_to_run.push_back(std::move(generator));
+  }
+  auto drawers = GenerateLineDrawers(pool, std::move(generators_to_run),
+                                     screen->columns());
+  for (size_t i = 0; i < drawers.size(); i++) {
+    output.insert({generated_hashes[i], std::move(drawers[i])});
+  }
+  return output;
+}
+
 void Terminal::WriteLine(Screen* screen, LineNumber line,
-                         OutputProducer::Generator generator) {
+                         OutputProducer::Generator generator,
+                         std::unordered_map<size_t, LineDrawer>* drawers) {
   if (hashes_current_lines_.size() <= line.line) {
     CHECK_LT(line.ToDelta(), screen->lines());
     hashes_current_lines_.resize(screen->lines().line_delta * 2 + 50);
   }
 
   auto factory = [&] {
+    if (generator.inputs_hash.has_value()) {
+      if (auto it = drawers->find(generator.inputs_hash.value());
+          it != drawers->end()) {
+        LineDrawer output = std::move(it->second);
+        drawers->erase(it);
+        return output;
+      }
+    }
+    CHECK(generator.generate != nullptr);
     return GetLineDrawer(generator.generate(), screen->columns());
   };
 
@@ -153,17 +325,49 @@ void Terminal::WriteLine(Screen* screen, LineNumber line,
 
   VLOG(8) << "Generating line for screen: " << line;
   screen->Move(line, ColumnNumber(0));
-  drawer->draw_callback(screen);
+  drawer->Draw(screen);
   hashes_current_lines_[line.line] = generator.inputs_hash;
   if (drawer->cursor.has_value()) {
     cursor_position_ = LineColumn(line, drawer->cursor.value());
   }
 }
 
+void Terminal::LineDrawer::Draw(Screen* screen) const {
+  std::wstring_view text = text_;
+  size_t text_start = 0;
+  for (const Command& command : commands_) {
+    switch (command.type) {
+      case CommandType::kWriteString:
+        screen->WriteString(
+            text.substr(text_start, command.text_end - text_start));
+        text_start = command.text_end;
+        break;
+      case CommandType::kSetModifiers:
+        FlushModifiers(screen, command.modifiers);
+        break;
+    }
+  }
+}
+
+void Terminal::LineDrawer::SetModifiers(LineModifierSet modifiers) {
+  commands_.push_back({.type = CommandType::kSetModifiers,
+                       .modifiers = modifiers,
+                       .text_end = 0});
+}
+
+void Terminal::LineDrawer::FinishString() {
+  if (text_written_ == text_.size()) return;
+  text_written_ = text_.size();
+  commands_.push_back({.type = CommandType::kWriteString,
+                       .modifiers = {},
+                       .text_end = text_written_});
+}
+
 Terminal::LineDrawer Terminal::GetLineDrawer(
     OutputProducer::LineWithCursor line_with_cursor, ColumnNumberDelta width) {
+  static Tracker tracker(L"Terminal::GetLineDrawer");
+  auto tracker_call = tracker.Call();
   Terminal::LineDrawer output;
-  std::vector<decltype(LineDrawer::draw_callback)> functions;
 
   CHECK(line_with_cursor.line != nullptr);
   VLOG(6) << "Writing line of length: "
@@ -171,14 +375,14 @@ Terminal::LineDrawer Terminal::GetLineDrawer(
   ColumnNumber input_column;
   ColumnNumber output_column;
 
-  functions.push_back(
-      [](Screen* screen) { screen->SetModifier(LineModifier::RESET); });
+  output.SetModifiers({});
 
-  auto modifiers_it =
-      line_with_cursor.line->modifiers().lower_bound(input_column);
+  const auto& modifiers = line_with_cursor.line->modifiers();
+  auto modifiers_it = modifiers.lower_bound(input_column);
+  auto contents = line_with_cursor.line->contents();
+  const ColumnNumber end_column = line_with_cursor.line->EndColumn();
 
-  while (input_column < line_with_cursor.line->EndColumn() &&
-         output_column < ColumnNumber(0) + width) {
+  while (input_column < end_column && output_column < ColumnNumber(0) + width) {
     if (line_with_cursor.cursor.has_value() &&
         input_column == line_with_cursor.cursor.value()) {
       output.cursor = output_column;
@@ -186,33 +390,24 @@ Terminal::LineDrawer Terminal::GetLineDrawer(
 
     // Each iteration will advance input_column and then print between start
     // and input_column.
-    auto start = input_column;
-    while ((input_column < line_with_cursor.line->EndColumn() &&
+    while ((input_column < end_column &&
             output_column < ColumnNumber(0) + width &&
             (!line_with_cursor.cursor.has_value() ||
              input_column != line_with_cursor.cursor.value() ||
              output.cursor == output_column) &&
-            (modifiers_it == line_with_cursor.line->modifiers().end() ||
+            (modifiers_it == modifiers.end() ||
              modifiers_it->first > input_column))) {
-      output_column += ColumnNumberDelta(
-          wcwidth(line_with_cursor.line->contents()->get(input_column)));
+      wchar_t c = contents->get(input_column);
+      output.AppendCharacter(c);
+      output_column += ColumnNumberDelta(wcwidth(c));
       ++input_column;
     }
+    output.FinishString();
 
-    // TODO: Have screen receive the LazyString directly.
-    if (start != input_column) {
-      auto str = Substring(line_with_cursor.line->contents(), start,
-                           input_column - start)
-                     ->ToString();
-      functions.push_back([str](Screen* screen) { screen->WriteString(str); });
-    }
-
-    if (modifiers_it != line_with_cursor.line->modifiers().end()) {
+    if (modifiers_it != modifiers.end()) {
       CHECK_GE(modifiers_it->first, input_column);
       if (modifiers_it->first == input_column) {
-        functions.push_back([modifiers = modifiers_it->second](Screen* screen) {
-          FlushModifiers(screen, modifiers);
-        });
+        output.SetModifiers(modifiers_it->second);
         ++modifiers_it;
       }
     }
@@ -223,13 +418,9 @@ Terminal::LineDrawer Terminal::GetLineDrawer(
   }
 
   if (output_column < ColumnNumber(0) + width) {
-    functions.push_back([](Screen* screen) { screen->WriteString(L"\n"); });
+    output.AppendCharacter(L'\n');
+    output.FinishString();
   }
-  output.draw_callback = [functions = std::move(functions)](Screen* screen) {
-    for (auto& f : functions) {
-      f(screen);
-    }
-  };
   return output;
 }
 
@@ -239,5 +430,120 @@ void Terminal::AdjustPosition(Screen* screen) {
   screen->Move(cursor_position_.value().line, cursor_position_.value().column);
 }
 
+namespace {
+// Discards everything.
+class NullScreen : public Screen {
+ public:
+  void Flush() override {}
+  void HardRefresh() override {}
+  void Refresh() override {}
+  void Clear() override {}
+  void SetCursorVisibility(CursorVisibility) override {}
+  void Move(LineNumber, ColumnNumber) override {}
+  void WriteString(std::wstring_view) override {}
+  void SetModifier(LineModifier) override {}
+  LineNumberDelta lines() const override { return LineNumberDelta(50); }
+  ColumnNumberDelta columns() const override { return ColumnNumberDelta(100); }
+};
+
+// Returns a line of 100 characters with `tokens` highlighted tokens.
+OutputProducer::LineWithCursor HighlightedLine(int tokens) {
+  Line::Options options;
+  for (int i = 0; i < 100; i++) {
+    options.AppendCharacter(L'a' + i % 26,
+                            i % (100 / std::min(tokens, 100)) == 0
+                                ? LineModifierSet{LineModifier::CYAN}
+                                : LineModifierSet{});
+  }
+  return {.line = std::make_shared<Line>(std::move(options)),
+          .cursor = std::nullopt};
+}
+
+// Returns the time to create a drawer for a line with `tokens` highlighted
+// tokens (in a screen 100 columns wide).
+bool registration_get_line_drawer_benchmark = tests::RegisterBenchmark(
+    L"Terminal::GetLineDrawer", [](int tokens) {
+      auto line = HighlightedLine(tokens);
+      auto start = Now();
+      Terminal::GetLineDrawer(line, ColumnNumberDelta(100));
+      return SecondsBetween(start, Now());
+    });
+
+// Returns the time to draw (from the cache) a line with `tokens` highlighted
+// tokens.
+bool registration_line_drawer_draw_benchmark =
+    tests::RegisterBenchmark(L"Terminal::LineDrawer::Draw", [](int tokens) {
+      auto drawer =
+          Terminal::GetLineDrawer(HighlightedLine(tokens), ColumnNumberDelta(100));
+      NullScreen screen;
+      static const int kRuns = 1000;
+      auto start = Now();
+      for (int i = 0; i < kRuns; i++) drawer.Draw(&screen);
+      return SecondsBetween(start, Now()) / kRuns;
+    });
+
+std::vector<OutputProducer::Generator> HighlightedLineGenerators(int lines) {
+  std::vector<OutputProducer::Generator> output;
+  for (int i = 0; i < lines; i++) {
+    output.push_back({.inputs_hash = i,
+                      .generate = [i] { return HighlightedLine(1 + i % 50); }});
+  }
+  return output;
+}
+
+// Returns the time to generate the drawers for `lines` lines in the compute
+// thread pool.
+bool registration_generate_line_drawers_benchmark = tests::RegisterBenchmark(
+    L"Terminal::GenerateLineDrawers", [](int lines) {
+      auto generators = HighlightedLineGenerators(lines);
+      auto start = Now();
+      GenerateLineDrawers(ComputeThreadPool(), std::move(generators),
+                          ColumnNumberDelta(100));
+      return SecondsBetween(start, Now());
+    });
+
+// Records the strings written (and the modifiers set).
+class RecordingScreen : public NullScreen {
+ public:
+  void WriteString(std::wstring_view str) override { contents.append(str); }
+  void SetModifier(LineModifier modifier) override {
+    contents += L"[" + std::to_wstring(static_cast<int>(modifier)) + L"]";
+  }
+
+  std::wstring contents;
+};
+
+class TerminalTests : public tests::TestGroup<TerminalTests> {
+ public:
+  TerminalTests() : TestGroup<TerminalTests>() {}
+  std::wstring Name() const override { return L"TerminalTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"GenerateLineDrawersMatchesSequential", .callback = [] {
+               static const int kLines = 200;
+               ThreadPool pool(4);
+               auto drawers = GenerateLineDrawers(
+                   &pool, HighlightedLineGenerators(kLines),
+                   ColumnNumberDelta(80));
+               CHECK_EQ(drawers.size(), size_t(kLines));
+               auto generators = HighlightedLineGenerators(kLines);
+               for (int i = 0; i < kLines; i++) {
+                 RecordingScreen parallel;
+                 drawers[i].Draw(&parallel);
+                 RecordingScreen sequential;
+                 Terminal::GetLineDrawer(generators[i].generate(),
+                                         ColumnNumberDelta(80))
+                     .Draw(&sequential);
+                 CHECK(parallel.contents == sequential.contents);
+                 CHECK(!parallel.contents.empty());
+               }
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<TerminalTests>::registration_ =
+    tests::Add<editor::TerminalTests>();
+}  // namespace
+
 }  // namespace editor
 }  // namespace afc
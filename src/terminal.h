@@ -5,11 +5,14 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 #include "src/editor.h"
+#include "src/line_modifier.h"
 #include "src/lru_cache.h"
 #include "src/output_producer.h"
 #include "src/screen.h"
+#include "src/tracker.h"
 
 namespace afc {
 namespace editor {
@@ -38,23 +41,85 @@ class Terminal {
   void Display(EditorState* editor_state, Screen* screen,
                const EditorState::ScreenState& screen_state);
 
- private:
-  // Function that will draw a given line of output at the current position. It
-  // also contains knowledge about where the cursor will be at the end.
-  struct LineDrawer {
-    std::function<void(Screen*)> draw_callback;
+  // Returns the earliest time at which `Display` needs to update a screen even
+  // if nothing happens.
+  std::optional<struct timespec> NextExpiration() const;
+
+  // Measures the calls to `Display` that update a screen.
+  static Tracker& DisplayTracker();
+
+  // Draws a given line of output at the current position. It also contains
+  // knowledge about where the cursor will be at the end.
+  //
+  // The commands are kept in a flat vector, with all the characters to write
+  // in a single string (rather than, say, in a closure for each command), to
+  // keep cached instances small and cheap to draw.
+  class LineDrawer {
+   public:
+    void Draw(Screen* screen) const;
+
+    void SetModifiers(LineModifierSet modifiers);
+    // Appends a character to the text written by the next call to
+    // `FinishString`.
+    void AppendCharacter(wchar_t c) { text_.push_back(c); }
+    // Writes all the characters appended since the previous command.
+    void FinishString();
+
     std::optional<ColumnNumber> cursor;
-  };
 
-  void WriteLine(Screen* screen, LineNumber line,
-                 OutputProducer::Generator line_with_cursor);
+   private:
+    enum class CommandType : uint8_t { kWriteString, kSetModifiers };
+    struct Command {
+      CommandType type;
+      // Only for kSetModifiers.
+      LineModifierSet modifiers;
+      // Only for kWriteString: writes the characters from the position in
+      // `text_` where the previous string ended until this position.
+      uint32_t text_end;
+    };
+    std::vector<Command> commands_;
+    std::wstring text_;
+    // Number of characters in `text_` that the commands already write.
+    uint32_t text_written_ = 0;
+  };
 
-  // Returns a DrawLine that can be used to draw a given line.
+  // Returns a LineDrawer that can be used to draw a given line.
   static LineDrawer GetLineDrawer(
       OutputProducer::LineWithCursor line_with_cursor, ColumnNumberDelta width);
 
+ private:
+  // Generates (in parallel) the drawers for the lines in `generators` that
+  // will be needed to update the screen (i.e., that aren't already shown nor
+  // in `lines_cache_`). Only considers generators with an `inputs_hash` (which
+  // only depend on immutable inputs, so they can run in any thread). Returns
+  // the drawers indexed by their hashes; moves out of `generators` the
+  // generators that it runs.
+  std::unordered_map<size_t, LineDrawer> GenerateLinesInParallel(
+      EditorState* editor_state, Screen* screen,
+      std::vector<OutputProducer::Generator>* generators);
+
+  // If `generator` has a hash that is a key in `drawers`, uses (and removes)
+  // the corresponding value rather than running `generator`.
+  void WriteLine(Screen* screen, LineNumber line,
+                 OutputProducer::Generator generator,
+                 std::unordered_map<size_t, LineDrawer>* drawers);
+
   void AdjustPosition(Screen* screen);
 
+  // What a screen showed when it was last updated.
+  struct ScreenVersion {
+    LineColumnDelta size;
+    size_t display_version;
+    // When something that was displayed changes, even if `display_version`
+    // doesn't (see `EditorState::AddDisplayExpiration`).
+    std::optional<struct timespec> expiration;
+  };
+  // Keyed by `Screen::id`. Entries are removed when their screens are
+  // destroyed (which may happen after the terminal is destroyed).
+  const std::shared_ptr<std::unordered_map<size_t, ScreenVersion>>
+      screen_versions_ =
+          std::make_shared<std::unordered_map<size_t, ScreenVersion>>();
+
   // Position at which the cursor should be placed in the screen, if known.
   std::optional<LineColumn> cursor_position_;
 
@@ -63,6 +128,8 @@ class Terminal {
   std::vector<std::optional<size_t>> hashes_current_lines_;
 
   // Given the hash of a line, return a LineDrawer that can be used to draw it.
+  // The size is adjusted to the size of the screen (see variable
+  // `line_cache_screens`).
   LRUCache<size_t, LineDrawer> lines_cache_;
 };
 
@@ -0,0 +1,100 @@
+#include "src/thread_pool.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "src/notification.h"
+#include "src/tests/tests.h"
+
+namespace afc::editor {
+
+ThreadPool::ThreadPool(size_t size) {
+  CHECK_GT(size, 0ul);
+  for (size_t i = 0; i < size; i++) {
+    threads_.emplace_back([this] { BackgroundThread(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  shutting_down_ = true;
+  lock.unlock();
+  condition_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::RunIgnoringResults(std::function<void()> callback) {
+  CHECK(callback != nullptr);
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(!shutting_down_);
+  callbacks_.push_back(std::move(callback));
+  lock.unlock();
+  condition_.notify_one();
+}
+
+void ThreadPool::BackgroundThread() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock,
+                    [this] { return shutting_down_ || !callbacks_.empty(); });
+    if (callbacks_.empty()) {
+      CHECK(shutting_down_);
+      return;
+    }
+    auto callback = std::move(callbacks_.front());
+    callbacks_.pop_front();
+    lock.unlock();
+    callback();
+  }
+}
+
+ThreadPool* ComputeThreadPool() {
+  static ThreadPool* const output =
+      new ThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+  return output;
+}
+
+namespace {
+class ThreadPoolTests : public tests::TestGroup<ThreadPoolTests> {
+ public:
+  ThreadPoolTests() : TestGroup<ThreadPoolTests>() {}
+  std::wstring Name() const override { return L"ThreadPoolTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"RunsAllCallbacks",
+             .callback =
+                 [] {
+                   std::atomic<int> count = 0;
+                   {
+                     ThreadPool pool(4);
+                     for (int i = 0; i < 1000; i++) {
+                       pool.RunIgnoringResults([&count] { count++; });
+                     }
+                   }
+                   CHECK_EQ(count.load(), 1000);
+                 }},
+            {.name = L"RunsInParallel", .callback = [] {
+               // Would deadlock if the callbacks ran sequentially.
+               Notification first_started;
+               Notification second_done;
+               ThreadPool pool(2);
+               pool.RunIgnoringResults([&] {
+                 first_started.Notify();
+                 second_done.WaitForNotification();
+               });
+               pool.RunIgnoringResults([&] {
+                 first_started.WaitForNotification();
+                 second_done.Notify();
+               });
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<ThreadPoolTests>::registration_ =
+    tests::Add<editor::ThreadPoolTests>();
+}  // namespace
+}  // namespace afc::editor
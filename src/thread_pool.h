@@ -0,0 +1,44 @@
+#ifndef __AFC_EDITOR_THREAD_POOL_H__
+#define __AFC_EDITOR_THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace afc::editor {
+
+// Runs callbacks in a fixed set of background threads.
+//
+// This class is thread-safe.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t size);
+
+  // Waits until all the callbacks that have been scheduled have executed.
+  ~ThreadPool();
+
+  size_t size() const { return threads_.size(); }
+
+  void RunIgnoringResults(std::function<void()> callback);
+
+ private:
+  void BackgroundThread();
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::deque<std::function<void()>> callbacks_;
+  bool shutting_down_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+// Returns a pool with one thread per available core, meant for CPU-bound work
+// that can be split into independent pieces.
+ThreadPool* ComputeThreadPool();
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_THREAD_POOL_H__
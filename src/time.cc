@@ -2,6 +2,7 @@
 
 #include <glog/logging.h>
 
+#include <cmath>
 #include <memory>
 
 #include "src/wstring.h"
@@ -31,6 +32,21 @@ double GetElapsedSecondsSince(const struct timespec& spec) {
   return GetElapsedSecondsAndUpdate(&copy);
 }
 
+struct timespec AddSeconds(struct timespec time, double seconds) {
+  double integral;
+  double fractional = modf(seconds, &integral);
+  time.tv_sec += static_cast<time_t>(integral);
+  time.tv_nsec += static_cast<long>(fractional * 1e9);
+  if (time.tv_nsec >= 1000000000) {
+    time.tv_sec++;
+    time.tv_nsec -= 1000000000;
+  } else if (time.tv_nsec < 0) {
+    time.tv_sec--;
+    time.tv_nsec += 1000000000;
+  }
+  return time;
+}
+
 double GetElapsedMillisecondsSince(const struct timespec& spec) {
   return GetElapsedSecondsSince(spec) * 1000;
 }
@@ -15,6 +15,7 @@ double SecondsBetween(const struct timespec& begin, const struct timespec& end);
 double MillisecondsBetween(const struct timespec& begin,
                            const struct timespec& end);
 double GetElapsedSecondsSince(const struct timespec& spec);
+struct timespec AddSeconds(struct timespec time, double seconds);
 double GetElapsedMillisecondsSince(const struct timespec& spec);
 
 double GetElapsedMillisecondsAndUpdate(struct timespec* spec);
@@ -47,4 +47,14 @@ std::unique_ptr<bool, std::function<void(bool*)>> Tracker::Call() {
         data_.seconds += GetElapsedSecondsSince(start);
       });
 }
+
+Tracker::Data Tracker::data() const {
+  std::unique_lock<std::mutex> lock(trackers_mutex);
+  return data_;
+}
+
+void Tracker::AddExecutions(size_t executions) {
+  std::unique_lock<std::mutex> lock(trackers_mutex);
+  data_.executions += executions;
+}
 }  // namespace afc::editor
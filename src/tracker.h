@@ -42,6 +42,13 @@ class Tracker {
 
   std::unique_ptr<bool, std::function<void(bool*)>> Call();
 
+  // Returns the data of this tracker (rather than of all trackers).
+  Data data() const;
+
+  // Adds `executions` to the count of executions, without measuring time. This
+  // is useful for frequent events that are counted in bulk (e.g., cache hits).
+  void AddExecutions(size_t executions);
+
  private:
   std::list<Tracker*>::iterator trackers_it_;
 
@@ -17,8 +17,8 @@ std::shared_ptr<editor::CompositeTransformation::Output>
 VMTypeMapper<std::shared_ptr<editor::CompositeTransformation::Output>>::get(
     Value* value) {
   CHECK(value != nullptr);
-  CHECK(value->type.type == VMType::OBJECT_TYPE);
-  CHECK(value->type.object_type == L"TransformationOutput");
+  CHECK(value->type().type == VMType::OBJECT_TYPE);
+  CHECK(value->type().object_type == L"TransformationOutput");
   CHECK(value->user_value != nullptr);
   return std::static_pointer_cast<editor::CompositeTransformation::Output>(
       value->user_value);
@@ -40,8 +40,8 @@ std::shared_ptr<editor::CompositeTransformation::Input>
 VMTypeMapper<std::shared_ptr<editor::CompositeTransformation::Input>>::get(
     Value* value) {
   CHECK(value != nullptr);
-  CHECK(value->type.type == VMType::OBJECT_TYPE);
-  CHECK(value->type.object_type == L"TransformationInput");
+  CHECK(value->type().type == VMType::OBJECT_TYPE);
+  CHECK(value->type().object_type == L"TransformationInput");
   CHECK(value->user_value != nullptr);
   return std::static_pointer_cast<editor::CompositeTransformation::Input>(
       value->user_value);
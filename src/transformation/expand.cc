@@ -178,7 +178,7 @@ class Execute : public CompositeTransformation {
           if (value != nullptr) {
             output.Push(DeleteLastCharacters(command_size));
           }
-          if (value != nullptr && value->type == VMType::String()) {
+          if (value != nullptr && value->type() == VMType::String()) {
             auto buffer_to_insert =
                 OpenBuffer::New({.editor = editor, .name = L"- text inserted"});
             buffer_to_insert->AppendLazyString(NewLazyString(value->str));
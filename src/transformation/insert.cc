@@ -15,8 +15,8 @@ template <>
 struct VMTypeMapper<std::shared_ptr<editor::transformation::Insert>> {
   static std::shared_ptr<editor::transformation::Insert> get(Value* value) {
     CHECK(value != nullptr);
-    CHECK(value->type.type == VMType::OBJECT_TYPE);
-    CHECK(value->type.object_type == L"InsertTransformationBuilder");
+    CHECK(value->type().type == VMType::OBJECT_TYPE);
+    CHECK(value->type().object_type == L"InsertTransformationBuilder");
     CHECK(value->user_value != nullptr);
     return std::static_pointer_cast<editor::transformation::Insert>(
         value->user_value);
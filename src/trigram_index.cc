@@ -0,0 +1,323 @@
+#include "src/trigram_index.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cwctype>
+
+#include "src/char_buffer.h"
+#include "src/lazy_string_functional.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
+#include "src/tracker.h"
+
+namespace afc::editor {
+namespace {
+// The index records the blocks (rather than the individual lines) that contain
+// each trigram, which makes it much smaller: a trigram that appears in many
+// lines in a block only takes one entry. The price is that a search has to scan
+// all the lines in every candidate block.
+constexpr size_t kLinesPerBlock = 256;
+
+// Each character takes 21 bits (enough for any Unicode code point).
+constexpr int kBitsPerCharacter = 21;
+constexpr uint64_t kTrigramMask = (uint64_t(1) << (3 * kBitsPerCharacter)) - 1;
+
+// Appends to `output` all the trigrams in `input` (possibly repeated).
+void AddTrigrams(const LazyString& input, std::vector<uint64_t>* output) {
+  uint64_t trigram = 0;
+  ForEachColumn(input, [&](ColumnNumber column, wchar_t c) {
+    trigram = ((trigram << kBitsPerCharacter) |
+               (static_cast<uint64_t>(towlower(c)) &
+                ((uint64_t(1) << kBitsPerCharacter) - 1))) &
+              kTrigramMask;
+    if (column >= ColumnNumber(2)) output->push_back(trigram);
+  });
+}
+
+void SortAndRemoveDuplicates(std::vector<uint64_t>* trigrams) {
+  std::sort(trigrams->begin(), trigrams->end());
+  trigrams->erase(std::unique(trigrams->begin(), trigrams->end()),
+                  trigrams->end());
+}
+}  // namespace
+
+void TrigramIndex::Update(const BufferContents& contents) {
+  static Tracker tracker(L"TrigramIndex::Update");
+  auto tracker_call = tracker.Call();
+
+  // We can read `contents_` without locking `mutex_`, since we're the only
+  // ones who modify it.
+  uint32_t first_block =
+      contents_ == nullptr
+          ? 0
+          : contents_->CommonPrefix(contents).line_delta / kLinesPerBlock;
+  VLOG(5) << "Updating trigram index starting at block: " << first_block;
+
+  std::unordered_map<uint64_t, std::vector<uint32_t>> new_blocks;
+  std::vector<uint64_t> trigrams;
+  auto it = contents.IteratorAt(LineNumber(first_block * kLinesPerBlock));
+  for (uint32_t block = first_block; it != contents.end(); block++) {
+    trigrams.clear();
+    for (size_t i = 0; i < kLinesPerBlock && it != contents.end(); i++, ++it) {
+      AddTrigrams(*(*it)->contents(), &trigrams);
+    }
+    SortAndRemoveDuplicates(&trigrams);
+    for (uint64_t trigram : trigrams) {
+      new_blocks[trigram].push_back(block);
+    }
+  }
+
+  std::shared_ptr<const BufferContents> snapshot = contents.copy();
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (auto entry = blocks_.begin(); entry != blocks_.end();) {
+    auto& blocks = entry->second;
+    blocks.erase(std::lower_bound(blocks.begin(), blocks.end(), first_block),
+                 blocks.end());
+    entry = blocks.empty() ? blocks_.erase(entry) : std::next(entry);
+  }
+  for (auto& [trigram, blocks] : new_blocks) {
+    auto& output = blocks_[trigram];
+    output.insert(output.end(), blocks.begin(), blocks.end());
+  }
+  contents_ = std::move(snapshot);
+}
+
+std::optional<std::vector<TrigramIndex::LineInterval>>
+TrigramIndex::CandidateLines(const BufferContents& contents,
+                             const std::vector<std::wstring>& literals) const {
+  static Tracker tracker(L"TrigramIndex::CandidateLines");
+  auto tracker_call = tracker.Call();
+
+  std::vector<uint64_t> trigrams;
+  for (const auto& literal : literals) {
+    AddTrigrams(*NewLazyString(literal), &trigrams);
+  }
+  if (trigrams.empty()) return std::nullopt;
+  SortAndRemoveDuplicates(&trigrams);
+
+  std::shared_ptr<const BufferContents> indexed_contents;
+  std::vector<uint32_t> candidates;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    indexed_contents = contents_;
+    std::vector<const std::vector<uint32_t>*> inputs;
+    for (uint64_t trigram : trigrams) {
+      if (auto it = blocks_.find(trigram); it != blocks_.end()) {
+        inputs.push_back(&it->second);
+      } else {
+        inputs.clear();
+        break;
+      }
+    }
+    // Start with the smallest set, to keep the intersections small.
+    std::sort(inputs.begin(), inputs.end(),
+              [](auto* a, auto* b) { return a->size() < b->size(); });
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (i == 0) {
+        candidates = *inputs[0];
+        continue;
+      }
+      std::vector<uint32_t> intersection;
+      std::set_intersection(candidates.begin(), candidates.end(),
+                            inputs[i]->begin(), inputs[i]->end(),
+                            std::back_inserter(intersection));
+      candidates = std::move(intersection);
+      if (candidates.empty()) break;
+    }
+  }
+
+  // The index is only valid for the lines that haven't changed.
+  LineNumber indexed_end =
+      LineNumber(0) + (indexed_contents == nullptr
+                           ? LineNumberDelta(0)
+                           : indexed_contents->CommonPrefix(contents));
+  std::vector<LineInterval> output;
+  auto add = [&output](LineNumber begin, LineNumber end) {
+    if (begin >= end) return;
+    if (!output.empty() && output.back().end == begin) {
+      output.back().end = end;
+    } else {
+      output.push_back({begin, end});
+    }
+  };
+  for (uint32_t block : candidates) {
+    LineNumber begin(block * kLinesPerBlock);
+    if (begin >= indexed_end) break;
+    add(begin,
+        std::min(begin + LineNumberDelta(kLinesPerBlock), indexed_end));
+  }
+  add(indexed_end, LineNumber(0) + contents.size());
+  return output;
+}
+
+namespace {
+// Returns contents where line `i` is "line i of text".
+std::unique_ptr<BufferContents> NumberedContents(size_t lines) {
+  auto line = [](size_t i) {
+    return std::make_shared<Line>(L"line " + std::to_wstring(i) + L" of text");
+  };
+  std::vector<std::shared_ptr<const Line>> output_lines;
+  for (size_t i = 1; i < lines; i++) {
+    output_lines.push_back(line(i));
+  }
+  auto output = std::make_unique<BufferContents>();
+  output->set_line(LineNumber(0), line(0));
+  output->append_back(std::move(output_lines));
+  return output;
+}
+
+// Returns the lines in `contents` that contain `literal`, ignoring case.
+std::vector<LineNumber> LinesContaining(const BufferContents& contents,
+                                        std::wstring literal) {
+  std::transform(literal.begin(), literal.end(), literal.begin(), towlower);
+  std::vector<LineNumber> output;
+  for (auto it = contents.begin(); it != contents.end(); ++it) {
+    std::wstring line = (*it)->ToString();
+    std::transform(line.begin(), line.end(), line.begin(), towlower);
+    if (line.find(literal) != std::wstring::npos) {
+      output.push_back(LineNumber(it.position()));
+    }
+  }
+  return output;
+}
+
+bool Contains(const std::vector<TrigramIndex::LineInterval>& intervals,
+              LineNumber line) {
+  return std::any_of(intervals.begin(), intervals.end(), [&](auto& interval) {
+    return interval.begin <= line && line < interval.end;
+  });
+}
+
+size_t CountLines(const std::vector<TrigramIndex::LineInterval>& intervals) {
+  size_t output = 0;
+  for (auto& interval : intervals) {
+    output += (interval.end - interval.begin).line_delta;
+  }
+  return output;
+}
+
+// Checks that the candidates include every line that contains `literal`.
+void CheckCandidates(const TrigramIndex& index, const BufferContents& contents,
+                     std::wstring literal) {
+  auto candidates = index.CandidateLines(contents, {literal});
+  CHECK(candidates.has_value());
+  for (LineNumber line : LinesContaining(contents, literal)) {
+    CHECK(Contains(candidates.value(), line)) << literal << ": " << line;
+  }
+}
+
+bool registration_update_benchmark =
+    tests::RegisterBenchmark(L"TrigramIndex::Update", [](int elements) {
+      auto contents = NumberedContents(elements);
+      TrigramIndex index;
+      auto start = Now();
+      index.Update(*contents);
+      auto end = Now();
+      return SecondsBetween(start, end) / elements;
+    });
+
+// Returns the time to find the candidates for a literal that only appears
+// once.
+bool registration_candidates_benchmark = tests::RegisterBenchmark(
+    L"TrigramIndex::CandidateLines", [](int elements) {
+      auto contents = NumberedContents(elements);
+      TrigramIndex index;
+      index.Update(*contents);
+      std::wstring literal = L"line " + std::to_wstring(elements / 2) + L" ";
+      auto start = Now();
+      CHECK(Contains(index.CandidateLines(*contents, {literal}).value(),
+                     LineNumber(elements / 2)));
+      auto end = Now();
+      return SecondsBetween(start, end);
+    });
+
+class TrigramIndexTests : public tests::TestGroup<TrigramIndexTests> {
+ public:
+  TrigramIndexTests() : TestGroup<TrigramIndexTests>() {}
+  std::wstring Name() const override { return L"TrigramIndexTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"NarrowsSearch",
+             .callback =
+                 [] {
+                   auto contents = NumberedContents(10000);
+                   TrigramIndex index;
+                   index.Update(*contents);
+                   auto candidates =
+                       index.CandidateLines(*contents, {L"line 7342 "});
+                   CHECK(candidates.has_value());
+                   CHECK(Contains(candidates.value(), LineNumber(7342)));
+                   CHECK_LE(CountLines(candidates.value()), kLinesPerBlock);
+                   CHECK(index.CandidateLines(*contents, {L"missing"})
+                             .value()
+                             .empty());
+                 }},
+            {.name = L"CaseInsensitive",
+             .callback =
+                 [] {
+                   auto contents = NumberedContents(1000);
+                   TrigramIndex index;
+                   index.Update(*contents);
+                   CheckCandidates(index, *contents, L"LiNe 999 OF");
+                   CHECK_EQ(CountLines(index.CandidateLines(
+                                *contents, {L"LiNe 999 OF"}).value()),
+                            1000ul - 3 * kLinesPerBlock);
+                 }},
+            {.name = L"ShortLiterals",
+             .callback =
+                 [] {
+                   auto contents = NumberedContents(10);
+                   TrigramIndex index;
+                   index.Update(*contents);
+                   CHECK(!index.CandidateLines(*contents, {}).has_value());
+                   CHECK(!index.CandidateLines(*contents, {L"ab", L"c"})
+                              .has_value());
+                 }},
+            {.name = L"UnindexedLines",
+             .callback =
+                 [] {
+                   auto contents = NumberedContents(2000);
+                   TrigramIndex index;
+                   CheckCandidates(index, *contents, L"line 17 ");
+                   index.Update(*contents);
+                   contents->push_back(L"new line");
+                   auto candidates =
+                       index.CandidateLines(*contents, {L"new line"}).value();
+                   CHECK_EQ(CountLines(candidates), 1ul);
+                   CHECK(Contains(candidates, LineNumber(2000)));
+                 }},
+            {.name = L"IncrementalUpdates", .callback = [] {
+               auto contents = NumberedContents(5000);
+               TrigramIndex index;
+               index.Update(*contents);
+               for (int i = 0; i < 100; i++) {
+                 LineNumber position(random() % contents->size().line_delta);
+                 std::wstring text = L"edit " + std::to_wstring(i);
+                 switch (random() % 3) {
+                   case 0:
+                     contents->insert_line(position,
+                                           std::make_shared<Line>(text));
+                     break;
+                   case 1:
+                     contents->set_line(position,
+                                        std::make_shared<Line>(text));
+                     break;
+                   case 2:
+                     contents->push_back(text);
+                     break;
+                 }
+                 if (random() % 2 == 0) index.Update(*contents);
+                 CheckCandidates(index, *contents, text);
+                 CheckCandidates(index, *contents,
+                                 L"line " + std::to_wstring(random() % 5000));
+               }
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<TrigramIndexTests>::registration_ =
+    tests::Add<editor::TrigramIndexTests>();
+}  // namespace
+}  // namespace afc::editor
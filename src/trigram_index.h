@@ -0,0 +1,58 @@
+#ifndef __AFC_EDITOR_TRIGRAM_INDEX_H__
+#define __AFC_EDITOR_TRIGRAM_INDEX_H__
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/buffer_contents.h"
+#include "src/line_column.h"
+
+namespace afc::editor {
+
+// Maps each trigram (sequence of three consecutive characters, ignoring case)
+// to the blocks of lines that contain it. This allows searches to skip most of
+// the lines that can't contain the literal strings in a regular expression.
+//
+// `CandidateLines` can be called from any thread, even while the index is being
+// updated.
+class TrigramIndex {
+ public:
+  // Makes the index reflect `contents`. Only indexes again the lines after the
+  // first line that differs from those given to the previous call, so this is
+  // cheap when lines are appended. Calls must not overlap.
+  void Update(const BufferContents& contents);
+
+  // A range of lines, from `begin` (inclusive) to `end` (exclusive).
+  struct LineInterval {
+    LineNumber begin;
+    LineNumber end;
+  };
+
+  // Returns the (sorted, disjoint) intervals with all the lines in `contents`
+  // that may contain every one of `literals`, ignoring case. Lines that the
+  // index doesn't reflect (because `contents` has changed since the last call
+  // to `Update`) are included. Returns nullopt if the index can't narrow the
+  // search (i.e., if none of the literals has at least three characters).
+  std::optional<std::vector<LineInterval>> CandidateLines(
+      const BufferContents& contents,
+      const std::vector<std::wstring>& literals) const;
+
+ private:
+  mutable std::mutex mutex_;
+
+  // The contents given to the last call to `Update`. Only `Update` changes
+  // this.
+  std::shared_ptr<const BufferContents> contents_;
+
+  // The (sorted) indices of the blocks of lines that contain each trigram.
+  std::unordered_map<uint64_t, std::vector<uint32_t>> blocks_;
+};
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_TRIGRAM_INDEX_H__
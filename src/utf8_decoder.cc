@@ -0,0 +1,342 @@
+#include "src/utf8_decoder.h"
+
+#include <glog/logging.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define EDGE_UTF8_DECODER_X86 1
+#endif
+
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
+
+namespace afc::editor {
+namespace {
+// Decodes the code point at the start of `input`. Returns the number of bytes
+// consumed, or 0 if `input` ends in the middle of a (so far) valid sequence.
+size_t DecodeCodePoint(const unsigned char* input, size_t length,
+                       wchar_t* output) {
+  unsigned char lead = input[0];
+  if (lead < 0x80) {
+    *output = lead;
+    return 1;
+  }
+
+  size_t size;
+  wchar_t code_point;
+  // Range of valid values for the second byte (which, for some lead bytes, is
+  // narrower than that of other continuation bytes, to reject overlong
+  // encodings, surrogates and values past U+10FFFF).
+  unsigned char second_min = 0x80;
+  unsigned char second_max = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    size = 2;
+    code_point = lead & 0x1F;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    size = 3;
+    code_point = lead & 0x0F;
+    if (lead == 0xE0) second_min = 0xA0;
+    if (lead == 0xED) second_max = 0x9F;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    size = 4;
+    code_point = lead & 0x07;
+    if (lead == 0xF0) second_min = 0x90;
+    if (lead == 0xF4) second_max = 0x8F;
+  } else {
+    *output = lead;
+    return 1;
+  }
+
+  for (size_t i = 1; i < size; i++) {
+    if (i == length) return 0;
+    unsigned char c = input[i];
+    if (c < (i == 1 ? second_min : 0x80) || c > (i == 1 ? second_max : 0xBF)) {
+      *output = lead;
+      return 1;
+    }
+    code_point = (code_point << 6) | (c & 0x3F);
+  }
+  *output = code_point;
+  return size;
+}
+
+// A block decoder consumes a prefix of `input` consisting only of ASCII
+// characters, writing them to `output` (and registering newlines, adding
+// `output_offset` to their positions). Returns the number of bytes consumed.
+size_t DecodeAsciiScalar(const unsigned char* input, size_t length,
+                         wchar_t* output, size_t output_offset,
+                         std::vector<size_t>* newlines) {
+  size_t position = 0;
+  while (position < length && input[position] < 0x80) {
+    output[position] = input[position];
+    if (input[position] == '\n') newlines->push_back(output_offset + position);
+    position++;
+  }
+  return position;
+}
+
+#if EDGE_UTF8_DECODER_X86
+static_assert(sizeof(wchar_t) == 4, "Vectorized decoders assume UTF-32.");
+
+void AddNewlines(uint32_t mask, size_t offset, std::vector<size_t>* newlines) {
+  while (mask != 0) {
+    newlines->push_back(offset + __builtin_ctz(mask));
+    mask &= mask - 1;
+  }
+}
+
+size_t DecodeAsciiSse2(const unsigned char* input, size_t length,
+                       wchar_t* output, size_t output_offset,
+                       std::vector<size_t>* newlines) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i newline = _mm_set1_epi8('\n');
+  size_t position = 0;
+  while (position + 16 <= length) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + position));
+    if (_mm_movemask_epi8(block) != 0) break;
+    __m128i low = _mm_unpacklo_epi8(block, zero);
+    __m128i high = _mm_unpackhi_epi8(block, zero);
+    __m128i* out = reinterpret_cast<__m128i*>(output + position);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(low, zero));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low, zero));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high, zero));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high, zero));
+    AddNewlines(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)),
+                output_offset + position, newlines);
+    position += 16;
+  }
+  return position + DecodeAsciiScalar(input + position, length - position,
+                                      output + position,
+                                      output_offset + position, newlines);
+}
+
+__attribute__((target("avx2"))) size_t DecodeAsciiAvx2(
+    const unsigned char* input, size_t length, wchar_t* output,
+    size_t output_offset, std::vector<size_t>* newlines) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t position = 0;
+  while (position + 32 <= length) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + position));
+    if (_mm256_movemask_epi8(block) != 0) break;
+    __m256i* out = reinterpret_cast<__m256i*>(output + position);
+    for (int i = 0; i < 4; i++) {
+      _mm256_storeu_si256(
+          out + i, _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                       reinterpret_cast<const __m128i*>(input + position +
+                                                        8 * i))));
+    }
+    AddNewlines(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)),
+                output_offset + position, newlines);
+    position += 32;
+  }
+  return position + DecodeAsciiScalar(input + position, length - position,
+                                      output + position,
+                                      output_offset + position, newlines);
+}
+#endif
+
+template <typename BlockDecoder>
+DecodedUtf8 Decode(const unsigned char* input, size_t length,
+                   BlockDecoder block_decoder) {
+  DecodedUtf8 output;
+  // Every byte produces at most one character.
+  output.contents.resize(length);
+  wchar_t* contents = output.contents.data();
+  size_t position = 0;
+  size_t written = 0;
+  while (position < length) {
+    size_t ascii = block_decoder(input + position, length - position,
+                                 contents + written, written, &output.newlines);
+    position += ascii;
+    written += ascii;
+    if (position == length) break;
+    size_t consumed =
+        DecodeCodePoint(input + position, length - position, contents + written);
+    if (consumed == 0) break;
+    if (contents[written] == L'\n') output.newlines.push_back(written);
+    position += consumed;
+    written++;
+  }
+  output.contents.resize(written);
+  output.bytes_consumed = position;
+  return output;
+}
+}  // namespace
+
+Utf8DecoderImplementation BestUtf8DecoderImplementation() {
+#if EDGE_UTF8_DECODER_X86
+  static const Utf8DecoderImplementation output =
+      __builtin_cpu_supports("avx2") ? Utf8DecoderImplementation::kAvx2
+                                     : Utf8DecoderImplementation::kSse2;
+  return output;
+#else
+  return Utf8DecoderImplementation::kScalar;
+#endif
+}
+
+size_t CountUtf8Characters(const char* input, size_t length) {
+  auto data = reinterpret_cast<const unsigned char*>(input);
+  size_t position = 0;
+  size_t output = 0;
+  while (position < length) {
+    if (data[position] < 0x80) {
+      position++;
+    } else {
+      wchar_t code_point;
+      size_t consumed =
+          DecodeCodePoint(data + position, length - position, &code_point);
+      if (consumed == 0) return output + length - position;
+      position += consumed;
+    }
+    output++;
+  }
+  return output;
+}
+
+DecodedUtf8 DecodeUtf8(const char* input, size_t length,
+                       Utf8DecoderImplementation implementation) {
+  auto data = reinterpret_cast<const unsigned char*>(input);
+  switch (implementation) {
+    case Utf8DecoderImplementation::kScalar:
+      break;
+    case Utf8DecoderImplementation::kSse2:
+#if EDGE_UTF8_DECODER_X86
+      return Decode(data, length, DecodeAsciiSse2);
+#endif
+      break;
+    case Utf8DecoderImplementation::kAvx2:
+#if EDGE_UTF8_DECODER_X86
+      if (__builtin_cpu_supports("avx2")) {
+        return Decode(data, length, DecodeAsciiAvx2);
+      }
+#endif
+      break;
+  }
+  return Decode(data, length, DecodeAsciiScalar);
+}
+
+namespace {
+const std::vector<Utf8DecoderImplementation> kAllImplementations = {
+    Utf8DecoderImplementation::kScalar, Utf8DecoderImplementation::kSse2,
+    Utf8DecoderImplementation::kAvx2};
+
+void CheckDecode(std::string input, std::wstring expected_contents,
+                 std::vector<size_t> expected_newlines,
+                 size_t expected_bytes_consumed) {
+  for (auto implementation : kAllImplementations) {
+    auto output = DecodeUtf8(input.c_str(), input.size(), implementation);
+    CHECK(std::wstring(output.contents.begin(), output.contents.end()) ==
+          expected_contents);
+    CHECK(output.newlines == expected_newlines);
+    CHECK_EQ(output.bytes_consumed, expected_bytes_consumed);
+  }
+}
+
+class DecodeUtf8Tests : public tests::TestGroup<DecodeUtf8Tests> {
+ public:
+  DecodeUtf8Tests() : TestGroup<DecodeUtf8Tests>() {}
+  std::wstring Name() const override { return L"DecodeUtf8Tests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {
+        {.name = L"Empty", .callback = [] { CheckDecode("", L"", {}, 0); }},
+        {.name = L"Ascii",
+         .callback =
+             [] {
+               std::string line = "Some log line that is longer than 32.\n";
+               CheckDecode(line + line,
+                           FromByteString(line) + FromByteString(line),
+                           {line.size() - 1, 2 * line.size() - 1},
+                           2 * line.size());
+             }},
+        {.name = L"Multibyte",
+         .callback =
+             [] {
+               CheckDecode("a\xc3\xb1o\n\xe2\x82\xac \xf0\x9f\x98\x80",
+                           L"año\n€ \U0001F600", {3}, 13);
+             }},
+        {.name = L"IncompleteSequence",
+         .callback = [] { CheckDecode("ab\xe2\x82", L"ab", {}, 2); }},
+        {.name = L"InvalidBytes",
+         .callback =
+             [] {
+               CheckDecode("\xff\n\xc0\xaf", std::wstring({0xff, L'\n', 0xc0, 0xaf}),
+                           {1}, 4);
+             }},
+        {.name = L"RandomInputsAgree", .callback = [] {
+           for (int i = 0; i < 100; i++) {
+             std::string input;
+             while (input.size() < 1000) {
+               switch (random() % 4) {
+                 case 0:
+                   input += std::string(random() % 70, 'x') + "\n";
+                   break;
+                 case 1:
+                   input += "\xc3\xb1";
+                   break;
+                 case 2:
+                   input.push_back(static_cast<char>(random() % 256));
+                   break;
+                 case 3:
+                   input += "\xe2\x82\xac\n";
+               }
+             }
+             auto expected = DecodeUtf8(input.c_str(), input.size(),
+                                        Utf8DecoderImplementation::kScalar);
+             CHECK_EQ(CountUtf8Characters(input.c_str(), input.size()),
+                      expected.contents.size() + input.size() -
+                          expected.bytes_consumed);
+             for (auto implementation : kAllImplementations) {
+               auto output =
+                   DecodeUtf8(input.c_str(), input.size(), implementation);
+               CHECK(output.contents == expected.contents);
+               CHECK(output.newlines == expected.newlines);
+               CHECK_EQ(output.bytes_consumed, expected.bytes_consumed);
+             }
+           }
+         }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<DecodeUtf8Tests>::registration_ =
+    tests::Add<editor::DecodeUtf8Tests>();
+
+// Returns the throughput, in MB/s, of decoding `elements` bytes of log-like
+// input (mostly ASCII, with a few multibyte characters).
+double BenchmarkDecode(Utf8DecoderImplementation implementation,
+                       int elements) {
+  std::string input;
+  for (int line = 0; static_cast<int>(input.size()) < elements; line++) {
+    input += "I1016 17:09:41.205333 20513 buffer_contents.cc:115] Inserting "
+             "line";
+    input += line % 10 == 0 ? " \xc3\xb1\n" : "\n";
+  }
+  input.resize(elements);
+  static const int kRuns = 100;
+  auto start = Now();
+  for (int i = 0; i < kRuns; i++) {
+    CHECK_LE(DecodeUtf8(input.c_str(), input.size(), implementation)
+                 .bytes_consumed,
+             input.size());
+  }
+  auto end = Now();
+  return kRuns * input.size() / SecondsBetween(start, end) / (1 << 20);
+}
+
+bool registration_scalar =
+    tests::RegisterBenchmark(L"DecodeUtf8::Scalar", [](int elements) {
+      return BenchmarkDecode(Utf8DecoderImplementation::kScalar, elements);
+    });
+bool registration_sse2 =
+    tests::RegisterBenchmark(L"DecodeUtf8::Sse2", [](int elements) {
+      return BenchmarkDecode(Utf8DecoderImplementation::kSse2, elements);
+    });
+bool registration_avx2 =
+    tests::RegisterBenchmark(L"DecodeUtf8::Avx2", [](int elements) {
+      return BenchmarkDecode(Utf8DecoderImplementation::kAvx2, elements);
+    });
+}  // namespace
+}  // namespace afc::editor
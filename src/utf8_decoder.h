@@ -0,0 +1,45 @@
+#ifndef __AFC_EDITOR_UTF8_DECODER_H__
+#define __AFC_EDITOR_UTF8_DECODER_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace afc::editor {
+
+struct DecodedUtf8 {
+  std::vector<wchar_t> contents;
+
+  // Positions (in `contents`) of all the '\n' characters, in ascending order.
+  std::vector<size_t> newlines;
+
+  // Number of bytes of the input that were consumed. A sequence at the end of
+  // the input that is valid but incomplete (e.g., because a read stopped in the
+  // middle of a character) isn't consumed; the caller should retain it and
+  // prepend it to the next input.
+  size_t bytes_consumed = 0;
+};
+
+enum class Utf8DecoderImplementation { kScalar, kSse2, kAvx2 };
+
+// Returns the fastest implementation that the current CPU supports.
+Utf8DecoderImplementation BestUtf8DecoderImplementation();
+
+// Decodes UTF-8 input in a single pass, also locating the newlines. Invalid
+// bytes are not fatal: each is decoded as the character with the same value.
+//
+// The vectorized implementations process blocks of ASCII characters (the
+// common case for command output and logs) without branching per character and
+// fall back to the scalar decoder around multibyte sequences.
+DecodedUtf8 DecodeUtf8(const char* input, size_t length,
+                       Utf8DecoderImplementation implementation =
+                           BestUtf8DecoderImplementation());
+
+// Returns the number of characters in `DecodeUtf8(input, length).contents`,
+// plus the number of bytes that it wouldn't consume (at the end of the input),
+// without allocating memory for the characters.
+size_t CountUtf8Characters(const char* input, size_t length);
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_UTF8_DECODER_H__
@@ -0,0 +1,37 @@
+#include "src/utf8_file_writer.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "src/lazy_string_functional.h"
+
+namespace afc::editor {
+
+Utf8FileWriter::Utf8FileWriter(int fd)
+    : fd_(fd), buffer_(std::make_unique<char[]>(kBufferSize)) {}
+
+void Utf8FileWriter::Write(const LazyString& str) {
+  ForEachColumn(str, [this](ColumnNumber, wchar_t c) { Write(c); });
+}
+
+void Utf8FileWriter::Write(const std::wstring& str) {
+  for (wchar_t c : str) Write(c);
+}
+
+int Utf8FileWriter::Flush() {
+  size_t start = 0;
+  while (error_ == 0 && start < used_) {
+    ssize_t written = write(fd_, buffer_.get() + start, used_ - start);
+    if (written != -1) {
+      start += written;
+    } else if (errno != EINTR) {
+      error_ = errno;
+    }
+  }
+  flushed_ += used_;
+  used_ = 0;
+  return error_;
+}
+
+}  // namespace afc::editor
@@ -0,0 +1,71 @@
+#ifndef __AFC_EDITOR_UTF8_FILE_WRITER_H__
+#define __AFC_EDITOR_UTF8_FILE_WRITER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "src/lazy_string.h"
+
+namespace afc::editor {
+
+// Encodes characters as UTF-8 directly into a large buffer, which is written to
+// a file descriptor whenever it fills up. This avoids creating temporary
+// strings and issuing a `write` call for each line.
+//
+// Invalid code points (surrogates and values past U+10FFFF) are written as
+// U+FFFD.
+class Utf8FileWriter {
+ public:
+  explicit Utf8FileWriter(int fd);
+
+  void Write(wchar_t c) {
+    if (kBufferSize - used_ < 4) Flush();
+    uint32_t code = c;
+    if (code < 0x80) {
+      buffer_[used_++] = code;
+      return;
+    }
+    if (code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+      code = 0xFFFD;  // Replacement character.
+    }
+    if (code < 0x800) {
+      buffer_[used_++] = 0xC0 | (code >> 6);
+    } else if (code < 0x10000) {
+      buffer_[used_++] = 0xE0 | (code >> 12);
+      buffer_[used_++] = 0x80 | ((code >> 6) & 0x3F);
+    } else {
+      buffer_[used_++] = 0xF0 | (code >> 18);
+      buffer_[used_++] = 0x80 | ((code >> 12) & 0x3F);
+      buffer_[used_++] = 0x80 | ((code >> 6) & 0x3F);
+    }
+    buffer_[used_++] = 0x80 | (code & 0x3F);
+  }
+
+  void Write(const LazyString& str);
+  void Write(const std::wstring& str);
+
+  // Writes all pending contents. Returns the `errno` of the first write that
+  // failed, or 0 if all writes succeeded.
+  int Flush();
+
+  int error() const { return error_; }
+
+  // The number of bytes given to the writer so far (including those that
+  // haven't been flushed).
+  size_t size() const { return flushed_ + used_; }
+
+ private:
+  static constexpr size_t kBufferSize = 1 << 20;
+
+  const int fd_;
+  const std::unique_ptr<char[]> buffer_;
+  size_t used_ = 0;
+  size_t flushed_ = 0;
+  int error_ = 0;
+};
+
+}  // namespace afc::editor
+
+#endif  // __AFC_EDITOR_UTF8_FILE_WRITER_H__
@@ -2,6 +2,7 @@
 
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "src/vm/internal/bytecode.h"
 #include "src/vm/internal/compilation.h"
 
 namespace afc {
@@ -33,6 +34,12 @@ class AppendExpression : public Expression {
         });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    // If `e0_` evaluates a `return` statement, the program stops.
+    compiler->Compile(e0_.get(), e0_->Types()[0]);
+    return compiler->Compile(e1_.get(), type);
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<AppendExpression>(e0_, e1_, return_types_);
   }
@@ -5,6 +5,7 @@
 #include "../public/environment.h"
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "bytecode.h"
 #include "compilation.h"
 #include "wstring.h"
 
@@ -16,45 +17,82 @@ class AssignExpression : public Expression {
  public:
   enum class AssignmentType { kDefine, kAssign };
 
-  AssignExpression(AssignmentType assignment_type, wstring symbol,
-                   unique_ptr<Expression> value)
+  // For `kDefine`, `addresses` must contain a single entry (for depth 0), with
+  // the type of the variable.
+  // For `kAssign`, it has an entry for each type of the variables that the
+  // value may be assigned to.
+  AssignExpression(
+      AssignmentType assignment_type, wstring symbol,
+      std::vector<std::pair<VMType, Environment::Address>> addresses,
+      std::shared_ptr<Expression> value)
       : assignment_type_(assignment_type),
         symbol_(std::move(symbol)),
+        addresses_(std::move(addresses)),
         value_(std::move(value)) {}
 
-  std::vector<VMType> Types() override { return value_->Types(); }
+  std::vector<VMType> Types() override {
+    if (assignment_type_ == AssignmentType::kDefine) {
+      return {addresses_[0].first};
+    }
+    return value_->Types();
+  }
   std::unordered_set<VMType> ReturnTypes() const override {
     return value_->ReturnTypes();
   }
 
   futures::Value<EvaluationOutput> Evaluate(Trampoline* trampoline,
                                             const VMType& type) override {
+    // For definitions, the value may support types other than the type of the
+    // variable.
+    const VMType& value_type = assignment_type_ == AssignmentType::kDefine
+                                   ? addresses_[0].first
+                                   : type;
     return futures::Transform(
-        trampoline->Bounce(value_.get(), type),
-        [trampoline, symbol = symbol_,
+        trampoline->Bounce(value_.get(), value_type),
+        [trampoline, symbol = symbol_, addresses = addresses_,
          assignment_type = assignment_type_](EvaluationOutput value_output) {
           DVLOG(3) << "Setting value for: " << symbol;
           DVLOG(4) << "Value: " << *value_output.value;
+          auto& environment = trampoline->environment();
           if (assignment_type == AssignmentType::kDefine) {
-            trampoline->environment()->Define(symbol,
-                                              std::move(value_output.value));
-          } else {
-            trampoline->environment()->Assign(symbol,
-                                              std::move(value_output.value));
+            CHECK_EQ(addresses.size(), 1ul);
+            environment->DefineSlot(addresses[0].second.slot, symbol,
+                                    std::move(value_output.value));
+            return EvaluationOutput::New(Value::NewVoid());
+          }
+          for (auto& [address_type, address] : addresses) {
+            if (address_type == value_output.value->type()) {
+              environment->Assign(symbol, address,
+                                  std::move(value_output.value));
+              return EvaluationOutput::New(Value::NewVoid());
+            }
           }
+          environment->Assign(symbol, std::move(value_output.value));
           // TODO: This seems wrong: shouldn't it be `value`?
           return EvaluationOutput::New(Value::NewVoid());
         });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    if (assignment_type_ == AssignmentType::kDefine) {
+      CHECK_EQ(addresses_.size(), 1ul);
+      return compiler->Define(
+          symbol_, addresses_[0].second.slot,
+          compiler->Compile(value_.get(), addresses_[0].first));
+    }
+    return compiler->Assign(symbol_, addresses_,
+                            compiler->Compile(value_.get(), type));
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<AssignExpression>(assignment_type_, symbol_,
-                                              value_->Clone());
+                                              addresses_, value_->Clone());
   }
 
  private:
   const AssignmentType assignment_type_;
   const wstring symbol_;
+  const std::vector<std::pair<VMType, Environment::Address>> addresses_;
   const std::shared_ptr<Expression> value_;
 };
 }  // namespace
@@ -91,9 +129,21 @@ std::unique_ptr<Expression> NewDefineExpression(
       return nullptr;
     }
   }
-  compilation->environment->Define(symbol, std::make_unique<Value>(type_def));
+  size_t slot = compilation->environment->Define(
+      symbol, std::make_unique<Value>(type_def));
+  return NewDefineSlotExpression(std::move(symbol), std::move(type_def), slot,
+                                 std::move(value));
+}
+
+std::unique_ptr<Expression> NewDefineSlotExpression(
+    std::wstring symbol, VMType type, size_t slot,
+    std::unique_ptr<Expression> value) {
+  CHECK(value != nullptr);
+  CHECK(value->SupportsType(type));
   return std::make_unique<AssignExpression>(
       AssignExpression::AssignmentType::kDefine, std::move(symbol),
+      std::vector<std::pair<VMType, Environment::Address>>(
+          {{std::move(type), Environment::Address{.depth = 0, .slot = slot}}}),
       std::move(value));
 }
 
@@ -105,12 +155,19 @@ std::unique_ptr<Expression> NewAssignExpression(
   }
   std::vector<Value*> variables;
   compilation->environment->PolyLookup(symbol, &variables);
+  std::vector<std::pair<VMType, Environment::Address>> addresses;
   for (auto& v : variables) {
-    if (value->SupportsType(v->type)) {
-      return std::make_unique<AssignExpression>(
-          AssignExpression::AssignmentType::kAssign, symbol, std::move(value));
+    if (value->SupportsType(v->type())) {
+      addresses.push_back(
+          {v->type(),
+           compilation->environment->LookupAddress(symbol, v->type()).value()});
     }
   }
+  if (!addresses.empty()) {
+    return std::make_unique<AssignExpression>(
+        AssignExpression::AssignmentType::kAssign, std::move(symbol),
+        std::move(addresses), std::move(value));
+  }
 
   if (variables.empty()) {
     compilation->errors.push_back(L"Variable not found: \"" + symbol + L"\"");
@@ -119,7 +176,7 @@ std::unique_ptr<Expression> NewAssignExpression(
 
   std::vector<VMType> variable_types;
   for (auto& v : variables) {
-    variable_types.push_back(v->type);
+    variable_types.push_back(v->type());
   }
 
   compilation->errors.push_back(
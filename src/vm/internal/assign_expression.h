@@ -12,12 +12,20 @@ using std::wstring;
 
 class Compilation;
 class Expression;
+struct VMType;
 
 // Declares a new variable of a given type and gives it an initial value.
 unique_ptr<Expression> NewDefineExpression(Compilation* compilation,
                                            wstring type, wstring symbol,
                                            unique_ptr<Expression> value);
 
+// Returns an expression that gives a value to a variable of type `type` that
+// has already been declared (in the environment used for compilation), in slot
+// `slot`.
+unique_ptr<Expression> NewDefineSlotExpression(wstring symbol, VMType type,
+                                               size_t slot,
+                                               unique_ptr<Expression> value);
+
 // Returns an expression that assigns a given value to an existing variable.
 unique_ptr<Expression> NewAssignExpression(Compilation* compilation,
                                            wstring symbol,
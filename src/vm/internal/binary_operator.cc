@@ -3,6 +3,7 @@
 #include <glog/logging.h>
 
 #include "../public/value.h"
+#include "src/vm/internal/bytecode.h"
 #include "src/vm/internal/compilation.h"
 
 namespace afc {
@@ -42,6 +43,14 @@ futures::Value<EvaluationOutput> BinaryOperator::Evaluate(
       });
 }
 
+size_t BinaryOperator::Compile(BytecodeCompiler* compiler,
+                               const VMType& type) {
+  CHECK(type_ == type);
+  auto a = compiler->Compile(a_.get(), a_->Types()[0]);
+  auto b = compiler->Compile(b_.get(), b_->Types()[0]);
+  return compiler->BinaryOperator(type_, operator_, a, b);
+}
+
 std::unique_ptr<Expression> BinaryOperator::Clone() {
   return std::make_unique<BinaryOperator>(a_->Clone(), b_->Clone(), type_,
                                           operator_);
@@ -82,12 +91,12 @@ std::unique_ptr<Expression> NewBinaryExpression(
         std::move(a), std::move(b), VMType::Double(),
         [double_operator](const Value& a, const Value& b, Value* output) {
           auto to_double = [](const Value& x) {
-            if (x.type.type == VMType::VM_INTEGER) {
+            if (x.type().type == VMType::VM_INTEGER) {
               return static_cast<double>(x.integer);
-            } else if (x.type.type == VMType::VM_DOUBLE) {
+            } else if (x.type().type == VMType::VM_DOUBLE) {
               return x.double_value;
             } else {
-              CHECK(false) << "Unexpected type: " << x.type;
+              CHECK(false) << "Unexpected type: " << x.type();
               return 0.0;  // Silence warning: no return.
             }
           };
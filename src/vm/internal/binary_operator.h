@@ -24,6 +24,7 @@ class BinaryOperator : public Expression {
 
   futures::Value<EvaluationOutput> Evaluate(Trampoline* evaluation,
                                             const VMType& type) override;
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override;
 
   std::unique_ptr<Expression> Clone() override;
 
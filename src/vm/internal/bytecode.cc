@@ -0,0 +1,369 @@
+#include "bytecode.h"
+
+#include <glog/logging.h>
+
+#include "../public/environment.h"
+#include "../public/value.h"
+#include "../public/vm.h"
+
+namespace afc::vm {
+
+size_t Expression::Compile(BytecodeCompiler* compiler, const VMType& type) {
+  return compiler->Evaluate(this, type);
+}
+
+BytecodeCompiler::BytecodeCompiler() : program_(std::make_shared<Program>()) {}
+
+/* static */ std::shared_ptr<const Program> BytecodeCompiler::Build(
+    Expression* expression, const VMType& type) {
+  BytecodeCompiler compiler;
+  compiler.program_->output = compiler.Compile(expression, type);
+  DVLOG(5) << "Compiled program, instructions: "
+           << compiler.program_->instructions.size()
+           << ", registers: " << compiler.program_->registers;
+  return compiler.program_;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Compile(Expression* expression,
+                                                     const VMType& type) {
+  CHECK(expression != nullptr);
+  CHECK(expression->SupportsType(type));
+  return expression->Compile(this, type);
+}
+
+BytecodeCompiler::Register BytecodeCompiler::NewRegister() {
+  return program_->registers++;
+}
+
+size_t BytecodeCompiler::Add(Program::Instruction instruction) {
+  program_->instructions.push_back(std::move(instruction));
+  return program_->instructions.size() - 1;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Constant(
+    std::unique_ptr<Value> value) {
+  CHECK(value != nullptr);
+  program_->constants.push_back(std::move(value));
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kConstant,
+       .output = output,
+       .argument = program_->constants.size() - 1});
+  return output;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Lookup(
+    std::wstring symbol, VMType type, Environment::Address address) {
+  program_->lookups.push_back({.symbol = std::move(symbol),
+                               .type = std::move(type),
+                               .address = address});
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kLookup,
+       .output = output,
+       .argument = program_->lookups.size() - 1});
+  return output;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Define(std::wstring symbol,
+                                                    size_t slot,
+                                                    Register value) {
+  program_->stores.push_back(
+      {.symbol = std::move(symbol),
+       .addresses = {{VMType::Void(),
+                      Environment::Address{.depth = 0, .slot = slot}}}});
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kDefine,
+       .output = output,
+       .input = value,
+       .argument = program_->stores.size() - 1});
+  return output;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Assign(
+    std::wstring symbol,
+    std::vector<std::pair<VMType, Environment::Address>> addresses,
+    Register value) {
+  program_->stores.push_back(
+      {.symbol = std::move(symbol), .addresses = std::move(addresses)});
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kAssign,
+       .output = output,
+       .input = value,
+       .argument = program_->stores.size() - 1});
+  return output;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::BinaryOperator(
+    VMType type,
+    std::function<void(const Value&, const Value&, Value*)> callback,
+    Register a, Register b) {
+  program_->operators.push_back(
+      {.type = std::move(type), .callback = std::move(callback)});
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kBinaryOperator,
+       .output = output,
+       .input = a,
+       .second_input = b,
+       .argument = program_->operators.size() - 1});
+  return output;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Transform(
+    std::function<Value::Ptr(Value::Ptr)> transform, Register input) {
+  program_->transforms.push_back(std::move(transform));
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kTransform,
+       .output = output,
+       .input = input,
+       .argument = program_->transforms.size() - 1});
+  return output;
+}
+
+void BytecodeCompiler::Move(Register input, Register output) {
+  Add({.type = Program::Instruction::Type::kMove,
+       .output = output,
+       .input = input});
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Call(
+    Register function, std::vector<Register> arguments) {
+  program_->calls.push_back(std::move(arguments));
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kCall,
+       .output = output,
+       .input = function,
+       .argument = program_->calls.size() - 1});
+  return output;
+}
+
+BytecodeCompiler::Register BytecodeCompiler::Evaluate(Expression* expression,
+                                                      const VMType& type) {
+  program_->expressions.push_back({expression, type});
+  Register output = NewRegister();
+  Add({.type = Program::Instruction::Type::kEvaluate,
+       .output = output,
+       .argument = program_->expressions.size() - 1});
+  return output;
+}
+
+void BytecodeCompiler::Return(Register value) {
+  Add({.type = Program::Instruction::Type::kReturn, .input = value});
+}
+
+size_t BytecodeCompiler::Jump() {
+  return Add({.type = Program::Instruction::Type::kJump});
+}
+
+size_t BytecodeCompiler::JumpIf(Register condition, bool value) {
+  return Add({.type = value ? Program::Instruction::Type::kJumpIfTrue
+                            : Program::Instruction::Type::kJumpIfFalse,
+              .input = condition});
+}
+
+void BytecodeCompiler::SetJumpTarget(size_t jump, size_t target) {
+  CHECK_LT(jump, program_->instructions.size());
+  CHECK_LE(target, program_->instructions.size());
+  program_->instructions[jump].argument = target;
+}
+
+namespace {
+struct Execution {
+  std::shared_ptr<const Program> program;
+  Trampoline* trampoline;
+  std::vector<std::unique_ptr<Value>> registers;
+  size_t next_instruction = 0;
+
+  // True while `Run` is executing instructions.
+  bool running = false;
+  // True while waiting for the output of an asynchronous instruction.
+  bool waiting = false;
+
+  // Set when a `return` statement is evaluated.
+  bool returned = false;
+  std::unique_ptr<Value> return_value;
+
+  futures::Value<EvaluationOutput>::Consumer consumer;
+};
+
+void Run(std::shared_ptr<Execution> execution);
+
+// Receives the output of an instruction that may be asynchronous. If the
+// execution was stopped waiting for it, resumes it.
+void ReceiveOutput(const std::shared_ptr<Execution>& execution,
+                   Program::Register output, EvaluationOutput value) {
+  CHECK(execution->waiting);
+  CHECK(value.value != nullptr);
+  if (value.type == EvaluationOutput::OutputType::kReturn) {
+    execution->returned = true;
+    execution->return_value = std::move(value.value);
+    execution->next_instruction = execution->program->instructions.size();
+  } else {
+    execution->registers[output] = std::move(value.value);
+  }
+  execution->waiting = false;
+  if (!execution->running) Run(execution);
+}
+
+// Returns true if the output was received immediately (in which case the
+// execution should continue). Otherwise, the execution should stop (and will
+// be resumed once the output is received).
+bool Wait(const std::shared_ptr<Execution>& execution, Program::Register output,
+          futures::Value<EvaluationOutput> value) {
+  execution->waiting = true;
+  value.SetConsumer([execution, output](EvaluationOutput value) {
+    ReceiveOutput(execution, output, std::move(value));
+  });
+  return !execution->waiting;
+}
+
+void Run(std::shared_ptr<Execution> execution) {
+  using Type = Program::Instruction::Type;
+  const Program& program = *execution->program;
+  auto& registers = execution->registers;
+  Trampoline* trampoline = execution->trampoline;
+  execution->running = true;
+  while (execution->next_instruction < program.instructions.size()) {
+    const Program::Instruction& instruction =
+        program.instructions[execution->next_instruction++];
+    switch (instruction.type) {
+      case Type::kConstant:
+        registers[instruction.output] =
+            std::make_unique<Value>(*program.constants[instruction.argument]);
+        break;
+
+      case Type::kLookup: {
+        const auto& lookup = program.lookups[instruction.argument];
+        Value* value = trampoline->environment()->Lookup(
+            lookup.symbol, lookup.type, lookup.address);
+        CHECK(value != nullptr);
+        registers[instruction.output] = std::make_unique<Value>(*value);
+        break;
+      }
+
+      case Type::kDefine: {
+        const auto& store = program.stores[instruction.argument];
+        trampoline->environment()->DefineSlot(
+            store.addresses[0].second.slot, store.symbol,
+            std::move(registers[instruction.input]));
+        registers[instruction.output] = Value::NewVoid();
+        break;
+      }
+
+      case Type::kAssign: {
+        const auto& store = program.stores[instruction.argument];
+        auto value = std::move(registers[instruction.input]);
+        auto it = std::find_if(
+            store.addresses.begin(), store.addresses.end(),
+            [&](auto& address) { return address.first == value->type(); });
+        if (it != store.addresses.end()) {
+          trampoline->environment()->Assign(store.symbol, it->second,
+                                            std::move(value));
+        } else {
+          trampoline->environment()->Assign(store.symbol, std::move(value));
+        }
+        registers[instruction.output] = Value::NewVoid();
+        break;
+      }
+
+      case Type::kBinaryOperator: {
+        const auto& op = program.operators[instruction.argument];
+        auto output = std::make_unique<Value>(op.type);
+        op.callback(*registers[instruction.input],
+                    *registers[instruction.second_input], output.get());
+        registers[instruction.output] = std::move(output);
+        break;
+      }
+
+      case Type::kTransform:
+        registers[instruction.output] = program.transforms[instruction.argument](
+            std::move(registers[instruction.input]));
+        break;
+
+      case Type::kMove:
+        registers[instruction.output] = std::move(registers[instruction.input]);
+        break;
+
+      case Type::kJump: {
+        bool backwards = instruction.argument < execution->next_instruction;
+        execution->next_instruction = instruction.argument;
+        // Backward jumps (i.e., loops) give other work a chance to run.
+        if (backwards && trampoline->ShouldYield()) {
+          execution->running = false;
+          trampoline->Yield([execution] { Run(execution); });
+          return;
+        }
+        break;
+      }
+
+      case Type::kJumpIfTrue:
+      case Type::kJumpIfFalse:
+        CHECK(registers[instruction.input]->IsBool());
+        if (registers[instruction.input]->boolean ==
+            (instruction.type == Type::kJumpIfTrue)) {
+          execution->next_instruction = instruction.argument;
+        }
+        break;
+
+      case Type::kCall: {
+        std::shared_ptr<Value> function =
+            std::move(registers[instruction.input]);
+        CHECK_EQ(function->type().type, VMType::FUNCTION);
+        CHECK(function->callback != nullptr);
+        std::vector<Value::Ptr> arguments;
+        for (auto& input : program.calls[instruction.argument]) {
+          arguments.push_back(std::move(registers[input]));
+        }
+        if (!Wait(execution, instruction.output,
+                  futures::Transform(
+                      function->callback(std::move(arguments), trampoline),
+                      [function](EvaluationOutput output) {
+                        // A `return` statement only stops the function.
+                        return EvaluationOutput::New(std::move(output.value));
+                      }))) {
+          execution->running = false;
+          return;
+        }
+        break;
+      }
+
+      case Type::kEvaluate: {
+        const auto& [expression, type] =
+            program.expressions[instruction.argument];
+        if (!Wait(execution, instruction.output,
+                  trampoline->Bounce(expression, type))) {
+          execution->running = false;
+          return;
+        }
+        break;
+      }
+
+      case Type::kReturn:
+        execution->returned = true;
+        execution->return_value = std::move(registers[instruction.input]);
+        execution->next_instruction = program.instructions.size();
+        break;
+    }
+  }
+  execution->running = false;
+  auto consumer = std::move(execution->consumer);
+  consumer(execution->returned
+               ? EvaluationOutput::Return(std::move(execution->return_value))
+               : EvaluationOutput::New(
+                     std::move(registers[program.output])));
+}
+}  // namespace
+
+futures::Value<EvaluationOutput> Execute(std::shared_ptr<const Program> program,
+                                         Trampoline* trampoline) {
+  CHECK(program != nullptr);
+  CHECK(trampoline != nullptr);
+  auto execution = std::make_shared<Execution>();
+  execution->registers.resize(program->registers);
+  execution->program = std::move(program);
+  execution->trampoline = trampoline;
+  futures::Future<EvaluationOutput> output;
+  execution->consumer = std::move(output.consumer);
+  Run(std::move(execution));
+  return std::move(output.value);
+}
+
+}  // namespace afc::vm
@@ -0,0 +1,151 @@
+#ifndef __AFC_VM_BYTECODE_H__
+#define __AFC_VM_BYTECODE_H__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../public/environment.h"
+#include "../public/value.h"
+#include "../public/vm.h"
+
+namespace afc::vm {
+
+// A sequence of instructions (produced by `BytecodeCompiler`) that evaluates an
+// expression. Instructions read their inputs from (and write their outputs to)
+// registers; each run of a program has its own set of registers.
+class Program {
+ public:
+  // Index of a register.
+  using Register = size_t;
+
+  struct Instruction {
+    enum class Type {
+      // Copies `constants[argument]` into `output`.
+      kConstant,
+      // Copies the value of a variable (`lookups[argument]`) into `output`.
+      kLookup,
+      // Moves `input` into `stores[argument]` and sets `output` to void.
+      kDefine,
+      kAssign,
+      // Sets `output` to `operators[argument]` applied to `input` and
+      // `second_input`.
+      kBinaryOperator,
+      // Sets `output` to `transforms[argument]` applied to `input`.
+      kTransform,
+      // Moves `input` into `output`.
+      kMove,
+      // Jumps to `argument`, perhaps conditionally (on the value of `input`).
+      kJump,
+      kJumpIfTrue,
+      kJumpIfFalse,
+      // Calls the function in `input` with the values in `calls[argument]`
+      // (which it moves). May be asynchronous.
+      kCall,
+      // Evaluates `expressions[argument]` (directly, through the trampoline).
+      // May be asynchronous.
+      kEvaluate,
+      // Stops the program, returning the value in `input` (through a `return`
+      // statement).
+      kReturn,
+    };
+
+    Type type;
+    Register output = 0;
+    Register input = 0;
+    Register second_input = 0;
+    size_t argument = 0;
+  };
+
+  struct Lookup {
+    std::wstring symbol;
+    VMType type;
+    Environment::Address address;
+  };
+
+  struct Store {
+    std::wstring symbol;
+    // For `kDefine`, a single entry (with depth 0).
+    std::vector<std::pair<VMType, Environment::Address>> addresses;
+  };
+
+  struct BinaryOperator {
+    VMType type;
+    std::function<void(const Value&, const Value&, Value*)> callback;
+  };
+
+  std::vector<Instruction> instructions;
+  Register registers = 0;
+  // The register that holds the value of the expression.
+  Register output = 0;
+
+  std::vector<std::unique_ptr<Value>> constants;
+  std::vector<Lookup> lookups;
+  std::vector<Store> stores;
+  std::vector<BinaryOperator> operators;
+  std::vector<std::function<Value::Ptr(Value::Ptr)>> transforms;
+  std::vector<std::vector<Register>> calls;
+  std::vector<std::pair<Expression*, VMType>> expressions;
+};
+
+// Used by `Expression::Compile` to produce a `Program`.
+class BytecodeCompiler {
+ public:
+  using Register = Program::Register;
+
+  // Compiles `expression` into a program that evaluates it as `type`. The
+  // program may reference `expression` (and its children), so it must outlive
+  // the program.
+  static std::shared_ptr<const Program> Build(Expression* expression,
+                                              const VMType& type);
+
+  Register Compile(Expression* expression, const VMType& type);
+
+  Register NewRegister();
+
+  Register Constant(std::unique_ptr<Value> value);
+  Register Lookup(std::wstring symbol, VMType type,
+                  Environment::Address address);
+  Register Define(std::wstring symbol, size_t slot, Register value);
+  Register Assign(
+      std::wstring symbol,
+      std::vector<std::pair<VMType, Environment::Address>> addresses,
+      Register value);
+  Register BinaryOperator(
+      VMType type,
+      std::function<void(const Value&, const Value&, Value*)> callback,
+      Register a, Register b);
+  Register Transform(std::function<Value::Ptr(Value::Ptr)> transform,
+                     Register input);
+  void Move(Register input, Register output);
+  Register Call(Register function, std::vector<Register> arguments);
+  Register Evaluate(Expression* expression, const VMType& type);
+  void Return(Register value);
+
+  // Returns the position of the next instruction.
+  size_t position() const { return program_->instructions.size(); }
+
+  // The jump functions return the position of the jump, which can be given to
+  // `SetJumpTarget`.
+  size_t Jump();
+  size_t JumpIf(Register condition, bool value);
+  void SetJumpTarget(size_t jump, size_t target);
+
+ private:
+  BytecodeCompiler();
+
+  size_t Add(Program::Instruction instruction);
+
+  const std::shared_ptr<Program> program_;
+};
+
+// Runs `program` in the environment of `trampoline`. The output type is
+// `kReturn` if the program evaluated a `return` statement.
+futures::Value<EvaluationOutput> Execute(std::shared_ptr<const Program> program,
+                                         Trampoline* trampoline);
+
+}  // namespace afc::vm
+
+#endif  // __AFC_VM_BYTECODE_H__
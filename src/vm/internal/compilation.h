@@ -2,10 +2,12 @@
 #define __AFC_VM_COMPILATION_H__
 
 #include <glog/logging.h>
+#include <sys/stat.h>
 
 #include <list>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace afc {
@@ -36,6 +38,10 @@ struct Compilation {
   unique_ptr<Expression> expr;
   vector<wstring> errors;
 
+  // The files read (including files given to `#include` directives), with
+  // their modification times (from before they were read).
+  vector<std::pair<string, struct timespec>> files;
+
   std::shared_ptr<Environment> environment;
   wstring last_token;
 };
@@ -4,6 +4,7 @@
 
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "bytecode.h"
 
 namespace afc {
 namespace vm {
@@ -16,16 +17,21 @@ class ConstantExpression : public Expression {
     CHECK(value_ != nullptr);
   }
 
-  std::vector<VMType> Types() { return {value_->type}; }
+  std::vector<VMType> Types() { return {value_->type()}; }
   std::unordered_set<VMType> ReturnTypes() const override { return {}; }
 
   futures::Value<EvaluationOutput> Evaluate(Trampoline*, const VMType& type) {
-    CHECK_EQ(type, value_->type);
+    CHECK_EQ(type, value_->type());
     DVLOG(5) << "Evaluating constant value: " << *value_;
     return futures::Past(
         EvaluationOutput::New(std::make_unique<Value>(*value_)));
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    CHECK_EQ(type, value_->type());
+    return compiler->Constant(std::make_unique<Value>(*value_));
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<ConstantExpression>(
         std::make_unique<Value>(*value_));
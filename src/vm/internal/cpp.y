@@ -87,8 +87,15 @@ statement(OUT) ::= function_declaration_params(FUNC)
       OUT = nullptr;
     } else {
       CHECK(FUNC->name.has_value());
-      compilation->environment->Define(FUNC->name.value(), std::move(value));
-      OUT = NewVoidExpression().release();
+      // We also define the function during the evaluation, which is needed if
+      // this is evaluated in a new environment (e.g., nested in the body of
+      // another function).
+      size_t slot = compilation->environment->Define(
+          FUNC->name.value(), std::make_unique<Value>(*value));
+      VMType type = value->type();
+      OUT = NewDefineSlotExpression(FUNC->name.value(), std::move(type), slot,
+                                    NewConstantExpression(std::move(value)))
+                .release();
     }
   }
 }
@@ -174,8 +181,8 @@ assignment_statement(A) ::= SYMBOL(TYPE) SYMBOL(NAME) EQ expr(VALUE) SEMICOLON.
 
 function_declaration_params(OUT) ::= SYMBOL(RETURN_TYPE) SYMBOL(NAME) LPAREN
     function_declaration_arguments(ARGS) RPAREN . {
-  CHECK_EQ(RETURN_TYPE->type, VMType::VM_SYMBOL);
-  CHECK_EQ(NAME->type, VMType::VM_SYMBOL);
+  CHECK_EQ(RETURN_TYPE->type(), VMType::VM_SYMBOL);
+  CHECK_EQ(NAME->type(), VMType::VM_SYMBOL);
   OUT = UserFunction::New(compilation, RETURN_TYPE->str, NAME->str, ARGS)
             .release();
   delete RETURN_TYPE;
@@ -240,7 +247,7 @@ non_empty_function_declaration_arguments(OUT) ::=
 lambda_declaration_params(OUT) ::= LBRACE RBRACE
     LPAREN function_declaration_arguments(ARGS) RPAREN
     MINUS GREATER_THAN SYMBOL(RETURN_TYPE) . {
-  CHECK_EQ(RETURN_TYPE->type, VMType::VM_SYMBOL);
+  CHECK_EQ(RETURN_TYPE->type(), VMType::VM_SYMBOL);
   OUT = UserFunction::New(compilation, RETURN_TYPE->str, std::nullopt, ARGS)
             .release();
   delete RETURN_TYPE;
@@ -548,17 +555,17 @@ expr(OUT) ::= expr(A) LESS_THAN expr(B). {
         unique_ptr<Expression>(B),
         VMType::Bool(),
         [](const Value& a, const Value& b, Value* output) {
-          if (a.type.type == VMType::VM_INTEGER && b.type.type == VMType::VM_INTEGER) {
+          if (a.type().type == VMType::VM_INTEGER && b.type().type == VMType::VM_INTEGER) {
             output->boolean = a.integer < b.integer;
             return;
           }
           auto to_double = [](const Value& x) {
-            if (x.type.type == VMType::VM_INTEGER) {
+            if (x.type().type == VMType::VM_INTEGER) {
               return static_cast<double>(x.integer);
-            } else if (x.type.type == VMType::VM_DOUBLE) {
+            } else if (x.type().type == VMType::VM_DOUBLE) {
               return x.double_value;
             } else {
-              LOG(FATAL) << "Unexpected value of type: " << x.type.ToString();
+              LOG(FATAL) << "Unexpected value of type: " << x.type().ToString();
               return 0.0;
             }
           };
@@ -584,17 +591,17 @@ expr(OUT) ::= expr(A) LESS_OR_EQUAL expr(B). {
         unique_ptr<Expression>(B),
         VMType::Bool(),
         [](const Value& a, const Value& b, Value* output) {
-          if (a.type.type == VMType::VM_INTEGER && b.type.type == VMType::VM_INTEGER) {
+          if (a.type().type == VMType::VM_INTEGER && b.type().type == VMType::VM_INTEGER) {
             output->boolean = a.integer <= b.integer;
             return;
           }
           auto to_double = [](const Value& x) {
-            if (x.type.type == VMType::VM_INTEGER) {
+            if (x.type().type == VMType::VM_INTEGER) {
               return static_cast<double>(x.integer);
-            } else if (x.type.type == VMType::VM_DOUBLE) {
+            } else if (x.type().type == VMType::VM_DOUBLE) {
               return x.double_value;
             } else {
-              LOG(FATAL) << "Unexpected value of type: " << x.type.ToString();
+              LOG(FATAL) << "Unexpected value of type: " << x.type().ToString();
               return 0.0;
             }
           };
@@ -620,17 +627,17 @@ expr(OUT) ::= expr(A) GREATER_THAN expr(B). {
         unique_ptr<Expression>(B),
         VMType::Bool(),
         [](const Value& a, const Value& b, Value* output) {
-          if (a.type.type == VMType::VM_INTEGER && b.type.type == VMType::VM_INTEGER) {
+          if (a.type().type == VMType::VM_INTEGER && b.type().type == VMType::VM_INTEGER) {
             output->boolean = a.integer > b.integer;
             return;
           }
           auto to_double = [](const Value& x) {
-            if (x.type.type == VMType::VM_INTEGER) {
+            if (x.type().type == VMType::VM_INTEGER) {
               return static_cast<double>(x.integer);
-            } else if (x.type.type == VMType::VM_DOUBLE) {
+            } else if (x.type().type == VMType::VM_DOUBLE) {
               return x.double_value;
             } else {
-              LOG(FATAL) << "Unexpected value of type: " << x.type.ToString();
+              LOG(FATAL) << "Unexpected value of type: " << x.type().ToString();
               return 0.0;
             }
           };
@@ -656,17 +663,17 @@ expr(OUT) ::= expr(A) GREATER_OR_EQUAL expr(B). {
         unique_ptr<Expression>(B),
         VMType::Bool(),
         [](const Value& a, const Value& b, Value* output) {
-          if (a.type.type == VMType::VM_INTEGER && b.type.type == VMType::VM_INTEGER) {
+          if (a.type().type == VMType::VM_INTEGER && b.type().type == VMType::VM_INTEGER) {
             output->boolean = a.integer >= b.integer;
             return;
           }
           auto to_double = [](const Value& x) {
-            if (x.type.type == VMType::VM_INTEGER) {
+            if (x.type().type == VMType::VM_INTEGER) {
               return static_cast<double>(x.integer);
-            } else if (x.type.type == VMType::VM_DOUBLE) {
+            } else if (x.type().type == VMType::VM_DOUBLE) {
               return x.double_value;
             } else {
-              LOG(FATAL) << "Unexpected value of type: " << x.type.ToString();
+              LOG(FATAL) << "Unexpected value of type: " << x.type().ToString();
               return 0.0;
             }
           };
@@ -800,21 +807,21 @@ expr(OUT) ::= string(S). {
 }
 
 string(OUT) ::= STRING(S). {
-  assert(S->type.type == VMType::VM_STRING);
+  assert(S->type().type == VMType::VM_STRING);
   OUT = S;
   S = nullptr;
 }
 
 string(OUT) ::= string(A) STRING(B). {
-  assert(A->type.type == VMType::VM_STRING);
-  assert(B->type.type == VMType::VM_STRING);
+  assert(A->type().type == VMType::VM_STRING);
+  assert(B->type().type == VMType::VM_STRING);
   OUT = A;
   OUT->str = A->str + B->str;
   A = nullptr;
 }
 
 expr(OUT) ::= SYMBOL(S). {
-  assert(S->type.type == VMType::VM_SYMBOL);
+  assert(S->type().type == VMType::VM_SYMBOL);
   OUT = NewVariableLookup(compilation, std::move(S->str)).release();
   delete S;
 }
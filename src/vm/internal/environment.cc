@@ -60,6 +60,8 @@ std::shared_ptr<Environment> BuildDefaultEnvironment() {
 void Environment::Clear() {
   object_types_.clear();
   table_.clear();
+  slots_.clear();
+  version_++;
 }
 
 /* static */ const std::shared_ptr<Environment>& Environment::GetDefault() {
@@ -102,24 +104,66 @@ void Environment::DefineType(const wstring& name,
                              unique_ptr<ObjectType> value) {
   auto it = object_types_.insert(make_pair(name, nullptr));
   it.first->second = std::move(value);
+  version_++;
 }
 
 Value* Environment::Lookup(const wstring& symbol, VMType expected_type) {
   std::vector<Value*> values;
   PolyLookup(symbol, &values);
   for (auto& value : values) {
-    if (value->type == expected_type) {
+    if (value->type() == expected_type) {
       return value;
     }
   }
   return nullptr;
 }
 
+Environment::Slot* Environment::FindSlot(const wstring& symbol,
+                                          const VMType& type,
+                                          Address address) {
+  Environment* environment = this;
+  for (size_t i = 0; i < address.depth && environment != nullptr; i++) {
+    environment = environment->parent_environment_.get();
+  }
+  if (environment == nullptr || address.slot >= environment->slots_.size()) {
+    return nullptr;
+  }
+  Slot& slot = environment->slots_[address.slot];
+  return slot.value != nullptr && slot.value->type() == type &&
+                 slot.symbol == symbol
+             ? &slot
+             : nullptr;
+}
+
+Value* Environment::Lookup(const wstring& symbol, const VMType& expected_type,
+                           Address address) {
+  if (Slot* slot = FindSlot(symbol, expected_type, address); slot != nullptr) {
+    return slot->value.get();
+  }
+  // The environment doesn't have the structure it had during compilation.
+  return Lookup(symbol, expected_type);
+}
+
+std::optional<Environment::Address> Environment::LookupAddress(
+    const wstring& symbol, const VMType& type) {
+  size_t depth = 0;
+  for (Environment* environment = this; environment != nullptr;
+       environment = environment->parent_environment_.get(), depth++) {
+    if (auto it = environment->table_.find(symbol);
+        it != environment->table_.end()) {
+      if (auto slot = it->second.find(type); slot != it->second.end()) {
+        return Address{.depth = depth, .slot = slot->second};
+      }
+    }
+  }
+  return std::nullopt;
+}
+
 void Environment::PolyLookup(const wstring& symbol,
                              std::vector<Value*>* output) {
   if (auto it = table_.find(symbol); it != table_.end()) {
     for (auto& entry : it->second) {
-      output->push_back(entry.second.get());
+      output->push_back(slots_[entry.second].value.get());
     }
   }
   if (parent_environment_ != nullptr) {
@@ -132,7 +176,7 @@ void Environment::CaseInsensitiveLookup(const wstring& symbol,
   for (auto& item : table_) {
     if (wcscasecmp(item.first.c_str(), symbol.c_str()) == 0) {
       for (auto& entry : item.second) {
-        output->push_back(entry.second.get());
+        output->push_back(slots_[entry.second].value.get());
       }
     }
   }
@@ -141,8 +185,42 @@ void Environment::CaseInsensitiveLookup(const wstring& symbol,
   }
 }
 
-void Environment::Define(const wstring& symbol, unique_ptr<Value> value) {
-  table_[symbol][value->type] = std::move(value);
+size_t Environment::Define(const wstring& symbol, unique_ptr<Value> value) {
+  auto [it, inserted] = table_[symbol].insert({value->type(), slots_.size()});
+  if (inserted) {
+    slots_.push_back({.symbol = symbol});
+    version_++;
+  }
+  slots_[it->second].value = std::move(value);
+  return it->second;
+}
+
+size_t Environment::Version() const {
+  size_t output = 0;
+  for (const Environment* environment = this; environment != nullptr;
+       environment = environment->parent_environment_.get()) {
+    output += environment->version_;
+  }
+  return output;
+}
+
+void Environment::DefineSlot(size_t slot, const wstring& symbol,
+                             unique_ptr<Value> value) {
+  if (slot >= slots_.size()) slots_.resize(slot + 1);
+  Slot& previous = slots_[slot];
+  if (previous.value != nullptr &&
+      (previous.symbol != symbol ||
+       !(previous.value->type() == value->type()))) {
+    // The slot held a different variable, which can no longer be found.
+    table_[previous.symbol].erase(previous.value->type());
+    version_++;
+  }
+  auto [it, inserted] = table_[symbol].insert({value->type(), slot});
+  if (inserted || it->second != slot) {
+    it->second = slot;
+    version_++;
+  }
+  slots_[slot] = {.symbol = symbol, .value = std::move(value)};
 }
 
 void Environment::Assign(const wstring& symbol, unique_ptr<Value> value) {
@@ -161,7 +239,21 @@ void Environment::Assign(const wstring& symbol, unique_ptr<Value> value) {
     parent_environment_->Assign(symbol, std::move(value));
     return;
   }
-  it->second[value->type] = std::move(value);
+  auto [slot, inserted] = it->second.insert({value->type(), slots_.size()});
+  if (inserted) {
+    slots_.push_back({.symbol = symbol});
+    version_++;
+  }
+  slots_[slot->second].value = std::move(value);
+}
+
+void Environment::Assign(const wstring& symbol, Address address,
+                         unique_ptr<Value> value) {
+  if (Slot* slot = FindSlot(symbol, value->type(), address); slot != nullptr) {
+    slot->value = std::move(value);
+    return;
+  }
+  Assign(symbol, std::move(value));
 }
 
 void Environment::ForEachType(
@@ -181,7 +273,7 @@ void Environment::ForEach(
   }
   for (auto& symbol_entry : table_) {
     for (auto& type_entry : symbol_entry.second) {
-      callback(symbol_entry.first, type_entry.second.get());
+      callback(symbol_entry.first, slots_[type_entry.second].value.get());
     }
   }
 }
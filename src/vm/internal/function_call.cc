@@ -7,6 +7,7 @@
 #include "../public/constant_expression.h"
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "src/vm/internal/bytecode.h"
 #include "src/vm/internal/compilation.h"
 #include "src/vm/public/environment.h"
 
@@ -86,7 +87,7 @@ class FunctionCall : public Expression {
                            VMType::Function(std::move(type_arguments))),
         [trampoline, args_types = args_](EvaluationOutput callback) {
           DVLOG(6) << "Got function: " << *callback.value;
-          CHECK_EQ(callback.value->type.type, VMType::FUNCTION);
+          CHECK_EQ(callback.value->type().type, VMType::FUNCTION);
           CHECK(callback.value->callback != nullptr);
           futures::Future<EvaluationOutput> output;
           CaptureArgs(trampoline, std::move(output.consumer), args_types,
@@ -96,6 +97,20 @@ class FunctionCall : public Expression {
         });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    std::vector<VMType> type_arguments = {type};
+    for (auto& arg : *args_) {
+      type_arguments.push_back(arg->Types()[0]);
+    }
+    auto function = compiler->Compile(
+        func_.get(), VMType::Function(std::move(type_arguments)));
+    std::vector<BytecodeCompiler::Register> arguments;
+    for (auto& arg : *args_) {
+      arguments.push_back(compiler->Compile(arg.get(), arg->Types()[0]));
+    }
+    return compiler->Call(function, std::move(arguments));
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<FunctionCall>(func_->Clone(), args_);
   }
@@ -109,7 +124,7 @@ class FunctionCall : public Expression {
       std::shared_ptr<Value> callback) {
     CHECK(args_types != nullptr);
     CHECK(values != nullptr);
-    CHECK_EQ(callback->type.type, VMType::FUNCTION);
+    CHECK_EQ(callback->type().type, VMType::FUNCTION);
     CHECK(callback->callback != nullptr);
 
     DVLOG(5) << "Evaluating function parameters, args: " << args_types->size();
@@ -224,7 +239,7 @@ std::unique_ptr<Expression> NewMethodLookup(Compilation* compilation,
       BindObjectExpression(std::unique_ptr<Expression> obj_expr,
                            Value* delegate)
           : type_([=]() {
-              auto output = std::make_shared<VMType>(delegate->type);
+              auto output = std::make_shared<VMType>(delegate->type());
               output->type_arguments.erase(output->type_arguments.begin() + 1);
               return output;
             }()),
@@ -240,32 +255,44 @@ std::unique_ptr<Expression> NewMethodLookup(Compilation* compilation,
       }
 
       futures::Value<EvaluationOutput> Evaluate(Trampoline* trampoline,
-                                                const VMType& type) override {
+                                                const VMType&) override {
         return futures::Transform(
             trampoline->Bounce(obj_expr_.get(), obj_expr_->Types()[0]),
-            [type, shared_type = type_,
+            [shared_type = type_,
              shared_delegate = delegate_](EvaluationOutput output) {
-              return EvaluationOutput::New(Value::NewFunction(
-                  shared_type->type_arguments,
-                  [obj = std::shared_ptr(std::move(output.value)),
-                   shared_delegate](std::vector<Value::Ptr> args,
-                                    Trampoline* trampoline) {
-                    args.emplace(args.begin(), std::make_unique<Value>(*obj));
-                    return shared_delegate->callback(std::move(args),
-                                                     trampoline);
-                  }));
+              return EvaluationOutput::New(Bind(
+                  *shared_type, shared_delegate, std::move(output.value)));
             });
       }
 
+      size_t Compile(BytecodeCompiler* compiler, const VMType&) override {
+        return compiler->Transform(
+            [shared_type = type_, shared_delegate = delegate_](Value::Ptr obj) {
+              return Bind(*shared_type, shared_delegate, std::move(obj));
+            },
+            compiler->Compile(obj_expr_.get(), obj_expr_->Types()[0]));
+      }
+
      private:
+      static Value::Ptr Bind(const VMType& type, Value* delegate,
+                             Value::Ptr obj) {
+        return Value::NewFunction(
+            type.type_arguments,
+            [obj = std::shared_ptr(std::move(obj)), delegate](
+                std::vector<Value::Ptr> args, Trampoline* trampoline) {
+              args.emplace(args.begin(), std::make_unique<Value>(*obj));
+              return delegate->callback(std::move(args), trampoline);
+            });
+      }
+
       const std::shared_ptr<VMType> type_;
       const std::shared_ptr<Expression> obj_expr_;
       Value* const delegate_;
     };
 
-    CHECK(field->type.type == VMType::FUNCTION);
-    CHECK_GE(field->type.type_arguments.size(), 2ul);
-    CHECK_EQ(field->type.type_arguments[1], type);
+    CHECK(field->type().type == VMType::FUNCTION);
+    CHECK_GE(field->type().type_arguments.size(), 2ul);
+    CHECK_EQ(field->type().type_arguments[1], type);
 
     return std::make_unique<BindObjectExpression>(object->Clone(), field);
   }
@@ -278,13 +305,13 @@ std::unique_ptr<Expression> NewMethodLookup(Compilation* compilation,
 futures::Value<std::unique_ptr<Value>> Call(
     const Value& func, vector<Value::Ptr> args,
     std::function<void(std::function<void()>)> yield_callback) {
-  CHECK_EQ(func.type.type, VMType::FUNCTION);
+  CHECK_EQ(func.type().type, VMType::FUNCTION);
   std::vector<std::unique_ptr<Expression>> args_expr;
   for (auto& a : args) {
     args_expr.push_back(NewConstantExpression(std::move(a)));
   }
-  return Evaluate(NewFunctionCall(NewConstantExpression(Value::NewFunction(
-                                      func.type.type_arguments, func.callback)),
+  return Evaluate(NewFunctionCall(NewConstantExpression(
+                                      std::make_unique<Value>(func)),
                                   std::move(args_expr))
                       .get(),
                   nullptr, yield_callback);
@@ -4,6 +4,7 @@
 
 #include "../internal/compilation.h"
 #include "../public/value.h"
+#include "bytecode.h"
 
 namespace afc {
 namespace vm {
@@ -44,6 +45,18 @@ class IfExpression : public Expression {
         });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    auto output = compiler->NewRegister();
+    auto jump_to_false_case = compiler->JumpIf(
+        compiler->Compile(cond_.get(), VMType::Bool()), false);
+    compiler->Move(compiler->Compile(true_case_.get(), type), output);
+    auto jump_to_end = compiler->Jump();
+    compiler->SetJumpTarget(jump_to_false_case, compiler->position());
+    compiler->Move(compiler->Compile(false_case_.get(), type), output);
+    compiler->SetJumpTarget(jump_to_end, compiler->position());
+    return output;
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<IfExpression>(cond_, true_case_, false_case_,
                                           return_types_);
@@ -6,13 +6,14 @@
 #include "../public/constant_expression.h"
 #include "../public/environment.h"
 #include "../public/value.h"
+#include "bytecode.h"
 
 namespace afc::vm {
 namespace {
 class LambdaExpression : public Expression {
  public:
   static std::unique_ptr<LambdaExpression> New(
-      VMType type, std::shared_ptr<std::vector<std::wstring>> argument_names,
+      VMType type, std::shared_ptr<UserFunction::ArgumentSlots> argument_slots,
       std::shared_ptr<Expression> body, std::wstring* error) {
     VMType expected_return_type = *type.type_arguments.cbegin();
     auto deduced_types = body->ReturnTypes();
@@ -35,16 +36,26 @@ class LambdaExpression : public Expression {
       return nullptr;
     }
     return std::make_unique<LambdaExpression>(
-        std::move(type), std::move(argument_names), std::move(body));
+        std::move(type), std::move(argument_slots), std::move(body));
   }
 
   LambdaExpression(VMType type,
-                   std::shared_ptr<std::vector<std::wstring>> argument_names,
+                   std::shared_ptr<UserFunction::ArgumentSlots> argument_slots,
                    std::shared_ptr<Expression> body)
+      : LambdaExpression(
+            std::move(type), std::move(argument_slots), body,
+            BytecodeCompiler::Build(body.get(), body->Types()[0])) {}
+
+  LambdaExpression(VMType type,
+                   std::shared_ptr<UserFunction::ArgumentSlots> argument_slots,
+                   std::shared_ptr<Expression> body,
+                   std::shared_ptr<const Program> program)
       : type_(std::move(type)),
-        argument_names_(std::move(argument_names)),
-        body_(std::move(body)) {
+        argument_slots_(std::move(argument_slots)),
+        body_(std::move(body)),
+        program_(std::move(program)) {
     CHECK(body_ != nullptr);
+    CHECK(program_ != nullptr);
     CHECK_EQ(type_.type, VMType::FUNCTION);
   }
 
@@ -61,21 +72,25 @@ class LambdaExpression : public Expression {
   std::unique_ptr<Value> BuildValue(
       std::shared_ptr<Environment> parent_environment) {
     CHECK(parent_environment != nullptr);
-    auto output = std::make_unique<Value>(VMType::FUNCTION);
-    output->type = type_;
+    auto output = std::make_unique<Value>(type_);
     output->callback =
-        [body = body_, parent_environment, argument_names = argument_names_](
-            vector<unique_ptr<Value>> args, Trampoline* trampoline) {
-          CHECK_EQ(args.size(), argument_names->size())
+        [body = body_, program = program_, parent_environment,
+         argument_slots = argument_slots_](vector<unique_ptr<Value>> args,
+                                           Trampoline* trampoline) {
+          CHECK_EQ(args.size(), argument_slots->size())
               << "Invalid number of arguments for function.";
           auto environment = std::make_shared<Environment>(parent_environment);
           for (size_t i = 0; i < args.size(); i++) {
-            environment->Define(argument_names->at(i), std::move(args.at(i)));
+            environment->DefineSlot(argument_slots->at(i).second,
+                                    argument_slots->at(i).first,
+                                    std::move(args.at(i)));
           }
           auto original_trampoline = *trampoline;
           trampoline->SetEnvironment(environment);
           return futures::Transform(
-              trampoline->Bounce(body.get(), body->Types()[0]),
+              trampoline->backend() == Backend::kBytecode
+                  ? Execute(program, trampoline)
+                  : trampoline->Bounce(body.get(), body->Types()[0]),
               [original_trampoline, trampoline,
                body](EvaluationOutput body_output) {
                 *trampoline = original_trampoline;
@@ -87,13 +102,16 @@ class LambdaExpression : public Expression {
   }
 
   std::unique_ptr<Expression> Clone() override {
-    return std::make_unique<LambdaExpression>(type_, argument_names_, body_);
+    return std::make_unique<LambdaExpression>(type_, argument_slots_, body_,
+                                              program_);
   }
 
  private:
   VMType type_;
-  const std::shared_ptr<std::vector<std::wstring>> argument_names_;
+  const std::shared_ptr<UserFunction::ArgumentSlots> argument_slots_;
   const std::shared_ptr<Expression> body_;
+  // Compiled from `body_`, which it references.
+  const std::shared_ptr<const Program> program_;
 };
 }  // namespace
 
@@ -117,7 +135,6 @@ std::unique_ptr<UserFunction> UserFunction::New(
   output->type.type_arguments.push_back(*return_type_def);
   for (pair<VMType, wstring> arg : *args) {
     output->type.type_arguments.push_back(arg.first);
-    output->argument_names->push_back(arg.second);
   }
   if (name.has_value()) {
     output->name = name.value();
@@ -127,8 +144,9 @@ std::unique_ptr<UserFunction> UserFunction::New(
   compilation->environment =
       std::make_shared<Environment>(compilation->environment);
   for (pair<VMType, wstring> arg : *args) {
-    compilation->environment->Define(arg.second,
-                                     std::make_unique<Value>(arg.first));
+    output->argument_slots->push_back(
+        {arg.second, compilation->environment->Define(
+                         arg.second, std::make_unique<Value>(arg.first))});
   }
   return output;
 }
@@ -136,12 +154,15 @@ std::unique_ptr<UserFunction> UserFunction::New(
 std::unique_ptr<Value> UserFunction::BuildValue(
     Compilation* compilation, std::unique_ptr<Expression> body,
     std::wstring* error) {
-  std::shared_ptr<Environment> environment = compilation->environment;
+  // The environments in which the function is called must have the same
+  // structure as the one used during the compilation of the body (which the
+  // addresses of the symbols reference), so we ignore the latter.
   compilation->environment = compilation->environment->parent_environment();
   auto expression = LambdaExpression::New(
-      std::move(type), std::move(argument_names), std::move(body), error);
-  return expression == nullptr ? nullptr
-                               : expression->BuildValue(std::move(environment));
+      std::move(type), std::move(argument_slots), std::move(body), error);
+  return expression == nullptr
+             ? nullptr
+             : expression->BuildValue(compilation->environment);
 }
 
 std::unique_ptr<Expression> UserFunction::BuildExpression(
@@ -152,7 +173,7 @@ std::unique_ptr<Expression> UserFunction::BuildExpression(
   // trampoline, correctly receiving the actual values in that environment.
   compilation->environment = compilation->environment->parent_environment();
 
-  return LambdaExpression::New(std::move(type), std::move(argument_names),
+  return LambdaExpression::New(std::move(type), std::move(argument_slots),
                                std::move(body), error);
 }
 
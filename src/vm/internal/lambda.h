@@ -27,8 +27,11 @@ struct UserFunction {
 
   std::optional<std::wstring> name;
   VMType type;
-  std::shared_ptr<std::vector<std::wstring>> argument_names =
-      std::make_shared<std::vector<std::wstring>>();
+  // The symbols of the arguments of the function and the slots in its
+  // environment that hold them.
+  using ArgumentSlots = std::vector<std::pair<std::wstring, size_t>>;
+  std::shared_ptr<ArgumentSlots> argument_slots =
+      std::make_shared<ArgumentSlots>();
 };
 }  // namespace afc::vm
 
@@ -5,6 +5,7 @@
 #include "../public/types.h"
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "src/vm/internal/bytecode.h"
 #include "src/vm/internal/compilation.h"
 
 namespace afc {
@@ -35,6 +36,15 @@ class LogicalExpression : public Expression {
                               });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    auto output = compiler->NewRegister();
+    compiler->Move(compiler->Compile(expr_a_.get(), VMType::Bool()), output);
+    auto jump_to_end = compiler->JumpIf(output, !identity_);
+    compiler->Move(compiler->Compile(expr_b_.get(), type), output);
+    compiler->SetJumpTarget(jump_to_end, compiler->position());
+    return output;
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<LogicalExpression>(identity_, expr_a_, expr_b_);
   }
@@ -2,6 +2,7 @@
 
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "bytecode.h"
 #include "compilation.h"
 
 namespace afc {
@@ -31,6 +32,16 @@ class NegateExpression : public Expression {
         });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType&) override {
+    return compiler->Transform(
+        [negate = negate_](Value::Ptr value) {
+          CHECK(value != nullptr);
+          negate(value.get());
+          return value;
+        },
+        compiler->Compile(expr_.get(), expr_->Types()[0]));
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<NegateExpression>(negate_, expr_->Clone());
   }
@@ -4,6 +4,7 @@
 
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "bytecode.h"
 #include "compilation.h"
 
 namespace afc {
@@ -32,6 +33,12 @@ class ReturnExpression : public Expression {
         });
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType&) override {
+    auto value = compiler->Compile(expr_.get(), expr_->Types()[0]);
+    compiler->Return(value);
+    return value;
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<ReturnExpression>(expr_);
   }
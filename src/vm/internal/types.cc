@@ -105,7 +105,7 @@ wstring VMType::ToString() const {
 
 /* static */ VMType VMType::Function(vector<VMType> arguments) {
   VMType output(VMType::FUNCTION);
-  output.type_arguments = arguments;
+  output.type_arguments = std::move(arguments);
   return output;
 }
 
@@ -1,11 +1,143 @@
 #include "../public/value.h"
 
+#include <mutex>
+#include <unordered_set>
+
 #include "../public/vm.h"
+#include "src/tests/tests.h"
 #include "wstring.h"
 
 namespace afc {
 namespace vm {
 
+namespace {
+// Returns the single instance of `type`, which is never deleted.
+const VMType* InternType(const VMType& type) {
+  if (type.type_arguments.empty() && type.object_type.empty()) {
+    switch (type.type) {
+      case VMType::VM_VOID:
+        return &VMType::Void();
+      case VMType::VM_BOOLEAN:
+        return &VMType::Bool();
+      case VMType::VM_INTEGER:
+        return &VMType::Integer();
+      case VMType::VM_STRING:
+        return &VMType::String();
+      case VMType::VM_DOUBLE:
+        return &VMType::Double();
+      default:
+        break;
+    }
+  }
+  static std::mutex mutex;
+  static auto* const types = new std::unordered_set<VMType>();
+  std::lock_guard<std::mutex> lock(mutex);
+  return &*types->insert(type).first;
+}
+}  // namespace
+
+Value::Value(const VMType& t) : type_(InternType(t)) {
+  switch (type_->type) {
+    case VMType::VM_BOOLEAN:
+      boolean = false;
+      break;
+    case VMType::VM_INTEGER:
+      integer = 0;
+      break;
+    case VMType::VM_DOUBLE:
+      double_value = 0;
+      break;
+    case VMType::VM_STRING:
+    case VMType::VM_SYMBOL:
+      new (&str) wstring();
+      break;
+    case VMType::FUNCTION:
+      new (&callback) Callback();
+      break;
+    case VMType::OBJECT_TYPE:
+      new (&user_value) shared_ptr<void>();
+      break;
+    case VMType::VM_VOID:
+    case VMType::ENVIRONMENT:
+      break;
+  }
+}
+
+Value::Value(const Value& other) : type_(other.type_) {
+  switch (type_->type) {
+    case VMType::VM_BOOLEAN:
+      boolean = other.boolean;
+      break;
+    case VMType::VM_INTEGER:
+      integer = other.integer;
+      break;
+    case VMType::VM_DOUBLE:
+      double_value = other.double_value;
+      break;
+    case VMType::VM_STRING:
+    case VMType::VM_SYMBOL:
+      new (&str) wstring(other.str);
+      break;
+    case VMType::FUNCTION:
+      new (&callback) Callback(other.callback);
+      break;
+    case VMType::OBJECT_TYPE:
+      new (&user_value) shared_ptr<void>(other.user_value);
+      break;
+    case VMType::VM_VOID:
+    case VMType::ENVIRONMENT:
+      break;
+  }
+}
+
+Value::Value(Value&& other) : type_(other.type_) {
+  switch (type_->type) {
+    case VMType::VM_BOOLEAN:
+      boolean = other.boolean;
+      break;
+    case VMType::VM_INTEGER:
+      integer = other.integer;
+      break;
+    case VMType::VM_DOUBLE:
+      double_value = other.double_value;
+      break;
+    case VMType::VM_STRING:
+    case VMType::VM_SYMBOL:
+      new (&str) wstring(std::move(other.str));
+      break;
+    case VMType::FUNCTION:
+      new (&callback) Callback(std::move(other.callback));
+      break;
+    case VMType::OBJECT_TYPE:
+      new (&user_value) shared_ptr<void>(std::move(other.user_value));
+      break;
+    case VMType::VM_VOID:
+    case VMType::ENVIRONMENT:
+      break;
+  }
+}
+
+Value::~Value() {
+  switch (type_->type) {
+    case VMType::VM_STRING:
+    case VMType::VM_SYMBOL:
+      str.~wstring();
+      break;
+    case VMType::FUNCTION:
+      callback.~Callback();
+      break;
+    case VMType::OBJECT_TYPE:
+      user_value.~shared_ptr<void>();
+      break;
+    case VMType::VM_BOOLEAN:
+    case VMType::VM_INTEGER:
+    case VMType::VM_DOUBLE:
+    case VMType::VM_VOID:
+    case VMType::ENVIRONMENT:
+      break;
+  }
+}
+
 /* static */ std::unique_ptr<Value> Value::NewVoid() {
   return std::make_unique<Value>(VMType::VM_VOID);
 }
@@ -43,8 +175,7 @@ namespace vm {
 
 /* static */ std::unique_ptr<Value> Value::NewFunction(
     std::vector<VMType> arguments, Value::Callback callback) {
-  auto output = std::make_unique<Value>(VMType::FUNCTION);
-  output->type.type_arguments = std::move(arguments);
+  auto output = std::make_unique<Value>(VMType::Function(std::move(arguments)));
   output->callback = std::move(callback);
   return output;
 }
@@ -67,10 +198,75 @@ std::ostream& operator<<(std::ostream& os, const Value& value) {
   } else if (value.IsDouble()) {
     os << value.double_value;
   } else {
-    os << value.type.ToString();
+    os << value.type().ToString();
   }
   return os;
 }
 
+namespace {
+class ValueTests : public tests::TestGroup<ValueTests> {
+ public:
+  ValueTests() : TestGroup<ValueTests>() {}
+  std::wstring Name() const override { return L"ValueTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"CopyScalars",
+             .callback =
+                 [] {
+                   CHECK(Value(*Value::NewBool(true)).boolean);
+                   CHECK_EQ(Value(*Value::NewInteger(42)).integer, 42);
+                   CHECK_EQ(Value(*Value::NewDouble(0.5)).double_value, 0.5);
+                 }},
+            {.name = L"CopyString",
+             .callback =
+                 [] {
+                   auto value = Value::NewString(L"alejandro");
+                   Value copy(*value);
+                   value->str = L"forero";
+                   CHECK(copy.str == L"alejandro");
+                 }},
+            {.name = L"MoveString",
+             .callback =
+                 [] {
+                   auto value = Value::NewString(L"alejandro");
+                   Value moved(std::move(*value));
+                   CHECK(moved.str == L"alejandro");
+                 }},
+            {.name = L"CopyFunction",
+             .callback =
+                 [] {
+                   auto value = Value::NewFunction(
+                       {VMType::Integer()},
+                       [](std::vector<Value::Ptr>) {
+                         return Value::NewInteger(5);
+                       });
+                   Value copy(*value);
+                   CHECK(copy.IsFunction());
+                   CHECK(copy.callback != nullptr);
+                 }},
+            {.name = L"CopyObject",
+             .callback =
+                 [] {
+                   auto object = std::make_shared<int>(4);
+                   auto value = Value::NewObject(L"foo", object);
+                   Value copy(*value);
+                   value = nullptr;
+                   CHECK_EQ(object.use_count(), 2);
+                   CHECK(copy.user_value == object);
+                 }},
+            {.name = L"InternsTypes", .callback = [] {
+               CHECK_EQ(&Value::NewInteger(4)->type(), &VMType::Integer());
+               auto a = Value::NewObject(L"foo", nullptr);
+               auto b = Value::NewObject(L"foo", nullptr);
+               CHECK_EQ(&a->type(), &b->type());
+               CHECK_NE(&a->type(), &Value::NewObject(L"bar", nullptr)->type());
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<ValueTests>::registration_ =
+    tests::Add<vm::ValueTests>();
+}  // namespace
+
 }  // namespace vm
 }  // namespace afc
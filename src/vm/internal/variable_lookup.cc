@@ -7,6 +7,7 @@
 #include "../public/environment.h"
 #include "../public/value.h"
 #include "../public/vm.h"
+#include "bytecode.h"
 #include "compilation.h"
 
 namespace afc {
@@ -16,8 +17,14 @@ namespace {
 
 class VariableLookup : public Expression {
  public:
-  VariableLookup(std::wstring symbol, std::vector<VMType> types)
-      : symbol_(std::move(symbol)), types_(types) {}
+  // `addresses[i]` is the address of the value of type `types[i]`.
+  VariableLookup(std::wstring symbol, std::vector<VMType> types,
+                 std::vector<Environment::Address> addresses)
+      : symbol_(std::move(symbol)),
+        types_(std::move(types)),
+        addresses_(std::move(addresses)) {
+    CHECK_EQ(types_.size(), addresses_.size());
+  }
 
   std::vector<VMType> Types() override { return types_; }
   std::unordered_set<VMType> ReturnTypes() const override { return {}; }
@@ -28,20 +35,37 @@ class VariableLookup : public Expression {
     // DVLOG(5) << "Look up symbol: " << symbol_;
     CHECK(trampoline != nullptr);
     CHECK(trampoline->environment() != nullptr);
-    Value* result = trampoline->environment()->Lookup(symbol_, type);
+    auto& environment = trampoline->environment();
+    Value* result = nullptr;
+    for (size_t i = 0; i < types_.size() && result == nullptr; i++) {
+      if (types_[i] == type) {
+        result = environment->Lookup(symbol_, type, addresses_[i]);
+      }
+    }
     CHECK(result != nullptr);
     DVLOG(5) << "Variable lookup: " << *result;
     return futures::Past(
         EvaluationOutput::New(std::make_unique<Value>(*result)));
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType& type) override {
+    for (size_t i = 0; i < types_.size(); i++) {
+      if (types_[i] == type) {
+        return compiler->Lookup(symbol_, type, addresses_[i]);
+      }
+    }
+    LOG(FATAL) << "Unsupported type: " << type;
+    return 0;
+  }
+
   std::unique_ptr<Expression> Clone() override {
-    return std::make_unique<VariableLookup>(symbol_, types_);
+    return std::make_unique<VariableLookup>(symbol_, types_, addresses_);
   }
 
  private:
   const std::wstring symbol_;
   const std::vector<VMType> types_;
+  const std::vector<Environment::Address> addresses_;
 };
 
 }  // namespace
@@ -55,13 +79,17 @@ std::unique_ptr<Expression> NewVariableLookup(Compilation* compilation,
     return nullptr;
   }
   std::vector<VMType> types;
+  std::vector<Environment::Address> addresses;
   std::unordered_set<VMType> types_already_seen;
   for (auto& v : result) {
-    if (types_already_seen.insert(v->type).second) {
-      types.push_back(v->type);
+    if (types_already_seen.insert(v->type()).second) {
+      types.push_back(v->type());
+      addresses.push_back(
+          compilation->environment->LookupAddress(symbol, v->type()).value());
     }
   }
-  return std::make_unique<VariableLookup>(std::move(symbol), types);
+  return std::make_unique<VariableLookup>(std::move(symbol), std::move(types),
+                                          std::move(addresses));
 }
 
 }  // namespace vm
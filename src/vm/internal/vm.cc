@@ -1,8 +1,12 @@
 #include "../public/vm.h"
 
+#include <fcntl.h>
 #include <glog/logging.h>
 #include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <istream>
@@ -17,12 +21,16 @@
 #include "append_expression.h"
 #include "assign_expression.h"
 #include "binary_operator.h"
+#include "bytecode.h"
 #include "compilation.h"
 #include "if_expression.h"
 #include "lambda.h"
 #include "logical_expression.h"
 #include "negate_expression.h"
 #include "return_expression.h"
+#include "src/tests/benchmarks.h"
+#include "src/tests/tests.h"
+#include "src/time.h"
 #include "string.h"
 #include "variable_lookup.h"
 #include "while_expression.h"
@@ -65,6 +73,11 @@ void CompileStream(std::wistream& stream, Compilation* compilation,
 void CompileFile(const string& path, Compilation* compilation, void* parser) {
   VLOG(3) << "Compiling file: [" << path << "]";
 
+  struct stat stat_buffer;
+  if (stat(path.c_str(), &stat_buffer) == 0) {
+    compilation->files.push_back({path, stat_buffer.st_mtim});
+  }
+
   std::wifstream infile(path);
   infile.imbue(std::locale(""));
   if (infile.fail()) {
@@ -482,8 +495,8 @@ void CompileLine(Compilation* compilation, void* parser, const wstring& str) {
     }
     if (token == SYMBOL || token == STRING) {
       CHECK(input != nullptr) << "No input with token: " << token;
-      CHECK(input->type == VMType::VM_SYMBOL ||
-            input->type == VMType::VM_STRING);
+      CHECK(input->type() == VMType::VM_SYMBOL ||
+            input->type() == VMType::VM_STRING);
       compilation->last_token = input->str;
     }
     Cpp(parser, token, input.release(), compilation);
@@ -514,6 +527,15 @@ unique_ptr<Expression> ResultsFromCompilation(Compilation* compilation,
   return std::move(compilation->expr);
 }
 
+void CompileFileInEnvironment(const string& path,
+                              std::shared_ptr<Environment> environment,
+                              Compilation* compilation) {
+  compilation->directory = CppDirname(path);
+  compilation->expr = nullptr;
+  compilation->environment = std::move(environment);
+  CompileFile(path, compilation, GetParser(compilation).get());
+}
+
 }  // namespace
 
 std::optional<std::unordered_set<VMType>> CombineReturnTypes(
@@ -533,13 +555,53 @@ unique_ptr<Expression> CompileFile(const string& path,
                                    std::shared_ptr<Environment> environment,
                                    wstring* error_description) {
   Compilation compilation;
-  compilation.directory = CppDirname(path);
-  compilation.expr = nullptr;
-  compilation.environment = std::move(environment);
+  CompileFileInEnvironment(path, std::move(environment), &compilation);
+  return ResultsFromCompilation(&compilation, error_description);
+}
 
-  CompileFile(path, &compilation, GetParser(&compilation).get());
+std::shared_ptr<Expression> CompiledFilesCache::CompileFile(
+    const string& path, std::shared_ptr<Environment> environment,
+    wstring* error_description) {
+  CHECK(environment != nullptr);
+  auto key = std::make_pair(environment.get(), path);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (auto it = entries_.find(key); it != entries_.end()) {
+      const Entry& entry = it->second;
+      if (entry.environment.lock() == environment &&
+          entry.environment_version == environment->Version() &&
+          std::all_of(entry.files.begin(), entry.files.end(),
+                      [](const std::pair<string, struct timespec>& file) {
+                        struct stat stat_buffer;
+                        return stat(file.first.c_str(), &stat_buffer) == 0 &&
+                               stat_buffer.st_mtim.tv_sec ==
+                                   file.second.tv_sec &&
+                               stat_buffer.st_mtim.tv_nsec ==
+                                   file.second.tv_nsec;
+                      })) {
+        VLOG(5) << "Reusing compilation: " << path;
+        return entry.expression;
+      }
+      entries_.erase(it);
+    }
+  }
 
-  return ResultsFromCompilation(&compilation, error_description);
+  Compilation compilation;
+  CompileFileInEnvironment(path, environment, &compilation);
+  std::shared_ptr<Expression> expression =
+      ResultsFromCompilation(&compilation, error_description);
+  if (expression == nullptr) return nullptr;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Drop the entries of environments that have been deleted.
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    it = it->second.environment.expired() ? entries_.erase(it) : std::next(it);
+  }
+  entries_[key] = {.environment = environment,
+                   .environment_version = environment->Version(),
+                   .files = std::move(compilation.files),
+                   .expression = expression};
+  return expression;
 }
 
 std::unique_ptr<Expression> CompileString(
@@ -556,28 +618,43 @@ std::unique_ptr<Expression> CompileString(
   return ResultsFromCompilation(&compilation, error_description);
 }
 
+namespace {
+static const size_t kMaximumJumps = 100;
+}
+
 Trampoline::Trampoline(Options options)
     : environment_(options.environment),
-      yield_callback_(std::move(options.yield_callback)) {}
+      yield_callback_(std::move(options.yield_callback)),
+      backend_(options.backend) {}
 
 futures::Value<EvaluationOutput> Trampoline::Bounce(Expression* expression,
                                                     VMType type) {
   CHECK(expression->SupportsType(type));
-  static size_t kMaximumJumps = 100;
-  if (++jumps_ < kMaximumJumps || yield_callback_ == nullptr) {
+  if (!ShouldYield()) {
     return expression->Evaluate(this, type);
   }
 
   futures::Future<EvaluationOutput> output;
-  yield_callback_([this, expression_raw = expression->Clone().release(), type,
-                   consumer = std::move(output.consumer)]() mutable {
+  Yield([this, expression_raw = expression->Clone().release(), type,
+         consumer = std::move(output.consumer)]() mutable {
     std::unique_ptr<Expression> expression(expression_raw);
-    jumps_ = 0;
     Bounce(expression.get(), type).SetConsumer(std::move(consumer));
   });
   return std::move(output.value);
 }
 
+bool Trampoline::ShouldYield() {
+  return ++jumps_ >= kMaximumJumps && yield_callback_ != nullptr;
+}
+
+void Trampoline::Yield(std::function<void()> resume) {
+  CHECK(yield_callback_ != nullptr);
+  yield_callback_([this, resume = std::move(resume)] {
+    jumps_ = 0;
+    resume();
+  });
+}
+
 void Trampoline::SetEnvironment(std::shared_ptr<Environment> environment) {
   environment_ = environment;
 }
@@ -593,19 +670,444 @@ bool Expression::SupportsType(const VMType& type) {
 
 futures::Value<std::unique_ptr<Value>> Evaluate(
     Expression* expr, std::shared_ptr<Environment> environment,
-    std::function<void(std::function<void()>)> yield_callback) {
+    std::function<void(std::function<void()>)> yield_callback,
+    Backend backend) {
   CHECK(expr != nullptr);
   Trampoline::Options options;
   options.environment = environment;
   options.yield_callback = yield_callback;
+  options.backend = backend;
   auto trampoline = std::make_shared<Trampoline>(options);
-  return futures::Transform(trampoline->Bounce(expr, expr->Types()[0]),
-                            [trampoline](EvaluationOutput value) {
-                              DVLOG(4) << "Evaluation done.";
-                              DVLOG(5) << "Result: " << *value.value;
-                              return std::move(value.value);
-                            });
+  VMType type = expr->Types()[0];
+  return futures::Transform(
+      backend == Backend::kBytecode
+          ? Execute(BytecodeCompiler::Build(expr, type), trampoline.get())
+          : trampoline->Bounce(expr, type),
+      [trampoline](EvaluationOutput value) {
+        DVLOG(4) << "Evaluation done.";
+        DVLOG(5) << "Result: " << *value.value;
+        return std::move(value.value);
+      });
 }
 
+namespace {
+// Compiles and evaluates `code` in a new environment (child of `parent`).
+std::unique_ptr<Value> CompileAndEvaluate(
+    const std::wstring& code, Backend backend = Backend::kBytecode,
+    std::shared_ptr<Environment> parent = Environment::GetDefault()) {
+  auto environment = std::make_shared<Environment>(std::move(parent));
+  std::wstring error;
+  auto expression = CompileString(code, environment, &error);
+  CHECK(expression != nullptr) << error;
+  std::unique_ptr<Value> output;
+  std::vector<std::function<void()>> pending;
+  Evaluate(
+      expression.get(), environment,
+      [&pending](std::function<void()> callback) {
+        pending.push_back(std::move(callback));
+      },
+      backend)
+      .SetConsumer([&output](std::unique_ptr<Value> value) {
+        output = std::move(value);
+      });
+  while (!pending.empty()) {
+    auto callback = std::move(pending.back());
+    pending.pop_back();
+    callback();
+  }
+  CHECK(output != nullptr);
+  return output;
+}
+
+std::wstring BackendName(Backend backend) {
+  switch (backend) {
+    case Backend::kTree:
+      return L"Tree";
+    case Backend::kBytecode:
+      return L"Bytecode";
+  }
+  LOG(FATAL) << "Invalid backend.";
+  return L"";
+}
+
+// Returns the time per iteration of a loop that updates a few variables
+// (defined in different environments). Like the environments of the editor
+// (in which extensions run), the parent environment has many symbols.
+bool registration_variables_benchmark =
+    tests::RegisterBenchmark(L"VM::Variables", [](int elements) {
+      auto parent = std::make_shared<Environment>(Environment::GetDefault());
+      for (int i = 0; i < 1000; i++) {
+        parent->Define(L"symbol_" + std::to_wstring(i), Value::NewInteger(i));
+      }
+      auto start = editor::Now();
+      auto value = CompileAndEvaluate(
+          L"int total = 0;"
+          L"int Sum(int n) {"
+          L"  int i = 0;"
+          L"  while (i < n) {"
+          L"    total = total + 1;"
+          L"    i = i + 1;"
+          L"  }"
+          L"  return total;"
+          L"}"
+          L"Sum(" +
+              std::to_wstring(elements) + L");",
+          Backend::kBytecode, parent);
+      auto end = editor::Now();
+      CHECK_EQ(value->integer, elements);
+      return editor::SecondsBetween(start, end) / elements;
+    });
+
+// Registers a benchmark for each backend, returning the time per iteration of
+// a loop in `code`. `code` receives the number of iterations in variable `n`.
+bool RegisterBackendBenchmarks(std::wstring name, std::wstring code) {
+  for (auto backend : {Backend::kTree, Backend::kBytecode}) {
+    tests::RegisterBenchmark(
+        L"VM::" + BackendName(backend) + L"::" + name,
+        [code, backend](int elements) {
+          auto start = editor::Now();
+          CompileAndEvaluate(
+              L"int n = " + std::to_wstring(elements) + L";" + code, backend);
+          return editor::SecondsBetween(start, editor::Now()) / elements;
+        });
+  }
+  return true;
+}
+
+bool registration_arithmetic_benchmarks =
+    RegisterBackendBenchmarks(L"Arithmetic",
+                              L"int total = 0;"
+                              L"for (int i = 0; i < n; i++) {"
+                              L"  total = (total + i * 3) / 2;"
+                              L"}"
+                              L"total;");
+
+bool registration_strings_benchmarks =
+    RegisterBackendBenchmarks(L"Strings",
+                              L"string output = \"\";"
+                              L"for (int i = 0; i < n; i++) {"
+                              L"  output = output + \"x\";"
+                              L"  if (output.size() > 100) output = \"\";"
+                              L"}"
+                              L"output;");
+
+bool registration_calls_benchmarks =
+    RegisterBackendBenchmarks(L"Calls",
+                              L"int Add(int a, int b) { return a + b; }"
+                              L"int total = 0;"
+                              L"for (int i = 0; i < n; i++) {"
+                              L"  total = Add(total, 1);"
+                              L"}"
+                              L"total;");
+
+// Adds a test for each backend that evaluates `code` and passes the output to
+// `validate`.
+void AddBackendTests(std::vector<tests::Test>* output, std::wstring name,
+                     std::wstring code,
+                     std::function<void(const Value&)> validate) {
+  for (auto backend : {Backend::kTree, Backend::kBytecode}) {
+    output->push_back(
+        {.name = name + BackendName(backend), .callback = [=] {
+           validate(*CompileAndEvaluate(code, backend));
+         }});
+  }
+}
+
+std::function<void(const Value&)> ExpectInteger(int expected) {
+  return [expected](const Value& value) { CHECK_EQ(value.integer, expected); };
+}
+
+class VmTests : public tests::TestGroup<VmTests> {
+ public:
+  VmTests() : TestGroup<VmTests>() {}
+  std::wstring Name() const override { return L"VmTests"; }
+  std::vector<tests::Test> Tests() const override {
+    std::vector<tests::Test> output;
+    AddBackendTests(&output, L"Loop",
+                    L"int i = 0;"
+                    L"int total = 0;"
+                    L"while (i < 100) {"
+                    L"  total = total + i;"
+                    L"  i = i + 1;"
+                    L"}"
+                    L"total;",
+                    ExpectInteger(4950));
+    // Long enough to yield many times.
+    AddBackendTests(&output, L"LongLoop",
+                    L"int total = 0;"
+                    L"for (int i = 0; i < 10000; i++) {"
+                    L"  total = total + 1;"
+                    L"}"
+                    L"total;",
+                    ExpectInteger(10000));
+    AddBackendTests(&output, L"Recursion",
+                    L"int Fib(int n) {"
+                    L"  if (n < 2) { return n; }"
+                    L"  return Fib(n - 1) + Fib(n - 2);"
+                    L"}"
+                    L"Fib(15);",
+                    ExpectInteger(610));
+    AddBackendTests(&output, L"ReturnFromLoop",
+                    L"int F() {"
+                    L"  for (int i = 0; i < 1000; i++) {"
+                    L"    if (i == 7) { return i; }"
+                    L"  }"
+                    L"  return -1;"
+                    L"}"
+                    L"F();",
+                    ExpectInteger(7));
+    AddBackendTests(&output, L"NestedFunction",
+                    L"int Outer(int x) {"
+                    L"  int Twice(int y) { return 2 * y; }"
+                    L"  return Twice(x) + 1;"
+                    L"}"
+                    L"Outer(5) + Outer(1);",
+                    ExpectInteger(14));
+    AddBackendTests(&output, L"LambdaCapturesEnvironment",
+                    L"int base = 10;"
+                    L"auto f = [](int x) -> int {"
+                    L"  return base + x;"
+                    L"};"
+                    L"base = 20;"
+                    L"f(1);",
+                    ExpectInteger(21));
+    AddBackendTests(&output, L"Shadowing",
+                    L"int x = 1;"
+                    L"int F(int x) {"
+                    L"  x = x + 1;"
+                    L"  return x;"
+                    L"}"
+                    L"F(10) + x;",
+                    ExpectInteger(12));
+    AddBackendTests(&output, L"LogicalOperators",
+                    L"int calls = 0;"
+                    L"bool T() { calls++; return true; }"
+                    L"bool F() { calls++; return false; }"
+                    L"int output = 0;"
+                    L"if (F() && T()) output = output + 1;"
+                    L"if (T() || F()) output = output + 10;"
+                    L"if (!(F() || F())) output = output + 100;"
+                    L"output * 10 + calls;",
+                    ExpectInteger(1104));
+    AddBackendTests(&output, L"Methods",
+                    L"string s = \"abc\";"
+                    L"s.size() + s.find_first_of(\"c\", 0);",
+                    ExpectInteger(5));
+    AddBackendTests(&output, L"OverloadedTypes",
+                    L"int x = 1;"
+                    L"string x = \"foo\";"
+                    L"x = \"bar\";"
+                    L"x = 5;"
+                    L"string y = x;"
+                    L"int z = x;"
+                    L"y + z.tostring();",
+                    [](const Value& value) { CHECK(value.str == L"bar5"); });
+    for (auto backend : {Backend::kTree, Backend::kBytecode}) {
+      output.push_back(
+          {.name = L"AsynchronousCallback" + BackendName(backend),
+           .callback = [backend] {
+             // A function that only returns once `consumer` runs.
+             futures::Value<EvaluationOutput>::Consumer consumer;
+             auto environment =
+                 std::make_shared<Environment>(Environment::GetDefault());
+             environment->Define(
+                 L"Wait",
+                 Value::NewFunction(
+                     {VMType::Integer(), VMType::Integer()},
+                     [&consumer](std::vector<Value::Ptr> args, Trampoline*) {
+                       CHECK_EQ(args.size(), 1ul);
+                       CHECK(consumer == nullptr);
+                       futures::Future<EvaluationOutput> output;
+                       consumer = [input = args[0]->integer,
+                                   output_consumer = std::move(
+                                       output.consumer)](EvaluationOutput) {
+                         output_consumer(EvaluationOutput::New(
+                             Value::NewInteger(input * 2)));
+                       };
+                       return std::move(output.value);
+                     }));
+             std::wstring error;
+             auto expression = CompileString(
+                 L"int total = 0;"
+                 L"for (int i = 0; i < 3; i++) total = total + Wait(i + 1);"
+                 L"total;",
+                 environment, &error);
+             CHECK(expression != nullptr) << error;
+             std::unique_ptr<Value> result;
+             Evaluate(expression.get(), environment, nullptr, backend)
+                 .SetConsumer([&result](std::unique_ptr<Value> value) {
+                   result = std::move(value);
+                 });
+             for (int i = 0; i < 3; i++) {
+               CHECK(result == nullptr);
+               CHECK(consumer != nullptr);
+               auto callback = std::move(consumer);
+               consumer = nullptr;
+               callback(EvaluationOutput::New(Value::NewVoid()));
+             }
+             CHECK(consumer == nullptr);
+             CHECK(result != nullptr);
+             CHECK_EQ(result->integer, 12);
+           }});
+      output.push_back(
+          {.name = L"DifferentEnvironmentLayout" + BackendName(backend),
+           .callback = [backend] {
+             auto compilation_environment =
+                 std::make_shared<Environment>(Environment::GetDefault());
+             compilation_environment->Define(L"a", Value::NewInteger(1));
+             compilation_environment->Define(L"b", Value::NewInteger(2));
+             std::wstring error;
+             auto expression =
+                 CompileString(L"int c = b; c;", compilation_environment,
+                               &error);
+             CHECK(expression != nullptr) << error;
+
+             // The slot of `b` in `compilation_environment` holds a different
+             // variable (of the same type).
+             auto environment =
+                 std::make_shared<Environment>(Environment::GetDefault());
+             environment->Define(L"x", Value::NewInteger(7));
+             environment->Define(L"y", Value::NewInteger(8));
+             environment->Define(L"b", Value::NewInteger(3));
+             std::unique_ptr<Value> result;
+             Evaluate(expression.get(), environment, nullptr, backend)
+                 .SetConsumer([&result](std::unique_ptr<Value> value) {
+                   result = std::move(value);
+                 });
+             CHECK(result != nullptr);
+             CHECK_EQ(result->integer, 3);
+             Value* c = environment->Lookup(L"c", VMType::Integer());
+             CHECK(c != nullptr);
+             CHECK_EQ(c->integer, 3);
+           }});
+    }
+    return output;
+  }
+};
+
+template <>
+const bool tests::TestGroup<VmTests>::registration_ =
+    tests::Add<vm::VmTests>();
+
+// Writes `contents` to `path` and sets its modification time to `seconds`.
+void WriteFile(const string& path, const string& contents, time_t seconds) {
+  std::ofstream(path) << contents;
+  struct timespec times[2] = {{.tv_sec = seconds, .tv_nsec = 0},
+                              {.tv_sec = seconds, .tv_nsec = 0}};
+  CHECK_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+}
+
+// Runs `callback` with a temporary directory with files `main.cc` (which
+// includes `lib.cc`) and `lib.cc`.
+void WithFiles(std::function<void(const string&)> callback) {
+  char directory_template[] = "/tmp/edge-compiled-files-test-XXXXXX";
+  string directory = mkdtemp(directory_template);
+  WriteFile(directory + "/lib.cc", "int Lib() { return 1; }", 1);
+  WriteFile(directory + "/main.cc", "#include \"lib.cc\"\nLib();", 1);
+  callback(directory);
+  unlink((directory + "/lib.cc").c_str());
+  unlink((directory + "/main.cc").c_str());
+  rmdir(directory.c_str());
+}
+
+class CompiledFilesCacheTests
+    : public tests::TestGroup<CompiledFilesCacheTests> {
+ public:
+  CompiledFilesCacheTests() : TestGroup<CompiledFilesCacheTests>() {}
+  std::wstring Name() const override { return L"CompiledFilesCacheTests"; }
+  std::vector<tests::Test> Tests() const override {
+    return {{.name = L"Reuses",
+             .callback =
+                 [] {
+                   WithFiles([](const string& directory) {
+                     CompiledFilesCache cache;
+                     auto environment = std::make_shared<Environment>(
+                         Environment::GetDefault());
+                     wstring error;
+                     auto first = cache.CompileFile(directory + "/main.cc",
+                                                    environment, &error);
+                     CHECK(first != nullptr) << error;
+                     CHECK(first == cache.CompileFile(directory + "/main.cc",
+                                                      environment, &error));
+                   });
+                 }},
+            {.name = L"IncludedFileModified",
+             .callback =
+                 [] {
+                   WithFiles([](const string& directory) {
+                     CompiledFilesCache cache;
+                     auto environment = std::make_shared<Environment>(
+                         Environment::GetDefault());
+                     wstring error;
+                     auto first = cache.CompileFile(directory + "/main.cc",
+                                                    environment, &error);
+                     CHECK(first != nullptr) << error;
+                     WriteFile(directory + "/lib.cc",
+                               "int Lib() { return 2; }", 2);
+                     auto second = cache.CompileFile(directory + "/main.cc",
+                                                     environment, &error);
+                     CHECK(second != nullptr) << error;
+                     CHECK(first != second);
+                   });
+                 }},
+            {.name = L"EnvironmentChanged",
+             .callback =
+                 [] {
+                   WithFiles([](const string& directory) {
+                     CompiledFilesCache cache;
+                     auto environment = std::make_shared<Environment>(
+                         Environment::GetDefault());
+                     wstring error;
+                     auto first = cache.CompileFile(directory + "/main.cc",
+                                                    environment, &error);
+                     CHECK(first != nullptr) << error;
+                     // May shadow symbols that `first` references.
+                     environment->Define(L"Lib2", Value::NewInteger(0));
+                     CHECK(first != cache.CompileFile(directory + "/main.cc",
+                                                      environment, &error));
+                   });
+                 }},
+            {.name = L"EnvironmentAssignedNewType",
+             .callback =
+                 [] {
+                   WithFiles([](const string& directory) {
+                     CompiledFilesCache cache;
+                     auto environment = std::make_shared<Environment>(
+                         Environment::GetDefault());
+                     environment->Define(L"Lib", Value::NewInteger(0));
+                     wstring error;
+                     auto first = cache.CompileFile(directory + "/main.cc",
+                                                    environment, &error);
+                     CHECK(first != nullptr) << error;
+                     // Adds a new slot for an existing symbol.
+                     environment->Assign(L"Lib", Value::NewString(L""));
+                     CHECK(first != cache.CompileFile(directory + "/main.cc",
+                                                      environment, &error));
+                   });
+                 }},
+            {.name = L"DifferentEnvironments", .callback = [] {
+               WithFiles([](const string& directory) {
+                 CompiledFilesCache cache;
+                 wstring error;
+                 auto first = cache.CompileFile(
+                     directory + "/main.cc",
+                     std::make_shared<Environment>(Environment::GetDefault()),
+                     &error);
+                 CHECK(first != nullptr) << error;
+                 CHECK(first !=
+                       cache.CompileFile(directory + "/main.cc",
+                                         std::make_shared<Environment>(
+                                             Environment::GetDefault()),
+                                         &error));
+               });
+             }}};
+  }
+};
+
+template <>
+const bool tests::TestGroup<CompiledFilesCacheTests>::registration_ =
+    tests::Add<vm::CompiledFilesCacheTests>();
+}  // namespace
+
 }  // namespace vm
 }  // namespace afc
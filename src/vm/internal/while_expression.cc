@@ -5,6 +5,7 @@
 #include "../public/value.h"
 #include "../public/vm.h"
 #include "append_expression.h"
+#include "bytecode.h"
 #include "compilation.h"
 
 namespace afc {
@@ -35,6 +36,16 @@ class WhileExpression : public Expression {
     return output.value;
   }
 
+  size_t Compile(BytecodeCompiler* compiler, const VMType&) override {
+    auto start = compiler->position();
+    auto jump_to_end = compiler->JumpIf(
+        compiler->Compile(condition_.get(), VMType::Bool()), false);
+    compiler->Compile(body_.get(), body_->Types()[0]);
+    compiler->SetJumpTarget(compiler->Jump(), start);
+    compiler->SetJumpTarget(jump_to_end, compiler->position());
+    return compiler->Constant(Value::NewVoid());
+  }
+
   std::unique_ptr<Expression> Clone() override {
     return std::make_unique<WhileExpression>(condition_, body_);
   }
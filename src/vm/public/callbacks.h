@@ -50,7 +50,9 @@ struct VMTypeMapper<double> {
 template <>
 struct VMTypeMapper<wstring> {
   static wstring get(Value* value) { return std::move(value->str); }
-  static Value::Ptr New(wstring value) { return Value::NewString(value); }
+  static Value::Ptr New(wstring value) {
+    return Value::NewString(std::move(value));
+  }
   static const VMType vmtype;
 };
 
@@ -113,10 +115,11 @@ Value::Ptr RunCallback(Callable& callback, std::vector<Value::Ptr> args,
 template <typename Callable>
 Value::Ptr NewCallback(Callable callback) {
   using ft = function_traits<Callable>;
-  auto callback_wrapper = std::make_unique<Value>(VMType::FUNCTION);
-  callback_wrapper->type.type_arguments.push_back(
-      VMTypeMapper<typename ft::ReturnType>().vmtype);
-  AddArgs<typename ft::ArgTuple, 0>(&callback_wrapper->type.type_arguments);
+  std::vector<VMType> type_arguments = {
+      VMTypeMapper<typename ft::ReturnType>().vmtype};
+  AddArgs<typename ft::ArgTuple, 0>(&type_arguments);
+  auto callback_wrapper =
+      std::make_unique<Value>(VMType::Function(std::move(type_arguments)));
   callback_wrapper->callback = [callback = std::move(callback)](
                                    vector<Value::Ptr> args, Trampoline*) {
     return futures::Past(EvaluationOutput::New(
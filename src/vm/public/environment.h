@@ -4,7 +4,9 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 namespace afc {
 namespace vm {
@@ -17,8 +19,20 @@ struct Value;
 struct VMType;
 class ObjectType;
 
+// Values are stored in a flat vector of slots; the table of symbols maps each
+// symbol (and type) to its slot. This allows the compiler to resolve symbols to
+// an `Address` (see `LookupAddress`), so that expressions can find their values
+// without looking up symbols by name during evaluation. Each slot remembers its
+// symbol, so that an address is only used if it still holds the same variable.
 class Environment {
  public:
+  // Identifies the value in slot `slot` of the environment `depth` levels above
+  // the environment in which the lookup starts (which is at depth 0).
+  struct Address {
+    size_t depth;
+    size_t slot;
+  };
+
   Environment();
   Environment(std::shared_ptr<Environment> parent_environment);
 
@@ -37,20 +51,51 @@ class Environment {
   void DefineType(const wstring& name, unique_ptr<ObjectType> value);
 
   Value* Lookup(const wstring& symbol, VMType expected_type);
+  // Like `Lookup(symbol, expected_type)`, but first tries `address` (obtained
+  // through `LookupAddress` during compilation), which is much faster.
+  Value* Lookup(const wstring& symbol, const VMType& expected_type,
+                Address address);
+  // Returns the address of the nearest definition of `symbol` with type `type`.
+  std::optional<Address> LookupAddress(const wstring& symbol,
+                                       const VMType& type);
   void PolyLookup(const wstring& symbol, std::vector<Value*>* output);
   // Same as `PolyLookup` but ignores case and thus is much slower (runtime
   // complexity is linear to the total number of symbols defined);
   void CaseInsensitiveLookup(const wstring& symbol,
                              std::vector<Value*>* output);
-  void Define(const wstring& symbol, unique_ptr<Value> value);
+  // Returns the slot that holds the value.
+  size_t Define(const wstring& symbol, unique_ptr<Value> value);
+  // Like `Define`, but uses the slot given by a call to `Define` (in the
+  // environment used to compile the code being evaluated).
+  void DefineSlot(size_t slot, const wstring& symbol, unique_ptr<Value> value);
   void Assign(const wstring& symbol, unique_ptr<Value> value);
+  // Like `Assign(symbol, value)`, but first tries `address`.
+  void Assign(const wstring& symbol, Address address, unique_ptr<Value> value);
+
+  // Returns a number that changes whenever a symbol or a type is defined in
+  // this environment or in any of its ancestors. Expressions compiled in an
+  // environment remain valid while its version doesn't change.
+  size_t Version() const;
 
   void ForEachType(std::function<void(const wstring&, ObjectType*)> callback);
   void ForEach(std::function<void(const wstring&, Value*)> callback);
 
  private:
+  struct Slot {
+    wstring symbol;
+    // Null if the slot hasn't been given a value.
+    unique_ptr<Value> value;
+  };
+
+  // Returns the slot at `address` if it holds `symbol` with type `type`.
+  Slot* FindSlot(const wstring& symbol, const VMType& type, Address address);
+
   map<wstring, unique_ptr<ObjectType>> object_types_;
-  map<wstring, std::unordered_map<VMType, unique_ptr<Value>>> table_;
+  // The slot for each symbol and type.
+  map<wstring, std::unordered_map<VMType, size_t>> table_;
+  std::vector<Slot> slots_;
+  // Incremented when the table of symbols (or of types) changes.
+  size_t version_ = 0;
 
   // TODO: Consider whether the parent environment should itself be const?
   const std::shared_ptr<Environment> parent_environment_;
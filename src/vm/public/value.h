@@ -20,11 +20,23 @@ using std::vector;
 class Trampoline;
 struct EvaluationOutput;
 
+// The members that hold the value of the different types share storage: only
+// the member that corresponds to `type().type` may be used (see the comments in
+// the union below). Because of this, the type can't change after the value is
+// constructed.
+//
+// Types are interned: each value points to a single instance of its type, so
+// creating or copying a value doesn't copy its type.
 struct Value {
   using Ptr = std::unique_ptr<Value>;
 
-  Value(const VMType::Type& t) : type(t) {}
-  Value(const VMType& t) : type(t) {}
+  Value(const VMType::Type& t) : Value(VMType(t)) {}
+  Value(const VMType& t);
+  Value(const Value& other);
+  Value(Value&& other);
+  ~Value();
+
+  Value& operator=(const Value&) = delete;
 
   using Callback = std::function<futures::Value<EvaluationOutput>(
       std::vector<Ptr>, Trampoline*)>;
@@ -42,20 +54,31 @@ struct Value {
       std::vector<VMType> arguments,
       std::function<Ptr(std::vector<Ptr>)> callback);
 
-  bool IsBool() const { return type.type == VMType::VM_BOOLEAN; };
-  bool IsInteger() const { return type.type == VMType::VM_INTEGER; };
-  bool IsDouble() const { return type.type == VMType::VM_DOUBLE; };
-  bool IsString() const { return type.type == VMType::VM_STRING; };
-  bool IsFunction() const { return type.type == VMType::FUNCTION; };
+  const VMType& type() const { return *type_; }
+
+  bool IsBool() const { return type_->type == VMType::VM_BOOLEAN; };
+  bool IsInteger() const { return type_->type == VMType::VM_INTEGER; };
+  bool IsDouble() const { return type_->type == VMType::VM_DOUBLE; };
+  bool IsString() const { return type_->type == VMType::VM_STRING; };
+  bool IsFunction() const { return type_->type == VMType::FUNCTION; };
 
-  VMType type;
+  union {
+    // VM_BOOLEAN.
+    bool boolean;
+    // VM_INTEGER.
+    int integer;
+    // VM_DOUBLE.
+    double double_value;
+    // VM_STRING and VM_SYMBOL.
+    wstring str;
+    // FUNCTION.
+    Callback callback;
+    // OBJECT_TYPE.
+    shared_ptr<void> user_value;
+  };
 
-  bool boolean;
-  int integer;
-  double double_value;
-  wstring str;
-  Callback callback;
-  shared_ptr<void> user_value;
+ private:
+  const VMType* const type_;
 };
 
 std::ostream& operator<<(std::ostream& os, const Value& value);
@@ -1,9 +1,11 @@
 #ifndef __AFC_VM_PUBLIC_VM_H__
 #define __AFC_VM_PUBLIC_VM_H__
 
+#include <ctime>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <utility>
@@ -28,14 +30,22 @@ class Environment;
 class Evaluation;
 struct VMType;
 
+class BytecodeCompiler;
 class Expression;
 struct EvaluationOutput;
 
+// How expressions are evaluated. `kTree` evaluates the tree of expressions
+// directly: every node returns a future. `kBytecode` compiles the tree into a
+// sequence of instructions that an interpreter executes, only creating futures
+// at the boundaries that may be asynchronous (such as calls into the editor).
+enum class Backend { kTree, kBytecode };
+
 class Trampoline {
  public:
   struct Options {
     std::shared_ptr<Environment> environment;
     std::function<void(std::function<void()>)> yield_callback;
+    Backend backend = Backend::kBytecode;
   };
 
   Trampoline(Options options);
@@ -43,14 +53,23 @@ class Trampoline {
   void SetEnvironment(std::shared_ptr<Environment> environment);
   const std::shared_ptr<Environment>& environment() const;
 
+  Backend backend() const { return backend_; }
+
   // Must ensure expression lives until the future is notified.
   futures::Value<EvaluationOutput> Bounce(Expression* expression,
                                           VMType expression_type);
 
+  // For evaluations that don't go through `Bounce`, which should call this
+  // periodically (e.g., on every iteration of a loop). If it returns true, the
+  // evaluation should stop and pass a callback that resumes it to `Yield`.
+  bool ShouldYield();
+  void Yield(std::function<void()> resume);
+
  private:
   std::shared_ptr<Environment> environment_;
 
   std::function<void(std::function<void()>)> yield_callback_;
+  Backend backend_;
   size_t jumps_ = 0;
 };
 
@@ -85,6 +104,11 @@ class Expression {
   // Returns a new copy of this expression.
   virtual std::unique_ptr<Expression> Clone() = 0;
 
+  // Appends to `compiler` instructions that evaluate this expression (with
+  // type `type`) and returns the register that will hold the value. The default
+  // implementation appends an instruction that calls `Evaluate`.
+  virtual size_t Compile(BytecodeCompiler* compiler, const VMType& type);
+
   // The expression may be deleted as soon as `Evaluate` returns, even before
   // the returned Value has been given a value.
   virtual futures::Value<EvaluationOutput> Evaluate(Trampoline* evaluation,
@@ -120,6 +144,31 @@ unique_ptr<Expression> CompileFile(const string& path,
                                    std::shared_ptr<Environment> environment,
                                    wstring* error_description);
 
+// Keeps the expressions compiled from files, so that they can be reused while
+// neither the files (nor the files they include) nor the environments in which
+// they were compiled change. Expressions compiled in one environment can't be
+// reused in others: they reference the slots that the compilation defined. All
+// methods are thread-safe.
+class CompiledFilesCache {
+ public:
+  // Like `CompileFile`, but may return an expression compiled previously.
+  std::shared_ptr<Expression> CompileFile(
+      const string& path, std::shared_ptr<Environment> environment,
+      wstring* error_description);
+
+ private:
+  struct Entry {
+    std::weak_ptr<Environment> environment;
+    // The value of `environment->Version()` after the compilation.
+    size_t environment_version;
+    std::vector<std::pair<string, struct timespec>> files;
+    std::shared_ptr<Expression> expression;
+  };
+
+  std::mutex mutex_;
+  std::map<std::pair<const Environment*, string>, Entry> entries_;
+};
+
 unique_ptr<Expression> CompileString(const wstring& str,
                                      std::shared_ptr<Environment> environment,
                                      wstring* error_description);
@@ -129,7 +178,8 @@ unique_ptr<Expression> CompileString(const wstring& str,
 // in the future.
 futures::Value<std::unique_ptr<Value>> Evaluate(
     Expression* expr, std::shared_ptr<Environment> environment,
-    std::function<void(std::function<void()>)> yield_callback);
+    std::function<void(std::function<void()>)> yield_callback,
+    Backend backend = Backend::kBytecode);
 
 }  // namespace vm
 }  // namespace afc
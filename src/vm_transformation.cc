@@ -26,8 +26,8 @@ const VMType VMTypeMapper<editor::transformation::Variant*>::vmtype =
 editor::transformation::Variant*
 VMTypeMapper<editor::transformation::Variant*>::get(Value* value) {
   CHECK(value != nullptr);
-  CHECK(value->type.type == VMType::OBJECT_TYPE);
-  CHECK(value->type.object_type == L"Transformation");
+  CHECK(value->type().type == VMType::OBJECT_TYPE);
+  CHECK(value->type().object_type == L"Transformation");
   CHECK(value->user_value != nullptr);
   return static_cast<editor::transformation::Variant*>(value->user_value.get());
 }